@@ -111,6 +111,11 @@ extern "C"
      */
     typedef void* plist_array_iter;
 
+    /**
+     * Incremental XML parser, see plist_xml_parser_new().
+     */
+    typedef void* plist_xml_parser_t;
+
     /**
      * The enumeration of plist node types.
      */
@@ -146,6 +151,7 @@ extern "C"
         PLIST_ERR_IO           = -5,  /**< I/O error */
         PLIST_ERR_CIRCULAR_REF = -6,  /**< circular reference detected */
         PLIST_ERR_MAX_NESTING  = -7,  /**< maximum nesting depth exceeded */
+        PLIST_ERR_LIMIT        = -8,  /**< a configured size limit was exceeded */
         PLIST_ERR_UNKNOWN      = -255 /**< an unspecified error occurred */
     } plist_err_t;
 
@@ -180,11 +186,106 @@ extern "C"
                                         #PLIST_DATA is converted to a Base64-encoded string, and
                                         #PLIST_UID is converted to an integer.
                                         Only valid for #PLIST_FORMAT_JSON. Without this option, these types cause #PLIST_ERR_FORMAT. */
+        PLIST_OPT_DEDUP = 1 << 5, /**< Also write whole arrays and dictionaries with equal contents only once, and let all occurrences reference the same object, like equal scalar and #PLIST_DATA values always are. Takes extra time and memory while writing but can make the output a lot smaller for plists with repeated structures. Only valid for #PLIST_FORMAT_BINARY. */
     } plist_write_options_t;
 
     /** To be used with #PLIST_OPT_INDENT - encodes the level of indentation for OR'ing it into the #plist_write_options_t bitfield. */
     #define PLIST_OPT_INDENT_BY(x) ((x & 0xFF) << 24)
 
+    /**
+     * libplist parse options
+     */
+    typedef enum
+    {
+        PLIST_PARSE_NONE   = 0, /**< Default value to use when none of the options is needed. */
+        PLIST_PARSE_ARENA  = 1 << 0, /**< Allocate the parsed tree from a few large memory slabs instead of individual heap allocations. Freeing the root node with plist_free() releases the whole tree at once. The tree can be modified as usual, newly added nodes are allocated on the heap. Currently only used for #PLIST_FORMAT_BINARY, other formats are parsed normally. */
+        PLIST_PARSE_LAZY   = 1 << 1, /**< Only decode the top level of a binary plist and decode the children of arrays and dictionaries on first access. The buffer passed to the parse function must stay valid and unmodified as long as the returned tree exists. Errors in parts of the data that are never accessed are not reported, a container that fails to decode appears empty. Accessing a lazily parsed tree modifies it internally, so it must not be accessed concurrently. Takes precedence over #PLIST_PARSE_ARENA and is ignored for formats other than #PLIST_FORMAT_BINARY. */
+        PLIST_PARSE_NOCOPY = 1 << 2, /**< Do not copy the payload of #PLIST_DATA nodes, let them point into the buffer passed to the parse function instead. The buffer must stay valid and unmodified as long as the returned tree exists. Setting a new value with plist_set_data_val() or plist_copy() will create a private copy as usual. String values are still copied since they have to be NUL-terminated. Currently only used for #PLIST_FORMAT_BINARY. */
+        PLIST_PARSE_INTERN_KEYS = 1 << 3, /**< Store the name of each distinct dictionary key only once and let all keys with the same name share it, which reduces the memory used by trees with many dictionaries of the same layout, e.g. arrays of records. The shared names are immutable and reference counted; setting a new key name with plist_set_key_val() gives that key a private copy. Ignored together with #PLIST_PARSE_LAZY or #PLIST_PARSE_ARENA, where key names are not allocated individually anyway. */
+    } plist_parse_options_t;
+
+    /**
+     * Output callback for the streaming writers.
+     *
+     * @param buf the data to write
+     * @param len number of bytes in \a buf
+     * @param user_data the pointer passed to the writer function
+     * @return the number of bytes written. Anything less than \a len
+     *     aborts the write with #PLIST_ERR_IO.
+     */
+    typedef size_t (*plist_write_func_t)(const void *buf, size_t len, void *user_data);
+
+    /**
+     * Limits for plist_validate_bin(). A value of 0 means no limit.
+     */
+    typedef struct {
+        uint64_t max_objects;      /**< Maximum number of objects in the offset table. */
+        uint64_t max_nodes;        /**< Maximum number of nodes that parsing would create, see #plist_bin_report_t. */
+        uint64_t max_string_bytes; /**< Maximum total size of the string objects, in encoded bytes. */
+        uint64_t max_data_bytes;   /**< Maximum total size of the data objects. */
+        uint32_t max_depth;        /**< Maximum nesting depth. Values above the limit of the parser are lowered to it. */
+    } plist_bin_limits_t;
+
+    /**
+     * Statistics of a binary plist, filled in by plist_validate_bin().
+     * Objects are counted once, even if they are referenced several times.
+     */
+    typedef struct {
+        uint64_t num_objects;      /**< Number of objects in the offset table. */
+        uint64_t type_count[PLIST_NULL + 1]; /**< Number of objects reachable from the root object by #plist_type. Strings used as dictionary keys count as #PLIST_STRING. */
+        uint64_t num_nodes;        /**< Number of nodes that parsing would create. Objects referenced several times count every time, and each dictionary key is a node. */
+        uint64_t string_bytes;     /**< Total size of the string objects, in encoded bytes. */
+        uint64_t data_bytes;       /**< Total size of the data objects. */
+        uint32_t max_depth;        /**< Nesting depth, where a root object without children has depth 0. */
+        uint64_t error_offset;     /**< Offset in the input of the object, reference, or trailer field where the first error was found, 0 on success. */
+    } plist_bin_report_t;
+
+    /**
+     * Callbacks for plist_parse_events(). Each callback returns
+     * #PLIST_ERR_SUCCESS to continue parsing; any other value stops the
+     * parser and is returned by plist_parse_events(). Callbacks that are
+     * NULL are skipped.
+     *
+     * Inside a dictionary, key() is called before the value of every
+     * entry, and that value is either a single value() call or a nested
+     * begin_dict()/end_dict() or begin_array()/end_array() sequence.
+     * Pointers passed to the callbacks are only valid until the callback
+     * returns.
+     */
+    typedef struct {
+        plist_err_t (*begin_dict)(void *user_data);
+        plist_err_t (*end_dict)(void *user_data);
+        plist_err_t (*begin_array)(void *user_data);
+        plist_err_t (*end_array)(void *user_data);
+        /** Name of the next dictionary entry, UTF-8 and not NUL-terminated. */
+        plist_err_t (*key)(void *user_data, const char *key, uint64_t length);
+        /**
+         * A value that is not a container. Depending on \a type, \a value
+         * points to:
+         * - #PLIST_BOOLEAN: a uint8_t that is 0 or 1, \a length is 1
+         * - #PLIST_INT: a uint64_t holding the value; \a length is 8 if it
+         *   is to be interpreted as int64_t and 16 for unsigned values
+         *   larger than INT64_MAX
+         * - #PLIST_REAL: a double, \a length is 8
+         * - #PLIST_DATE: a double with the seconds since 01/01/2001, \a length is 8
+         * - #PLIST_STRING: \a length bytes of UTF-8, not NUL-terminated
+         * - #PLIST_DATA: \a length bytes
+         * - #PLIST_UID: a uint64_t, \a length is 8
+         * - #PLIST_NULL: NULL, \a length is 0
+         */
+        plist_err_t (*value)(void *user_data, plist_type type, const void *value, uint64_t length);
+        /**
+         * Optional. Used instead of value() for #PLIST_STRING and
+         * #PLIST_DATA values that the parser had to copy anyway, e.g.
+         * because of escape sequences or base64 encoding. \a value was
+         * allocated by libplist, the callback takes it over and has to
+         * release it with plist_mem_free(). Strings are NUL-terminated
+         * after \a length bytes. If this is NULL, value() is called and
+         * the buffer is released by the parser.
+         */
+        plist_err_t (*value_owned)(void *user_data, plist_type type, void *value, uint64_t length);
+    } plist_event_handler_t;
+
 
     /********************************************
      *                                          *
@@ -917,9 +1018,25 @@ extern "C"
      */
     PLIST_API plist_err_t plist_to_xml(plist_t plist, char **plist_xml, uint32_t * length);
 
+    /**
+     * Export the #plist_t structure to XML format, with a 64-bit length.
+     * Same as plist_to_xml(), but also works for output larger than 4GB.
+     *
+     * @param plist the root node to export
+     * @param plist_xml a pointer to a C-string. This function allocates the memory,
+     *            caller is responsible for freeing it. Data is UTF-8 encoded.
+     * @param length a pointer to an uint64_t variable. Represents the length of the allocated buffer.
+     * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure
+     * @note Use plist_mem_free() to free the allocated memory.
+     */
+    PLIST_API plist_err_t plist_to_xml64(plist_t plist, char **plist_xml, uint64_t * length);
+
     /**
      * Export the #plist_t structure to binary format.
      *
+     * Equal strings, numbers, dates and #PLIST_DATA values are written
+     * only once, see #PLIST_OPT_DEDUP for arrays and dictionaries.
+     *
      * @param plist the root node to export
      * @param plist_bin a pointer to a char* buffer. This function allocates the memory,
      *            caller is responsible for freeing it.
@@ -929,6 +1046,88 @@ extern "C"
      */
     PLIST_API plist_err_t plist_to_bin(plist_t plist, char **plist_bin, uint32_t * length);
 
+    /**
+     * Export the #plist_t structure to binary format, with a 64-bit length.
+     * Same as plist_to_bin(), but also works for output larger than 4GB,
+     * in which case 8-byte offsets are used.
+     *
+     * @param plist the root node to export
+     * @param plist_bin a pointer to a char* buffer. This function allocates the memory,
+     *            caller is responsible for freeing it.
+     * @param length a pointer to an uint64_t variable. Represents the length of the allocated buffer.
+     * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure
+     * @note Use plist_mem_free() to free the allocated memory.
+     */
+    PLIST_API plist_err_t plist_to_bin64(plist_t plist, char **plist_bin, uint64_t * length);
+
+    /**
+     * Export the #plist_t structure to binary format with additional options.
+     *
+     * When \a PLIST_OPT_DEDUP is set in \a options, whole arrays and
+     * dictionaries with equal contents are written only once as well.
+     * Otherwise the output is the same as with plist_to_bin().
+     *
+     * @param plist the root node to export
+     * @param plist_bin a pointer to a char* buffer. This function allocates the memory,
+     *            caller is responsible for freeing it.
+     * @param length a pointer to an uint32_t variable. Represents the length of the allocated buffer.
+     * @param options One or more bitwise ORed values of #plist_write_options_t.
+     * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure
+     * @note Use plist_mem_free() to free the allocated memory.
+     */
+    PLIST_API plist_err_t plist_to_bin_with_options(plist_t plist, char **plist_bin, uint32_t * length, plist_write_options_t options);
+
+    /**
+     * Same as plist_to_bin_with_options(), but with a 64-bit length, see
+     * plist_to_bin64().
+     *
+     * @param plist the root node to export
+     * @param plist_bin a pointer to a char* buffer. This function allocates the memory,
+     *            caller is responsible for freeing it.
+     * @param length a pointer to an uint64_t variable. Represents the length of the allocated buffer.
+     * @param options One or more bitwise ORed values of #plist_write_options_t.
+     * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure
+     * @note Use plist_mem_free() to free the allocated memory.
+     */
+    PLIST_API plist_err_t plist_to_bin_with_options64(plist_t plist, char **plist_bin, uint64_t * length, plist_write_options_t options);
+
+    /**
+     * Same as plist_to_bin_with_options64(), but encodes the objects of
+     * large plists with several threads. The output is exactly the same
+     * as with a single thread. Small plists, and builds without thread
+     * support, always use a single thread.
+     *
+     * While writing, up to the size of the output is needed in additional
+     * buffers for the objects encoded by the worker threads.
+     *
+     * @param plist the root node to export
+     * @param plist_bin a pointer to a char* buffer. This function allocates the memory,
+     *            caller is responsible for freeing it.
+     * @param length a pointer to an uint64_t variable. Represents the length of the allocated buffer.
+     * @param options One or more bitwise ORed values of #plist_write_options_t.
+     * @param num_threads The maximum number of threads to use, or 0 to use
+     *            one per available processor.
+     * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure
+     * @note Use plist_mem_free() to free the allocated memory.
+     */
+    PLIST_API plist_err_t plist_to_bin_ex(plist_t plist, char **plist_bin, uint64_t * length, plist_write_options_t options, unsigned int num_threads);
+
+    /**
+     * Export the #plist_t structure to binary format, passing the output
+     * to a callback while it is generated.
+     *
+     * Unlike plist_to_bin(), the output is never held in memory as a whole;
+     * only the offset table (8 bytes per object) is kept until the end.
+     * This allows writing binary plists larger than 4GB.
+     *
+     * @param plist the root node to export
+     * @param write_func the callback that receives the output in order
+     * @param user_data a pointer that is passed to \a write_func
+     * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure.
+     *     If an error occurs after writing started, the output is incomplete.
+     */
+    PLIST_API plist_err_t plist_to_bin_with_callback(plist_t plist, plist_write_func_t write_func, void *user_data);
+
     /**
      * Export the #plist_t structure to JSON format.
      *
@@ -965,6 +1164,20 @@ extern "C"
      */
     PLIST_API plist_err_t plist_to_json_with_options(plist_t plist, char **plist_json, uint32_t* length, plist_write_options_t options);
 
+    /**
+     * Export the #plist_t structure to JSON format, with a 64-bit length.
+     * Same as plist_to_json_with_options(), but also works for output larger than 4GB.
+     *
+     * @param plist the root node to export
+     * @param plist_json a pointer to a char* buffer. This function allocates the memory,
+     *     caller is responsible for freeing it.
+     * @param length a pointer to an uint64_t variable. Represents the length of the allocated buffer.
+     * @param options One or more bitwise ORed values of #plist_write_options_t.
+     * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure
+     * @note Use plist_mem_free() to free the allocated memory.
+     */
+    PLIST_API plist_err_t plist_to_json64(plist_t plist, char **plist_json, uint64_t* length, plist_write_options_t options);
+
     /**
      * Export the #plist_t structure to OpenStep format.
      *
@@ -1002,6 +1215,20 @@ extern "C"
      */
     PLIST_API plist_err_t plist_to_openstep_with_options(plist_t plist, char **plist_openstep, uint32_t* length, plist_write_options_t options);
 
+    /**
+     * Export the #plist_t structure to OpenStep format, with a 64-bit length.
+     * Same as plist_to_openstep_with_options(), but also works for output larger than 4GB.
+     *
+     * @param plist the root node to export
+     * @param plist_openstep a pointer to a char* buffer. This function allocates the memory,
+     *     caller is responsible for freeing it.
+     * @param length a pointer to an uint64_t variable. Represents the length of the allocated buffer.
+     * @param options One or more bitwise ORed values of #plist_write_options_t.
+     * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure
+     * @note Use plist_mem_free() to free the allocated memory.
+     */
+    PLIST_API plist_err_t plist_to_openstep64(plist_t plist, char **plist_openstep, uint64_t* length, plist_write_options_t options);
+
 
     /**
      * Import the #plist_t structure from XML format.
@@ -1013,6 +1240,63 @@ extern "C"
      */
     PLIST_API plist_err_t plist_from_xml(const char *plist_xml, uint32_t length, plist_t * plist);
 
+    /**
+     * Import the #plist_t structure from XML format, with a 64-bit length.
+     * Same as plist_from_xml(), but also accepts buffers larger than 4GB.
+     *
+     * @param plist_xml a pointer to the XML buffer.
+     * @param length length of the buffer to read.
+     * @param plist a pointer to the imported plist.
+     * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure
+     */
+    PLIST_API plist_err_t plist_from_xml64(const char *plist_xml, uint64_t length, plist_t * plist);
+
+    /**
+     * Create a parser that imports an XML plist from a sequence of chunks.
+     * This allows parsing while the data is still being received: the
+     * document is passed piecewise to plist_xml_parser_feed(), and
+     * plist_xml_parser_finish() returns the result. Only the part of the
+     * input that hasn't been consumed yet is kept in memory.
+     *
+     * @return a new parser that must be freed with plist_xml_parser_free(),
+     *     or NULL when out of memory.
+     */
+    PLIST_API plist_xml_parser_t plist_xml_parser_new(void);
+
+    /**
+     * Pass the next chunk of an XML plist to the parser. Chunks may be split
+     * at any byte position. Everything that is complete is parsed right away.
+     *
+     * @param parser the parser
+     * @param buf the data. It is copied if needed and can be reused by the
+     *     caller after this function returns.
+     * @param len length of the data
+     * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure. After
+     *     an error, further calls return the same error until
+     *     plist_xml_parser_finish() is called.
+     */
+    PLIST_API plist_err_t plist_xml_parser_feed(plist_xml_parser_t parser, const char *buf, size_t len);
+
+    /**
+     * Signal the end of the input and retrieve the parsed plist. The result
+     * is the same that plist_from_xml() returns for the concatenation of all
+     * chunks. Afterwards the parser is reset and can be used for the next
+     * document.
+     *
+     * @param parser the parser
+     * @param plist a pointer to the imported plist.
+     * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure
+     */
+    PLIST_API plist_err_t plist_xml_parser_finish(plist_xml_parser_t parser, plist_t *plist);
+
+    /**
+     * Free a parser created with plist_xml_parser_new(), including any
+     * partially parsed data.
+     *
+     * @param parser the parser to free
+     */
+    PLIST_API void plist_xml_parser_free(plist_xml_parser_t parser);
+
     /**
      * Import the #plist_t structure from binary format.
      *
@@ -1023,6 +1307,58 @@ extern "C"
      */
     PLIST_API plist_err_t plist_from_bin(const char *plist_bin, uint32_t length, plist_t * plist);
 
+    /**
+     * Import the #plist_t structure from binary format, with a 64-bit length.
+     * Same as plist_from_bin(), but also accepts buffers larger than 4GB.
+     *
+     * @param plist_bin a pointer to the binary plist buffer.
+     * @param length length of the buffer to read.
+     * @param plist a pointer to the imported plist.
+     * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure
+     */
+    PLIST_API plist_err_t plist_from_bin64(const char *plist_bin, uint64_t length, plist_t * plist);
+
+    /**
+     * Import the #plist_t structure from binary format with parse options,
+     * decoding the children of large arrays and dictionaries with several
+     * threads. The result is the same as with a single thread, including
+     * the error reported for invalid input.
+     *
+     * Small binary plists always use a single thread, as do builds without
+     * thread support and parses with #PLIST_PARSE_ARENA or #PLIST_PARSE_LAZY.
+     * With #PLIST_PARSE_INTERN_KEYS every thread interns the keys it
+     * decodes, so equal keys share a string per thread.
+     *
+     * @param plist_bin a pointer to the binary plist buffer.
+     * @param length length of the buffer to read.
+     * @param plist a pointer to the imported plist.
+     * @param options One or more bitwise ORed values of #plist_parse_options_t.
+     * @param num_threads The maximum number of threads to use, or 0 to use
+     *            one per available processor.
+     * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure
+     */
+    PLIST_API plist_err_t plist_from_bin_ex(const char *plist_bin, uint64_t length, plist_t * plist, plist_parse_options_t options, unsigned int num_threads);
+
+    /**
+     * Check that a binary plist can be parsed, without creating any nodes.
+     * All checks of plist_from_bin() are performed, including those for
+     * circular references and the nesting depth, and the same error is
+     * returned. This is a lot faster than parsing and uses a small
+     * amount of memory per object, which makes it suitable to filter
+     * untrusted input before parsing it.
+     *
+     * @param plist_bin a pointer to the binary plist buffer.
+     * @param length length of the buffer to read.
+     * @param limits The limits to enforce, or NULL for the limits of the
+     *            parser only. Exceeding one returns #PLIST_ERR_LIMIT.
+     * @param report If not NULL, receives statistics about the plist.
+     *            On failure the counts are incomplete and error_offset
+     *            tells where the error was found.
+     * @return PLIST_ERR_SUCCESS if the plist is valid or a #plist_err_t
+     *     on failure
+     */
+    PLIST_API plist_err_t plist_validate_bin(const char *plist_bin, uint64_t length, const plist_bin_limits_t *limits, plist_bin_report_t *report);
+
     /**
      * Import the #plist_t structure from JSON format.
      *
@@ -1033,6 +1369,17 @@ extern "C"
      */
     PLIST_API plist_err_t plist_from_json(const char *json, uint32_t length, plist_t * plist);
 
+    /**
+     * Import the #plist_t structure from JSON format, with a 64-bit length.
+     * Same as plist_from_json(), but also accepts buffers larger than 4GB.
+     *
+     * @param json a pointer to the JSON buffer.
+     * @param length length of the buffer to read.
+     * @param plist a pointer to the imported plist.
+     * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure
+     */
+    PLIST_API plist_err_t plist_from_json64(const char *json, uint64_t length, plist_t * plist);
+
     /**
      * Import the #plist_t structure from OpenStep plist format.
      *
@@ -1043,6 +1390,17 @@ extern "C"
      */
     PLIST_API plist_err_t plist_from_openstep(const char *openstep, uint32_t length, plist_t * plist);
 
+    /**
+     * Import the #plist_t structure from OpenStep plist format, with a 64-bit length.
+     * Same as plist_from_openstep(), but also accepts buffers larger than 4GB.
+     *
+     * @param openstep a pointer to the OpenStep plist buffer.
+     * @param length length of the buffer to read.
+     * @param plist a pointer to the imported plist.
+     * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure
+     */
+    PLIST_API plist_err_t plist_from_openstep64(const char *openstep, uint64_t length, plist_t * plist);
+
     /**
      * Import the #plist_t structure from memory data.
      *
@@ -1063,13 +1421,95 @@ extern "C"
      */
     PLIST_API plist_err_t plist_from_memory(const char *plist_data, uint32_t length, plist_t *plist, plist_format_t *format);
 
+    /**
+     * Import the #plist_t structure from memory data, with a 64-bit length.
+     * Same as plist_from_memory(), but also accepts buffers larger than 4GB.
+     *
+     * @param plist_data A pointer to the memory buffer containing plist data.
+     * @param length Length of the buffer to read.
+     * @param plist A pointer to the imported plist.
+     * @param format If non-NULL, the #plist_format_t value pointed to will be set to the parsed format.
+     * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure
+     */
+    PLIST_API plist_err_t plist_from_memory64(const char *plist_data, uint64_t length, plist_t *plist, plist_format_t *format);
+
+    /**
+     * Import the #plist_t structure from memory data with the given parse options.
+     *
+     * Works like plist_from_memory(), but allows to pass options that
+     * change how the resulting tree is created.
+     *
+     * @param plist_data A pointer to the memory buffer containing plist data.
+     * @param length Length of the buffer to read.
+     * @param plist A pointer to the imported plist.
+     * @param format If non-NULL, the #plist_format_t value pointed to will be set to the parsed format.
+     * @param options One or more bitwise ORed values of #plist_parse_options_t.
+     * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure
+     */
+    PLIST_API plist_err_t plist_from_memory_ex(const char *plist_data, uint64_t length, plist_t *plist, plist_format_t *format, plist_parse_options_t options);
+
+    /**
+     * Parse a plist and report its contents to a set of callbacks instead
+     * of creating a #plist_t tree. This suits consumers that only need to
+     * scan the data, e.g. to pick a few values out of a large plist, since
+     * apart from the input the memory used only grows with the nesting
+     * depth. The JSON parser is an exception: it tokenizes the whole input
+     * before reporting the first value.
+     *
+     * Events are reported in document order. When parsing fails, the
+     * events reported so far are followed by the error return and no
+     * further callbacks. In XML plists, a dictionary with the single
+     * entry "CF$UID" is reported as such and not as #PLIST_UID.
+     *
+     * @param plist_data A pointer to the memory buffer containing plist data.
+     * @param length Length of the buffer to read.
+     * @param format The format of the data, or #PLIST_FORMAT_NONE to detect
+     *     it like plist_from_memory() does.
+     * @param handler The callbacks to invoke, see #plist_event_handler_t.
+     * @param user_data Passed to each callback.
+     * @return PLIST_ERR_SUCCESS on success, the value returned by a callback
+     *     that stopped parsing, or a #plist_err_t on failure
+     */
+    PLIST_API plist_err_t plist_parse_events(const char *plist_data, uint64_t length, plist_format_t format, const plist_event_handler_t *handler, void *user_data);
+
+    /**
+     * Convert a plist from one format to another without creating a
+     * #plist_t tree for it, where possible.
+     *
+     * For #PLIST_FORMAT_XML, #PLIST_FORMAT_JSON and #PLIST_FORMAT_OSTEP
+     * output, the parser events of plist_parse_events() are written out
+     * as they arrive. Binary output needs the whole object table and the
+     * other output formats are written from a tree, so for those the
+     * input is parsed into a tree first.
+     *
+     * Converted values are written like plist_write_to_string() writes
+     * them, with two exceptions: a dictionary with the single entry
+     * "CF$UID" in XML input stays a dictionary in JSON and OpenStep
+     * output, and a key that occurs more than once in a dictionary is
+     * written out each time, in input order. A tree keeps only the last
+     * value for it, at the position of the first one; reading the
+     * converted output back gives that same tree.
+     *
+     * @param plist_data A pointer to the memory buffer containing plist data.
+     * @param length Length of the buffer to read.
+     * @param in_format The format of the data, or #PLIST_FORMAT_NONE to
+     *     detect it like plist_from_memory() does.
+     * @param out_format The format to write.
+     * @param options One or more bitwise ORed values of #plist_write_options_t.
+     * @param write_func the callback that receives the output in order
+     * @param user_data a pointer that is passed to \a write_func
+     * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure.
+     *     If an error occurs after writing started, the output is incomplete.
+     */
+    PLIST_API plist_err_t plist_convert(const char *plist_data, uint64_t length, plist_format_t in_format, plist_format_t out_format, plist_write_options_t options, plist_write_func_t write_func, void *user_data);
+
     /**
      * Import the #plist_t structure directly from file.
      *
      * This function will look at the first bytes of the file data
      * to determine if it contains a binary, JSON, OpenStep, or XML plist
      * and tries to parse the data in the appropriate format.
-     * Uses plist_from_memory() internally.
+     * Uses plist_read_from_fd() internally.
      *
      * @param filename The name of the file to parse.
      * @param plist A pointer to the imported plist.
@@ -1078,6 +1518,27 @@ extern "C"
      */
     PLIST_API plist_err_t plist_read_from_file(const char *filename, plist_t *plist, plist_format_t *format);
 
+    /**
+     * Import the #plist_t structure from an open file descriptor.
+     *
+     * Regular files are memory mapped where supported, other file types
+     * like pipes are read until end of file. The format is detected like
+     * in plist_from_memory(). The file descriptor is not closed.
+     *
+     * When \a options contains #PLIST_PARSE_NOCOPY or #PLIST_PARSE_LAZY and
+     * the data is a binary plist, the mapping (or buffer) is kept alive
+     * and released together with the returned tree.
+     *
+     * @param fd A file descriptor open for reading.
+     * @param plist A pointer to the imported plist.
+     * @param format If non-NULL, the #plist_format_t value pointed to will be set to the parsed format.
+     * @param options One or more bitwise ORed values of #plist_parse_options_t.
+     * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure
+     * @note If a mapped file is truncated while the tree is still using
+     *     the mapping, accessing the tree may crash the process.
+     */
+    PLIST_API plist_err_t plist_read_from_fd(int fd, plist_t *plist, plist_format_t *format, plist_parse_options_t options);
+
     /**
      * Write the #plist_t structure to a NULL-terminated string using the given format and options.
      *
@@ -1093,6 +1554,22 @@ extern "C"
      */
     PLIST_API plist_err_t plist_write_to_string(plist_t plist, char **output, uint32_t* length, plist_format_t format, plist_write_options_t options);
 
+    /**
+     * Write the #plist_t structure to a NULL-terminated string using the given format and options,
+     * with a 64-bit length. Same as plist_write_to_string(), but also works for output larger than 4GB.
+     *
+     * @param plist The input plist structure
+     * @param output Pointer to a char* buffer. This function allocates the memory,
+     *     caller is responsible for freeing it.
+     * @param length A pointer to a uint64_t value that will receive the length of the allocated buffer.
+     * @param format A #plist_format_t value that specifies the output format to use.
+     * @param options One or more bitwise ORed values of #plist_write_options_t.
+     * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure.
+     * @note Use plist_mem_free() to free the allocated memory.
+     * @note #PLIST_FORMAT_BINARY is not supported by this function.
+     */
+    PLIST_API plist_err_t plist_write_to_string64(plist_t plist, char **output, uint64_t* length, plist_format_t format, plist_write_options_t options);
+
     /**
      * Write the #plist_t structure to a FILE* stream using the given format and options.
      *
@@ -1102,9 +1579,9 @@ extern "C"
      * @param options One or more bitwise ORed values of #plist_write_options_t.
      * @return PLIST_ERR_SUCCESS on success or a #plist_err_t on failure.
      * @note While this function allows all formats to be written to the given stream,
-     *     only the formats #PLIST_FORMAT_PRINT, #PLIST_FORMAT_LIMD, and #PLIST_FORMAT_PLUTIL
-     *     (basically all output-only formats) are directly and efficiently written to the stream;
-     *     the other formats are written to a memory buffer first.
+     *     only #PLIST_FORMAT_BINARY and the formats #PLIST_FORMAT_PRINT, #PLIST_FORMAT_LIMD,
+     *     and #PLIST_FORMAT_PLUTIL (basically all output-only formats) are directly and
+     *     efficiently written to the stream; the other formats are written to a memory buffer first.
      */
     PLIST_API plist_err_t plist_write_to_stream(plist_t plist, FILE* stream, plist_format_t format, plist_write_options_t options);
 
@@ -44,9 +44,8 @@
 // This class implements the abstract iterator class
 typedef struct node* node_t;
 struct node {
-	// Super class
-	node_t next;
-	node_t prev;
+	// position in the parent's child list
+	unsigned int index;
 	unsigned int count;
 
 	// Local Members
@@ -59,15 +58,22 @@ void node_destroy(node_t node);
 node_t node_create(node_t parent, void* data);
 
 int node_attach(node_t parent, node_t child);
+// Same as node_attach() but without the parent, cycle and depth checks.
+// Only for building new trees from freshly created nodes, where the
+// caller enforces NODE_MAX_DEPTH itself.
+int node_attach_unchecked(node_t parent, node_t child);
 int node_detach(node_t parent, node_t child);
 int node_insert(node_t parent, unsigned int index, node_t child);
+int node_replace(node_t parent, node_t old_child, node_t child);
 
 unsigned int node_n_children(node_t node);
 node_t node_nth_child(node_t node, unsigned int n);
 node_t node_first_child(node_t node);
+node_t node_last_child(node_t node);
 node_t node_prev_sibling(node_t node);
 node_t node_next_sibling(node_t node);
 int node_child_position(node_t parent, node_t child);
+int node_reserve_children(node_t node, unsigned int count);
 
 typedef void* (*copy_func_t)(const void *src);
 node_t node_copy_deep(node_t node, copy_func_t copy_func);
@@ -28,20 +28,22 @@
 
 typedef struct node* node_t;
 
-// This class implements the list_t abstract class
+// Child list of a node: a vector of node pointers
 struct node_list {
-	// list_t members
-	node_t begin;
-	node_t end;
-
-	// node_list_t members
+	node_t *items;
 	unsigned int count;
+	unsigned int capacity;
 
+	// items is not owned by the list (e.g. allocated from an arena)
+	int static_items;
 };
 typedef struct node_list* node_list_t;
 
 void node_list_destroy(node_list_t list);
 node_list_t node_list_create();
+void node_list_use_buffer(node_list_t list, node_t *items, unsigned int capacity);
+void node_list_clear(node_list_t list);
+int node_list_reserve(node_list_t list, unsigned int capacity);
 
 int node_list_add(node_list_t list, node_t node);
 int node_list_insert(node_list_t list, unsigned int index, node_t node);
@@ -31,11 +31,9 @@ void node_destroy(node_t node)
 {
 	if(!node) return;
 
-	if (node->children && node->children->count > 0) {
-		node_t ch;
-		while ((ch = node->children->begin)) {
-			node_list_remove(node->children, ch);
-			node_destroy(ch);
+	if (node->children) {
+		for (unsigned int i = 0; i < node->children->count; i++) {
+			node_destroy(node->children->items[i]);
 		}
 	}
 	node_list_destroy(node->children);
@@ -54,8 +52,7 @@ node_t node_create(node_t parent, void* data)
 	}
 
 	node->data = data;
-	node->next = NULL;
-	node->prev = NULL;
+	node->index = 0;
 	node->count = 0;
 	node->parent = NULL;
 	node->children = NULL;
@@ -74,21 +71,13 @@ node_t node_create(node_t parent, void* data)
 	return node;
 }
 
-static int node_depth_from_root(node_t n)
-{
-	int d = 0;
-	while (n && n->parent) {
-		d++;
-		n = n->parent;
-		if (d > NODE_MAX_DEPTH) return d; // early out
-	}
-	return d;
-}
-
 static int node_subtree_max_depth(node_t root)
 {
 	if (!root) return 0;
 
+	// most attached nodes are leaves or freshly created containers
+	if (!root->children || root->children->count == 0) return 0;
+
 	typedef struct { node_t n; int depth; } frame_t;
 	size_t cap = 64, sp = 0;
 	frame_t *st = (frame_t*)malloc(cap * sizeof(*st));
@@ -120,33 +109,33 @@ out:
 	return maxd;
 }
 
-static int would_create_cycle(node_t parent, node_t child)
-{
-	// if parent is anywhere in child's ancestor chain => cycle
-	for (node_t p = parent; p; p = p->parent) {
-		if (p == child) return 1;
-	}
-	return 0;
-}
-
-int node_attach(node_t parent, node_t child)
+// Validates attaching child below parent. The depth of parent and the
+// cycle check share one walk up the ancestor chain: since child has no
+// parent itself, a cycle can only occur if child is an ancestor of parent.
+static int node_check_attach(node_t parent, node_t child)
 {
 	if (!parent || !child) return NODE_ERR_INVALID_ARG;
 
 	// already parented?
 	if (child->parent) return NODE_ERR_PARENT;
 
-	// self/cycle guard
-	if (parent == child) return NODE_ERR_CIRCULAR_REF;
-	if (would_create_cycle(parent, child)) return NODE_ERR_CIRCULAR_REF;
+	// self/cycle guard, and depth(parent) on the way
+	int pd = 0;
+	for (node_t p = parent; p; p = p->parent) {
+		if (p == child) return NODE_ERR_CIRCULAR_REF;
+		if (p->parent) pd++;
+	}
 
 	// depth guard: depth(parent)+1+max_depth(child_subtree) <= NODE_MAX_DEPTH
-	int pd = node_depth_from_root(parent);
 	int cd = node_subtree_max_depth(child);
 	if (pd + 1 + cd > NODE_MAX_DEPTH) {
 		return NODE_ERR_MAX_DEPTH;
 	}
+	return NODE_ERR_SUCCESS;
+}
 
+int node_attach_unchecked(node_t parent, node_t child)
+{
 	if (!parent->children) {
 		parent->children = node_list_create();
 		if (!parent->children) return NODE_ERR_NO_MEM;
@@ -159,6 +148,14 @@ int node_attach(node_t parent, node_t child)
 	return res;
 }
 
+int node_attach(node_t parent, node_t child)
+{
+	int res = node_check_attach(parent, child);
+	if (res < 0) return res;
+
+	return node_attach_unchecked(parent, child);
+}
+
 int node_detach(node_t parent, node_t child)
 {
 	if (!parent || !child) return NODE_ERR_INVALID_ARG;
@@ -169,35 +166,20 @@ int node_detach(node_t parent, node_t child)
 	if (node_index >= 0) {
 		if (parent->count > 0) parent->count--;
 		child->parent = NULL;
-		child->prev = NULL;
-		child->next = NULL;
 	}
 	return node_index;
 }
 
 int node_insert(node_t parent, unsigned int node_index, node_t child)
 {
-	if (!parent || !child) return NODE_ERR_INVALID_ARG;
-
-	// already parented?
-	if (child->parent) return NODE_ERR_PARENT;
-
-	// self/cycle guard
-	if (parent == child) return NODE_ERR_CIRCULAR_REF;
-	if (would_create_cycle(parent, child)) return NODE_ERR_CIRCULAR_REF;
-
-	// depth guard: depth(parent)+1+max_depth(child_subtree) <= NODE_MAX_DEPTH
-	int pd = node_depth_from_root(parent);
-	int cd = node_subtree_max_depth(child);
-	if (pd + 1 + cd > NODE_MAX_DEPTH) {
-		return NODE_ERR_MAX_DEPTH;
-	}
+	int res = node_check_attach(parent, child);
+	if (res < 0) return res;
 
 	if (!parent->children) {
 		parent->children = node_list_create();
 		if (!parent->children) return NODE_ERR_NO_MEM;
 	}
-	int res = node_list_insert(parent->children, node_index, child);
+	res = node_list_insert(parent->children, node_index, child);
 	if (res == 0) {
 		child->parent = parent;
 		parent->count++;
@@ -205,6 +187,29 @@ int node_insert(node_t parent, unsigned int node_index, node_t child)
 	return res;
 }
 
+// Puts child in the place of old_child, without moving the other children.
+// Returns the index of that place or a negative error code.
+int node_replace(node_t parent, node_t old_child, node_t child)
+{
+	if (!parent || !old_child || !child) return NODE_ERR_INVALID_ARG;
+	if (old_child->parent != parent || !parent->children) return NODE_ERR_NOT_FOUND;
+
+	node_list_t list = parent->children;
+	unsigned int node_index = old_child->index;
+	if (node_index >= list->count || list->items[node_index] != old_child) {
+		return NODE_ERR_NOT_FOUND;
+	}
+	int res = node_check_attach(parent, child);
+	if (res < 0) return res;
+
+	list->items[node_index] = child;
+	child->index = node_index;
+	child->parent = parent;
+	old_child->index = 0;
+	old_child->parent = NULL;
+	return (int)node_index;
+}
+
 static void _node_debug(node_t node, unsigned int depth)
 {
 	unsigned int i = 0;
@@ -242,57 +247,53 @@ unsigned int node_n_children(node_t node)
 
 node_t node_nth_child(node_t node, unsigned int n)
 {
-	if (!node || !node->children || !node->children->begin) return NULL;
-	unsigned int node_index = 0;
-	int found = 0;
-	node_t ch;
-	for (ch = node_first_child(node); ch; ch = node_next_sibling(ch)) {
-		if (node_index++ == n) {
-			found = 1;
-			break;
-		}
-	}
-	if (!found) {
-		return NULL;
-	}
-	return ch;
+	if (!node || !node->children || n >= node->children->count) return NULL;
+	return node->children->items[n];
 }
 
 node_t node_first_child(node_t node)
 {
-	if (!node || !node->children) return NULL;
-	return node->children->begin;
+	if (!node || !node->children || node->children->count == 0) return NULL;
+	return node->children->items[0];
+}
+
+node_t node_last_child(node_t node)
+{
+	if (!node || !node->children || node->children->count == 0) return NULL;
+	return node->children->items[node->children->count - 1];
 }
 
 node_t node_prev_sibling(node_t node)
 {
-	if (!node) return NULL;
-	return node->prev;
+	if (!node || !node->parent || node->index == 0) return NULL;
+	return node->parent->children->items[node->index - 1];
 }
 
 node_t node_next_sibling(node_t node)
 {
-	if (!node) return NULL;
-	return node->next;
+	if (!node || !node->parent) return NULL;
+	node_list_t list = node->parent->children;
+	if (node->index + 1 >= list->count) return NULL;
+	return list->items[node->index + 1];
 }
 
 int node_child_position(node_t parent, node_t child)
 {
-	if (!parent || !parent->children || !parent->children->begin || !child) return NODE_ERR_INVALID_ARG;
-	int node_index = 0;
-	int found = 0;
-	node_t ch;
-	for (ch = node_first_child(parent); ch; ch = node_next_sibling(ch)) {
-		if (ch == child) {
-			found = 1;
-			break;
-		}
-		node_index++;
-	}
-	if (!found) {
+	if (!parent || !parent->children || parent->children->count == 0 || !child) return NODE_ERR_INVALID_ARG;
+	if (child->parent != parent) {
 		return NODE_ERR_NOT_FOUND;
 	}
-	return node_index;
+	return (int)child->index;
+}
+
+int node_reserve_children(node_t node, unsigned int count)
+{
+	if (!node) return NODE_ERR_INVALID_ARG;
+	if (!node->children) {
+		node->children = node_list_create();
+		if (!node->children) return NODE_ERR_NO_MEM;
+	}
+	return node_list_reserve(node->children, count);
 }
 
 node_t node_copy_deep(node_t node, copy_func_t copy_func)
@@ -311,8 +312,10 @@ node_t node_copy_deep(node_t node, copy_func_t copy_func)
 			node_destroy(copy);
 			return NULL;
 		}
-		if (node_attach(copy, cc) < 0) {
-                        node_destroy(cc);
+		// the copy has the same shape as the source tree, which already
+		// satisfies the depth limit
+		if (node_attach_unchecked(copy, cc) < 0) {
+			node_destroy(cc);
 			node_destroy(copy);
 			return NULL;
 		}
@@ -24,12 +24,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #include "node.h"
 #include "node_list.h"
 
+// Children are kept in a growable vector; every node stores its position
+// in node->index, so lookups by index or by node are O(1) and only
+// insert/remove in the middle have to move (and renumber) the tail.
+
+static void node_list_renumber(node_list_t list, unsigned int from)
+{
+	for (unsigned int i = from; i < list->count; i++) {
+		list->items[i]->index = i;
+	}
+}
+
 void node_list_destroy(node_list_t list)
 {
+	if (!list) return;
+	node_list_clear(list);
 	free(list);
 }
 
@@ -41,37 +55,74 @@ node_list_t node_list_create()
 	}
 
 	// Initialize structure
-	list->begin = NULL;
-	list->end = NULL;
+	list->items = NULL;
 	list->count = 0;
+	list->capacity = 0;
+	list->static_items = 0;
 	return list;
 }
 
-int node_list_add(node_list_t list, node_t node)
+void node_list_use_buffer(node_list_t list, node_t *items, unsigned int capacity)
 {
-	if (!list || !node) return NODE_ERR_INVALID_ARG;
-
-	// Find the last element in the list
-	node_t last = list->end;
+	if (!list) return;
+	node_list_clear(list);
+	list->items = items;
+	list->capacity = capacity;
+	list->static_items = 1;
+}
 
-	// Setup our new node as the new last element
-	node->next = NULL;
-	node->prev = last;
+void node_list_clear(node_list_t list)
+{
+	if (!list) return;
+	if (!list->static_items) {
+		free(list->items);
+	}
+	list->items = NULL;
+	list->count = 0;
+	list->capacity = 0;
+	list->static_items = 0;
+}
 
-	// Set the next element of our old "last" element
-	if (last) {
-		// but only if the node list is not empty
-		last->next = node;
+int node_list_reserve(node_list_t list, unsigned int capacity)
+{
+	if (!list) return NODE_ERR_INVALID_ARG;
+	if (capacity <= list->capacity) return NODE_ERR_SUCCESS;
+
+	node_t *items;
+	if (list->static_items) {
+		// the buffer isn't ours, move to the heap
+		items = (node_t*)malloc(capacity * sizeof(node_t));
+		if (!items) return NODE_ERR_NO_MEM;
+		if (list->count > 0) {
+			memcpy(items, list->items, list->count * sizeof(node_t));
+		}
+		list->static_items = 0;
 	} else {
-		// otherwise this is the start of the list
-		list->begin = node;
+		items = (node_t*)realloc(list->items, capacity * sizeof(node_t));
+		if (!items) return NODE_ERR_NO_MEM;
 	}
+	list->items = items;
+	list->capacity = capacity;
+	return NODE_ERR_SUCCESS;
+}
 
-	// Set the lists prev to the new last element
-	list->end = node;
+static int node_list_grow(node_list_t list)
+{
+	if (list->count < list->capacity) return NODE_ERR_SUCCESS;
+	if (list->capacity >= UINT_MAX / 2) return NODE_ERR_NO_MEM;
+	unsigned int capacity = (list->capacity < 4) ? 4 : list->capacity * 2;
+	return node_list_reserve(list, capacity);
+}
 
-	// Increment our node count for this list
-	list->count++;
+int node_list_add(node_list_t list, node_t node)
+{
+	if (!list || !node) return NODE_ERR_INVALID_ARG;
+
+	int res = node_list_grow(list);
+	if (res < 0) return res;
+
+	node->index = list->count;
+	list->items[list->count++] = node;
 	return NODE_ERR_SUCCESS;
 }
 
@@ -83,35 +134,13 @@ int node_list_insert(node_list_t list, unsigned int node_index, node_t node)
 		return node_list_add(list, node);
 	}
 
-	// Get the first element in the list
-	node_t cur = list->begin;
-	node_t prev = NULL;
-
-	for (unsigned int pos = 0; pos < node_index; pos++) {
-		if (!cur) return NODE_ERR_INVALID_ARG;
-		prev = cur;
-		cur = cur->next;
-	}
-
-	// insert node before cur
-	node->prev = prev;
-	node->next = cur;
-
-	if (prev) {
-		prev->next = node;
-	} else {
-		list->begin = node;
-	}
-
-	if (cur) {
-		cur->prev = node;
-	} else {
-		// should not happen with bounds above, but keeps things consistent
-		list->end = node;
-	}
+	int res = node_list_grow(list);
+	if (res < 0) return res;
 
-	// Increment our node count for this list
+	memmove(&list->items[node_index + 1], &list->items[node_index], (list->count - node_index) * sizeof(node_t));
+	list->items[node_index] = node;
 	list->count++;
+	node_list_renumber(list, node_index);
 	return NODE_ERR_SUCCESS;
 }
 
@@ -121,31 +150,14 @@ int node_list_remove(node_list_t list, node_t node)
 	if (!list || !node) return NODE_ERR_INVALID_ARG;
 	if (list->count == 0) return NODE_ERR_NOT_FOUND;
 
-	int node_index = 0;
-	for (node_t n = list->begin; n; n = n->next, node_index++) {
-		if (node != n) continue;
-
-		node_t newnode = node->next;
-		if (node->prev) {
-			node->prev->next = newnode;
-		} else {
-			// we just removed the first element
-			list->begin = newnode;
-		}
-
-		if (newnode) {
-			newnode->prev = node->prev;
-		} else {
-			// we removed the last element, set new end
-			list->end = node->prev;
-		}
-
-		// fully detach node from list
-		node->prev = NULL;
-		node->next = NULL;
-
-		list->count--;
-		return node_index;
+	unsigned int node_index = node->index;
+	if (node_index >= list->count || list->items[node_index] != node) {
+		return NODE_ERR_NOT_FOUND;
 	}
-	return NODE_ERR_NOT_FOUND;
+
+	list->count--;
+	memmove(&list->items[node_index], &list->items[node_index + 1], (list->count - node_index) * sizeof(node_t));
+	node_list_renumber(list, node_index);
+	node->index = 0;
+	return (int)node_index;
 }
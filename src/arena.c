@@ -0,0 +1,133 @@
+/*
+ * arena.c
+ * simple slab based arena allocator
+ *
+ * Copyright (c) 2026 Nikias Bassen, All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <string.h>
+#include "arena.h"
+
+/*
+ * Memory is handed out from large zero-filled slabs and is never returned
+ * individually; arena_free() releases all slabs at once. Each new slab is
+ * twice the size of the previous one (up to ARENA_MAX_SLAB_SIZE), and
+ * requests that don't fit a regular slab get a dedicated one.
+ */
+
+#define ARENA_MIN_SLAB_SIZE 65536
+#define ARENA_MAX_SLAB_SIZE (64*1024*1024)
+#define ARENA_ALIGN 8
+#define ARENA_SLAB_HDR ((sizeof(arena_slab_t) + (ARENA_ALIGN-1)) & ~(size_t)(ARENA_ALIGN-1))
+
+static arena_slab_t* arena_slab_new(size_t size)
+{
+	arena_slab_t *slab = (arena_slab_t*)calloc(1, ARENA_SLAB_HDR + size);
+	if (!slab) {
+		return NULL;
+	}
+	slab->size = size;
+	slab->used = 0;
+	slab->next = NULL;
+	return slab;
+}
+
+arena_t* arena_new(size_t initial)
+{
+	arena_t *arena = (arena_t*)malloc(sizeof(arena_t));
+	if (!arena) {
+		return NULL;
+	}
+	if (initial < ARENA_MIN_SLAB_SIZE) {
+		initial = ARENA_MIN_SLAB_SIZE;
+	} else if (initial > ARENA_MAX_SLAB_SIZE) {
+		initial = ARENA_MAX_SLAB_SIZE;
+	}
+	arena->slab_size = (initial + (ARENA_ALIGN-1)) & ~(size_t)(ARENA_ALIGN-1);
+	arena->slabs = NULL;
+	arena->num_slabs = 0;
+	return arena;
+}
+
+void arena_free(arena_t *arena)
+{
+	if (!arena) return;
+
+	arena_slab_t *slab = arena->slabs;
+	while (slab) {
+		arena_slab_t *next = slab->next;
+		free(slab);
+		slab = next;
+	}
+	free(arena);
+}
+
+void* arena_alloc(arena_t *arena, size_t size)
+{
+	if (!arena) return NULL;
+
+	size = (size + (ARENA_ALIGN-1)) & ~(size_t)(ARENA_ALIGN-1);
+	if (size == 0) {
+		size = ARENA_ALIGN;
+	}
+
+	arena_slab_t *slab = arena->slabs;
+	if (!slab || slab->size - slab->used < size) {
+		if (size > arena->slab_size / 4) {
+			// oversized request, give it its own slab and keep the current one
+			arena_slab_t *big = arena_slab_new(size);
+			if (!big) {
+				return NULL;
+			}
+			big->used = size;
+			if (slab) {
+				big->next = slab->next;
+				slab->next = big;
+			} else {
+				arena->slabs = big;
+			}
+			arena->num_slabs++;
+			return (char*)big + ARENA_SLAB_HDR;
+		}
+		if (slab) {
+			if (arena->slab_size < ARENA_MAX_SLAB_SIZE) {
+				arena->slab_size <<= 1;
+			}
+		}
+		slab = arena_slab_new(arena->slab_size);
+		if (!slab) {
+			return NULL;
+		}
+		slab->next = arena->slabs;
+		arena->slabs = slab;
+		arena->num_slabs++;
+	}
+
+	void *ptr = (char*)slab + ARENA_SLAB_HDR + slab->used;
+	slab->used += size;
+	return ptr;
+}
+
+char* arena_strndup(arena_t *arena, const char *str, size_t len)
+{
+	char *s = (char*)arena_alloc(arena, len + 1);
+	if (!s) {
+		return NULL;
+	}
+	memcpy(s, str, len);
+	s[len] = '\0';
+	return s;
+}
@@ -0,0 +1,43 @@
+/*
+ * arena.h
+ * header file for simple slab based arena allocator
+ *
+ * Copyright (c) 2026 Nikias Bassen, All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef ARENA_H
+#define ARENA_H
+#include <stdlib.h>
+
+typedef struct arena_slab_t {
+	struct arena_slab_t *next;
+	size_t size;
+	size_t used;
+} arena_slab_t;
+
+typedef struct arena_t {
+	arena_slab_t *slabs;
+	size_t slab_size;
+	size_t num_slabs;
+} arena_t;
+
+arena_t* arena_new(size_t initial);
+void arena_free(arena_t *arena);
+
+void* arena_alloc(arena_t *arena, size_t size);
+char* arena_strndup(arena_t *arena, const char *str, size_t len);
+
+#endif
@@ -19,7 +19,25 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 #include <string.h>
+#include <stdint.h>
 #include "base64.h"
+#include "thread.h"
+
+/*
+ * The SIMD kernels translate 16 (SSSE3) or 32 (AVX2) characters at once
+ * with byte shuffles over nibble lookup tables instead of one table lookup
+ * per character. They are compiled with a target attribute and only
+ * selected at runtime when the CPU supports them. The decode kernels stop
+ * at the first block that contains anything but base64 characters; line
+ * breaks, indentation, padding and invalid characters are then handled by
+ * the scalar code, which picks up the kernels again at the next full
+ * quartet.
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define BASE64_SIMD 1
+#include <immintrin.h>
+#endif
 
 static const char base64_str[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 static const char base64_pad = '=';
@@ -43,6 +61,182 @@ static const signed char base64_table[256] = {
 	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
 };
 
+/* the kernels return the number of bytes consumed from buf and write
+ * 4/3 (encode) or 3/4 (decode) as many bytes to outbuf */
+typedef size_t (*encode_func_t)(char *outbuf, const unsigned char *buf, size_t size);
+typedef size_t (*decode_func_t)(unsigned char *outbuf, size_t outsize, const char *buf, size_t len);
+
+#ifdef BASE64_SIMD
+__attribute__((target("ssse3")))
+static inline __m128i enc_reshuffle_ssse3(__m128i in)
+{
+	/* spread 3 bytes over 4 and move the 6-bit groups into place */
+	in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+	const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00));
+	const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+	const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003F03F0));
+	const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+	return _mm_or_si128(t1, t3);
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i enc_translate_ssse3(__m128i in)
+{
+	/* offset from the 6-bit value to its character, by range */
+	const __m128i lut = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+	__m128i indices = _mm_subs_epu8(in, _mm_set1_epi8(51));
+	indices = _mm_sub_epi8(indices, _mm_cmpgt_epi8(in, _mm_set1_epi8(25)));
+	return _mm_add_epi8(in, _mm_shuffle_epi8(lut, indices));
+}
+
+__attribute__((target("ssse3")))
+static size_t encode_ssse3(char *outbuf, const unsigned char *buf, size_t size)
+{
+	size_t n = 0;
+	/* 16 bytes are loaded for every 12 that are encoded */
+	while (size - n >= 16) {
+		__m128i in = _mm_loadu_si128((const __m128i*)(buf + n));
+		_mm_storeu_si128((__m128i*)outbuf, enc_translate_ssse3(enc_reshuffle_ssse3(in)));
+		outbuf += 16;
+		n += 12;
+	}
+	return n;
+}
+
+__attribute__((target("avx2")))
+static size_t encode_avx2(char *outbuf, const unsigned char *buf, size_t size)
+{
+	const __m256i shuf = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+	                                      1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const __m256i lut = _mm256_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0,
+	                                     65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+	size_t n = 0;
+	/* each lane encodes 12 bytes, the upper lane is loaded from buf + 12 */
+	while (size - n >= 28) {
+		__m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(buf + n))),
+		                                     _mm_loadu_si128((const __m128i*)(buf + n + 12)), 1);
+		in = _mm256_shuffle_epi8(in, shuf);
+		const __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0FC0FC00));
+		const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+		const __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003F03F0));
+		const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+		in = _mm256_or_si256(t1, t3);
+		__m256i indices = _mm256_subs_epu8(in, _mm256_set1_epi8(51));
+		indices = _mm256_sub_epi8(indices, _mm256_cmpgt_epi8(in, _mm256_set1_epi8(25)));
+		in = _mm256_add_epi8(in, _mm256_shuffle_epi8(lut, indices));
+		_mm256_storeu_si256((__m256i*)outbuf, in);
+		outbuf += 32;
+		n += 24;
+	}
+	/* the compiler does not always do this before the SSE code below */
+	_mm256_zeroupper();
+	return n + encode_ssse3(outbuf, buf + n, size - n);
+}
+
+__attribute__((target("ssse3")))
+static size_t decode_ssse3(unsigned char *outbuf, size_t outsize, const char *buf, size_t len)
+{
+	const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+	const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i mask_2f = _mm_set1_epi8(0x2F);
+	size_t n = 0;
+	/* 16 bytes are stored for every 12 that are decoded */
+	while (len - n >= 16 && outsize >= 16) {
+		__m128i str = _mm_loadu_si128((const __m128i*)(buf + n));
+		const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+		const __m128i lo_nibbles = _mm_and_si128(str, mask_2f);
+		const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+		const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+		/* any character outside of the alphabet has a common bit set */
+		if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128()))) {
+			break;
+		}
+		const __m128i eq_2f = _mm_cmpeq_epi8(str, mask_2f);
+		str = _mm_add_epi8(str, _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles)));
+		/* pack the 6-bit values of each quartet into 3 bytes */
+		str = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+		str = _mm_madd_epi16(str, _mm_set1_epi32(0x00011000));
+		str = _mm_shuffle_epi8(str, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+		_mm_storeu_si128((__m128i*)outbuf, str);
+		outbuf += 12;
+		outsize -= 12;
+		n += 16;
+	}
+	return n;
+}
+
+__attribute__((target("avx2")))
+static size_t decode_avx2(unsigned char *outbuf, size_t outsize, const char *buf, size_t len)
+{
+	const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+	                                        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+	const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+	                                        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+	                                          0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i mask_2f = _mm256_set1_epi8(0x2F);
+	size_t n = 0;
+	while (len - n >= 32 && outsize >= 32) {
+		__m256i str = _mm256_loadu_si256((const __m256i*)(buf + n));
+		const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+		const __m256i lo_nibbles = _mm256_and_si256(str, mask_2f);
+		const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+		const __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+		if (!_mm256_testz_si256(lo, hi)) {
+			break;
+		}
+		const __m256i eq_2f = _mm256_cmpeq_epi8(str, mask_2f);
+		str = _mm256_add_epi8(str, _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles)));
+		str = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+		str = _mm256_madd_epi16(str, _mm256_set1_epi32(0x00011000));
+		str = _mm256_shuffle_epi8(str, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		                                                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+		/* close the gap between the 12 bytes of each lane */
+		str = _mm256_permutevar8x32_epi32(str, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+		_mm256_storeu_si256((__m256i*)outbuf, str);
+		outbuf += 24;
+		outsize -= 24;
+		n += 32;
+	}
+	_mm256_zeroupper();
+	return n + decode_ssse3(outbuf, outsize, buf + n, len - n);
+}
+#endif
+
+static size_t encode_none(char *outbuf, const unsigned char *buf, size_t size)
+{
+	return 0;
+}
+
+static size_t decode_none(unsigned char *outbuf, size_t outsize, const char *buf, size_t len)
+{
+	return 0;
+}
+
+static encode_func_t encode_impl = NULL;
+static decode_func_t decode_impl = NULL;
+static thread_once_t base64_once = THREAD_ONCE_INIT;
+
+/* Picks the kernels for the running CPU, called once through thread_once() */
+static void base64_select(void)
+{
+	encode_func_t enc = encode_none;
+	decode_func_t dec = decode_none;
+#ifdef BASE64_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		enc = encode_avx2;
+		dec = decode_avx2;
+	} else if (__builtin_cpu_supports("ssse3")) {
+		enc = encode_ssse3;
+		dec = decode_ssse3;
+	}
+#endif
+	decode_impl = dec;
+	encode_impl = enc;
+}
+
 size_t base64encode(char *outbuf, const unsigned char *buf, size_t size)
 {
 	if (!outbuf || !buf || (size <= 0)) {
@@ -51,57 +245,95 @@ size_t base64encode(char *outbuf, const unsigned char *buf, size_t size)
 
 	size_t n = 0;
 	size_t m = 0;
-	unsigned char input[3];
-	unsigned int output[4];
-	while (n < size) {
-		input[0] = buf[n];
-		input[1] = (n+1 < size) ? buf[n+1] : 0;
-		input[2] = (n+2 < size) ? buf[n+2] : 0;
-		output[0] = input[0] >> 2;
-		output[1] = ((input[0] & 3) << 4) + (input[1] >> 4);
-		output[2] = ((input[1] & 15) << 2) + (input[2] >> 6);
-		output[3] = input[2] & 63;
-		outbuf[m++] = base64_str[(int)output[0]];
-		outbuf[m++] = base64_str[(int)output[1]];
-		outbuf[m++] = (n+1 < size) ? base64_str[(int)output[2]] : base64_pad;
-		outbuf[m++] = (n+2 < size) ? base64_str[(int)output[3]] : base64_pad;
-		n+=3;
+	if (size >= 16) {
+		thread_once(&base64_once, base64_select);
+		n = encode_impl(outbuf, buf, size);
+		m = n / 3 * 4;
+	}
+	while (size - n >= 3) {
+		uint32_t v = ((uint32_t)buf[n] << 16) | ((uint32_t)buf[n+1] << 8) | buf[n+2];
+		outbuf[m++] = base64_str[v >> 18];
+		outbuf[m++] = base64_str[(v >> 12) & 63];
+		outbuf[m++] = base64_str[(v >> 6) & 63];
+		outbuf[m++] = base64_str[v & 63];
+		n += 3;
+	}
+	if (n < size) {
+		uint32_t v = (uint32_t)buf[n] << 16;
+		if (n+1 < size) {
+			v |= (uint32_t)buf[n+1] << 8;
+		}
+		outbuf[m++] = base64_str[v >> 18];
+		outbuf[m++] = base64_str[(v >> 12) & 63];
+		outbuf[m++] = (n+1 < size) ? base64_str[(v >> 6) & 63] : base64_pad;
+		outbuf[m++] = base64_pad;
 	}
 	outbuf[m] = 0; // 0-termination!
 	return m;
 }
 
-unsigned char *base64decode(const char *buf, size_t *size)
+void base64decode_init(base64_decoder_t *dec)
+{
+	memset(dec, 0, sizeof(base64_decoder_t));
+}
+
+size_t base64decode_update(base64_decoder_t *dec, unsigned char *outbuf, size_t outsize, const char *buf, size_t len)
 {
-	if (!buf || !size) return NULL;
-	size_t len = (*size > 0) ? *size : strlen(buf);
-	if (len <= 0) return NULL;
-	unsigned char *outbuf = (unsigned char*)malloc((len/4)*3+3);
-	if (!outbuf) return NULL;
 	const char *ptr = buf;
+	const char *end = buf + len;
 	size_t p = 0;
-	int wv, w1, w2, w3, w4;
-	int tmpval[4];
-	int tmpcnt = 0;
+	int wv;
 
-	do {
-		while (ptr < buf+len && (*ptr == ' ' || *ptr == '\t' || *ptr == '\n' || *ptr == '\r')) {
+	if (dec->done) {
+		return 0;
+	}
+	while (ptr < end) {
+		if (dec->cnt == 0) {
+			/* fast path for runs of complete quartets */
+			if (end - ptr >= 16) {
+				thread_once(&base64_once, base64_select);
+				size_t n = decode_impl(outbuf + p, outsize - p, ptr, end - ptr);
+				ptr += n;
+				p += n / 4 * 3;
+			}
+			while (end - ptr >= 4) {
+				int w1 = base64_table[(unsigned char)ptr[0]];
+				int w2 = base64_table[(unsigned char)ptr[1]];
+				int w3 = base64_table[(unsigned char)ptr[2]];
+				int w4 = base64_table[(unsigned char)ptr[3]];
+				if ((w1 | w2 | w3 | w4) < 0) {
+					break;
+				}
+				outbuf[p++] = (unsigned char)((w1 << 2) | (w2 >> 4));
+				outbuf[p++] = (unsigned char)((w2 << 4) | (w3 >> 2));
+				outbuf[p++] = (unsigned char)((w3 << 6) | w4);
+				ptr += 4;
+			}
+			if (ptr >= end) {
+				break;
+			}
+		}
+		if (*ptr == ' ' || *ptr == '\t' || *ptr == '\n' || *ptr == '\r') {
 			ptr++;
+			continue;
 		}
-		if (*ptr == '\0' || ptr >= buf+len) {
+		if (*ptr == '\0') {
+			/* nothing after a 0 byte is decoded, also not in later calls */
+			dec->done = 1;
 			break;
 		}
 		if ((wv = base64_table[(int)(unsigned char)*ptr++]) == -1) {
 			continue;
 		}
-		tmpval[tmpcnt++] = wv;
-		if (tmpcnt == 4) {
-			tmpcnt = 0;
-			w1 = tmpval[0];
-			w2 = tmpval[1];
-			w3 = tmpval[2];
-			w4 = tmpval[3];
+		dec->val[dec->cnt++] = wv;
+		if (dec->cnt == 4) {
+			int w1 = dec->val[0];
+			int w2 = dec->val[1];
+			int w3 = dec->val[2];
+			int w4 = dec->val[3];
+			dec->cnt = 0;
 
+			/* a quartet with padding yields fewer bytes */
 			if (w1 >= 0 && w2 >= 0) {
 				outbuf[p++] = (unsigned char)(((w1 << 2) + (w2 >> 4)) & 0xFF);
 			}
@@ -112,9 +344,6 @@ unsigned char *base64decode(const char *buf, size_t *size)
 				outbuf[p++] = (unsigned char)(((w3 << 6) + w4) & 0xFF);
 			}
 		}
-	} while (1);
-
-	outbuf[p] = 0;
-	*size = p;
-	return outbuf;
+	}
+	return p;
 }
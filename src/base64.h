@@ -22,7 +22,20 @@
 #define BASE64_H
 #include <stdlib.h>
 
+/* decoding state, so input can be passed in several pieces */
+typedef struct {
+	int val[4];
+	int cnt;
+	int done;
+} base64_decoder_t;
+
+/* size of an output buffer that can hold the decoded form of len characters */
+#define BASE64_DECODE_MAX_SIZE(len) (((len) / 4) * 3 + 3)
+
 size_t base64encode(char *outbuf, const unsigned char *buf, size_t size);
-unsigned char *base64decode(const char *buf, size_t *size);
+void base64decode_init(base64_decoder_t *dec);
+/* outsize must be at least BASE64_DECODE_MAX_SIZE of all characters
+ * passed to the decoder so far, minus what it has returned before */
+size_t base64decode_update(base64_decoder_t *dec, unsigned char *outbuf, size_t outsize, const char *buf, size_t len);
 
 #endif
@@ -27,14 +27,16 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 
-#include <ctype.h>
 #include <inttypes.h>
 
 #include "plist.h"
 #include "hashtable.h"
 #include "bytearray.h"
 #include "ptrarray.h"
+#include "thread.h"
+#include "unicode.h"
 #include "plist/plist.h"
 
 #include <node.h>
@@ -46,6 +48,9 @@
 #define BPLIST_VERSION          ((uint8_t*)"00")
 #define BPLIST_VERSION_SIZE     2
 
+/* upper limit for the number of threads used to parse or write */
+#define BPLIST_MAX_THREADS      64
+
 #pragma pack(push,1)
 typedef struct {
     uint8_t unused[6];
@@ -229,6 +234,23 @@ static int uint64_mul_overflow(uint64_t a, uint64_t b, uint64_t *res)
 
 #define NODE_IS_ROOT(x) (((node_t)(x))->isRoot)
 
+/* a container whose children are being decoded, see parse_bin_stack() */
+struct bplist_frame {
+    plist_t node;
+    const char* refs;
+    uint64_t size;
+    uint64_t next;
+    uint64_t node_index;
+    plist_type type;
+};
+
+/* one bit per object index, set while the object is a container on the
+ * stack; finding an object's own bit set means a circular reference */
+#define VISITING_SIZE(n) (((n) + 7) / 8)
+#define visiting_get(v, i) ((v)[(i) >> 3] & (1 << ((i) & 7)))
+#define visiting_set(v, i) ((v)[(i) >> 3] |= (uint8_t)(1 << ((i) & 7)))
+#define visiting_clear(v, i) ((v)[(i) >> 3] &= (uint8_t)~(1 << ((i) & 7)))
+
 struct bplist_data {
     const char* data;
     uint64_t size;
@@ -236,11 +258,57 @@ struct bplist_data {
     uint8_t ref_size;
     uint8_t offset_size;
     const char* offset_table;
+    /* nesting depth of the children of the bottom stack frame */
     uint32_t level;
-    ptrarray_t* used_indexes;
+    struct bplist_frame* stack;
+    uint32_t stack_len;
+    uint32_t stack_cap;
+    uint8_t* visiting;
+    /* index of the object being decoded */
+    uint64_t cur_index;
+    arena_t* arena;
+    struct bplist_lazy_ctx* lazy;
+    struct bplist_lazy_path* lazy_path;
+    int nocopy;
+    hashtable_t* keys;
+    int parsing_key;
+    /* threads to decode large containers with, see parse_children_parallel() */
+    unsigned int threads;
+    /* dicts of an arena tree that get their index once the arena root is set */
+    ptrarray_t* arena_dicts;
     plist_err_t err;
 };
 
+/* shared state of a lazily decoded binary plist, alive as long as
+ * there are containers in the tree that were not yet decoded */
+struct bplist_lazy_ctx {
+    const char* data;
+    uint64_t size;
+    uint64_t num_objects;
+    uint8_t ref_size;
+    uint8_t offset_size;
+    const char* offset_table;
+    arena_t* paths;
+    /* shared by all expansions, which must not run concurrently anyway */
+    uint8_t* visiting;
+    uint64_t refcount;
+    int nocopy;
+};
+
+/* object indexes from the root to a lazy container, for the recursion check */
+struct bplist_lazy_path {
+    struct bplist_lazy_path* parent;
+    uint64_t node_index;
+    uint32_t level;
+};
+
+struct bplist_lazy {
+    struct bplist_lazy_ctx* ctx;
+    struct bplist_lazy_path* path;
+    const char* refs;
+    uint64_t size;
+};
+
 #ifdef DEBUG
 static int plist_bin_debug = 0;
 #define PLIST_BIN_ERR(...) if (plist_bin_debug) { fprintf(stderr, "libplist[binparser] ERROR: " __VA_ARGS__); }
@@ -273,11 +341,85 @@ void plist_bin_set_debug(int debug)
 #endif
 }
 
-static plist_t parse_bin_node_at_index(struct bplist_data *bplist, uint32_t node_index);
+static plist_t parse_bin_node_at_index(struct bplist_data *bplist, uint64_t node_index);
+static int bplist_push_frame(struct bplist_data *bplist, plist_t node, const char* refs, uint64_t size, plist_type type);
+
+static plist_data_t bplist_new_data(struct bplist_data *bplist)
+{
+    if (bplist->arena) {
+        return plist_new_plist_data_arena(bplist->arena);
+    }
+    return plist_new_plist_data();
+}
+
+static plist_t bplist_new_node(struct bplist_data *bplist, plist_data_t data)
+{
+    if (bplist->arena) {
+        return plist_new_node_arena(bplist->arena, data);
+    }
+    return plist_new_node(data);
+}
+
+static int bplist_lazy_attach(struct bplist_data *bplist, plist_t node, const char* refs, uint64_t size)
+{
+    struct bplist_lazy_ctx *ctx = bplist->lazy;
+    struct bplist_lazy *lazy = (struct bplist_lazy*)malloc(sizeof(struct bplist_lazy));
+    struct bplist_lazy_path *path = (struct bplist_lazy_path*)arena_alloc(ctx->paths, sizeof(struct bplist_lazy_path));
+    if (!lazy || !path) {
+        free(lazy);
+        PLIST_BIN_ERR("%s: failed to allocate lazy node state\n", __func__);
+        bplist->err = PLIST_ERR_NO_MEM;
+        return -1;
+    }
+    /* the index of this node was stored by parse_bin_node_at_index() */
+    path->parent = bplist->lazy_path;
+    path->level = bplist->level + bplist->stack_len;
+    path->node_index = bplist->cur_index;
+    lazy->ctx = ctx;
+    lazy->path = path;
+    lazy->refs = refs;
+    lazy->size = size;
+    ctx->refcount++;
+
+    plist_data_t data = plist_get_data(node);
+    data->hashtable = lazy;
+    data->flags |= PLIST_DATA_FLAG_LAZY;
+    return 0;
+}
+
+static void bplist_lazy_ctx_free(struct bplist_lazy_ctx *ctx)
+{
+    arena_free(ctx->paths);
+    free(ctx->visiting);
+    free(ctx);
+}
+
+void plist_bin_lazy_free(void *lazy_state)
+{
+    struct bplist_lazy *lazy = (struct bplist_lazy*)lazy_state;
+    if (!lazy) return;
+    if (--lazy->ctx->refcount == 0) {
+        bplist_lazy_ctx_free(lazy->ctx);
+    }
+    free(lazy);
+}
+
+/* allocate a value buffer for data, from the arena if there is one */
+static void* bplist_alloc(struct bplist_data *bplist, plist_data_t data, size_t size)
+{
+    if (bplist->arena) {
+        void *buf = arena_alloc(bplist->arena, size);
+        if (buf) {
+            data->flags |= PLIST_DATA_FLAG_BORROWED;
+        }
+        return buf;
+    }
+    return malloc(size);
+}
 
-static plist_t parse_int_node(const char **bnode, uint8_t size)
+static plist_t parse_int_node(struct bplist_data *bplist, const char **bnode, uint8_t size)
 {
-    plist_data_t data = plist_new_plist_data();
+    plist_data_t data = bplist_new_data(bplist);
     if (!data) {
         PLIST_BIN_ERR("%s: failed to allocate plist data\n", __func__);
         return NULL;
@@ -296,7 +438,7 @@ static plist_t parse_int_node(const char **bnode, uint8_t size)
         data->length = size;
         break;
     default:
-        free(data);
+        plist_free_data(data);
         PLIST_BIN_ERR("%s: Invalid byte size for integer node\n", __func__);
         return NULL;
     };
@@ -306,12 +448,12 @@ static plist_t parse_int_node(const char **bnode, uint8_t size)
     (*bnode) += size;
     data->type = PLIST_INT;
 
-    return node_create(NULL, data);
+    return bplist_new_node(bplist, data);
 }
 
-static plist_t parse_real_node(const char **bnode, uint8_t size)
+static plist_t parse_real_node(struct bplist_data *bplist, const char **bnode, uint8_t size)
 {
-    plist_data_t data = plist_new_plist_data();
+    plist_data_t data = bplist_new_data(bplist);
     if (!data) {
         PLIST_BIN_ERR("%s: failed to allocate plist data\n", __func__);
         return NULL;
@@ -341,19 +483,19 @@ static plist_t parse_real_node(const char **bnode, uint8_t size)
     }
 
     default:
-        free(data);
+        plist_free_data(data);
         PLIST_BIN_ERR("%s: Invalid byte size for real node\n", __func__);
         return NULL;
     }
     data->type = PLIST_REAL;
     data->length = sizeof(double);
 
-    return node_create(NULL, data);
+    return bplist_new_node(bplist, data);
 }
 
-static plist_t parse_date_node(const char **bnode, uint8_t size)
+static plist_t parse_date_node(struct bplist_data *bplist, const char **bnode, uint8_t size)
 {
-    plist_t node = parse_real_node(bnode, size);
+    plist_t node = parse_real_node(bplist, bnode, size);
     plist_data_t data = plist_get_data(node);
 
     data->type = PLIST_DATE;
@@ -361,16 +503,37 @@ static plist_t parse_date_node(const char **bnode, uint8_t size)
     return node;
 }
 
-static plist_t parse_string_node(const char **bnode, uint64_t size)
+static plist_t parse_string_node(struct bplist_data *bplist, const char **bnode, uint64_t size)
 {
-    plist_data_t data = plist_new_plist_data();
+    plist_data_t data;
+    if (bplist->keys && bplist->parsing_key) {
+        const char *nul = (const char*)memchr(*bnode, '\0', size);
+        data = plist_new_interned_key_data(bplist->keys, *bnode, (nul) ? (size_t)(nul - *bnode) : size);
+        if (!data) {
+            PLIST_BIN_ERR("%s: Could not allocate %" PRIu64 " bytes\n", __func__, sizeof(char) * (size + 1));
+            return NULL;
+        }
+        return plist_new_node(data);
+    }
+    if (!bplist->arena) {
+        data = plist_new_string_data(*bnode, size);
+        if (!data) {
+            PLIST_BIN_ERR("%s: Could not allocate %" PRIu64 " bytes\n", __func__, sizeof(char) * (size + 1));
+            return NULL;
+        }
+        data->type = PLIST_STRING;
+        data->length = strlen(data->strval);
+        return plist_new_node(data);
+    }
+
+    data = bplist_new_data(bplist);
     if (!data) {
         PLIST_BIN_ERR("%s: failed to allocate plist data\n", __func__);
         return NULL;
     }
 
     data->type = PLIST_STRING;
-    data->strval = (char *) malloc(sizeof(char) * (size + 1));
+    data->strval = (char *) bplist_alloc(bplist, data, sizeof(char) * (size + 1));
     if (!data->strval) {
         plist_free_data(data);
         PLIST_BIN_ERR("%s: Could not allocate %" PRIu64 " bytes\n", __func__, sizeof(char) * (size + 1));
@@ -380,111 +543,53 @@ static plist_t parse_string_node(const char **bnode, uint64_t size)
     data->strval[size] = '\0';
     data->length = strlen(data->strval);
 
-    return node_create(NULL, data);
-}
-
-static char *plist_utf16be_to_utf8(uint16_t *unistr, size_t len, size_t *items_read, size_t *items_written)
-{
-	if (!unistr || (len <= 0)) return NULL;
-	char* outbuf;
-	char* outbuf_new;
-	size_t p = 0;
-	size_t i = 0;
-
-	uint16_t wc;
-	uint32_t w;
-	int read_lead_surrogate = 0;
-
-	/* allocate with enough space */
-	outbuf = (char*)malloc(4*(len+1));
-	if (!outbuf) {
-		PLIST_BIN_ERR("%s: Could not allocate %" PRIu64 " bytes\n", __func__, (uint64_t)(4*(len+1)));
-		return NULL;
-	}
-
-	while (i < len) {
-		wc = UINT_TO_HOST(unistr + i, sizeof(wc));
-		i++;
-		if (wc >= 0xD800 && wc <= 0xDBFF) {
-			if (!read_lead_surrogate) {
-				read_lead_surrogate = 1;
-				w = 0x010000 + ((wc & 0x3FF) << 10);
-			} else {
-				// This is invalid, the next 16 bit char should be a trail surrogate.
-				// Handling error by skipping.
-				read_lead_surrogate = 0;
-			}
-		} else if (wc >= 0xDC00 && wc <= 0xDFFF) {
-			if (read_lead_surrogate) {
-				read_lead_surrogate = 0;
-				w = w | (wc & 0x3FF);
-				outbuf[p++] = (char)(0xF0 + ((w >> 18) & 0x7));
-				outbuf[p++] = (char)(0x80 + ((w >> 12) & 0x3F));
-				outbuf[p++] = (char)(0x80 + ((w >> 6) & 0x3F));
-				outbuf[p++] = (char)(0x80 + (w & 0x3F));
-			} else {
-				// This is invalid.  A trail surrogate should always follow a lead surrogate.
-				// Handling error by skipping
-			}
-		} else if (wc >= 0x800) {
-			outbuf[p++] = (char)(0xE0 + ((wc >> 12) & 0xF));
-			outbuf[p++] = (char)(0x80 + ((wc >> 6) & 0x3F));
-			outbuf[p++] = (char)(0x80 + (wc & 0x3F));
-		} else if (wc >= 0x80) {
-			outbuf[p++] = (char)(0xC0 + ((wc >> 6) & 0x1F));
-			outbuf[p++] = (char)(0x80 + (wc & 0x3F));
-		} else {
-			outbuf[p++] = (char)(wc & 0x7F);
-		}
-	}
-	if (items_read) {
-		*items_read = i;
-	}
-	if (items_written) {
-		*items_written = p;
-	}
-	outbuf[p] = 0;
-
-	/* reduce the size to the actual size */
-	outbuf_new = (char*)realloc(outbuf, p+1);
-	if (outbuf_new) {
-		outbuf = outbuf_new;
-	}
-
-	return outbuf;
-}
-
-static plist_t parse_unicode_node(const char **bnode, uint64_t size)
-{
-    plist_data_t data = plist_new_plist_data();
+    return bplist_new_node(bplist, data);
+}
+
+static plist_t parse_unicode_node(struct bplist_data *bplist, const char **bnode, uint64_t size)
+{
+    if (size == 0) {
+        PLIST_BIN_ERR("%s: empty BPLIST_UNICODE node\n", __func__);
+        return NULL;
+    }
+    plist_data_t data = bplist_new_data(bplist);
     if (!data) {
         PLIST_BIN_ERR("%s: failed to allocate plist data\n", __func__);
         return NULL;
     }
-    size_t items_read = 0;
-    size_t items_written = 0;
+    const unsigned char *units = (const unsigned char *)*bnode;
+    size_t len = utf16be_utf8_length(units, size);
 
     data->type = PLIST_STRING;
-    data->strval = plist_utf16be_to_utf8((uint16_t*)(*bnode), size, &items_read, &items_written);
+    data->strval = (char *) bplist_alloc(bplist, data, len + 1);
     if (!data->strval) {
         plist_free_data(data);
+        PLIST_BIN_ERR("%s: Could not allocate %" PRIu64 " bytes\n", __func__, (uint64_t)len + 1);
         return NULL;
     }
-    data->length = items_written;
+    utf16be_to_utf8(units, size, data->strval);
+    data->strval[len] = '\0';
+    data->length = len;
 
-    return node_create(NULL, data);
+    return bplist_new_node(bplist, data);
 }
 
-static plist_t parse_data_node(const char **bnode, uint64_t size)
+static plist_t parse_data_node(struct bplist_data *bplist, const char **bnode, uint64_t size)
 {
-    plist_data_t data = plist_new_plist_data();
+    plist_data_t data = bplist_new_data(bplist);
     if (!data) {
         PLIST_BIN_ERR("%s: failed to allocate plist data\n", __func__);
         return NULL;
     }
     data->type = PLIST_DATA;
     data->length = size;
-    data->buff = (uint8_t *) malloc(sizeof(uint8_t) * size);
+    if (bplist->nocopy) {
+        // the caller keeps the input buffer alive, so just point into it
+        data->buff = (uint8_t *) *bnode;
+        data->flags |= PLIST_DATA_FLAG_BORROWED;
+        return bplist_new_node(bplist, data);
+    }
+    data->buff = (uint8_t *) bplist_alloc(bplist, data, sizeof(uint8_t) * size);
     if (!data->buff) {
         plist_free_data(data);
         PLIST_BIN_ERR("%s: Could not allocate %" PRIu64 " bytes\n", __func__, sizeof(uint8_t) * size);
@@ -492,153 +597,488 @@ static plist_t parse_data_node(const char **bnode, uint64_t size)
     }
     memcpy(data->buff, *bnode, sizeof(uint8_t) * size);
 
-    return node_create(NULL, data);
+    return bplist_new_node(bplist, data);
 }
 
-static plist_t parse_dict_node(struct bplist_data *bplist, const char** bnode, uint64_t size)
+/* parse key and value of dict entry j */
+static plist_err_t parse_dict_entry(struct bplist_data *bplist, const char* refs, uint64_t size, uint64_t j, plist_t *key_out, plist_t *val_out)
 {
-    uint64_t j;
-    uint64_t str_i = 0, str_j = 0;
+    uint64_t str_i = j * bplist->ref_size;
+    uint64_t str_j = (j + size) * bplist->ref_size;
     uint64_t index1, index2;
-    plist_data_t data = plist_new_plist_data();
-    if (!data) {
-        PLIST_BIN_ERR("%s: failed to allocate plist data\n", __func__);
-        return NULL;
+    const char *index1_ptr = refs + str_i;
+    const char *index2_ptr = refs + str_j;
+
+    if ((index1_ptr < bplist->data || index1_ptr + bplist->ref_size > bplist->offset_table) ||
+        (index2_ptr < bplist->data || index2_ptr + bplist->ref_size > bplist->offset_table)) {
+        PLIST_BIN_ERR("%s: dict entry %" PRIu64 " is outside of valid range\n", __func__, j);
+        return PLIST_ERR_PARSE;
     }
-    const char *index1_ptr = NULL;
-    const char *index2_ptr = NULL;
 
-    data->type = PLIST_DICT;
-    data->length = size;
+    index1 = UINT_TO_HOST(index1_ptr, bplist->ref_size);
+    index2 = UINT_TO_HOST(index2_ptr, bplist->ref_size);
 
-    plist_t node = node_create(NULL, data);
-    if (!node) {
-        plist_free_data(data);
-        PLIST_BIN_ERR("%s: failed to create node\n", __func__);
-        return NULL;
+    if (index1 >= bplist->num_objects) {
+        PLIST_BIN_ERR("%s: dict entry %" PRIu64 ": key index (%" PRIu64 ") must be smaller than the number of objects (%" PRIu64 ")\n", __func__, j, index1, bplist->num_objects);
+        return PLIST_ERR_PARSE;
+    }
+    if (index2 >= bplist->num_objects) {
+        PLIST_BIN_ERR("%s: dict entry %" PRIu64 ": value index (%" PRIu64 ") must be smaller than the number of objects (%" PRIu64 ")\n", __func__, j, index1, bplist->num_objects);
+        return PLIST_ERR_PARSE;
     }
 
-    for (j = 0; j < data->length; j++) {
-        str_i = j * bplist->ref_size;
-        str_j = (j + size) * bplist->ref_size;
-        index1_ptr = (*bnode) + str_i;
-        index2_ptr = (*bnode) + str_j;
+    /* process key node */
+    bplist->parsing_key = 1;
+    plist_t key = parse_bin_node_at_index(bplist, index1);
+    bplist->parsing_key = 0;
+    if (!key) {
+        return PLIST_ERR_PARSE;
+    }
 
-        if ((index1_ptr < bplist->data || index1_ptr + bplist->ref_size > bplist->offset_table) ||
-            (index2_ptr < bplist->data || index2_ptr + bplist->ref_size > bplist->offset_table)) {
-            plist_free(node);
-            PLIST_BIN_ERR("%s: dict entry %" PRIu64 " is outside of valid range\n", __func__, j);
-            return NULL;
+    if (plist_get_data(key)->type != PLIST_STRING && plist_get_data(key)->type != PLIST_KEY) {
+        PLIST_BIN_ERR("%s: dict entry %" PRIu64 ": invalid node type for key\n", __func__, j);
+        plist_free(key);
+        return PLIST_ERR_PARSE;
+    }
+
+    if (bplist->keys && plist_get_data(key)->type == PLIST_STRING && plist_get_data(key)->strval) {
+        /* UTF-16 key, intern the converted string */
+        plist_data_t keydata = plist_get_data(key);
+        plist_data_t interned = plist_new_interned_key_data(bplist->keys, keydata->strval, keydata->length);
+        plist_free(key);
+        if (!interned) {
+            bplist->err = PLIST_ERR_NO_MEM;
+            return PLIST_ERR_NO_MEM;
         }
+        key = plist_new_node(interned);
+    }
 
-        index1 = UINT_TO_HOST(index1_ptr, bplist->ref_size);
-        index2 = UINT_TO_HOST(index2_ptr, bplist->ref_size);
+    /* enforce key type */
+    plist_get_data(key)->type = PLIST_KEY;
+    if (!plist_get_data(key)->strval) {
+        PLIST_BIN_ERR("%s: dict entry %" PRIu64 ": key must not be NULL\n", __func__, j);
+        plist_free(key);
+        return PLIST_ERR_PARSE;
+    }
+    if (!(plist_get_data(key)->flags & PLIST_DATA_FLAG_HASHED)) {
+        plist_key_data_set_hash(plist_get_data(key));
+    }
 
-        if (index1 >= bplist->num_objects) {
-            plist_free(node);
-            PLIST_BIN_ERR("%s: dict entry %" PRIu64 ": key index (%" PRIu64 ") must be smaller than the number of objects (%" PRIu64 ")\n", __func__, j, index1, bplist->num_objects);
-            return NULL;
+    /* process value node */
+    plist_t val = parse_bin_node_at_index(bplist, index2);
+    if (!val) {
+        plist_free(key);
+        return PLIST_ERR_PARSE;
+    }
+
+    *key_out = key;
+    *val_out = val;
+    return PLIST_ERR_SUCCESS;
+}
+
+/* parse array item j */
+static plist_err_t parse_array_item(struct bplist_data *bplist, const char* refs, uint64_t j, plist_t *val_out)
+{
+    uint64_t str_j = j * bplist->ref_size;
+    uint64_t index1;
+    const char *index1_ptr = refs + str_j;
+
+    if (index1_ptr < bplist->data || index1_ptr + bplist->ref_size > bplist->offset_table) {
+        PLIST_BIN_ERR("%s: array item %" PRIu64 " is outside of valid range\n", __func__, j);
+        return PLIST_ERR_PARSE;
+    }
+
+    index1 = UINT_TO_HOST(index1_ptr, bplist->ref_size);
+
+    if (index1 >= bplist->num_objects) {
+        PLIST_BIN_ERR("%s: array item %" PRIu64 " object index (%" PRIu64 ") must be smaller than the number of objects (%" PRIu64 ")\n", __func__, j, index1, bplist->num_objects);
+        return PLIST_ERR_PARSE;
+    }
+
+    /* process value node */
+    plist_t val = parse_bin_node_at_index(bplist, index1);
+    if (!val) {
+        return PLIST_ERR_PARSE;
+    }
+
+    *val_out = val;
+    return PLIST_ERR_SUCCESS;
+}
+
+/*
+ * Parallel parsing. The offset table gives direct access to every object,
+ * so the children of a container decode independently of each other.
+ * Large containers are split into small batches of children that worker
+ * threads (and the calling thread) claim from a shared counter until none
+ * are left, so threads that finish early pick up the remaining work. Each
+ * thread decodes with its own copy of the parser state: the containers
+ * above are marked in its own visiting bitmap and its depth starts below
+ * them, which keeps the circular reference and nesting depth checks
+ * exactly as they are in a serial parse, and it interns keys into its own
+ * table. The results are
+ * stored per child and attached in order once all threads are done.
+ */
+#define BPLIST_PARSE_MIN_OBJECTS 65536
+#define BPLIST_PARSE_MIN_CHILDREN 1024
+#define BPLIST_PARSE_MIN_CHILDREN_PER_THREAD 256
+#define BPLIST_PARSE_BATCHES_PER_THREAD 16
+
+#ifdef WIN32
+#define parse_counter_next(c, n) ((uint64_t)InterlockedExchangeAdd64((volatile LONG64*)(c), (LONG64)(n)))
+#define parse_flag_get(f) InterlockedCompareExchange((volatile LONG*)(f), 0, 0)
+#define parse_flag_set(f) InterlockedExchange((volatile LONG*)(f), 1)
+#else
+#define parse_counter_next(c, n) __atomic_fetch_add((c), (n), __ATOMIC_RELAXED)
+#define parse_flag_get(f) __atomic_load_n((f), __ATOMIC_RELAXED)
+#define parse_flag_set(f) __atomic_store_n((f), 1, __ATOMIC_RELAXED)
+#endif
+
+struct parse_job {
+    struct bplist_data *parent;
+    plist_type type;
+    const char* refs;
+    uint64_t size;
+    uint64_t batch;
+    uint64_t num_batches;
+    uint64_t next_batch;
+    int failed;
+    /* children in order; keys and values alternate for dicts */
+    plist_t *items;
+    /* error of every batch, PLIST_ERR_SUCCESS if not failed */
+    plist_err_t *errors;
+};
+
+struct parse_worker {
+    struct parse_job *job;
+    THREAD_T thread;
+    int running;
+};
+
+static plist_err_t parse_bin_stack(struct bplist_data *bplist, uint32_t base);
+
+static void* parse_worker_run(void *arg)
+{
+    struct parse_job *job = ((struct parse_worker*)arg)->job;
+    struct bplist_data *parent = job->parent;
+    struct bplist_data bplist = *parent;
+    uint32_t i;
+
+    bplist.keys = NULL;
+    bplist.parsing_key = 0;
+    bplist.threads = 1;
+    bplist.arena_dicts = NULL;
+    bplist.err = PLIST_ERR_SUCCESS;
+    bplist.level = parent->level + parent->stack_len;
+    bplist.stack = NULL;
+    bplist.stack_len = 0;
+    bplist.stack_cap = 0;
+    bplist.visiting = (uint8_t*)calloc(1, VISITING_SIZE(bplist.num_objects));
+    if (parent->keys) {
+        bplist.keys = plist_key_table_new();
+    }
+    if (!bplist.visiting || (parent->keys && !bplist.keys)) {
+        free(bplist.visiting);
+        plist_key_table_free(bplist.keys);
+        parse_flag_set(&job->failed);
+        return NULL;
+    }
+    /* the containers above, the current one included */
+    for (i = 0; i < parent->stack_len; i++) {
+        visiting_set(bplist.visiting, parent->stack[i].node_index);
+    }
+
+    while (!parse_flag_get(&job->failed)) {
+        uint64_t b = parse_counter_next(&job->next_batch, 1);
+        uint64_t j, last;
+        if (b >= job->num_batches) {
+            break;
         }
-        if (index2 >= bplist->num_objects) {
-            plist_free(node);
-            PLIST_BIN_ERR("%s: dict entry %" PRIu64 ": value index (%" PRIu64 ") must be smaller than the number of objects (%" PRIu64 ")\n", __func__, j, index1, bplist->num_objects);
-            return NULL;
+        last = (b + 1) * job->batch;
+        if (last > job->size) {
+            last = job->size;
+        }
+        for (j = b * job->batch; j < last; j++) {
+            plist_err_t err;
+            if (job->type == PLIST_DICT) {
+                err = parse_dict_entry(&bplist, job->refs, job->size, j, &job->items[j*2], &job->items[j*2+1]);
+            } else {
+                err = parse_array_item(&bplist, job->refs, j, &job->items[j]);
+            }
+            if (err == PLIST_ERR_SUCCESS) {
+                err = parse_bin_stack(&bplist, 0);
+            }
+            if (err != PLIST_ERR_SUCCESS) {
+                job->errors[b] = (bplist.err != PLIST_ERR_SUCCESS) ? bplist.err : err;
+                bplist.err = PLIST_ERR_SUCCESS;
+                parse_flag_set(&job->failed);
+                break;
+            }
         }
+    }
 
-        /* process key node */
-        plist_t key = parse_bin_node_at_index(bplist, index1);
-        if (!key) {
-            plist_free(node);
-            return NULL;
+    free(bplist.stack);
+    free(bplist.visiting);
+    plist_key_table_free(bplist.keys);
+    return NULL;
+}
+
+static plist_err_t parse_children_parallel(struct bplist_data *bplist, plist_t node, const char* refs, uint64_t size, plist_type type, unsigned int num_threads)
+{
+    struct parse_worker workers[BPLIST_MAX_THREADS];
+    struct parse_job job;
+    uint64_t num_items = (type == PLIST_DICT) ? size * 2 : size;
+    plist_err_t err = PLIST_ERR_SUCCESS;
+    uint64_t j;
+    unsigned int t;
+
+    memset(&job, '\0', sizeof(job));
+    job.parent = bplist;
+    job.type = type;
+    job.refs = refs;
+    job.size = size;
+    job.batch = size / (num_threads * BPLIST_PARSE_BATCHES_PER_THREAD);
+    if (job.batch == 0) {
+        job.batch = 1;
+    }
+    job.num_batches = (size + job.batch - 1) / job.batch;
+    job.items = (plist_t*)calloc(num_items, sizeof(plist_t));
+    job.errors = (plist_err_t*)calloc(job.num_batches, sizeof(plist_err_t));
+    if (!job.items || !job.errors) {
+        free(job.items);
+        free(job.errors);
+        bplist->err = PLIST_ERR_NO_MEM;
+        return PLIST_ERR_NO_MEM;
+    }
+
+    memset(workers, '\0', sizeof(workers));
+    for (t = 0; t < num_threads; t++) {
+        workers[t].job = &job;
+        if (t > 0) {
+            workers[t].running = (thread_new(&workers[t].thread, parse_worker_run, &workers[t]) == 0);
         }
+    }
+    /* the calling thread works along */
+    parse_worker_run(&workers[0]);
+    for (t = 1; t < num_threads; t++) {
+        if (workers[t].running) {
+            thread_join(workers[t].thread);
+        }
+    }
 
-        if (plist_get_data(key)->type != PLIST_STRING) {
-            PLIST_BIN_ERR("%s: dict entry %" PRIu64 ": invalid node type for key\n", __func__, j);
-            plist_free(key);
-            plist_free(node);
-            return NULL;
+    if (job.failed) {
+        /* batches are claimed in order, so the first failed batch has the
+         * error a serial parse would have run into */
+        err = PLIST_ERR_NO_MEM;
+        for (j = 0; j < job.num_batches; j++) {
+            if (job.errors[j] != PLIST_ERR_SUCCESS) {
+                err = job.errors[j];
+                break;
+            }
+        }
+        for (j = 0; j < num_items; j++) {
+            plist_free(job.items[j]);
         }
+        bplist->err = err;
+    } else {
+        node_reserve_children((node_t)node, (unsigned int)num_items);
+        for (j = 0; j < num_items; j++) {
+            node_attach_unchecked((node_t)node, (node_t)job.items[j]);
+        }
+    }
 
-        /* enforce key type */
-        plist_get_data(key)->type = PLIST_KEY;
-        if (!plist_get_data(key)->strval) {
-            PLIST_BIN_ERR("%s: dict entry %" PRIu64 ": key must not be NULL\n", __func__, j);
-            plist_free(key);
-            plist_free(node);
-            return NULL;
+    free(job.items);
+    free(job.errors);
+    return err;
+}
+
+/* number of threads to decode a container with size children with */
+static unsigned int bplist_parse_threads(struct bplist_data *bplist, uint64_t size)
+{
+    uint64_t max_threads = size / BPLIST_PARSE_MIN_CHILDREN_PER_THREAD;
+    unsigned int num_threads = bplist->threads;
+    if (num_threads <= 1 || size < BPLIST_PARSE_MIN_CHILDREN || bplist->num_objects < BPLIST_PARSE_MIN_OBJECTS) {
+        return 1;
+    }
+    if (num_threads > max_threads) {
+        num_threads = (unsigned int)max_threads;
+    }
+    return num_threads;
+}
+
+/* gives a dict its hash index once all of its entries are decoded. Arena
+ * nodes can only be tracked once the arena root is set, so those dicts are
+ * indexed at the end of the parse. */
+static void bplist_index_dict(struct bplist_data *bplist, plist_t node)
+{
+    if (((node_t)node)->count <= PLIST_DICT_HASH_THRESHOLD) {
+        return;
+    }
+    if (bplist->arena) {
+        if (!bplist->arena_dicts) {
+            bplist->arena_dicts = ptr_array_new(16);
+        }
+        if (bplist->arena_dicts) {
+            ptr_array_add(bplist->arena_dicts, node);
         }
+    } else {
+        plist_dict_index_parsed(node);
+    }
+}
 
-        /* process value node */
-        plist_t val = parse_bin_node_at_index(bplist, index2);
-        if (!val) {
-            plist_free(key);
-            plist_free(node);
-            return NULL;
+/*
+ * Decodes the children of all containers pushed onto the stack above
+ * base, depth first and in order, without recursion. A child container is
+ * attached to its parent right away and pushed in turn; a container is
+ * popped once all of its children are decoded. On error the containers are
+ * left partially filled, to be freed with the tree they are attached to.
+ */
+static plist_err_t parse_bin_stack(struct bplist_data *bplist, uint32_t base)
+{
+    plist_err_t err = PLIST_ERR_SUCCESS;
+
+    while (bplist->stack_len > base) {
+        struct bplist_frame *frame = &bplist->stack[bplist->stack_len-1];
+        node_t node = (node_t)frame->node;
+        uint64_t j;
+
+        if (frame->next >= frame->size) {
+            if (frame->type == PLIST_DICT) {
+                bplist_index_dict(bplist, frame->node);
+            }
+            visiting_clear(bplist->visiting, frame->node_index);
+            bplist->stack_len--;
+            continue;
+        }
+
+        if (frame->next == 0) {
+            unsigned int num_threads = bplist_parse_threads(bplist, frame->size);
+            if (num_threads > 1) {
+                frame->next = frame->size;
+                err = parse_children_parallel(bplist, frame->node, frame->refs, frame->size, frame->type, num_threads);
+                if (err != PLIST_ERR_SUCCESS) {
+                    break;
+                }
+                continue;
+            }
+        }
+
+        /* the frame might move when a child container is pushed */
+        j = frame->next++;
+        if (frame->type == PLIST_DICT) {
+            plist_t key = NULL;
+            plist_t val = NULL;
+            err = parse_dict_entry(bplist, frame->refs, frame->size, j, &key, &val);
+            if (err != PLIST_ERR_SUCCESS) {
+                break;
+            }
+            node_attach_unchecked(node, (node_t)key);
+            node_attach_unchecked(node, (node_t)val);
+        } else {
+            plist_t val = NULL;
+            err = parse_array_item(bplist, frame->refs, j, &val);
+            if (err != PLIST_ERR_SUCCESS) {
+                break;
+            }
+            node_attach_unchecked(node, (node_t)val);
         }
+    }
 
-        node_attach((node_t)node, (node_t)key);
-        node_attach((node_t)node, (node_t)val);
+    if (err != PLIST_ERR_SUCCESS) {
+        while (bplist->stack_len > base) {
+            visiting_clear(bplist->visiting, bplist->stack[bplist->stack_len-1].node_index);
+            bplist->stack_len--;
+        }
     }
 
+    return err;
+}
+
+/* decodes the object at node_index including everything below it */
+static plist_t parse_bin_tree(struct bplist_data *bplist, uint64_t node_index)
+{
+    uint32_t base = bplist->stack_len;
+    plist_t node = parse_bin_node_at_index(bplist, node_index);
+    if (node && parse_bin_stack(bplist, base) != PLIST_ERR_SUCCESS) {
+        plist_free(node);
+        return NULL;
+    }
     return node;
 }
 
-static plist_t parse_array_node(struct bplist_data *bplist, const char** bnode, uint64_t size)
+static int bplist_push_frame(struct bplist_data *bplist, plist_t node, const char* refs, uint64_t size, plist_type type)
 {
-    uint64_t j;
-    uint64_t str_j = 0;
-    uint64_t index1;
-    plist_data_t data = plist_new_plist_data();
+    struct bplist_frame *frame;
+    if (bplist->stack_len == bplist->stack_cap) {
+        uint32_t cap = (bplist->stack_cap) ? bplist->stack_cap * 2 : 16;
+        struct bplist_frame *stack = (struct bplist_frame*)realloc(bplist->stack, cap * sizeof(struct bplist_frame));
+        if (!stack) {
+            PLIST_BIN_ERR("%s: failed to grow the parse stack\n", __func__);
+            bplist->err = PLIST_ERR_NO_MEM;
+            return -1;
+        }
+        bplist->stack = stack;
+        bplist->stack_cap = cap;
+    }
+
+    /* size the child list upfront if all refs are in range */
+    uint64_t refs_per_child = (type == PLIST_DICT) ? 2 : 1;
+    if (!bplist->arena && refs <= bplist->offset_table && size <= (uint64_t)(bplist->offset_table - refs) / (refs_per_child * bplist->ref_size)) {
+        node_reserve_children((node_t)node, (unsigned int)(size * refs_per_child));
+    }
+
+    frame = &bplist->stack[bplist->stack_len++];
+    frame->node = node;
+    frame->refs = refs;
+    frame->size = size;
+    frame->next = 0;
+    frame->node_index = bplist->cur_index;
+    frame->type = type;
+    visiting_set(bplist->visiting, frame->node_index);
+    return 0;
+}
+
+static plist_t parse_container_node(struct bplist_data *bplist, const char** bnode, uint64_t size, plist_type type)
+{
+    plist_data_t data = bplist_new_data(bplist);
     if (!data) {
         PLIST_BIN_ERR("%s: failed to allocate plist data\n", __func__);
         return NULL;
     }
-    const char *index1_ptr = NULL;
 
-    data->type = PLIST_ARRAY;
+    data->type = type;
     data->length = size;
 
-    plist_t node = node_create(NULL, data);
+    plist_t node = bplist_new_node(bplist, data);
     if (!node) {
         plist_free_data(data);
         PLIST_BIN_ERR("%s: failed to create node\n", __func__);
         return NULL;
     }
 
-    for (j = 0; j < data->length; j++) {
-        str_j = j * bplist->ref_size;
-        index1_ptr = (*bnode) + str_j;
-
-        if (index1_ptr < bplist->data || index1_ptr + bplist->ref_size > bplist->offset_table) {
-            plist_free(node);
-            PLIST_BIN_ERR("%s: array item %" PRIu64 " is outside of valid range\n", __func__, j);
-            return NULL;
-        }
-
-        index1 = UINT_TO_HOST(index1_ptr, bplist->ref_size);
-
-        if (index1 >= bplist->num_objects) {
+    if (bplist->lazy && size > 0) {
+        /* children are decoded on first access */
+        if (bplist_lazy_attach(bplist, node, *bnode, size) < 0) {
             plist_free(node);
-            PLIST_BIN_ERR("%s: array item %" PRIu64 " object index (%" PRIu64 ") must be smaller than the number of objects (%" PRIu64 ")\n", __func__, j, index1, bplist->num_objects);
             return NULL;
         }
+        return node;
+    }
 
-        /* process value node */
-        plist_t val = parse_bin_node_at_index(bplist, index1);
-        if (!val) {
+    /* a container as key is rejected by the caller, do not descend */
+    if (size > 0 && !bplist->parsing_key) {
+        /* children are decoded by parse_bin_stack() */
+        if (bplist_push_frame(bplist, node, *bnode, size, type) < 0) {
             plist_free(node);
             return NULL;
         }
-
-        node_attach((node_t)node, (node_t)val);
     }
 
     return node;
 }
 
-static plist_t parse_uid_node(const char **bnode, uint8_t size)
+static plist_t parse_uid_node(struct bplist_data *bplist, const char **bnode, uint8_t size)
 {
-    plist_data_t data = plist_new_plist_data();
+    plist_data_t data = bplist_new_data(bplist);
     if (!data) {
         PLIST_BIN_ERR("%s: failed to allocate plist data\n", __func__);
         return NULL;
@@ -647,7 +1087,7 @@ static plist_t parse_uid_node(const char **bnode, uint8_t size)
     data->intval = UINT_TO_HOST(*bnode, size);
     if (data->intval > UINT32_MAX) {
         PLIST_BIN_ERR("%s: value %" PRIu64 " too large for UID node (must be <= %u)\n", __func__, (uint64_t)data->intval, UINT32_MAX);
-        free(data);
+        plist_free_data(data);
         return NULL;
     }
 
@@ -655,21 +1095,14 @@ static plist_t parse_uid_node(const char **bnode, uint8_t size)
     data->type = PLIST_UID;
     data->length = sizeof(uint64_t);
 
-    return node_create(NULL, data);
+    return bplist_new_node(bplist, data);
 }
 
-static plist_t parse_bin_node(struct bplist_data *bplist, const char** object)
+/* reads the marker byte of an object and the length that may follow it */
+static int parse_bin_object_header(struct bplist_data *bplist, const char** object, uint16_t *type_out, uint64_t *size_out)
 {
-    uint16_t type = 0;
-    uint64_t size = 0;
-    uint64_t pobject = 0;
-    uint64_t poffset_table = (uint64_t)(uintptr_t)bplist->offset_table;
-
-    if (!object)
-        return NULL;
-
-    type = (**object) & BPLIST_MASK;
-    size = (**object) & BPLIST_FILL;
+    uint16_t type = (**object) & BPLIST_MASK;
+    uint64_t size = (**object) & BPLIST_FILL;
     (*object)++;
 
     if (size == BPLIST_FILL) {
@@ -684,13 +1117,13 @@ static plist_t parse_bin_node(struct bplist_data *bplist, const char** object)
             uint16_t next_size = **object & BPLIST_FILL;
             if ((**object & BPLIST_MASK) != BPLIST_INT) {
                 PLIST_BIN_ERR("%s: invalid size node type for node type 0x%02x: found 0x%02x, expected 0x%02x\n", __func__, type, **object & BPLIST_MASK, BPLIST_INT);
-                return NULL;
+                return -1;
             }
             (*object)++;
             next_size = 1 << next_size;
             if (*object + next_size > bplist->offset_table) {
                 PLIST_BIN_ERR("%s: size node data bytes for node type 0x%02x point outside of valid range\n", __func__, type);
-                return NULL;
+                return -1;
             }
             size = UINT_TO_HOST(*object, next_size);
             (*object) += next_size;
@@ -701,6 +1134,25 @@ static plist_t parse_bin_node(struct bplist_data *bplist, const char** object)
         }
     }
 
+    *type_out = type;
+    *size_out = size;
+    return 0;
+}
+
+static plist_t parse_bin_node(struct bplist_data *bplist, const char** object)
+{
+    uint16_t type = 0;
+    uint64_t size = 0;
+    uint64_t pobject = 0;
+    uint64_t poffset_table = (uint64_t)(uintptr_t)bplist->offset_table;
+
+    if (!object)
+        return NULL;
+
+    if (parse_bin_object_header(bplist, object, &type, &size) < 0) {
+        return NULL;
+    }
+
     pobject = (uint64_t)(uintptr_t)*object;
 
     switch (type)
@@ -712,7 +1164,7 @@ static plist_t parse_bin_node(struct bplist_data *bplist, const char** object)
 
         case BPLIST_TRUE:
         {
-            plist_data_t data = plist_new_plist_data();
+            plist_data_t data = bplist_new_data(bplist);
             if (!data) {
                 PLIST_BIN_ERR("%s: failed to allocate plist data\n", __func__);
                 return NULL;
@@ -720,12 +1172,12 @@ static plist_t parse_bin_node(struct bplist_data *bplist, const char** object)
             data->type = PLIST_BOOLEAN;
             data->boolval = TRUE;
             data->length = 1;
-            return node_create(NULL, data);
+            return bplist_new_node(bplist, data);
         }
 
         case BPLIST_FALSE:
         {
-            plist_data_t data = plist_new_plist_data();
+            plist_data_t data = bplist_new_data(bplist);
             if (!data) {
                 PLIST_BIN_ERR("%s: failed to allocate plist data\n", __func__);
                 return NULL;
@@ -733,19 +1185,19 @@ static plist_t parse_bin_node(struct bplist_data *bplist, const char** object)
             data->type = PLIST_BOOLEAN;
             data->boolval = FALSE;
             data->length = 1;
-            return node_create(NULL, data);
+            return bplist_new_node(bplist, data);
         }
 
         case BPLIST_NULL:
         {
-            plist_data_t data = plist_new_plist_data();
+            plist_data_t data = bplist_new_data(bplist);
             if (!data) {
                 PLIST_BIN_ERR("%s: failed to allocate plist data\n", __func__);
                 return NULL;
             }
             data->type = PLIST_NULL;
             data->length = 0;
-            return node_create(NULL, data);
+            return bplist_new_node(bplist, data);
         }
 
         default:
@@ -757,14 +1209,14 @@ static plist_t parse_bin_node(struct bplist_data *bplist, const char** object)
             PLIST_BIN_ERR("%s: BPLIST_INT data bytes point outside of valid range\n", __func__);
             return NULL;
         }
-        return parse_int_node(object, size);
+        return parse_int_node(bplist, object, size);
 
     case BPLIST_REAL:
         if (pobject + (uint64_t)(1 << size) > poffset_table) {
             PLIST_BIN_ERR("%s: BPLIST_REAL data bytes point outside of valid range\n", __func__);
             return NULL;
         }
-        return parse_real_node(object, size);
+        return parse_real_node(bplist, object, size);
 
     case BPLIST_DATE:
         if (3 != size) {
@@ -775,21 +1227,21 @@ static plist_t parse_bin_node(struct bplist_data *bplist, const char** object)
             PLIST_BIN_ERR("%s: BPLIST_DATE data bytes point outside of valid range\n", __func__);
             return NULL;
         }
-        return parse_date_node(object, size);
+        return parse_date_node(bplist, object, size);
 
     case BPLIST_DATA:
         if (pobject + size < pobject || pobject + size > poffset_table) {
             PLIST_BIN_ERR("%s: BPLIST_DATA data bytes point outside of valid range\n", __func__);
             return NULL;
         }
-        return parse_data_node(object, size);
+        return parse_data_node(bplist, object, size);
 
     case BPLIST_STRING:
         if (pobject + size < pobject || pobject + size > poffset_table) {
             PLIST_BIN_ERR("%s: BPLIST_STRING data bytes point outside of valid range\n", __func__);
             return NULL;
         }
-        return parse_string_node(object, size);
+        return parse_string_node(bplist, object, size);
 
     case BPLIST_UNICODE:
         if (size*2 < size) {
@@ -800,7 +1252,7 @@ static plist_t parse_bin_node(struct bplist_data *bplist, const char** object)
             PLIST_BIN_ERR("%s: BPLIST_UNICODE data bytes point outside of valid range\n", __func__);
             return NULL;
         }
-        return parse_unicode_node(object, size);
+        return parse_unicode_node(bplist, object, size);
 
     case BPLIST_SET:
     case BPLIST_ARRAY:
@@ -808,21 +1260,21 @@ static plist_t parse_bin_node(struct bplist_data *bplist, const char** object)
             PLIST_BIN_ERR("%s: BPLIST_ARRAY data bytes point outside of valid range\n", __func__);
             return NULL;
         }
-        return parse_array_node(bplist, object, size);
+        return parse_container_node(bplist, object, size, PLIST_ARRAY);
 
     case BPLIST_UID:
         if (pobject + size+1 > poffset_table) {
             PLIST_BIN_ERR("%s: BPLIST_UID data bytes point outside of valid range\n", __func__);
             return NULL;
         }
-        return parse_uid_node(object, size);
+        return parse_uid_node(bplist, object, size);
 
     case BPLIST_DICT:
         if (pobject + size < pobject || pobject + size > poffset_table) {
             PLIST_BIN_ERR("%s: BPLIST_DICT data bytes point outside of valid range\n", __func__);
             return NULL;
         }
-        return parse_dict_node(bplist, object, size);
+        return parse_container_node(bplist, object, size, PLIST_DICT);
 
     default:
         PLIST_BIN_ERR("%s: unexpected node type 0x%02x\n", __func__, type);
@@ -831,78 +1283,152 @@ static plist_t parse_bin_node(struct bplist_data *bplist, const char** object)
     return NULL;
 }
 
-static plist_t parse_bin_node_at_index(struct bplist_data *bplist, uint32_t node_index)
+/* looks up the start of an object in the offset table, NULL if invalid */
+static const char* bplist_object_ptr(struct bplist_data *bplist, uint64_t node_index)
 {
-    int i = 0;
     const char* ptr = NULL;
-    plist_t plist = NULL;
-    const char* idx_ptr = NULL;
-
-    if (node_index >= bplist->num_objects) {
-        PLIST_BIN_ERR("node index (%u) must be smaller than the number of objects (%" PRIu64 ")\n", node_index, bplist->num_objects);
-        bplist->err = PLIST_ERR_PARSE;
-        return NULL;
-    }
+    const char* idx_ptr = bplist->offset_table + node_index * bplist->offset_size;
 
-    idx_ptr = bplist->offset_table + node_index * bplist->offset_size;
     if (idx_ptr < bplist->offset_table ||
         idx_ptr >= bplist->offset_table + bplist->num_objects * bplist->offset_size) {
-        PLIST_BIN_ERR("node index %u points outside of valid range\n", node_index);
-        bplist->err = PLIST_ERR_PARSE;
+        PLIST_BIN_ERR("node index %" PRIu64 " points outside of valid range\n", node_index);
         return NULL;
     }
 
     uint64_t node_offset = UINT_TO_HOST(idx_ptr, bplist->offset_size);
     if (node_offset > (uint64_t)bplist->size) {
         PLIST_BIN_ERR("node offset overflow (%llu)\n", node_offset);
-        bplist->err = PLIST_ERR_PARSE;
         return NULL;
     }
     ptr = bplist->data + node_offset;
     /* make sure the node offset is in a sane range */
     if ((ptr < bplist->data+BPLIST_MAGIC_SIZE+BPLIST_VERSION_SIZE) || (ptr >= bplist->offset_table)) {
-        PLIST_BIN_ERR("offset for node index %u points outside of valid range\n", node_index);
+        PLIST_BIN_ERR("offset for node index %" PRIu64 " points outside of valid range\n", node_index);
+        return NULL;
+    }
+    return ptr;
+}
+
+static plist_t parse_bin_node_at_index(struct bplist_data *bplist, uint64_t node_index)
+{
+    const char* ptr = NULL;
+    plist_t plist = NULL;
+
+    if (node_index >= bplist->num_objects) {
+        PLIST_BIN_ERR("node index (%" PRIu64 ") must be smaller than the number of objects (%" PRIu64 ")\n", node_index, bplist->num_objects);
+        bplist->err = PLIST_ERR_PARSE;
+        return NULL;
+    }
+
+    ptr = bplist_object_ptr(bplist, node_index);
+    if (!ptr) {
         bplist->err = PLIST_ERR_PARSE;
         return NULL;
     }
 
     /* check nesting depth */
-    if (bplist->level > PLIST_MAX_NESTING_DEPTH) {
+    if (bplist->level + bplist->stack_len > PLIST_MAX_NESTING_DEPTH) {
         PLIST_BIN_ERR("maximum nesting depth (%u) exceeded\n",(unsigned)PLIST_MAX_NESTING_DEPTH);
         bplist->err = PLIST_ERR_MAX_NESTING;
         return NULL;
     }
 
-    /* store node_index for current recursion level */
-    if ((uint32_t)ptr_array_size(bplist->used_indexes) < bplist->level+1) {
-        while ((uint32_t)ptr_array_size(bplist->used_indexes) < bplist->level+1) {
-            ptr_array_add(bplist->used_indexes, (void*)(uintptr_t)node_index);
-        }
-    } else {
-	ptr_array_set(bplist->used_indexes, (void*)(uintptr_t)node_index, bplist->level);
-    }
-
     /* recursion check */
-    if (bplist->level > 0) {
-        for (i = bplist->level-1; i >= 0; i--) {
-            void *node_i = ptr_array_index(bplist->used_indexes, i);
-            void *node_level = ptr_array_index(bplist->used_indexes, bplist->level);
-            if (node_i == node_level) {
-                PLIST_BIN_ERR("recursion detected in binary plist\n");
-                bplist->err = PLIST_ERR_CIRCULAR_REF;
-                return NULL;
-            }
-        }
+    if (visiting_get(bplist->visiting, node_index)) {
+        PLIST_BIN_ERR("recursion detected in binary plist\n");
+        bplist->err = PLIST_ERR_CIRCULAR_REF;
+        return NULL;
     }
 
     /* finally parse node */
-    bplist->level++;
+    bplist->cur_index = node_index;
     plist = parse_bin_node(bplist, &ptr);
-    bplist->level--;
     return plist;
 }
 
+plist_err_t plist_bin_lazy_expand(plist_t node)
+{
+    plist_data_t data = plist_get_data(node);
+    struct bplist_lazy *lazy = (struct bplist_lazy*)data->hashtable;
+    struct bplist_lazy_ctx *ctx = lazy->ctx;
+    struct bplist_lazy_path *path = NULL;
+    plist_err_t err = PLIST_ERR_SUCCESS;
+
+    data->hashtable = NULL;
+    data->flags &= ~PLIST_DATA_FLAG_LAZY;
+
+    struct bplist_data bplist;
+    bplist.data = ctx->data;
+    bplist.size = ctx->size;
+    bplist.num_objects = ctx->num_objects;
+    bplist.ref_size = ctx->ref_size;
+    bplist.offset_size = ctx->offset_size;
+    bplist.offset_table = ctx->offset_table;
+    bplist.level = lazy->path->level;
+    bplist.stack = NULL;
+    bplist.stack_len = 0;
+    bplist.stack_cap = 0;
+    bplist.visiting = ctx->visiting;
+    bplist.cur_index = lazy->path->node_index;
+    bplist.arena = NULL;
+    bplist.lazy = ctx;
+    bplist.lazy_path = lazy->path;
+    bplist.nocopy = ctx->nocopy;
+    bplist.keys = NULL;
+    bplist.parsing_key = 0;
+    bplist.threads = 1;
+    bplist.arena_dicts = NULL;
+    bplist.err = PLIST_ERR_SUCCESS;
+
+    /* mark the containers above as being decoded; this node is marked
+     * when it is pushed. Children are lazy again, so nothing deeper is
+     * pushed and the stack only ever holds this node. */
+    for (path = lazy->path->parent; path; path = path->parent) {
+        visiting_set(bplist.visiting, path->node_index);
+    }
+    if (bplist_push_frame(&bplist, node, lazy->refs, lazy->size, (plist_type)data->type) < 0) {
+        err = bplist.err;
+    } else {
+        err = parse_bin_stack(&bplist, 0);
+        if (err != PLIST_ERR_SUCCESS && bplist.err != PLIST_ERR_SUCCESS) {
+            err = bplist.err;
+        }
+    }
+    for (path = lazy->path->parent; path; path = path->parent) {
+        visiting_clear(bplist.visiting, path->node_index);
+    }
+    free(bplist.stack);
+
+    if (err != PLIST_ERR_SUCCESS) {
+        /* leave an empty container behind */
+        node_t ch;
+        while ((ch = node_first_child((node_t)node))) {
+            plist_free(ch);
+        }
+    }
+
+    plist_bin_lazy_free(lazy);
+
+    return err;
+}
+
 plist_err_t plist_from_bin(const char *plist_bin, uint32_t length, plist_t * plist)
+{
+    return plist_from_bin_with_options(plist_bin, length, plist, PLIST_PARSE_NONE);
+}
+
+plist_err_t plist_from_bin64(const char *plist_bin, uint64_t length, plist_t * plist)
+{
+    return plist_from_bin_with_options(plist_bin, length, plist, PLIST_PARSE_NONE);
+}
+
+plist_err_t plist_from_bin_with_options(const char *plist_bin, uint64_t length, plist_t * plist, plist_parse_options_t options)
+{
+    return plist_from_bin_ex(plist_bin, length, plist, options, 1);
+}
+
+/* checks the header and trailer and fills in the layout of the objects */
+static plist_err_t parse_bin_trailer(const char *plist_bin, uint64_t length, struct bplist_data *bplist, uint64_t *root_object_out, uint64_t *err_offset)
 {
     bplist_trailer_t *trailer = NULL;
     uint8_t offset_size = 0;
@@ -914,13 +1440,7 @@ plist_err_t plist_from_bin(const char *plist_bin, uint32_t length, plist_t * pli
     const char *start_data = NULL;
     const char *end_data = NULL;
 
-    if (!plist) {
-        return PLIST_ERR_INVALID_ARG;
-    }
-    *plist = NULL;
-    if (!plist_bin || length == 0) {
-        return PLIST_ERR_INVALID_ARG;
-    }
+    *err_offset = 0;
 
     //first check we have enough data
     if (!(length >= BPLIST_MAGIC_SIZE + BPLIST_VERSION_SIZE + sizeof(bplist_trailer_t))) {
@@ -943,6 +1463,7 @@ plist_err_t plist_from_bin(const char *plist_bin, uint32_t length, plist_t * pli
 
     //now parse trailer
     trailer = (bplist_trailer_t*)end_data;
+    *err_offset = (uint64_t)(end_data - plist_bin);
 
     offset_size = trailer->offset_size;
     ref_size = trailer->ref_size;
@@ -992,25 +1513,130 @@ plist_err_t plist_from_bin(const char *plist_bin, uint32_t length, plist_t * pli
         return PLIST_ERR_PARSE;
     }
 
+    bplist->data = plist_bin;
+    bplist->size = length;
+    bplist->num_objects = num_objects;
+    bplist->ref_size = ref_size;
+    bplist->offset_size = offset_size;
+    bplist->offset_table = offset_table;
+    *root_object_out = root_object;
+    *err_offset = 0;
+    return PLIST_ERR_SUCCESS;
+}
+
+plist_err_t plist_from_bin_ex(const char *plist_bin, uint64_t length, plist_t * plist, plist_parse_options_t options, unsigned int num_threads)
+{
     struct bplist_data bplist;
-    bplist.data = plist_bin;
-    bplist.size = length;
-    bplist.num_objects = num_objects;
-    bplist.ref_size = ref_size;
-    bplist.offset_size = offset_size;
-    bplist.offset_table = offset_table;
+    uint64_t root_object = 0;
+    uint64_t err_offset = 0;
+    plist_err_t err;
+
+    if (!plist) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+    *plist = NULL;
+    if (!plist_bin || length == 0) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+
+    err = parse_bin_trailer(plist_bin, length, &bplist, &root_object, &err_offset);
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
+    }
+
     bplist.level = 0;
-    bplist.used_indexes = ptr_array_new(16);
+    bplist.stack = NULL;
+    bplist.stack_len = 0;
+    bplist.stack_cap = 0;
+    bplist.visiting = (uint8_t*)calloc(1, VISITING_SIZE(bplist.num_objects));
+    bplist.cur_index = 0;
+    bplist.arena = NULL;
+    bplist.lazy = NULL;
+    bplist.lazy_path = NULL;
+    bplist.nocopy = (options & PLIST_PARSE_NOCOPY) ? 1 : 0;
+    bplist.keys = NULL;
+    bplist.parsing_key = 0;
+    bplist.threads = 1;
+    bplist.arena_dicts = NULL;
     bplist.err = PLIST_ERR_SUCCESS;
 
-    if (!bplist.used_indexes) {
-        PLIST_BIN_ERR("failed to create array to hold used node indexes. Out of memory?\n");
+    if (!bplist.visiting) {
+        PLIST_BIN_ERR("failed to allocate the object bitmap. Out of memory?\n");
         return PLIST_ERR_NO_MEM;
     }
 
-    *plist = parse_bin_node_at_index(&bplist, root_object);
+    if (options & PLIST_PARSE_LAZY) {
+        bplist.lazy = (struct bplist_lazy_ctx*)malloc(sizeof(struct bplist_lazy_ctx));
+        if (bplist.lazy) {
+            bplist.lazy->paths = arena_new(0);
+        }
+        if (!bplist.lazy || !bplist.lazy->paths) {
+            free(bplist.lazy);
+            free(bplist.visiting);
+            return PLIST_ERR_NO_MEM;
+        }
+        bplist.lazy->data = bplist.data;
+        bplist.lazy->size = bplist.size;
+        bplist.lazy->num_objects = bplist.num_objects;
+        bplist.lazy->ref_size = bplist.ref_size;
+        bplist.lazy->offset_size = bplist.offset_size;
+        bplist.lazy->offset_table = bplist.offset_table;
+        bplist.lazy->visiting = bplist.visiting;
+        /* parse_bin_node_at_index() keeps a reference while parsing */
+        bplist.lazy->refcount = 1;
+        bplist.lazy->nocopy = bplist.nocopy;
+    } else if (options & PLIST_PARSE_ARENA) {
+        // first slab sized for the nodes plus about the size of the input
+        bplist.arena = arena_new(bplist.num_objects * (sizeof(struct node) + sizeof(struct plist_data_s)) + length);
+        if (!bplist.arena) {
+            free(bplist.visiting);
+            return PLIST_ERR_NO_MEM;
+        }
+    } else if (options & PLIST_PARSE_INTERN_KEYS) {
+        bplist.keys = plist_key_table_new();
+        if (!bplist.keys) {
+            free(bplist.visiting);
+            return PLIST_ERR_NO_MEM;
+        }
+    }
+
+    if (!bplist.lazy && !bplist.arena) {
+        // arenas are not thread safe, lazy parses decode on access
+        bplist.threads = (num_threads == 0) ? thread_cpu_count() : num_threads;
+        if (bplist.threads > BPLIST_MAX_THREADS) {
+            bplist.threads = BPLIST_MAX_THREADS;
+        }
+    }
+
+    *plist = parse_bin_tree(&bplist, root_object);
 
-    ptr_array_free(bplist.used_indexes);
+    free(bplist.stack);
+    if (!bplist.lazy) {
+        free(bplist.visiting);
+    }
+    if (bplist.keys) {
+        plist_key_table_free(bplist.keys);
+    }
+
+    if (bplist.lazy && --bplist.lazy->refcount == 0) {
+        bplist_lazy_ctx_free(bplist.lazy);
+    }
+
+    if (bplist.arena) {
+        if (*plist && !plist_set_arena_root(*plist, bplist.arena)) {
+            *plist = NULL;
+            bplist.err = PLIST_ERR_NO_MEM;
+        }
+        if (!*plist) {
+            arena_free(bplist.arena);
+        } else if (bplist.arena_dicts) {
+            long i;
+            for (i = 0; i < ptr_array_size(bplist.arena_dicts); i++) {
+                plist_dict_index_parsed((plist_t)ptr_array_index(bplist.arena_dicts, i));
+            }
+        }
+        ptr_array_free(bplist.arena_dicts);
+    }
 
     if (!*plist) {
         return (bplist.err != PLIST_ERR_SUCCESS) ? bplist.err : PLIST_ERR_PARSE;
@@ -1019,6 +1645,356 @@ plist_err_t plist_from_bin(const char *plist_bin, uint32_t length, plist_t * pli
     return PLIST_ERR_SUCCESS;
 }
 
+/*
+ * Validation. The objects reachable from the root are checked like
+ * plist_from_bin() would decode them, but without creating any nodes.
+ * Each object is checked once and keeps a small state; objects that are
+ * referenced again reuse the node count and height from the first time,
+ * so the work stays linear even for input that references the same
+ * containers over and over to blow up the size of the decoded tree.
+ */
+enum {
+    BPLIST_VOBJ_NEW = 0,
+    BPLIST_VOBJ_ACTIVE,
+    BPLIST_VOBJ_DONE
+};
+
+struct bplist_vobj {
+    uint64_t nodes;
+    uint32_t height;
+    uint8_t state;
+    int8_t type;
+};
+
+struct bplist_vframe {
+    uint64_t node_index;
+    const char* object;
+    const char* refs;
+    uint64_t size;
+    uint64_t next;
+    uint64_t nodes;
+    uint32_t height;
+    int dict;
+};
+
+struct bplist_validator {
+    struct bplist_data *bplist;
+    const plist_bin_limits_t *limits;
+    plist_bin_report_t *report;
+    struct bplist_vobj *objs;
+    struct bplist_vframe *stack;
+    uint32_t stack_len;
+    uint32_t max_depth;
+};
+
+static plist_err_t validate_error(struct bplist_validator *v, plist_err_t err, const char *pos)
+{
+    v->report->error_offset = (uint64_t)(pos - v->bplist->data);
+    return err;
+}
+
+static uint64_t validate_add_nodes(uint64_t a, uint64_t b)
+{
+    return (a > UINT64_MAX - b) ? UINT64_MAX : a + b;
+}
+
+/* adds a checked object to the container it was found in */
+static void validate_attach(struct bplist_validator *v, struct bplist_vobj *obj)
+{
+    struct bplist_vframe *parent;
+    if (v->stack_len == 0) {
+        return;
+    }
+    parent = &v->stack[v->stack_len - 1];
+    parent->nodes = validate_add_nodes(parent->nodes, obj->nodes);
+    if (obj->height + 1 > parent->height) {
+        parent->height = obj->height + 1;
+    }
+}
+
+static plist_err_t validate_bytes(struct bplist_validator *v, uint64_t *total, uint64_t size, uint64_t limit, const char *object)
+{
+    *total = validate_add_nodes(*total, size);
+    if (limit > 0 && *total > limit) {
+        PLIST_BIN_ERR("%s: size limit (%" PRIu64 ") exceeded\n", __func__, limit);
+        return validate_error(v, PLIST_ERR_LIMIT, object);
+    }
+    return PLIST_ERR_SUCCESS;
+}
+
+/* checks the object at node_index, found at the given depth through the
+ * reference at ref; containers with children are pushed onto the stack */
+static plist_err_t validate_object(struct bplist_validator *v, uint64_t node_index, uint32_t depth, int is_key, const char *ref)
+{
+    struct bplist_data *bplist = v->bplist;
+    plist_bin_report_t *report = v->report;
+    const plist_bin_limits_t *limits = v->limits;
+    struct bplist_vobj *obj = &v->objs[node_index];
+    const char *object;
+    const char *ptr;
+    uint16_t type = 0;
+    uint64_t size = 0;
+    uint64_t pobject;
+    uint64_t poffset_table = (uint64_t)(uintptr_t)bplist->offset_table;
+    plist_type ptype;
+    plist_err_t err = PLIST_ERR_SUCCESS;
+
+    object = bplist_object_ptr(bplist, node_index);
+    if (!object) {
+        return validate_error(v, PLIST_ERR_PARSE, ref);
+    }
+    if (depth > v->max_depth) {
+        PLIST_BIN_ERR("maximum nesting depth (%u) exceeded\n", v->max_depth);
+        return validate_error(v, PLIST_ERR_MAX_NESTING, object);
+    }
+    if (obj->state == BPLIST_VOBJ_ACTIVE) {
+        PLIST_BIN_ERR("recursion detected in binary plist\n");
+        return validate_error(v, PLIST_ERR_CIRCULAR_REF, ref);
+    }
+    if (obj->state == BPLIST_VOBJ_DONE) {
+        if (is_key && obj->type != PLIST_STRING) {
+            PLIST_BIN_ERR("%s: invalid node type for key\n", __func__);
+            return validate_error(v, PLIST_ERR_PARSE, object);
+        }
+        if (depth + obj->height > v->max_depth) {
+            PLIST_BIN_ERR("maximum nesting depth (%u) exceeded\n", v->max_depth);
+            return validate_error(v, PLIST_ERR_MAX_NESTING, object);
+        }
+        validate_attach(v, obj);
+        return PLIST_ERR_SUCCESS;
+    }
+
+    ptr = object;
+    if (parse_bin_object_header(bplist, &ptr, &type, &size) < 0) {
+        return validate_error(v, PLIST_ERR_PARSE, object);
+    }
+    pobject = (uint64_t)(uintptr_t)ptr;
+
+    switch (type) {
+    case BPLIST_NULL:
+        if (size != BPLIST_TRUE && size != BPLIST_FALSE && size != BPLIST_NULL) {
+            return validate_error(v, PLIST_ERR_PARSE, object);
+        }
+        ptype = (size == BPLIST_NULL) ? PLIST_NULL : PLIST_BOOLEAN;
+        break;
+    case BPLIST_INT:
+        if (pobject + (uint64_t)(1 << size) > poffset_table || (size > 3 && size != 4)) {
+            PLIST_BIN_ERR("%s: invalid BPLIST_INT node\n", __func__);
+            return validate_error(v, PLIST_ERR_PARSE, object);
+        }
+        ptype = PLIST_INT;
+        break;
+    case BPLIST_REAL:
+    case BPLIST_DATE:
+        if (pobject + (uint64_t)(1 << size) > poffset_table || (size != 3 && (size != 2 || type == BPLIST_DATE))) {
+            PLIST_BIN_ERR("%s: invalid BPLIST_REAL or BPLIST_DATE node\n", __func__);
+            return validate_error(v, PLIST_ERR_PARSE, object);
+        }
+        ptype = (type == BPLIST_DATE) ? PLIST_DATE : PLIST_REAL;
+        break;
+    case BPLIST_DATA:
+    case BPLIST_STRING:
+        if (pobject + size < pobject || pobject + size > poffset_table) {
+            PLIST_BIN_ERR("%s: data bytes of node type 0x%02x point outside of valid range\n", __func__, type);
+            return validate_error(v, PLIST_ERR_PARSE, object);
+        }
+        if (type == BPLIST_DATA) {
+            err = validate_bytes(v, &report->data_bytes, size, (limits) ? limits->max_data_bytes : 0, object);
+            ptype = PLIST_DATA;
+        } else {
+            err = validate_bytes(v, &report->string_bytes, size, (limits) ? limits->max_string_bytes : 0, object);
+            ptype = PLIST_STRING;
+        }
+        break;
+    case BPLIST_UNICODE:
+        /* an empty UTF-16 string does not decode */
+        if (size == 0 || size*2 < size || pobject + size*2 < pobject || pobject + size*2 > poffset_table) {
+            PLIST_BIN_ERR("%s: invalid BPLIST_UNICODE node\n", __func__);
+            return validate_error(v, PLIST_ERR_PARSE, object);
+        }
+        err = validate_bytes(v, &report->string_bytes, size*2, (limits) ? limits->max_string_bytes : 0, object);
+        ptype = PLIST_STRING;
+        break;
+    case BPLIST_UID:
+        if (pobject + size+1 > poffset_table || UINT_TO_HOST(ptr, size+1) > UINT32_MAX) {
+            PLIST_BIN_ERR("%s: invalid BPLIST_UID node\n", __func__);
+            return validate_error(v, PLIST_ERR_PARSE, object);
+        }
+        ptype = PLIST_UID;
+        break;
+    case BPLIST_SET:
+    case BPLIST_ARRAY:
+    case BPLIST_DICT:
+        if (pobject + size < pobject || pobject + size > poffset_table) {
+            PLIST_BIN_ERR("%s: data bytes of node type 0x%02x point outside of valid range\n", __func__, type);
+            return validate_error(v, PLIST_ERR_PARSE, object);
+        }
+        ptype = (type == BPLIST_DICT) ? PLIST_DICT : PLIST_ARRAY;
+        break;
+    default:
+        PLIST_BIN_ERR("%s: unexpected node type 0x%02x\n", __func__, type);
+        return validate_error(v, PLIST_ERR_PARSE, object);
+    }
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
+    }
+    if (is_key && ptype != PLIST_STRING) {
+        PLIST_BIN_ERR("%s: invalid node type for key\n", __func__);
+        return validate_error(v, PLIST_ERR_PARSE, object);
+    }
+
+    report->type_count[ptype]++;
+    obj->type = (int8_t)ptype;
+    obj->nodes = 1;
+    obj->height = 0;
+    if ((ptype == PLIST_ARRAY || ptype == PLIST_DICT) && size > 0) {
+        /* the stack never gets deeper than max_depth + 1 frames */
+        struct bplist_vframe *frame = &v->stack[v->stack_len++];
+        frame->node_index = node_index;
+        frame->object = object;
+        frame->refs = ptr;
+        frame->size = size;
+        frame->next = 0;
+        frame->nodes = 1;
+        frame->height = 1;
+        frame->dict = (ptype == PLIST_DICT);
+        obj->state = BPLIST_VOBJ_ACTIVE;
+        return PLIST_ERR_SUCCESS;
+    }
+    obj->state = BPLIST_VOBJ_DONE;
+    validate_attach(v, obj);
+    return PLIST_ERR_SUCCESS;
+}
+
+/* reads the object index stored at ref */
+static plist_err_t validate_ref(struct bplist_validator *v, const char *ref, uint64_t *node_index)
+{
+    struct bplist_data *bplist = v->bplist;
+    if (ref < bplist->data || ref + bplist->ref_size > bplist->offset_table) {
+        PLIST_BIN_ERR("%s: reference is outside of valid range\n", __func__);
+        return validate_error(v, PLIST_ERR_PARSE, ref);
+    }
+    *node_index = UINT_TO_HOST(ref, bplist->ref_size);
+    if (*node_index >= bplist->num_objects) {
+        PLIST_BIN_ERR("%s: object index (%" PRIu64 ") must be smaller than the number of objects (%" PRIu64 ")\n", __func__, *node_index, bplist->num_objects);
+        return validate_error(v, PLIST_ERR_PARSE, ref);
+    }
+    return PLIST_ERR_SUCCESS;
+}
+
+static plist_err_t validate_bin_tree(struct bplist_validator *v, uint64_t root_object)
+{
+    struct bplist_data *bplist = v->bplist;
+    const plist_bin_limits_t *limits = v->limits;
+    plist_err_t err = validate_object(v, root_object, 0, 0, bplist->data + bplist->size - sizeof(bplist_trailer_t) + offsetof(bplist_trailer_t, root_object_index));
+
+    while (err == PLIST_ERR_SUCCESS && v->stack_len > 0) {
+        struct bplist_vframe *frame = &v->stack[v->stack_len - 1];
+        uint32_t depth = v->stack_len;
+        uint64_t j = frame->next;
+
+        if (j == frame->size) {
+            struct bplist_vobj *obj = &v->objs[frame->node_index];
+            if (limits && limits->max_nodes > 0 && frame->nodes > limits->max_nodes) {
+                PLIST_BIN_ERR("%s: node limit (%" PRIu64 ") exceeded\n", __func__, limits->max_nodes);
+                return validate_error(v, PLIST_ERR_LIMIT, frame->object);
+            }
+            obj->nodes = frame->nodes;
+            obj->height = frame->height;
+            obj->state = BPLIST_VOBJ_DONE;
+            v->stack_len--;
+            validate_attach(v, obj);
+            continue;
+        }
+        frame->next++;
+
+        if (frame->dict) {
+            const char *key_ref = frame->refs + j * bplist->ref_size;
+            const char *val_ref = frame->refs + (j + frame->size) * bplist->ref_size;
+            uint64_t key_index = 0;
+            uint64_t val_index = 0;
+            err = validate_ref(v, key_ref, &key_index);
+            if (err == PLIST_ERR_SUCCESS) {
+                err = validate_ref(v, val_ref, &val_index);
+            }
+            if (err == PLIST_ERR_SUCCESS) {
+                err = validate_object(v, key_index, depth, 1, key_ref);
+            }
+            if (err == PLIST_ERR_SUCCESS) {
+                err = validate_object(v, val_index, depth, 0, val_ref);
+            }
+        } else {
+            const char *ref = frame->refs + j * bplist->ref_size;
+            uint64_t index = 0;
+            err = validate_ref(v, ref, &index);
+            if (err == PLIST_ERR_SUCCESS) {
+                err = validate_object(v, index, depth, 0, ref);
+            }
+        }
+    }
+    return err;
+}
+
+plist_err_t plist_validate_bin(const char *plist_bin, uint64_t length, const plist_bin_limits_t *limits, plist_bin_report_t *report)
+{
+    struct bplist_data bplist;
+    struct bplist_validator v;
+    plist_bin_report_t rep;
+    uint64_t root_object = 0;
+    plist_err_t err;
+
+    memset(&rep, 0, sizeof(rep));
+    if (!plist_bin || length == 0) {
+        err = PLIST_ERR_INVALID_ARG;
+        goto leave;
+    }
+
+    err = parse_bin_trailer(plist_bin, length, &bplist, &root_object, &rep.error_offset);
+    if (err != PLIST_ERR_SUCCESS) {
+        goto leave;
+    }
+    rep.num_objects = bplist.num_objects;
+    if (limits && limits->max_objects > 0 && bplist.num_objects > limits->max_objects) {
+        PLIST_BIN_ERR("number of objects (%" PRIu64 ") exceeds the limit (%" PRIu64 ")\n", bplist.num_objects, limits->max_objects);
+        rep.error_offset = length - sizeof(bplist_trailer_t) + offsetof(bplist_trailer_t, num_objects);
+        err = PLIST_ERR_LIMIT;
+        goto leave;
+    }
+
+    v.bplist = &bplist;
+    v.limits = limits;
+    v.report = &rep;
+    v.max_depth = PLIST_MAX_NESTING_DEPTH;
+    if (limits && limits->max_depth > 0 && limits->max_depth < v.max_depth) {
+        v.max_depth = limits->max_depth;
+    }
+    v.stack_len = 0;
+    /* the offset table bounds the number of objects by the input size */
+    v.objs = (struct bplist_vobj*)calloc(bplist.num_objects, sizeof(struct bplist_vobj));
+    v.stack = (struct bplist_vframe*)malloc((v.max_depth + 1) * sizeof(struct bplist_vframe));
+    if (!v.objs || !v.stack) {
+        free(v.objs);
+        free(v.stack);
+        err = PLIST_ERR_NO_MEM;
+        goto leave;
+    }
+
+    err = validate_bin_tree(&v, root_object);
+    if (err == PLIST_ERR_SUCCESS) {
+        rep.num_nodes = v.objs[root_object].nodes;
+        rep.max_depth = v.objs[root_object].height;
+    }
+
+    free(v.objs);
+    free(v.stack);
+
+leave:
+    if (report) {
+        *report = rep;
+    }
+    return err;
+}
+
 static unsigned int plist_data_hash(const void* key)
 {
     plist_data_t data = plist_get_data((plist_t) key);
@@ -1042,10 +2018,14 @@ static unsigned int plist_data_hash(const void* key)
         break;
     case PLIST_KEY:
     case PLIST_STRING:
-        buff = data->strval;
-        size = data->length;
-        break;
+        // dict keys carry their hash, see plist_key_data_set_hash()
+        if (data->flags & PLIST_DATA_FLAG_HASHED) {
+            return hash + data->hash;
+        }
+        return hash + plist_str_hash(data->strval, data->length);
     case PLIST_DATA:
+        // compared by content, so equal values must hash the same
+        return hash + plist_str_hash((const char*)data->buff, data->length);
     case PLIST_ARRAY:
     case PLIST_DICT:
         //for these types only hash pointer
@@ -1066,44 +2046,177 @@ static unsigned int plist_data_hash(const void* key)
     return hash;
 }
 
-struct serialize_s
-{
-    ptrarray_t* objects;
-    hashtable_t* ref_table;
+/* object indexes are stored inline in ref_table, offset by one so that
+ * a valid index never looks like a failed lookup (NULL) */
+#define REF_TO_VAL(idx) ((void*)(uintptr_t)((idx) + 1))
+#define VAL_TO_REF(val) ((uint64_t)(uintptr_t)(val) - 1)
+
+/*
+ * Deduplication for PLIST_OPT_DEDUP. A bottom-up pass maps every node to
+ * the first node with the same content (its canonical node). Scalars and
+ * data are compared by value; a container equals another container of the
+ * same type whose children have the same canonical nodes, in the same
+ * order, so whole subtrees compare in O(number of children).
+ */
+struct dedup_sig {
+    unsigned int hash;
+    plist_type type;
+    node_t node;
+    uint64_t count;
+    node_t children[];
+};
+
+struct dedup_s {
+    hashtable_t* canon;
+    hashtable_t* values;
+    hashtable_t* containers;
     hashtable_t* in_stack;
+    arena_t* sigs;
 };
 
-static plist_err_t serialize_plist(node_t node, void* data, uint32_t depth)
+static unsigned int plist_data_deep_hash(const void* key)
 {
-    uint64_t *index_val = NULL;
-    struct serialize_s *ser = (struct serialize_s *) data;
+    plist_data_t data = plist_get_data((plist_t) key);
+    if (data->type == PLIST_DATA) {
+        return data->type + plist_str_hash((const char*)data->buff, (data->buff) ? data->length : 0);
+    }
+    return plist_data_hash(key);
+}
+
+static unsigned int dedup_sig_hash(const void* key)
+{
+    return ((const struct dedup_sig*)key)->hash;
+}
+
+static int dedup_sig_compare(const void* a, const void* b)
+{
+    const struct dedup_sig *sig_a = (const struct dedup_sig*)a;
+    const struct dedup_sig *sig_b = (const struct dedup_sig*)b;
+    return sig_a->type == sig_b->type && sig_a->count == sig_b->count
+        && memcmp(sig_a->children, sig_b->children, sig_a->count * sizeof(node_t)) == 0;
+}
+
+static node_t dedup_canonical(struct dedup_s *dd, node_t node)
+{
+    node_t canon = (node_t)hash_table_lookup(dd->canon, node);
+    return (canon) ? canon : node;
+}
 
+static plist_err_t dedup_plist(struct dedup_s *dd, node_t node, uint32_t depth)
+{
     if (depth > PLIST_MAX_NESTING_DEPTH) {
         PLIST_BIN_WRITE_ERR("maximum nesting depth (%u) exceeded\n", (unsigned)PLIST_MAX_NESTING_DEPTH);
         return PLIST_ERR_MAX_NESTING;
     }
-
-    // circular reference check: is node on current recursion stack?
-    if (hash_table_lookup(ser->in_stack, node)) {
+    if (hash_table_lookup(dd->in_stack, node)) {
         PLIST_BIN_WRITE_ERR("circular reference detected\n");
         return PLIST_ERR_CIRCULAR_REF;
     }
+    if (plist_node_expand(node) != PLIST_ERR_SUCCESS) {
+        return PLIST_ERR_PARSE;
+    }
 
-    // first check that node is not yet in objects
-    void* val = hash_table_lookup(ser->ref_table, node);
+    plist_data_t data = plist_get_data(node);
+    node_t canon = node;
+    if (data->type == PLIST_ARRAY || data->type == PLIST_DICT) {
+        uint64_t count = node_n_children(node);
+        struct dedup_sig *sig = (struct dedup_sig*)arena_alloc(dd->sigs, sizeof(struct dedup_sig) + count * sizeof(node_t));
+        if (!sig) {
+            return PLIST_ERR_NO_MEM;
+        }
+        hash_table_insert(dd->in_stack, node, (void*)1);
+        node_t ch;
+        uint64_t i = 0;
+        for (ch = node_first_child(node); ch; ch = node_next_sibling(ch), i++) {
+            plist_err_t err = dedup_plist(dd, ch, depth+1);
+            if (err != PLIST_ERR_SUCCESS) {
+                return err;
+            }
+            sig->children[i] = dedup_canonical(dd, ch);
+        }
+        hash_table_remove(dd->in_stack, node);
+        sig->type = data->type;
+        sig->node = node;
+        sig->count = count;
+        sig->hash = (unsigned int)data->type ^ plist_str_hash((const char*)sig->children, count * sizeof(node_t));
+        struct dedup_sig *found = (struct dedup_sig*)hash_table_lookup(dd->containers, sig);
+        if (found) {
+            canon = found->node;
+        } else {
+            hash_table_insert(dd->containers, sig, sig);
+        }
+    } else {
+        node_t found = (node_t)hash_table_lookup(dd->values, node);
+        if (found) {
+            canon = found;
+        } else {
+            hash_table_insert(dd->values, node, node);
+        }
+    }
+    if (canon != node) {
+        hash_table_insert(dd->canon, node, canon);
+    }
+    return PLIST_ERR_SUCCESS;
+}
+
+struct serialize_s
+{
+    ptrarray_t* objects;
+    hashtable_t* ref_table;
+    hashtable_t* in_stack;
+    /* with deduplication: node -> canonical node, ref_table is keyed by node */
+    hashtable_t* canon;
+};
+
+static plist_err_t serialize_plist(node_t node, void* data, uint32_t depth)
+{
+    struct serialize_s *ser = (struct serialize_s *) data;
+
+    if (depth > PLIST_MAX_NESTING_DEPTH) {
+        PLIST_BIN_WRITE_ERR("maximum nesting depth (%u) exceeded\n", (unsigned)PLIST_MAX_NESTING_DEPTH);
+        return PLIST_ERR_MAX_NESTING;
+    }
+
+    // circular reference check: is node on current recursion stack?
+    if (hash_table_lookup(ser->in_stack, node)) {
+        PLIST_BIN_WRITE_ERR("circular reference detected\n");
+        return PLIST_ERR_CIRCULAR_REF;
+    }
+
+    // first check that node is not yet in objects
+    void* val = hash_table_lookup(ser->ref_table, node);
     if (val) {
         // data is already in table
         return PLIST_ERR_SUCCESS;
     }
 
+    // an equal node might have been written already
+    node_t canon = NULL;
+    if (ser->canon) {
+        canon = (node_t)hash_table_lookup(ser->canon, node);
+        if (canon) {
+            val = hash_table_lookup(ser->ref_table, canon);
+            if (val) {
+                hash_table_insert(ser->ref_table, node, val);
+                return PLIST_ERR_SUCCESS;
+            }
+        }
+    }
+
+    // decode lazily parsed containers before walking them
+    if (plist_node_expand(node) != PLIST_ERR_SUCCESS) {
+        return PLIST_ERR_PARSE;
+    }
+
     // mark as active
     hash_table_insert(ser->in_stack, node, (void*)1);
 
     // insert new ref
-    index_val = (uint64_t *) malloc(sizeof(uint64_t));
-    if (!index_val) return PLIST_ERR_NO_MEM;
-    *index_val = ser->objects->len;
-    hash_table_insert(ser->ref_table, node, index_val);
+    hash_table_insert(ser->ref_table, node, REF_TO_VAL(ser->objects->len));
+    if (canon) {
+        // later copies refer to this one
+        hash_table_insert(ser->ref_table, canon, REF_TO_VAL(ser->objects->len));
+    }
 
     // now append current node to object array
     ptr_array_add(ser->objects, node);
@@ -1200,89 +2313,33 @@ static void write_string(bytearray_t * bplist, char *val, uint64_t size)
     write_raw_data(bplist, BPLIST_STRING, (uint8_t *) val, size);
 }
 
-static uint16_t *plist_utf8_to_utf16be(const unsigned char *unistr, size_t size, size_t *items_read, size_t *items_written)
-{
-    uint16_t *outbuf;
-    size_t p = 0;
-    size_t i = 0;
-
-    unsigned char c0;
-    unsigned char c1;
-    unsigned char c2;
-    unsigned char c3;
-
-    outbuf = (uint16_t*)malloc(((size*2)+1)*sizeof(uint16_t));
-    if (!outbuf) {
-        PLIST_BIN_ERR("%s: Could not allocate %" PRIu64 " bytes\n", __func__, (uint64_t)((size*2)+1)*sizeof(uint16_t));
-        return NULL;
-    }
-
-    while (i < size) {
-        c0 = unistr[i];
-        c1 = (i+1 < size) ? unistr[i+1] : 0;
-        c2 = (i+2 < size) ? unistr[i+2] : 0;
-        c3 = (i+3 < size) ? unistr[i+3] : 0;
-        if ((c0 >= 0xF0 && c0 <= 0xF4) && (i+3 < size) && ((c1 & 0xC0) == 0x80) && ((c2 & 0xC0) == 0x80) && ((c3 & 0xC0) == 0x80)) {
-            // 4 byte sequence.  Need to generate UTF-16 surrogate pair
-            /* lead-specific second-byte constraints */
-            if ((c0 == 0xF0 && c1 < 0x90) ||     /* overlong (< U+10000) */
-               (c0 == 0xF4 && c1 > 0x8F))       /* > U+10FFFF */
-            {
-                break;
-            }
-            uint32_t w = ((uint32_t)(c3 & 0x3F)) | ((uint32_t)(c2 & 0x3F) << 6) | ((uint32_t)(c1 & 0x3F) << 12) | ((uint32_t)(c0 & 0x07) << 18);
-            if (w < 0x10000 || w > 0x10FFFF) break;
-            w -= 0x10000;
-            outbuf[p++] = be16toh((uint16_t)(0xD800 + (w >> 10)));
-            outbuf[p++] = be16toh((uint16_t)(0xDC00 + (w & 0x3FF)));
-            i+=4;
-        } else if (((c0 & 0xF0) == 0xE0) && (i+2 < size) && ((c1 & 0xC0) == 0x80) && ((c2 & 0xC0) == 0x80)) {
-            // 3 byte sequence
-            if ((c0 == 0xE0 && c1 < 0xA0) ||     /* overlong (< U+0800) */
-               (c0 == 0xED && c1 > 0x9F))       /* UTF-16 surrogate range */
-            {
-                break;
-            }
-            uint32_t w = ((uint32_t)(c2 & 0x3F)) | ((uint32_t)(c1 & 0x3F) << 6) | ((uint32_t)(c0 & 0x0F) << 12);
-            if (w < 0x800) break;
-            if (w >= 0xD800 && w <= 0xDFFF) break; // invalid Unicode scalar values
-            outbuf[p++] = be16toh((uint16_t)w);
-            i+=3;
-        } else if ((c0 >= 0xC2 && c0 <= 0xDF) && (i+1 < size) && ((c1 & 0xC0) == 0x80)) {
-            // 2 byte sequence
-            uint32_t w = ((uint32_t)(c1 & 0x3F)) | ((uint32_t)(c0 & 0x1F) << 6);
-            outbuf[p++] = be16toh((uint16_t)w);
-            i+=2;
-        } else if (c0 < 0x80) {
-            // 1 byte sequence
-            outbuf[p++] = be16toh((uint16_t)c0);
-            i+=1;
-        } else {
-            // invalid character
-            PLIST_BIN_ERR("%s: invalid utf8 sequence in string at index %zu\n", __func__, i);
-            break;
-        }
-    }
-    if (items_read) {
-        *items_read = i;
-    }
-    if (items_written) {
-        *items_written = p;
-    }
-    outbuf[p] = 0;
-
-    return outbuf;
-}
+/* strings up to this size are converted without a heap allocation */
+#define BPLIST_UNICODE_STACK_SIZE 256
 
 static void write_unicode(bytearray_t * bplist, char *val, size_t size)
 {
+    unsigned char stackbuf[2 * BPLIST_UNICODE_STACK_SIZE];
+    unsigned char *unicodestr = stackbuf;
     size_t items_read = 0;
     size_t items_written = 0;
-    uint16_t *unicodestr = NULL;
 
-    unicodestr = plist_utf8_to_utf16be((const unsigned char *)val, size, &items_read, &items_written);
-    write_raw_data(bplist, BPLIST_UNICODE, (uint8_t*)unicodestr, items_written);
-    free(unicodestr);
+    // UTF-16 never needs more code units than UTF-8 needs bytes
+    if (size > BPLIST_UNICODE_STACK_SIZE) {
+        unicodestr = (unsigned char*)malloc(2 * size);
+        if (!unicodestr) {
+            PLIST_BIN_ERR("%s: Could not allocate %" PRIu64 " bytes\n", __func__, (uint64_t)(2 * size));
+            bplist->error = 1;
+            return;
+        }
+    }
+    items_written = utf8_to_utf16be(val, size, unicodestr, &items_read);
+    if (items_read < size) {
+        PLIST_BIN_ERR("%s: invalid utf8 sequence in string at index %zu\n", __func__, items_read);
+    }
+    write_raw_data(bplist, BPLIST_UNICODE, unicodestr, items_written);
+    if (unicodestr != stackbuf) {
+        free(unicodestr);
+    }
 }
 
 static void write_array(bytearray_t * bplist, node_t node, hashtable_t* ref_table, uint8_t ref_size)
@@ -1298,7 +2355,7 @@ static void write_array(bytearray_t * bplist, node_t node, hashtable_t* ref_tabl
     }
 
     for (i = 0, cur = node_first_child(node); cur && i < size; cur = node_next_sibling(cur), i++) {
-        uint64_t idx = *(uint64_t *) (hash_table_lookup(ref_table, cur));
+        uint64_t idx = VAL_TO_REF(hash_table_lookup(ref_table, cur));
         idx = be64toh(idx);
         byte_array_append(bplist, (uint8_t*)&idx + (sizeof(uint64_t) - ref_size), ref_size);
     }
@@ -1317,13 +2374,13 @@ static void write_dict(bytearray_t * bplist, node_t node, hashtable_t* ref_table
     }
 
     for (i = 0, cur = node_first_child(node); cur && i < size; cur = node_next_sibling(node_next_sibling(cur)), i++) {
-        uint64_t idx1 = *(uint64_t *) (hash_table_lookup(ref_table, cur));
+        uint64_t idx1 = VAL_TO_REF(hash_table_lookup(ref_table, cur));
         idx1 = be64toh(idx1);
         byte_array_append(bplist, (uint8_t*)&idx1 + (sizeof(uint64_t) - ref_size), ref_size);
     }
 
     for (i = 0, cur = node_first_child(node); cur && i < size; cur = node_next_sibling(node_next_sibling(cur)), i++) {
-        uint64_t idx2 = *(uint64_t *) (hash_table_lookup(ref_table, cur->next));
+        uint64_t idx2 = VAL_TO_REF(hash_table_lookup(ref_table, node_next_sibling(cur)));
         idx2 = be64toh(idx2);
         byte_array_append(bplist, (uint8_t*)&idx2 + (sizeof(uint64_t) - ref_size), ref_size);
     }
@@ -1344,51 +2401,386 @@ static void write_uid(bytearray_t * bplist, uint64_t val)
     byte_array_append(bplist, (uint8_t*)&val + (8-size), size);
 }
 
-static int is_ascii_string(const char* s, size_t len)
+/* string classes, kept by the writer with one byte per object */
+#define BPLIST_STR_UNKNOWN 0
+#define BPLIST_STR_ASCII   1
+#define BPLIST_STR_UNICODE 2
+
+/* whether a string is written as ASCII or as UTF-16; str_class is the
+ * entry of the object, so each string is only classified once. The tree
+ * is not touched. The parallel writer sizes all objects before it starts
+ * its threads, which then only read the entries. */
+static int is_ascii_string(plist_data_t data, uint8_t *str_class)
 {
-    int ret = 1;
-    size_t i = 0;
-    for (i = 0; i < len; i++) {
-        if ( !isascii( s[i] ) ) {
-            ret = 0;
-            break;
+    if (*str_class == BPLIST_STR_UNKNOWN) {
+        *str_class = (utf8_is_ascii(data->strval, data->length)) ? BPLIST_STR_ASCII : BPLIST_STR_UNICODE;
+    }
+    return *str_class == BPLIST_STR_ASCII;
+}
+
+/* estimated encoded size of a single object; exact except for non-ASCII
+ * strings, which are assumed to take two bytes per byte of UTF-8 */
+static uint64_t bplist_object_size(node_t node, uint8_t ref_size, uint8_t *str_class)
+{
+    plist_data_t data = plist_get_data(node);
+    uint64_t req = 0;
+    uint64_t size;
+    uint8_t bsize;
+    switch (data->type)
+    {
+    case PLIST_NULL:
+    case PLIST_BOOLEAN:
+        req += 1;
+        break;
+    case PLIST_KEY:
+    case PLIST_STRING:
+        req += 1;
+        if (data->length >= 15) {
+            bsize = get_needed_bytes(data->length);
+            if (bsize == 3) bsize = 4;
+            req += 1;
+            req += bsize;
         }
+        if ( is_ascii_string(data, str_class) )
+        {
+            req += data->length;
+        }
+        else
+        {
+            req += data->length * 2;
+        }
+        break;
+    case PLIST_REAL:
+        size = get_real_bytes(data->realval);
+        req += 1;
+        req += size;
+        break;
+    case PLIST_DATE:
+        req += 9;
+        break;
+    case PLIST_ARRAY:
+        size = node_n_children(node);
+        req += 1;
+        if (size >= 15) {
+            bsize = get_needed_bytes(size);
+            if (bsize == 3) bsize = 4;
+            req += 1;
+            req += bsize;
+        }
+        req += size * ref_size;
+        break;
+    case PLIST_DICT:
+        size = node_n_children(node) / 2;
+        req += 1;
+        if (size >= 15) {
+            bsize = get_needed_bytes(size);
+            if (bsize == 3) bsize = 4;
+            req += 1;
+            req += bsize;
+        }
+        req += size * 2 * ref_size;
+        break;
+    default:
+        size = data->length;
+        req += 1;
+        if (size >= 15) {
+            bsize = get_needed_bytes(size);
+            if (bsize == 3) bsize = 4;
+            req += 1;
+            req += bsize;
+        }
+        req += data->length;
+        break;
     }
-    return ret;
+    return req;
 }
 
-plist_err_t plist_to_bin(plist_t plist, char **plist_bin, uint32_t * length)
+/* storage size of a binary plist with objects_size bytes of objects */
+static uint64_t bplist_total_size(uint64_t objects_size, uint64_t num_objects)
+{
+    uint64_t req = objects_size;
+    // add size of magic
+    req += BPLIST_MAGIC_SIZE;
+    req += BPLIST_VERSION_SIZE;
+    // add size of offset table
+    req += get_needed_bytes(req) * num_objects;
+    // add size of trailer
+    req += sizeof(bplist_trailer_t);
+
+    return req;
+}
+
+/* figure out the storage size required for a buffered binary plist */
+static uint64_t bplist_estimate_size(ptrarray_t* objects, uint8_t ref_size, uint8_t *str_classes)
+{
+    uint64_t num_objects = objects->len;
+    uint64_t req = 0;
+    uint64_t i = 0;
+    for (i = 0; i < num_objects; i++) {
+        req += bplist_object_size((node_t)ptr_array_index(objects, i), ref_size, &str_classes[i]);
+    }
+    return bplist_total_size(req, num_objects);
+}
+
+static void write_object(bytearray_t *bplist_buff, node_t node, hashtable_t* ref_table, uint8_t ref_size, uint8_t *str_class)
+{
+    plist_data_t data = plist_get_data(node);
+
+    switch (data->type)
+    {
+    case PLIST_NULL: {
+        uint8_t b = 0;
+        byte_array_append(bplist_buff, &b, 1);
+        break;
+    }
+    case PLIST_BOOLEAN: {
+        uint8_t b = data->boolval ? BPLIST_TRUE : BPLIST_FALSE;
+        byte_array_append(bplist_buff, &b, 1);
+        break;
+    }
+    case PLIST_INT:
+        if (data->length == 16) {
+            write_uint(bplist_buff, data->intval);
+        } else {
+            write_int(bplist_buff, data->intval);
+        }
+        break;
+
+    case PLIST_REAL:
+        write_real(bplist_buff, data->realval);
+        break;
+
+    case PLIST_KEY:
+    case PLIST_STRING:
+        if ( is_ascii_string(data, str_class) )
+        {
+            write_string(bplist_buff, data->strval, data->length);
+        }
+        else
+        {
+            write_unicode(bplist_buff, data->strval, data->length);
+        }
+        break;
+    case PLIST_DATA:
+        write_data(bplist_buff, data->buff, data->length);
+        break;
+    case PLIST_ARRAY:
+        write_array(bplist_buff, node, ref_table, ref_size);
+        break;
+    case PLIST_DICT:
+        write_dict(bplist_buff, node, ref_table, ref_size);
+        break;
+    case PLIST_DATE:
+        write_date(bplist_buff, data->realval);
+        break;
+    case PLIST_UID:
+        write_uid(bplist_buff, data->intval);
+        break;
+    default:
+        break;
+    }
+}
+
+/* write objects [first, last) and store their offsets in bplist_buff */
+static void write_objects(bytearray_t *bplist_buff, ptrarray_t* objects, uint64_t first, uint64_t last, hashtable_t* ref_table, uint8_t ref_size, uint64_t *offsets, uint8_t *str_classes)
+{
+    uint64_t i;
+    for (i = first; i < last; i++) {
+        offsets[i] = bplist_buff->len;
+        write_object(bplist_buff, (node_t)ptr_array_index(objects, i), ref_table, ref_size, &str_classes[i]);
+    }
+}
+
+/*
+ * Parallel writing. Once all objects are numbered and the ref size is
+ * known, every object encodes independently of the others. The objects
+ * are split into ranges of about the same estimated size; the first range
+ * is written straight to the output while the others are encoded by
+ * worker threads into buffers of their own. The buffers are then appended
+ * in order and the offsets of each range are shifted by the position its
+ * buffer ended up at. The output is identical to the single-threaded one.
+ */
+#define BPLIST_MIN_OBJECTS_PER_THREAD 4096
+
+struct write_job {
+    ptrarray_t* objects;
+    hashtable_t* ref_table;
+    uint8_t ref_size;
+    uint64_t first;
+    uint64_t last;
+    uint64_t size;
+    uint64_t *offsets;
+    uint8_t *str_classes;
+    bytearray_t *buff;
+    THREAD_T thread;
+    int running;
+};
+
+static void* write_job_run(void *arg)
+{
+    struct write_job *job = (struct write_job*)arg;
+    write_objects(job->buff, job->objects, job->first, job->last, job->ref_table, job->ref_size, job->offsets, job->str_classes);
+    return NULL;
+}
+
+/* returns the number of threads to use for writing num_objects objects */
+static unsigned int bplist_write_threads(unsigned int num_threads, uint64_t num_objects)
+{
+    uint64_t max_threads = num_objects / BPLIST_MIN_OBJECTS_PER_THREAD;
+    if (num_threads == 0) {
+        num_threads = thread_cpu_count();
+    }
+    if (num_threads > BPLIST_MAX_THREADS) {
+        num_threads = BPLIST_MAX_THREADS;
+    }
+    if (num_threads > max_threads) {
+        num_threads = (max_threads > 0) ? (unsigned int)max_threads : 1;
+    }
+    return num_threads;
+}
+
+/* offsets[] must hold the running total of the estimated object sizes,
+ * and str_classes[] the class of every string */
+static void write_objects_parallel(bytearray_t *bplist_buff, ptrarray_t* objects, hashtable_t* ref_table, uint8_t ref_size, uint64_t *offsets, uint8_t *str_classes, unsigned int num_threads)
+{
+    struct write_job jobs[BPLIST_MAX_THREADS];
+    uint64_t num_objects = objects->len;
+    uint64_t total = offsets[num_objects-1];
+    uint64_t first = 0;
+    unsigned int t;
+
+    memset(jobs, '\0', sizeof(jobs));
+
+    // split at about equal estimated sizes
+    for (t = 0; t < num_threads; t++) {
+        uint64_t last = num_objects;
+        if (t < num_threads-1) {
+            uint64_t target = total / num_threads * (t+1);
+            uint64_t lo = first, hi = num_objects;
+            while (lo < hi) {
+                uint64_t mid = lo + (hi - lo) / 2;
+                if (offsets[mid] < target) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            last = lo;
+        }
+        jobs[t].objects = objects;
+        jobs[t].ref_table = ref_table;
+        jobs[t].ref_size = ref_size;
+        jobs[t].offsets = offsets;
+        jobs[t].str_classes = str_classes;
+        jobs[t].first = first;
+        jobs[t].last = last;
+        if (last > first) {
+            jobs[t].size = offsets[last-1] - ((first > 0) ? offsets[first-1] : 0);
+        }
+        first = last;
+    }
+
+    // start workers for all ranges but the first; from here on offsets[]
+    // is overwritten by the workers
+    for (t = 1; t < num_threads; t++) {
+        struct write_job *job = &jobs[t];
+        if (job->first >= job->last) {
+            continue;
+        }
+        job->buff = byte_array_new(job->size);
+        if (!job->buff || !job->buff->data) {
+            // written directly to the output below
+            byte_array_free(job->buff);
+            job->buff = NULL;
+            continue;
+        }
+        job->running = (thread_new(&job->thread, write_job_run, job) == 0);
+        if (!job->running) {
+            byte_array_free(job->buff);
+            job->buff = NULL;
+        }
+    }
+
+    write_objects(bplist_buff, objects, jobs[0].first, jobs[0].last, ref_table, ref_size, offsets, str_classes);
+
+    // stitch in order
+    for (t = 1; t < num_threads; t++) {
+        struct write_job *job = &jobs[t];
+        uint64_t i;
+        if (!job->running) {
+            write_objects(bplist_buff, objects, job->first, job->last, ref_table, ref_size, offsets, str_classes);
+            continue;
+        }
+        thread_join(job->thread);
+        for (i = job->first; i < job->last; i++) {
+            offsets[i] += bplist_buff->len;
+        }
+        byte_array_append(bplist_buff, job->buff->data, job->buff->len);
+        byte_array_free(job->buff);
+    }
+}
+
+/* write the serialized objects of plist to out, which is either a growing
+ * buffer or a stream; only the offset table is kept in memory */
+static plist_err_t plist_write_bin(plist_t plist, bytearray_t *out, bytearray_t **out_buffer, plist_write_options_t options, unsigned int num_threads)
 {
     ptrarray_t* objects = NULL;
     hashtable_t* ref_table = NULL;
     hashtable_t* in_stack = NULL;
+    hashtable_t* canon = NULL;
     struct serialize_s ser_s;
     uint8_t offset_size = 0;
     uint8_t ref_size = 0;
     uint64_t num_objects = 0;
     uint64_t root_object = 0;
     uint64_t offset_table_index = 0;
-    bytearray_t *bplist_buff = NULL;
+    bytearray_t *bplist_buff = out;
     uint64_t i = 0;
-    uint64_t buff_len = 0;
     uint64_t *offsets = NULL;
+    uint8_t *str_classes = NULL;
+    uint64_t objects_size = 0;
     bplist_trailer_t trailer;
-    uint64_t objects_len = 0;
 
-    //check for valid input
-    if (!plist || !plist_bin || !length) {
-        return PLIST_ERR_INVALID_ARG;
+    if (options & PLIST_OPT_DEDUP) {
+        struct dedup_s dd;
+        dd.canon = hash_table_new(plist_node_ptr_hash, plist_node_ptr_compare, NULL);
+        dd.values = hash_table_new(plist_data_deep_hash, plist_data_compare, NULL);
+        dd.containers = hash_table_new(dedup_sig_hash, dedup_sig_compare, NULL);
+        dd.in_stack = hash_table_new(plist_node_ptr_hash, plist_node_ptr_compare, NULL);
+        dd.sigs = arena_new(0);
+        plist_err_t err = PLIST_ERR_NO_MEM;
+        if (dd.canon && dd.values && dd.containers && dd.in_stack && dd.sigs) {
+            err = dedup_plist(&dd, (node_t)plist, 0);
+        }
+        hash_table_destroy(dd.values);
+        hash_table_destroy(dd.containers);
+        hash_table_destroy(dd.in_stack);
+        if (dd.sigs) {
+            arena_free(dd.sigs);
+        }
+        if (err != PLIST_ERR_SUCCESS) {
+            hash_table_destroy(dd.canon);
+            return err;
+        }
+        canon = dd.canon;
     }
 
     //list of objects
     objects = ptr_array_new(4096);
     if (!objects) {
+        hash_table_destroy(canon);
         return PLIST_ERR_NO_MEM;
     }
-    //hashtable to write only once same nodes
-    ref_table = hash_table_new(plist_data_hash, plist_data_compare, free);
+    //hashtable to write only once same nodes; with deduplication the
+    //canonical nodes take care of that and nodes are looked up directly
+    if (canon) {
+        ref_table = hash_table_new(plist_node_ptr_hash, plist_node_ptr_compare, NULL);
+    } else {
+        ref_table = hash_table_new(plist_data_hash, plist_data_compare, NULL);
+    }
     if (!ref_table) {
         ptr_array_free(objects);
+        hash_table_destroy(canon);
         return PLIST_ERR_NO_MEM;
     }
     //hashtable for circular reference detection
@@ -1396,6 +2788,7 @@ plist_err_t plist_to_bin(plist_t plist, char **plist_bin, uint32_t * length)
     if (!in_stack) {
         ptr_array_free(objects);
         hash_table_destroy(ref_table);
+        hash_table_destroy(canon);
         return PLIST_ERR_NO_MEM;
     }
 
@@ -1403,114 +2796,56 @@ plist_err_t plist_to_bin(plist_t plist, char **plist_bin, uint32_t * length)
     ser_s.objects = objects;
     ser_s.ref_table = ref_table;
     ser_s.in_stack = in_stack;
+    ser_s.canon = canon;
     plist_err_t err = serialize_plist((node_t)plist, &ser_s, 0);
+    //no longer needed
+    hash_table_destroy(in_stack);
+    hash_table_destroy(canon);
+    ser_s.in_stack = NULL;
+    ser_s.canon = NULL;
     if (err != PLIST_ERR_SUCCESS) {
         ptr_array_free(objects);
         hash_table_destroy(ref_table);
-        hash_table_destroy(in_stack);
         return err;
     }
-    //no longer needed
-    hash_table_destroy(in_stack);
-    ser_s.in_stack = NULL;
 
     //now stream to output buffer
     offset_size = 0;			//unknown yet
-    objects_len = objects->len;
-    ref_size = get_needed_bytes(objects_len);
+    ref_size = get_needed_bytes(objects->len);
     num_objects = objects->len;
     root_object = 0;			//root is first in list
     offset_table_index = 0;		//unknown yet
 
-    //figure out the storage size required
-    uint64_t req = 0;
-    for (i = 0; i < num_objects; i++)
-    {
-        node_t node = (node_t)ptr_array_index(objects, i);
-        plist_data_t data = plist_get_data(node);
-        uint64_t size;
-        uint8_t bsize;
-        switch (data->type)
-        {
-        case PLIST_NULL:
-        case PLIST_BOOLEAN:
-            req += 1;
-            break;
-        case PLIST_KEY:
-        case PLIST_STRING:
-            req += 1;
-            if (data->length >= 15) {
-                bsize = get_needed_bytes(data->length);
-                if (bsize == 3) bsize = 4;
-                req += 1;
-                req += bsize;
-            }
-            if ( is_ascii_string(data->strval, data->length) )
-            {
-                req += data->length;
-            }
-            else
-            {
-                req += data->length * 2;
-            }
-            break;
-        case PLIST_REAL:
-            size = get_real_bytes(data->realval);
-            req += 1;
-            req += size;
-            break;
-        case PLIST_DATE:
-            req += 9;
-            break;
-        case PLIST_ARRAY:
-            size = node_n_children(node);
-            req += 1;
-            if (size >= 15) {
-                bsize = get_needed_bytes(size);
-                if (bsize == 3) bsize = 4;
-                req += 1;
-                req += bsize;
-            }
-            req += size * ref_size;
-            break;
-        case PLIST_DICT:
-            size = node_n_children(node) / 2;
-            req += 1;
-            if (size >= 15) {
-                bsize = get_needed_bytes(size);
-                if (bsize == 3) bsize = 4;
-                req += 1;
-                req += bsize;
-            }
-            req += size * 2 * ref_size;
-            break;
-        default:
-            size = data->length;
-            req += 1;
-            if (size >= 15) {
-                bsize = get_needed_bytes(size);
-                if (bsize == 3) bsize = 4;
-                req += 1;
-                req += bsize;
-            }
-            req += data->length;
-            break;
+    offsets = (uint64_t *) malloc(num_objects * sizeof(uint64_t));
+    str_classes = (uint8_t *) calloc(num_objects, sizeof(uint8_t));
+    if (!offsets || !str_classes) {
+        free(offsets);
+        free(str_classes);
+        ptr_array_free(objects);
+        hash_table_destroy(ref_table);
+        return PLIST_ERR_NO_MEM;
+    }
+
+    num_threads = bplist_write_threads(num_threads, num_objects);
+    if (num_threads > 1) {
+        //the parallel writer splits the objects by their running size
+        for (i = 0; i < num_objects; i++) {
+            objects_size += bplist_object_size((node_t)ptr_array_index(objects, i), ref_size, &str_classes[i]);
+            offsets[i] = objects_size;
         }
     }
-    // add size of magic
-    req += BPLIST_MAGIC_SIZE;
-    req += BPLIST_VERSION_SIZE;
-    // add size of offset table
-    req += get_needed_bytes(req) * num_objects;
-    // add size of trailer
-    req += sizeof(bplist_trailer_t);
 
-    //setup a dynamic bytes array to store bplist in
-    bplist_buff = byte_array_new(req);
     if (!bplist_buff) {
-        ptr_array_free(objects);
-        hash_table_destroy(ref_table);
-        return PLIST_ERR_NO_MEM;
+        //setup a dynamic bytes array to store bplist in
+        bplist_buff = byte_array_new((num_threads > 1) ? bplist_total_size(objects_size, num_objects) : bplist_estimate_size(objects, ref_size, str_classes));
+        if (!bplist_buff || !bplist_buff->data) {
+            byte_array_free(bplist_buff);
+            free(offsets);
+            free(str_classes);
+            ptr_array_free(objects);
+            hash_table_destroy(ref_table);
+            return PLIST_ERR_NO_MEM;
+        }
     }
 
     //set magic number and version
@@ -1518,78 +2853,19 @@ plist_err_t plist_to_bin(plist_t plist, char **plist_bin, uint32_t * length)
     byte_array_append(bplist_buff, BPLIST_VERSION, BPLIST_VERSION_SIZE);
 
     //write objects and table
-    offsets = (uint64_t *) malloc(num_objects * sizeof(uint64_t));
-    if (!offsets) {
-        return PLIST_ERR_NO_MEM;
-    }
-    for (i = 0; i < num_objects; i++)
-    {
-
-        plist_data_t data = plist_get_data(ptr_array_index(objects, i));
-        offsets[i] = bplist_buff->len;
-
-        switch (data->type)
-        {
-        case PLIST_NULL: {
-            uint8_t b = 0;
-            byte_array_append(bplist_buff, &b, 1);
-            break;
-        }
-        case PLIST_BOOLEAN: {
-            uint8_t b = data->boolval ? BPLIST_TRUE : BPLIST_FALSE;
-            byte_array_append(bplist_buff, &b, 1);
-            break;
-        }
-        case PLIST_INT:
-            if (data->length == 16) {
-                write_uint(bplist_buff, data->intval);
-            } else {
-                write_int(bplist_buff, data->intval);
-            }
-            break;
-
-        case PLIST_REAL:
-            write_real(bplist_buff, data->realval);
-            break;
-
-        case PLIST_KEY:
-        case PLIST_STRING:
-            if ( is_ascii_string(data->strval, data->length) )
-            {
-                write_string(bplist_buff, data->strval, data->length);
-            }
-            else
-            {
-                write_unicode(bplist_buff, data->strval, data->length);
-            }
-            break;
-        case PLIST_DATA:
-            write_data(bplist_buff, data->buff, data->length);
-            break;
-        case PLIST_ARRAY:
-            write_array(bplist_buff, (node_t)ptr_array_index(objects, i), ref_table, ref_size);
-            break;
-        case PLIST_DICT:
-            write_dict(bplist_buff, (node_t)ptr_array_index(objects, i), ref_table, ref_size);
-            break;
-        case PLIST_DATE:
-            write_date(bplist_buff, data->realval);
-            break;
-        case PLIST_UID:
-            write_uid(bplist_buff, data->intval);
-            break;
-        default:
-            break;
-        }
+    if (num_threads > 1) {
+        write_objects_parallel(bplist_buff, objects, ref_table, ref_size, offsets, str_classes, num_threads);
+    } else {
+        write_objects(bplist_buff, objects, 0, num_objects, ref_table, ref_size, offsets, str_classes);
     }
 
     //free intermediate objects
     ptr_array_free(objects);
     hash_table_destroy(ref_table);
+    free(str_classes);
 
     //write offsets
-    buff_len = bplist_buff->len;
-    offset_size = get_needed_bytes(buff_len);
+    offset_size = get_needed_bytes(bplist_buff->len);
     offset_table_index = bplist_buff->len;
     for (i = 0; i < num_objects; i++) {
         uint64_t offset = be64toh(offsets[i]);
@@ -1607,6 +2883,60 @@ plist_err_t plist_to_bin(plist_t plist, char **plist_bin, uint32_t * length)
 
     byte_array_append(bplist_buff, &trailer, sizeof(bplist_trailer_t));
 
+    if (out_buffer) {
+        *out_buffer = bplist_buff;
+    }
+    if (byte_array_flush(bplist_buff) < 0) {
+        return PLIST_ERR_IO;
+    }
+
+    return PLIST_ERR_SUCCESS;
+}
+
+plist_err_t plist_to_bin(plist_t plist, char **plist_bin, uint32_t * length)
+{
+    uint64_t length64 = 0;
+    if (!length) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+    plist_err_t err = plist_to_bin64(plist, plist_bin, &length64);
+    return plist_output_length32(err, plist_bin, length64, length);
+}
+
+plist_err_t plist_to_bin64(plist_t plist, char **plist_bin, uint64_t * length)
+{
+    return plist_to_bin_with_options64(plist, plist_bin, length, PLIST_OPT_NONE);
+}
+
+plist_err_t plist_to_bin_with_options(plist_t plist, char **plist_bin, uint32_t * length, plist_write_options_t options)
+{
+    uint64_t length64 = 0;
+    if (!length) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+    plist_err_t err = plist_to_bin_with_options64(plist, plist_bin, &length64, options);
+    return plist_output_length32(err, plist_bin, length64, length);
+}
+
+plist_err_t plist_to_bin_with_options64(plist_t plist, char **plist_bin, uint64_t * length, plist_write_options_t options)
+{
+    return plist_to_bin_ex(plist, plist_bin, length, options, 1);
+}
+
+plist_err_t plist_to_bin_ex(plist_t plist, char **plist_bin, uint64_t * length, plist_write_options_t options, unsigned int num_threads)
+{
+    bytearray_t *bplist_buff = NULL;
+
+    //check for valid input
+    if (!plist || !plist_bin || !length) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+
+    plist_err_t err = plist_write_bin(plist, NULL, &bplist_buff, options, num_threads);
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
+    }
+
     //set output buffer and size
     *plist_bin = (char*)bplist_buff->data;
     *length = bplist_buff->len;
@@ -1616,3 +2946,303 @@ plist_err_t plist_to_bin(plist_t plist, char **plist_bin, uint32_t * length)
 
     return PLIST_ERR_SUCCESS;
 }
+
+plist_err_t plist_to_bin_stream(plist_t plist, FILE *stream, plist_write_options_t options)
+{
+    if (!plist || !stream) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+    bytearray_t *out = byte_array_new_for_stream(stream);
+    if (!out) {
+        return PLIST_ERR_NO_MEM;
+    }
+    plist_err_t err = plist_write_bin(plist, out, NULL, options, 1);
+    byte_array_free(out);
+    return err;
+}
+
+plist_err_t plist_to_bin_callback(plist_t plist, plist_write_func_t write_func, void *user_data, plist_write_options_t options)
+{
+    if (!plist || !write_func) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+    bytearray_t *out = byte_array_new_for_callback(write_func, user_data);
+    if (!out) {
+        return PLIST_ERR_NO_MEM;
+    }
+    plist_err_t err = plist_write_bin(plist, out, NULL, options, 1);
+    byte_array_free(out);
+    return err;
+}
+
+plist_err_t plist_to_bin_with_callback(plist_t plist, plist_write_func_t write_func, void *user_data)
+{
+    return plist_to_bin_callback(plist, write_func, user_data, PLIST_OPT_NONE);
+}
+
+/* frame of the stack of plist_bin_parse_events(), one per open container */
+struct bplist_eframe {
+    uint64_t node_index;
+    const char* refs;
+    uint64_t size;
+    uint64_t next;
+    int dict;
+};
+
+struct bplist_event_parser {
+    struct bplist_data *bplist;
+    const plist_event_handler_t *handler;
+    void *user_data;
+    struct bplist_eframe *stack;
+    uint32_t stack_len;
+    /* UTF-8 conversion buffer for BPLIST_UNICODE strings */
+    char *buf;
+    size_t buf_size;
+};
+
+/* reads the object index stored at ref */
+static plist_err_t bin_event_ref(struct bplist_data *bplist, const char *ref, uint64_t *node_index)
+{
+    if (ref < bplist->data || ref + bplist->ref_size > bplist->offset_table) {
+        PLIST_BIN_ERR("%s: reference is outside of valid range\n", __func__);
+        return PLIST_ERR_PARSE;
+    }
+    *node_index = UINT_TO_HOST(ref, bplist->ref_size);
+    if (*node_index >= bplist->num_objects) {
+        PLIST_BIN_ERR("%s: object index (%" PRIu64 ") must be smaller than the number of objects (%" PRIu64 ")\n", __func__, *node_index, bplist->num_objects);
+        return PLIST_ERR_PARSE;
+    }
+    return PLIST_ERR_SUCCESS;
+}
+
+/* reports the object at node_index as a key or a value; containers with
+ * children are pushed onto the stack, their end event follows once all
+ * children are reported */
+static plist_err_t bin_event_object(struct bplist_event_parser *p, uint64_t node_index, int is_key)
+{
+    struct bplist_data *bplist = p->bplist;
+    const plist_event_handler_t *handler = p->handler;
+    uint64_t poffset_table = (uint64_t)(uintptr_t)bplist->offset_table;
+    const char *ptr;
+    uint16_t type = 0;
+    uint64_t size = 0;
+    uint64_t pobject;
+    uint32_t i;
+
+    ptr = bplist_object_ptr(bplist, node_index);
+    if (!ptr) {
+        return PLIST_ERR_PARSE;
+    }
+    if (p->stack_len > PLIST_MAX_NESTING_DEPTH) {
+        PLIST_BIN_ERR("maximum nesting depth (%u) exceeded\n", (uint32_t)PLIST_MAX_NESTING_DEPTH);
+        return PLIST_ERR_MAX_NESTING;
+    }
+    if (parse_bin_object_header(bplist, &ptr, &type, &size) < 0) {
+        return PLIST_ERR_PARSE;
+    }
+    pobject = (uint64_t)(uintptr_t)ptr;
+
+    if (is_key && type != BPLIST_STRING && type != BPLIST_UNICODE) {
+        PLIST_BIN_ERR("%s: invalid node type for key\n", __func__);
+        return PLIST_ERR_PARSE;
+    }
+
+    switch (type) {
+    case BPLIST_NULL:
+        if (size == BPLIST_NULL) {
+            return PLIST_EVENT(handler, value, p->user_data, PLIST_NULL, NULL, 0);
+        }
+        if (size == BPLIST_TRUE || size == BPLIST_FALSE) {
+            uint8_t boolval = (size == BPLIST_TRUE);
+            return PLIST_EVENT(handler, value, p->user_data, PLIST_BOOLEAN, &boolval, 1);
+        }
+        PLIST_BIN_ERR("%s: unexpected node type 0x%02x\n", __func__, (unsigned int)(type | size));
+        return PLIST_ERR_PARSE;
+    case BPLIST_INT: {
+        if (size > 4 || pobject + (uint64_t)(1 << size) > poffset_table) {
+            PLIST_BIN_ERR("%s: invalid BPLIST_INT node\n", __func__);
+            return PLIST_ERR_PARSE;
+        }
+        uint64_t intval = UINT_TO_HOST(ptr, 1 << size);
+        return PLIST_EVENT(handler, value, p->user_data, PLIST_INT, &intval, (size == 4) ? 16 : sizeof(uint64_t));
+    }
+    case BPLIST_REAL:
+    case BPLIST_DATE: {
+        double realval;
+        if (pobject + (uint64_t)(1 << size) > poffset_table || (size != 3 && (size != 2 || type == BPLIST_DATE))) {
+            PLIST_BIN_ERR("%s: invalid BPLIST_REAL or BPLIST_DATE node\n", __func__);
+            return PLIST_ERR_PARSE;
+        }
+        if (size == 2) {
+            uint32_t ival;
+            float fval;
+            memcpy(&ival, ptr, sizeof(uint32_t));
+            ival = float_bswap32(ival);
+            memcpy(&fval, &ival, sizeof(float));
+            realval = fval;
+        } else {
+            uint64_t ival;
+            memcpy(&ival, ptr, sizeof(uint64_t));
+            ival = float_bswap64(ival);
+            memcpy(&realval, &ival, sizeof(double));
+        }
+        return PLIST_EVENT(handler, value, p->user_data, (type == BPLIST_DATE) ? PLIST_DATE : PLIST_REAL, &realval, sizeof(double));
+    }
+    case BPLIST_DATA:
+        if (pobject + size < pobject || pobject + size > poffset_table) {
+            PLIST_BIN_ERR("%s: BPLIST_DATA data bytes point outside of valid range\n", __func__);
+            return PLIST_ERR_PARSE;
+        }
+        return PLIST_EVENT(handler, value, p->user_data, PLIST_DATA, ptr, size);
+    case BPLIST_STRING: {
+        if (pobject + size < pobject || pobject + size > poffset_table) {
+            PLIST_BIN_ERR("%s: BPLIST_STRING data bytes point outside of valid range\n", __func__);
+            return PLIST_ERR_PARSE;
+        }
+        size_t len = strnlen(ptr, size);
+        if (is_key) {
+            return PLIST_EVENT(handler, key, p->user_data, ptr, len);
+        }
+        return PLIST_EVENT(handler, value, p->user_data, PLIST_STRING, ptr, len);
+    }
+    case BPLIST_UNICODE: {
+        /* an empty UTF-16 string does not decode */
+        if (size == 0 || size*2 < size || pobject + size*2 < pobject || pobject + size*2 > poffset_table) {
+            PLIST_BIN_ERR("%s: invalid BPLIST_UNICODE node\n", __func__);
+            return PLIST_ERR_PARSE;
+        }
+        size_t len = utf16be_utf8_length((const unsigned char*)ptr, size);
+        if (len + 1 > p->buf_size) {
+            char *buf = (char*)realloc(p->buf, len + 1);
+            if (!buf) {
+                PLIST_BIN_ERR("%s: Could not allocate %" PRIu64 " bytes\n", __func__, (uint64_t)len + 1);
+                return PLIST_ERR_NO_MEM;
+            }
+            p->buf = buf;
+            p->buf_size = len + 1;
+        }
+        utf16be_to_utf8((const unsigned char*)ptr, size, p->buf);
+        p->buf[len] = '\0';
+        if (is_key) {
+            return PLIST_EVENT(handler, key, p->user_data, p->buf, len);
+        }
+        return PLIST_EVENT(handler, value, p->user_data, PLIST_STRING, p->buf, len);
+    }
+    case BPLIST_UID: {
+        if (pobject + size+1 > poffset_table) {
+            PLIST_BIN_ERR("%s: BPLIST_UID data bytes point outside of valid range\n", __func__);
+            return PLIST_ERR_PARSE;
+        }
+        uint64_t uid = UINT_TO_HOST(ptr, size+1);
+        if (uid > UINT32_MAX) {
+            PLIST_BIN_ERR("%s: value %" PRIu64 " too large for UID node (must be <= %u)\n", __func__, uid, UINT32_MAX);
+            return PLIST_ERR_PARSE;
+        }
+        return PLIST_EVENT(handler, value, p->user_data, PLIST_UID, &uid, sizeof(uint64_t));
+    }
+    case BPLIST_SET:
+    case BPLIST_ARRAY:
+    case BPLIST_DICT: {
+        plist_err_t err;
+        int dict = (type == BPLIST_DICT);
+        if (pobject + size < pobject || pobject + size > poffset_table) {
+            PLIST_BIN_ERR("%s: data bytes of node type 0x%02x point outside of valid range\n", __func__, type);
+            return PLIST_ERR_PARSE;
+        }
+        for (i = 0; i < p->stack_len; i++) {
+            if (p->stack[i].node_index == node_index) {
+                PLIST_BIN_ERR("recursion detected in binary plist\n");
+                return PLIST_ERR_CIRCULAR_REF;
+            }
+        }
+        err = (dict) ? PLIST_EVENT(handler, begin_dict, p->user_data) : PLIST_EVENT(handler, begin_array, p->user_data);
+        if (err != PLIST_ERR_SUCCESS) {
+            return err;
+        }
+        if (size == 0) {
+            return (dict) ? PLIST_EVENT(handler, end_dict, p->user_data) : PLIST_EVENT(handler, end_array, p->user_data);
+        }
+        /* the stack never gets deeper than PLIST_MAX_NESTING_DEPTH + 1 frames */
+        struct bplist_eframe *frame = &p->stack[p->stack_len++];
+        frame->node_index = node_index;
+        frame->refs = ptr;
+        frame->size = size;
+        frame->next = 0;
+        frame->dict = dict;
+        return PLIST_ERR_SUCCESS;
+    }
+    default:
+        PLIST_BIN_ERR("%s: unexpected node type 0x%02x\n", __func__, type);
+        return PLIST_ERR_PARSE;
+    }
+}
+
+plist_err_t plist_bin_parse_events(const char *plist_bin, uint64_t length, const plist_event_handler_t *handler, void *user_data)
+{
+    struct bplist_data bplist;
+    struct bplist_event_parser p;
+    uint64_t root_object = 0;
+    uint64_t err_offset = 0;
+    plist_err_t err;
+
+    if (!plist_bin || length == 0 || !handler) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+
+    err = parse_bin_trailer(plist_bin, length, &bplist, &root_object, &err_offset);
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
+    }
+
+    p.bplist = &bplist;
+    p.handler = handler;
+    p.user_data = user_data;
+    p.stack_len = 0;
+    p.buf = NULL;
+    p.buf_size = 0;
+    p.stack = (struct bplist_eframe*)malloc((PLIST_MAX_NESTING_DEPTH + 1) * sizeof(struct bplist_eframe));
+    if (!p.stack) {
+        return PLIST_ERR_NO_MEM;
+    }
+
+    err = bin_event_object(&p, root_object, 0);
+    while (err == PLIST_ERR_SUCCESS && p.stack_len > 0) {
+        struct bplist_eframe *frame = &p.stack[p.stack_len - 1];
+        uint64_t j = frame->next;
+
+        if (j == frame->size) {
+            p.stack_len--;
+            err = (frame->dict) ? PLIST_EVENT(handler, end_dict, user_data) : PLIST_EVENT(handler, end_array, user_data);
+            continue;
+        }
+        frame->next++;
+
+        if (frame->dict) {
+            const char *key_ref = frame->refs + j * bplist.ref_size;
+            const char *val_ref = frame->refs + (j + frame->size) * bplist.ref_size;
+            uint64_t key_index = 0;
+            uint64_t val_index = 0;
+            err = bin_event_ref(&bplist, key_ref, &key_index);
+            if (err == PLIST_ERR_SUCCESS) {
+                err = bin_event_ref(&bplist, val_ref, &val_index);
+            }
+            if (err == PLIST_ERR_SUCCESS) {
+                err = bin_event_object(&p, key_index, 1);
+            }
+            if (err == PLIST_ERR_SUCCESS) {
+                err = bin_event_object(&p, val_index, 0);
+            }
+        } else {
+            const char *ref = frame->refs + j * bplist.ref_size;
+            uint64_t index = 0;
+            err = bin_event_ref(&bplist, ref, &index);
+            if (err == PLIST_ERR_SUCCESS) {
+                err = bin_event_object(&p, index, 0);
+            }
+        }
+    }
+
+    free(p.stack);
+    free(p.buf);
+    return err;
+}
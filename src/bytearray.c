@@ -22,6 +22,7 @@
 #include "bytearray.h"
 
 #define PAGE_SIZE 4096
+#define CALLBACK_BUFFER_SIZE (16*PAGE_SIZE)
 
 bytearray_t *byte_array_new(size_t initial)
 {
@@ -30,6 +31,10 @@ bytearray_t *byte_array_new(size_t initial)
 	a->data = malloc(a->capacity);
 	a->len = 0;
 	a->stream = NULL;
+	a->write_func = NULL;
+	a->user_data = NULL;
+	a->buffered = 0;
+	a->error = 0;
 	return a;
 }
 
@@ -40,6 +45,29 @@ bytearray_t *byte_array_new_for_stream(FILE *stream)
 	a->data = NULL;
 	a->len = 0;
 	a->stream = stream;
+	a->write_func = NULL;
+	a->user_data = NULL;
+	a->buffered = 0;
+	a->error = 0;
+	return a;
+}
+
+bytearray_t *byte_array_new_for_callback(byte_array_write_func_t write_func, void *user_data)
+{
+	bytearray_t *a = (bytearray_t*)malloc(sizeof(bytearray_t));
+	if (!a) return NULL;
+	a->capacity = CALLBACK_BUFFER_SIZE;
+	a->data = malloc(a->capacity);
+	if (!a->data) {
+		free(a);
+		return NULL;
+	}
+	a->len = 0;
+	a->stream = NULL;
+	a->write_func = write_func;
+	a->user_data = user_data;
+	a->buffered = 0;
+	a->error = 0;
 	return a;
 }
 
@@ -54,14 +82,43 @@ void byte_array_free(bytearray_t *ba)
 
 void byte_array_grow(bytearray_t *ba, size_t amount)
 {
-	if (ba->stream) {
+	if (ba->stream || ba->write_func) {
 		return;
 	}
+	/* grow by at least the current size so appending stays linear */
+	if (amount < ba->capacity) {
+		amount = ba->capacity;
+	}
 	size_t increase = (amount > PAGE_SIZE) ? (amount+(PAGE_SIZE-1)) & (~(PAGE_SIZE-1)) : PAGE_SIZE;
 	ba->data = realloc(ba->data, ba->capacity + increase);
 	ba->capacity += increase;
 }
 
+static void byte_array_write_out(bytearray_t *ba, const void *buf, size_t len)
+{
+	if (ba->error) return;
+	if (ba->write_func(buf, len, ba->user_data) < len) {
+#if DEBUG
+		fprintf(stderr, "ERROR: Failed to write to callback.\n");
+#endif
+		ba->error = 1;
+	}
+}
+
+int byte_array_flush(bytearray_t *ba)
+{
+	if (!ba) return -1;
+	if (ba->write_func && ba->buffered > 0) {
+		byte_array_write_out(ba, ba->data, ba->buffered);
+		ba->buffered = 0;
+	} else if (ba->stream && !ba->error) {
+		if (fflush(ba->stream) != 0) {
+			ba->error = 1;
+		}
+	}
+	return (ba->error) ? -1 : 0;
+}
+
 void byte_array_append(bytearray_t *ba, void *buf, size_t len)
 {
 	if (!ba || (!ba->stream && !ba->data) || (len <= 0)) return;
@@ -70,6 +127,17 @@ void byte_array_append(bytearray_t *ba, void *buf, size_t len)
 #if DEBUG
 			fprintf(stderr, "ERROR: Failed to write to stream.\n");
 #endif
+			ba->error = 1;
+		}
+	} else if (ba->write_func) {
+		if (len > ba->capacity - ba->buffered) {
+			byte_array_flush(ba);
+		}
+		if (len >= ba->capacity) {
+			byte_array_write_out(ba, buf, len);
+		} else {
+			memcpy(((char*)ba->data) + ba->buffered, buf, len);
+			ba->buffered += len;
 		}
 	} else {
 		size_t remaining = ba->capacity-ba->len;
@@ -23,17 +23,25 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+typedef size_t (*byte_array_write_func_t)(const void *buf, size_t len, void *user_data);
+
 typedef struct bytearray_t {
 	void *data;
 	size_t len;
 	size_t capacity;
 	FILE *stream;
+	byte_array_write_func_t write_func;
+	void *user_data;
+	size_t buffered;
+	int error;
 } bytearray_t;
 
 bytearray_t *byte_array_new(size_t initial);
 bytearray_t *byte_array_new_for_stream(FILE *stream);
+bytearray_t *byte_array_new_for_callback(byte_array_write_func_t write_func, void *user_data);
 void byte_array_free(bytearray_t *ba);
 void byte_array_grow(bytearray_t *ba, size_t amount);
 void byte_array_append(bytearray_t *ba, void *buf, size_t len);
+int byte_array_flush(bytearray_t *ba);
 
 #endif
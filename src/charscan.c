@@ -0,0 +1,218 @@
+/*
+ * charscan.c
+ * vectorized character scanning helpers
+ *
+ * Copyright (c) 2026 Nikias Bassen, All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <string.h>
+#include <stdint.h>
+#include "charscan.h"
+#include "thread.h"
+
+/*
+ * The kernels compare a whole block of input against every character of
+ * interest at once and use the resulting bit mask to jump straight to the
+ * first hit. SSE2 is part of the x86_64 baseline; the AVX2 variants are
+ * compiled with a target attribute and only selected at runtime when the
+ * CPU supports them. Everything else uses the portable scalar loops.
+ */
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__))
+#define CHAR_SCAN_SSE2 1
+#include <emmintrin.h>
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(_MSC_VER)
+#define CHAR_SCAN_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+#if defined(_MSC_VER) && defined(CHAR_SCAN_SSE2)
+#include <intrin.h>
+static inline unsigned int ctz32(uint32_t x)
+{
+	unsigned long r;
+	_BitScanForward(&r, x);
+	return (unsigned int)r;
+}
+#else
+#define ctz32(x) ((unsigned int)__builtin_ctz(x))
+#endif
+
+static inline int is_ws(unsigned char c)
+{
+	return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+}
+
+static const char* skip_ws_scalar(const char *p, const char *end)
+{
+	while (p < end && is_ws(*p)) {
+		p++;
+	}
+	return p;
+}
+
+static const char* find_any_scalar(const char *p, const char *end, const char *set, int numchars)
+{
+	int i;
+	for (; p < end; p++) {
+		for (i = 0; i < numchars; i++) {
+			if (*p == set[i]) {
+				return p;
+			}
+		}
+	}
+	return end;
+}
+
+#ifdef CHAR_SCAN_SSE2
+static const char* skip_ws_sse2(const char *p, const char *end)
+{
+	const __m128i sp = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i lf = _mm_set1_epi8('\n');
+	while (end - p >= 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)p);
+		__m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, sp), _mm_cmpeq_epi8(x, tab)),
+		                         _mm_or_si128(_mm_cmpeq_epi8(x, cr), _mm_cmpeq_epi8(x, lf)));
+		uint32_t mask = ~(uint32_t)_mm_movemask_epi8(m) & 0xFFFF;
+		if (mask) {
+			return p + ctz32(mask);
+		}
+		p += 16;
+	}
+	return skip_ws_scalar(p, end);
+}
+
+static const char* find_any_sse2(const char *p, const char *end, const char *set, int numchars)
+{
+	__m128i v[CHAR_SCAN_MAX_SET];
+	int i;
+	for (i = 0; i < numchars; i++) {
+		v[i] = _mm_set1_epi8(set[i]);
+	}
+	while (end - p >= 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)p);
+		__m128i m = _mm_cmpeq_epi8(x, v[0]);
+		for (i = 1; i < numchars; i++) {
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(x, v[i]));
+		}
+		uint32_t mask = (uint32_t)_mm_movemask_epi8(m);
+		if (mask) {
+			return p + ctz32(mask);
+		}
+		p += 16;
+	}
+	return find_any_scalar(p, end, set, numchars);
+}
+#endif
+
+#ifdef CHAR_SCAN_AVX2
+__attribute__((target("avx2")))
+static const char* skip_ws_avx2(const char *p, const char *end)
+{
+	const __m256i sp = _mm256_set1_epi8(' ');
+	const __m256i tab = _mm256_set1_epi8('\t');
+	const __m256i cr = _mm256_set1_epi8('\r');
+	const __m256i lf = _mm256_set1_epi8('\n');
+	while (end - p >= 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)p);
+		__m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, sp), _mm256_cmpeq_epi8(x, tab)),
+		                            _mm256_or_si256(_mm256_cmpeq_epi8(x, cr), _mm256_cmpeq_epi8(x, lf)));
+		uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(m);
+		if (mask) {
+			return p + ctz32(mask);
+		}
+		p += 32;
+	}
+	return skip_ws_sse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char* find_any_avx2(const char *p, const char *end, const char *set, int numchars)
+{
+	__m256i v[CHAR_SCAN_MAX_SET];
+	int i;
+	for (i = 0; i < numchars; i++) {
+		v[i] = _mm256_set1_epi8(set[i]);
+	}
+	while (end - p >= 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)p);
+		__m256i m = _mm256_cmpeq_epi8(x, v[0]);
+		for (i = 1; i < numchars; i++) {
+			m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, v[i]));
+		}
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(m);
+		if (mask) {
+			return p + ctz32(mask);
+		}
+		p += 32;
+	}
+	return find_any_sse2(p, end, set, numchars);
+}
+#endif
+
+typedef const char* (*skip_ws_func_t)(const char *p, const char *end);
+typedef const char* (*find_any_func_t)(const char *p, const char *end, const char *set, int numchars);
+
+static skip_ws_func_t skip_ws_impl = NULL;
+static find_any_func_t find_any_impl = NULL;
+static thread_once_t char_scan_once = THREAD_ONCE_INIT;
+
+/* Picks the best implementation for the running CPU, called once through
+ * thread_once() */
+static void char_scan_select(void)
+{
+	skip_ws_func_t sw = skip_ws_scalar;
+	find_any_func_t fa = find_any_scalar;
+#ifdef CHAR_SCAN_SSE2
+	sw = skip_ws_sse2;
+	fa = find_any_sse2;
+#endif
+#ifdef CHAR_SCAN_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		sw = skip_ws_avx2;
+		fa = find_any_avx2;
+	}
+#endif
+	find_any_impl = fa;
+	skip_ws_impl = sw;
+}
+
+const char* char_scan_skip_ws(const char *p, const char *end)
+{
+	/* most calls land directly on markup, avoid the indirect call then */
+	if (p < end && !is_ws(*p)) {
+		return p;
+	}
+	thread_once(&char_scan_once, char_scan_select);
+	return skip_ws_impl(p, end);
+}
+
+const char* char_scan_find_any(const char *p, const char *end, const char *set, int numchars)
+{
+	if (p >= end) {
+		return end;
+	}
+	if (numchars == 1) {
+		const char *r = (const char*)memchr(p, set[0], (size_t)(end - p));
+		return (r) ? r : end;
+	}
+	thread_once(&char_scan_once, char_scan_select);
+	return find_any_impl(p, end, set, numchars);
+}
@@ -0,0 +1,36 @@
+/*
+ * charscan.h
+ * header file for vectorized character scanning helpers
+ *
+ * Copyright (c) 2026 Nikias Bassen, All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef CHARSCAN_H
+#define CHARSCAN_H
+#include <stddef.h>
+
+/* maximum number of characters accepted by char_scan_find_any() */
+#define CHAR_SCAN_MAX_SET 8
+
+/* Returns a pointer to the first byte in [p, end) that is not XML
+ * whitespace (space, tab, CR, LF), or end if there is none. */
+const char* char_scan_skip_ws(const char *p, const char *end);
+
+/* Returns a pointer to the first byte in [p, end) that equals one of the
+ * numchars (1..CHAR_SCAN_MAX_SET) bytes in set, or end if there is none. */
+const char* char_scan_find_any(const char *p, const char *end, const char *set, int numchars);
+
+#endif
@@ -20,13 +20,60 @@
  */
 #include "hashtable.h"
 
+/*
+ * Open addressing with linear probing. The slot array always has a
+ * power-of-two capacity and is grown once it gets more than 3/4 full.
+ * Removal uses backward shift deletion, so no tombstones are needed.
+ */
+
+#define HASH_TABLE_MIN_CAPACITY 16
+
+static unsigned int hash_mix(unsigned int h)
+{
+	/* murmur3 finalizer, spreads weak hashes over the low bits */
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+static int hash_table_resize(hashtable_t* ht, size_t capacity)
+{
+	hashentry_t* entries = (hashentry_t*)calloc(capacity, sizeof(hashentry_t));
+	if (!entries) {
+		return -1;
+	}
+	size_t mask = capacity - 1;
+	size_t i;
+	for (i = 0; i < ht->capacity; i++) {
+		hashentry_t* e = &ht->entries[i];
+		if (!e->key) continue;
+		size_t idx = e->hash & mask;
+		while (entries[idx].key) {
+			idx = (idx + 1) & mask;
+		}
+		entries[idx] = *e;
+	}
+	free(ht->entries);
+	ht->entries = entries;
+	ht->capacity = capacity;
+	return 0;
+}
+
 hashtable_t* hash_table_new(hash_func_t hash_func, compare_func_t compare_func, free_func_t free_func)
 {
 	hashtable_t* ht = (hashtable_t*)malloc(sizeof(hashtable_t));
-	int i;
-	for (i = 0; i < 4096; i++) {
-		ht->entries[i] = NULL;
+	if (!ht) {
+		return NULL;
 	}
+	ht->entries = (hashentry_t*)calloc(HASH_TABLE_MIN_CAPACITY, sizeof(hashentry_t));
+	if (!ht->entries) {
+		free(ht);
+		return NULL;
+	}
+	ht->capacity = HASH_TABLE_MIN_CAPACITY;
 	ht->count = 0;
 	ht->hash_func = hash_func;
 	ht->compare_func = compare_func;
@@ -38,72 +85,90 @@ void hash_table_destroy(hashtable_t *ht)
 {
 	if (!ht) return;
 
-	int i = 0;
-	for (i = 0; i < 4096; i++) {
-		if (ht->entries[i]) {
-			hashentry_t* e = ht->entries[i];
-			while (e) {
-				if (ht->free_func) {
-					ht->free_func(e->value);
-				}
-				hashentry_t* old = e;
-				e = e->next;
-				free(old);
+	if (ht->free_func) {
+		size_t i;
+		for (i = 0; i < ht->capacity; i++) {
+			if (ht->entries[i].key) {
+				ht->free_func(ht->entries[i].value);
 			}
 		}
 	}
+	free(ht->entries);
 	free(ht);
 }
 
+int hash_table_reserve(hashtable_t* ht, size_t count)
+{
+	if (!ht) return -1;
+
+	size_t capacity = ht->capacity;
+	while (count * 4 > capacity * 3) {
+		capacity <<= 1;
+	}
+	if (capacity == ht->capacity) {
+		return 0;
+	}
+	return hash_table_resize(ht, capacity);
+}
+
 void hash_table_insert(hashtable_t* ht, void *key, void *value)
 {
 	if (!ht || !key) return;
 
-	unsigned int hash = ht->hash_func(key);
+	unsigned int hash = hash_mix(ht->hash_func(key));
+	size_t mask = ht->capacity - 1;
+	size_t idx = hash & mask;
 
-	int idx0 = hash & 0xFFF;
-
-	// get the idx0 list
-	hashentry_t* e = ht->entries[idx0];
-	while (e) {
-		if (ht->compare_func(e->key, key)) {
+	hashentry_t* e = &ht->entries[idx];
+	while (e->key) {
+		if (e->hash == hash && ht->compare_func(e->key, key)) {
 			// element already present. replace value.
 			e->value = value;
 			return;
 		}
-		e = e->next;
+		idx = (idx + 1) & mask;
+		e = &ht->entries[idx];
 	}
 
-	// if we get here, the element is not yet in the list.
-
-	// make a new entry.
-	hashentry_t* entry = (hashentry_t*)malloc(sizeof(hashentry_t));
-	entry->key = key;
-	entry->value = value;
-	if (!ht->entries[idx0]) {
-		// first entry
-		entry->next = NULL;
-	} else {
-		// add to list
-		entry->next = ht->entries[idx0];
+	// if we get here, the element is not yet in the table.
+	if ((ht->count + 1) * 4 > ht->capacity * 3) {
+		if (hash_table_resize(ht, ht->capacity << 1) < 0) {
+			// keep going with the current table as long as there is room
+			if (ht->count + 1 >= ht->capacity) {
+				return;
+			}
+		} else {
+			mask = ht->capacity - 1;
+			idx = hash & mask;
+			e = &ht->entries[idx];
+			while (e->key) {
+				idx = (idx + 1) & mask;
+				e = &ht->entries[idx];
+			}
+		}
 	}
-	ht->entries[idx0] = entry;
+
+	e->key = key;
+	e->value = value;
+	e->hash = hash;
 	ht->count++;
 }
 
 void* hash_table_lookup(hashtable_t* ht, void *key)
 {
 	if (!ht || !key) return NULL;
-	unsigned int hash = ht->hash_func(key);
 
-	int idx0 = hash & 0xFFF;
+	unsigned int hash = hash_mix(ht->hash_func(key));
+	size_t mask = ht->capacity - 1;
+	size_t idx = hash & mask;
 
-	hashentry_t* e = ht->entries[idx0];
-	while (e) {
-		if (ht->compare_func(e->key, key)) {
+	hashentry_t* e = &ht->entries[idx];
+	while (e->key) {
+		if (e->hash == hash && ht->compare_func(e->key, key)) {
 			return e->value;
 		}
-		e = e->next;
+		idx = (idx + 1) & mask;
+		e = &ht->entries[idx];
 	}
 	return NULL;
 }
@@ -112,29 +177,40 @@ void hash_table_remove(hashtable_t* ht, void *key)
 {
 	if (!ht || !key) return;
 
-	unsigned int hash = ht->hash_func(key);
-
-	int idx0 = hash & 0xFFF;
-
-	// get the idx0 list
-	hashentry_t* e = ht->entries[idx0];
-	hashentry_t* last = e;
-	while (e) {
-		if (ht->compare_func(e->key, key)) {
-			// found element, remove it from the list
-			hashentry_t* old = e;
-			if (e == ht->entries[idx0]) {
-				ht->entries[idx0] = e->next;
-			} else {
-				last->next = e->next;
-			}
-			if (ht->free_func) {
-				ht->free_func(old->value);
-			}
-			free(old);
-			return;
+	unsigned int hash = hash_mix(ht->hash_func(key));
+	size_t mask = ht->capacity - 1;
+	size_t idx = hash & mask;
+
+	hashentry_t* e = &ht->entries[idx];
+	while (e->key) {
+		if (e->hash == hash && ht->compare_func(e->key, key)) {
+			break;
+		}
+		idx = (idx + 1) & mask;
+		e = &ht->entries[idx];
+	}
+	if (!e->key) {
+		return;
+	}
+
+	if (ht->free_func) {
+		ht->free_func(e->value);
+	}
+	ht->count--;
+
+	// shift back following entries of the same probe run into the hole
+	size_t hole = idx;
+	size_t next = (idx + 1) & mask;
+	while (ht->entries[next].key) {
+		size_t home = ht->entries[next].hash & mask;
+		// move the entry unless its home lies cyclically in (hole, next]
+		if (((next - home) & mask) >= ((next - hole) & mask)) {
+			ht->entries[hole] = ht->entries[next];
+			hole = next;
 		}
-		last = e;
-		e = e->next;
+		next = (next + 1) & mask;
 	}
+	ht->entries[hole].key = NULL;
+	ht->entries[hole].value = NULL;
+	ht->entries[hole].hash = 0;
 }
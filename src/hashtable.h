@@ -22,10 +22,11 @@
 #define HASHTABLE_H
 #include <stdlib.h>
 
+/* A slot is free when key == NULL; hash caches the (mixed) key hash */
 typedef struct hashentry_t {
 	void *key;
 	void *value;
-	struct hashentry_t *next;
+	unsigned int hash;
 } hashentry_t;
 
 typedef unsigned int(*hash_func_t)(const void* key);
@@ -33,7 +34,8 @@ typedef int (*compare_func_t)(const void *a, const void *b);
 typedef void (*free_func_t)(void *ptr);
 
 typedef struct hashtable_t {
-	hashentry_t *entries[4096];
+	hashentry_t *entries;
+	size_t capacity;
 	size_t count;
 	hash_func_t hash_func;
 	compare_func_t compare_func;
@@ -43,6 +45,7 @@ typedef struct hashtable_t {
 hashtable_t* hash_table_new(hash_func_t hash_func, compare_func_t compare_func, free_func_t free_func);
 void hash_table_destroy(hashtable_t *ht);
 
+int hash_table_reserve(hashtable_t* ht, size_t count);
 void hash_table_insert(hashtable_t* ht, void *key, void *value);
 void* hash_table_lookup(hashtable_t* ht, void *key);
 void hash_table_remove(hashtable_t* ht, void *key);
@@ -119,161 +119,91 @@ static size_t dtostr(char *buf, size_t bufsize, double realval)
     return len;
 }
 
-static plist_err_t node_to_json(node_t node, bytearray_t **outbuf, uint32_t depth, int prettify, int coerce)
+static void json_write_string(bytearray_t *outbuf, const char *str, size_t len)
 {
-    plist_data_t node_data = NULL;
-
-    char *val = NULL;
-    size_t val_len = 0;
-
-    uint32_t i = 0;
+    const char *charmap[32] = {
+        "\\u0000", "\\u0001", "\\u0002", "\\u0003", "\\u0004", "\\u0005", "\\u0006", "\\u0007",
+        "\\b",     "\\t",     "\\n",     "\\u000b", "\\f",     "\\r",     "\\u000e", "\\u000f",
+        "\\u0010", "\\u0011", "\\u0012", "\\u0013", "\\u0014", "\\u0015", "\\u0016", "\\u0017",
+        "\\u0018", "\\u0019", "\\u001a", "\\u001b", "\\u001c", "\\u001d", "\\u001e", "\\u001f",
+    };
+    size_t j = 0;
+    off_t start = 0;
+    off_t cur = 0;
+
+    str_buf_append(outbuf, "\"", 1);
+
+    for (j = 0; j < len; j++) {
+        unsigned char ch = (unsigned char)str[j];
+        if (ch < 0x20) {
+            str_buf_append(outbuf, str + start, cur - start);
+            str_buf_append(outbuf, charmap[ch], (charmap[ch][1] == 'u') ? 6 : 2);
+            start = cur+1;
+        } else if (ch == '"') {
+            str_buf_append(outbuf, str + start, cur - start);
+            str_buf_append(outbuf, "\\\"", 2);
+            start = cur+1;
+        }
+        cur++;
+    }
+    str_buf_append(outbuf, str + start, cur - start);
 
-    if (!node)
-        return PLIST_ERR_INVALID_ARG;
+    str_buf_append(outbuf, "\"", 1);
+}
 
-    node_data = plist_get_data(node);
+/* writes a value that is not a container, passed like to
+ * plist_event_handler_t.value() */
+static plist_err_t json_write_value(bytearray_t *outbuf, plist_type type, const void *value, uint64_t length, int coerce)
+{
+    char val[64];
+    size_t val_len = 0;
 
-    switch (node_data->type)
+    switch (type)
     {
     case PLIST_BOOLEAN:
     {
-        if (node_data->boolval) {
-            str_buf_append(*outbuf, "true", 4);
+        if (*(const uint8_t*)value) {
+            str_buf_append(outbuf, "true", 4);
         } else {
-            str_buf_append(*outbuf, "false", 5);
+            str_buf_append(outbuf, "false", 5);
         }
     }
     break;
 
     case PLIST_NULL:
-        str_buf_append(*outbuf, "null", 4);
+        str_buf_append(outbuf, "null", 4);
 	break;
 
     case PLIST_INT:
-        val = (char*)malloc(64);
-        if (node_data->length == 16) {
-            val_len = snprintf(val, 64, "%" PRIu64, node_data->intval);
+        if (length == 16) {
+            val_len = snprintf(val, sizeof(val), "%" PRIu64, *(const uint64_t*)value);
         } else {
-            val_len = snprintf(val, 64, "%" PRIi64, node_data->intval);
+            val_len = snprintf(val, sizeof(val), "%" PRIi64, *(const int64_t*)value);
         }
-        str_buf_append(*outbuf, val, val_len);
-        free(val);
+        str_buf_append(outbuf, val, val_len);
         break;
 
     case PLIST_REAL:
-        val = (char*)malloc(64);
-        val_len = dtostr(val, 64, node_data->realval);
-        str_buf_append(*outbuf, val, val_len);
-        free(val);
+        val_len = dtostr(val, sizeof(val), *(const double*)value);
+        str_buf_append(outbuf, val, val_len);
         break;
 
     case PLIST_STRING:
-    case PLIST_KEY: {
-        const char *charmap[32] = {
-            "\\u0000", "\\u0001", "\\u0002", "\\u0003", "\\u0004", "\\u0005", "\\u0006", "\\u0007",
-            "\\b",     "\\t",     "\\n",     "\\u000b", "\\f",     "\\r",     "\\u000e", "\\u000f",
-            "\\u0010", "\\u0011", "\\u0012", "\\u0013", "\\u0014", "\\u0015", "\\u0016", "\\u0017",
-            "\\u0018", "\\u0019", "\\u001a", "\\u001b", "\\u001c", "\\u001d", "\\u001e", "\\u001f",
-        };
-        size_t j = 0;
-        size_t len = 0;
-        off_t start = 0;
-        off_t cur = 0;
-
-        str_buf_append(*outbuf, "\"", 1);
-
-        len = node_data->length;
-        for (j = 0; j < len; j++) {
-            unsigned char ch = (unsigned char)node_data->strval[j];
-            if (ch < 0x20) {
-                str_buf_append(*outbuf, node_data->strval + start, cur - start);
-                str_buf_append(*outbuf, charmap[ch], (charmap[ch][1] == 'u') ? 6 : 2);
-                start = cur+1;
-            } else if (ch == '"') {
-                str_buf_append(*outbuf, node_data->strval + start, cur - start);
-                str_buf_append(*outbuf, "\\\"", 2);
-                start = cur+1;
-            }
-            cur++;
-        }
-        str_buf_append(*outbuf, node_data->strval + start, cur - start);
-
-        str_buf_append(*outbuf, "\"", 1);
-        } break;
+    case PLIST_KEY:
+        json_write_string(outbuf, (const char*)value, length);
+        break;
 
-    case PLIST_ARRAY: {
-        str_buf_append(*outbuf, "[", 1);
-        node_t ch;
-        uint32_t cnt = 0;
-        for (ch = node_first_child(node); ch; ch = node_next_sibling(ch)) {
-            if (cnt > 0) {
-                str_buf_append(*outbuf, ",", 1);
-            }
-            if (prettify) {
-                str_buf_append(*outbuf, "\n", 1);
-                for (i = 0; i <= depth; i++) {
-                    str_buf_append(*outbuf, "  ", 2);
-                }
-            }
-            plist_err_t res = node_to_json(ch, outbuf, depth+1, prettify, coerce);
-            if (res < 0) {
-                return res;
-            }
-            cnt++;
-        }
-        if (cnt > 0 && prettify) {
-            str_buf_append(*outbuf, "\n", 1);
-            for (i = 0; i < depth; i++) {
-                str_buf_append(*outbuf, "  ", 2);
-            }
-        }
-        str_buf_append(*outbuf, "]", 1);
-        } break;
-    case PLIST_DICT: {
-        str_buf_append(*outbuf, "{", 1);
-        node_t ch;
-        uint32_t cnt = 0;
-        for (ch = node_first_child(node); ch; ch = node_next_sibling(ch)) {
-            if (cnt > 0 && cnt % 2 == 0) {
-                str_buf_append(*outbuf, ",", 1);
-            }
-            if (cnt % 2 == 0 && prettify) {
-                str_buf_append(*outbuf, "\n", 1);
-                for (i = 0; i <= depth; i++) {
-                    str_buf_append(*outbuf, "  ", 2);
-                }
-            }
-            plist_err_t res = node_to_json(ch, outbuf, depth+1, prettify, coerce);
-            if (res < 0) {
-                return res;
-            }
-            if (cnt % 2 == 0) {
-                str_buf_append(*outbuf, ":", 1);
-                if (prettify) {
-                  str_buf_append(*outbuf, " ", 1);
-                }
-            }
-            cnt++;
-        }
-        if (cnt > 0 && prettify) {
-            str_buf_append(*outbuf, "\n", 1);
-            for (i = 0; i < depth; i++) {
-                str_buf_append(*outbuf, "  ", 2);
-            }
-        }
-        str_buf_append(*outbuf, "}", 1);
-        } break;
     case PLIST_DATA:
         if (coerce) {
-            size_t b64_len = ((node_data->length + 2) / 3) * 4;
+            size_t b64_len = ((length + 2) / 3) * 4;
             char *b64_buf = (char*)malloc(b64_len + 1);
             if (!b64_buf) {
                 return PLIST_ERR_NO_MEM;
             }
-            size_t actual_len = base64encode(b64_buf, node_data->buff, node_data->length);
-            str_buf_append(*outbuf, "\"", 1);
-            str_buf_append(*outbuf, b64_buf, actual_len);
-            str_buf_append(*outbuf, "\"", 1);
+            size_t actual_len = base64encode(b64_buf, (const unsigned char*)value, length);
+            str_buf_append(outbuf, "\"", 1);
+            str_buf_append(outbuf, b64_buf, actual_len);
+            str_buf_append(outbuf, "\"", 1);
             free(b64_buf);
         } else {
             PLIST_JSON_WRITE_ERR("PLIST_DATA type is not valid for JSON format\n");
@@ -282,7 +212,7 @@ static plist_err_t node_to_json(node_t node, bytearray_t **outbuf, uint32_t dept
         break;
     case PLIST_DATE:
         if (coerce) {
-            Time64_T timev = (Time64_T)node_data->realval + MAC_EPOCH;
+            Time64_T timev = (Time64_T)*(const double*)value + MAC_EPOCH;
             struct TM _btime;
             struct TM *btime = gmtime64_r(&timev, &_btime);
             char datebuf[32];
@@ -295,9 +225,9 @@ static plist_err_t node_to_json(node_t node, bytearray_t **outbuf, uint32_t dept
             if (datelen <= 0) {
                 datelen = snprintf(datebuf, sizeof(datebuf), "1970-01-01T00:00:00Z");
             }
-            str_buf_append(*outbuf, "\"", 1);
-            str_buf_append(*outbuf, datebuf, datelen);
-            str_buf_append(*outbuf, "\"", 1);
+            str_buf_append(outbuf, "\"", 1);
+            str_buf_append(outbuf, datebuf, datelen);
+            str_buf_append(outbuf, "\"", 1);
         } else {
             PLIST_JSON_WRITE_ERR("PLIST_DATE type is not valid for JSON format\n");
             return PLIST_ERR_FORMAT;
@@ -305,14 +235,12 @@ static plist_err_t node_to_json(node_t node, bytearray_t **outbuf, uint32_t dept
         break;
     case PLIST_UID:
         if (coerce) {
-            val = (char*)malloc(64);
-            if (node_data->length == 16) {
-                val_len = snprintf(val, 64, "%" PRIu64, node_data->intval);
+            if (length == 16) {
+                val_len = snprintf(val, sizeof(val), "%" PRIu64, *(const uint64_t*)value);
             } else {
-                val_len = snprintf(val, 64, "%" PRIi64, node_data->intval);
+                val_len = snprintf(val, sizeof(val), "%" PRIi64, *(const int64_t*)value);
             }
-            str_buf_append(*outbuf, val, val_len);
-            free(val);
+            str_buf_append(outbuf, val, val_len);
         } else {
             PLIST_JSON_WRITE_ERR("PLIST_UID type is not valid for JSON format\n");
             return PLIST_ERR_FORMAT;
@@ -325,172 +253,94 @@ static plist_err_t node_to_json(node_t node, bytearray_t **outbuf, uint32_t dept
     return PLIST_ERR_SUCCESS;
 }
 
-#define PO10i_LIMIT (INT64_MAX/10)
-
-/* based on https://stackoverflow.com/a/4143288 */
-static int num_digits_i(int64_t i)
+static plist_err_t node_to_json(node_t node, bytearray_t **outbuf, uint32_t depth, int prettify, int coerce, node_t *path)
 {
-    int n;
-    int64_t po10;
-    n=1;
-    if (i < 0) {
-        i = (i == INT64_MIN) ? INT64_MAX : -i;
-        n++;
-    }
-    po10=10;
-    while (i>=po10) {
-        n++;
-        if (po10 > PO10i_LIMIT) break;
-        po10*=10;
-    }
-    return n;
-}
-
-#define PO10u_LIMIT (UINT64_MAX/10)
+    plist_data_t node_data = NULL;
 
-/* based on https://stackoverflow.com/a/4143288 */
-static int num_digits_u(uint64_t i)
-{
-    int n;
-    uint64_t po10;
-    n=1;
-    po10=10;
-    while (i>=po10) {
-        n++;
-        if (po10 > PO10u_LIMIT) break;
-        po10*=10;
-    }
-    return n;
-}
+    uint32_t i = 0;
 
-static plist_err_t _node_estimate_size(node_t node, uint64_t *size, uint32_t depth, int prettify, int coerce, hashtable_t *visited)
-{
-    plist_data_t data;
-    if (!node) {
+    if (!node)
         return PLIST_ERR_INVALID_ARG;
-    }
 
-    if (depth > PLIST_MAX_NESTING_DEPTH) {
-        PLIST_JSON_WRITE_ERR("maximum nesting depth (%u) exceeded\n", (unsigned)PLIST_MAX_NESTING_DEPTH);
-        return PLIST_ERR_MAX_NESTING;
+    plist_err_t err = plist_write_check_node(node, path, depth);
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
     }
 
-    if (hash_table_lookup(visited, node)) {
-        PLIST_JSON_WRITE_ERR("circular reference detected\n");
-        return PLIST_ERR_CIRCULAR_REF;
-    }
-
-    // mark as visited
-    hash_table_insert(visited, node, (void*)1);
+    node_data = plist_get_data(node);
 
-    data = plist_get_data(node);
-    if (node->children) {
+    switch (node_data->type)
+    {
+    case PLIST_ARRAY: {
+        str_buf_append(*outbuf, "[", 1);
         node_t ch;
-        unsigned int n_children = node_n_children(node);
+        uint32_t cnt = 0;
         for (ch = node_first_child(node); ch; ch = node_next_sibling(ch)) {
-            plist_err_t res = _node_estimate_size(ch, size, depth + 1, prettify, coerce, visited);
+            if (cnt > 0) {
+                str_buf_append(*outbuf, ",", 1);
+            }
+            if (prettify) {
+                str_buf_append(*outbuf, "\n", 1);
+                for (i = 0; i <= depth; i++) {
+                    str_buf_append(*outbuf, "  ", 2);
+                }
+            }
+            plist_err_t res = node_to_json(ch, outbuf, depth+1, prettify, coerce, path);
             if (res < 0) {
                 return res;
             }
+            cnt++;
         }
-        switch (data->type) {
-        case PLIST_DICT:
-            *size += 2; // '{' and '}'
-            *size += n_children-1; // number of ':' and ','
-            if (prettify) {
-                *size += n_children; // number of '\n' and extra space
-                *size += (uint64_t)n_children * (depth+1); // indent for every 2nd child
-                *size += 1; // additional '\n'
-            }
-            break;
-        case PLIST_ARRAY:
-            *size += 2; // '[' and ']'
-            *size += n_children-1; // number of ','
-            if (prettify) {
-                *size += n_children; // number of '\n'
-                *size += (uint64_t)n_children * ((depth+1)<<1); // indent for every child
-                *size += 1; // additional '\n'
+        if (cnt > 0 && prettify) {
+            str_buf_append(*outbuf, "\n", 1);
+            for (i = 0; i < depth; i++) {
+                str_buf_append(*outbuf, "  ", 2);
             }
-            break;
-        default:
-            break;
-	}
-        if (prettify)
-            *size += (depth << 1); // indent for {} and []
-    } else {
-        switch (data->type) {
-        case PLIST_STRING:
-        case PLIST_KEY:
-            *size += data->length;
-            *size += 2;
-            break;
-        case PLIST_INT:
-            if (data->length == 16) {
-                *size += num_digits_u(data->intval);
-            } else {
-                *size += num_digits_i((int64_t)data->intval);
+        }
+        str_buf_append(*outbuf, "]", 1);
+        } break;
+    case PLIST_DICT: {
+        str_buf_append(*outbuf, "{", 1);
+        node_t ch;
+        uint32_t cnt = 0;
+        for (ch = node_first_child(node); ch; ch = node_next_sibling(ch)) {
+            if (cnt > 0 && cnt % 2 == 0) {
+                str_buf_append(*outbuf, ",", 1);
             }
-            break;
-        case PLIST_REAL:
-            *size += dtostr(NULL, 0, data->realval);
-            break;
-        case PLIST_BOOLEAN:
-            *size += ((data->boolval) ? 4 : 5);
-            break;
-        case PLIST_NULL:
-            *size += 4;
-            break;
-        case PLIST_DICT:
-        case PLIST_ARRAY:
-            *size += 2;
-            break;
-        case PLIST_DATA:
-            if (coerce) {
-                // base64 encoded string: 2 quotes + ((len+2)/3)*4 base64 chars
-                *size += 2 + ((data->length + 2) / 3) * 4;
-            } else {
-                PLIST_JSON_WRITE_ERR("PLIST_DATA type is not valid for JSON format\n");
-                return PLIST_ERR_FORMAT;
+            if (cnt % 2 == 0 && prettify) {
+                str_buf_append(*outbuf, "\n", 1);
+                for (i = 0; i <= depth; i++) {
+                    str_buf_append(*outbuf, "  ", 2);
+                }
             }
-            break;
-        case PLIST_DATE:
-            if (coerce) {
-                // ISO 8601 string: "YYYY-MM-DDTHH:MM:SSZ" = 22 chars max
-                *size += 24;
-            } else {
-                PLIST_JSON_WRITE_ERR("PLIST_DATE type is not valid for JSON format\n");
-                return PLIST_ERR_FORMAT;
+            plist_err_t res = node_to_json(ch, outbuf, depth+1, prettify, coerce, path);
+            if (res < 0) {
+                return res;
             }
-            break;
-        case PLIST_UID:
-            if (coerce) {
-                // integer representation
-                if (data->length == 16) {
-                    *size += num_digits_u(data->intval);
-                } else {
-                    *size += num_digits_i((int64_t)data->intval);
+            if (cnt % 2 == 0) {
+                str_buf_append(*outbuf, ":", 1);
+                if (prettify) {
+                  str_buf_append(*outbuf, " ", 1);
                 }
-            } else {
-                PLIST_JSON_WRITE_ERR("PLIST_UID type is not valid for JSON format\n");
-                return PLIST_ERR_FORMAT;
             }
-            break;
-        default:
-            PLIST_JSON_WRITE_ERR("invalid node type encountered\n");
-            return PLIST_ERR_UNKNOWN;
+            cnt++;
+        }
+        if (cnt > 0 && prettify) {
+            str_buf_append(*outbuf, "\n", 1);
+            for (i = 0; i < depth; i++) {
+                str_buf_append(*outbuf, "  ", 2);
+            }
         }
+        str_buf_append(*outbuf, "}", 1);
+        } break;
+    default:
+        return json_write_value(*outbuf, node_data->type, plist_data_value(node_data), node_data->length, coerce);
     }
+
     return PLIST_ERR_SUCCESS;
 }
 
-static plist_err_t node_estimate_size(node_t node, uint64_t *size, uint32_t depth, int prettify, int coerce)
-{
-    hashtable_t *visited = hash_table_new(plist_node_ptr_hash, plist_node_ptr_compare, NULL);
-    if (!visited) return PLIST_ERR_NO_MEM;
-    plist_err_t err = _node_estimate_size(node, size, depth, prettify, coerce, visited);
-    hash_table_destroy(visited);
-    return err;
-}
+#define PO10i_LIMIT (INT64_MAX/10)
 
 plist_err_t plist_to_json(plist_t plist, char **plist_json, uint32_t* length, int prettify)
 {
@@ -500,7 +350,16 @@ plist_err_t plist_to_json(plist_t plist, char **plist_json, uint32_t* length, in
 
 plist_err_t plist_to_json_with_options(plist_t plist, char **plist_json, uint32_t* length, plist_write_options_t options)
 {
-    uint64_t size = 0;
+    uint64_t length64 = 0;
+    if (!length) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+    plist_err_t err = plist_to_json64(plist, plist_json, &length64, options);
+    return plist_output_length32(err, plist_json, length64, length);
+}
+
+plist_err_t plist_to_json64(plist_t plist, char **plist_json, uint64_t* length, plist_write_options_t options)
+{
     plist_err_t res;
 
     if (!plist || !plist_json || !length) {
@@ -515,18 +374,14 @@ plist_err_t plist_to_json_with_options(plist_t plist, char **plist_json, uint32_
     int prettify = !(options & PLIST_OPT_COMPACT);
     int coerce = options & PLIST_OPT_COERCE;
 
-    res = node_estimate_size((node_t)plist, &size, 0, prettify, coerce);
-    if (res < 0) {
-        return res;
-    }
-
-    strbuf_t *outbuf = str_buf_new(size);
+    strbuf_t *outbuf = str_buf_new(0);
     if (!outbuf) {
         PLIST_JSON_WRITE_ERR("Could not allocate output buffer\n");
         return PLIST_ERR_NO_MEM;
     }
 
-    res = node_to_json((node_t)plist, &outbuf, 0, prettify, coerce);
+    node_t path[PLIST_WRITE_PATH_SIZE];
+    res = node_to_json((node_t)plist, &outbuf, 0, prettify, coerce, path);
     if (res < 0) {
         str_buf_free(outbuf);
         *plist_json = NULL;
@@ -548,10 +403,154 @@ plist_err_t plist_to_json_with_options(plist_t plist, char **plist_json, uint32_
     return PLIST_ERR_SUCCESS;
 }
 
+/* writes JSON while the input is parsed, see plist_convert() */
+struct json_event_writer {
+    bytearray_t *outbuf;
+    int prettify;
+    int coerce;
+    /* number of open containers */
+    uint32_t depth;
+    /* per open container: whether it is a dictionary, and whether it has
+     * items already */
+    uint8_t dict[PLIST_WRITE_PATH_SIZE];
+    uint8_t items[PLIST_WRITE_PATH_SIZE];
+};
+
+static void json_writer_indent(struct json_event_writer *w, uint32_t depth)
+{
+    uint32_t i;
+    str_buf_append(w->outbuf, "\n", 1);
+    for (i = 0; i < depth; i++) {
+        str_buf_append(w->outbuf, "  ", 2);
+    }
+}
+
+/* separates an array item or a dictionary entry from the previous one */
+static void json_writer_next_item(struct json_event_writer *w)
+{
+    if (w->items[w->depth-1]) {
+        str_buf_append(w->outbuf, ",", 1);
+    }
+    w->items[w->depth-1] = 1;
+    if (w->prettify) {
+        json_writer_indent(w, w->depth);
+    }
+}
+
+static plist_err_t json_writer_begin(struct json_event_writer *w, int dict)
+{
+    if (w->depth >= PLIST_WRITE_PATH_SIZE) {
+        return PLIST_ERR_MAX_NESTING;
+    }
+    if (w->depth > 0 && !w->dict[w->depth-1]) {
+        json_writer_next_item(w);
+    }
+    str_buf_append(w->outbuf, (dict) ? "{" : "[", 1);
+    w->dict[w->depth] = (uint8_t)dict;
+    w->items[w->depth] = 0;
+    w->depth++;
+    return plist_write_status(w->outbuf);
+}
+
+static plist_err_t json_writer_end(struct json_event_writer *w, int dict)
+{
+    if (w->depth == 0) {
+        return PLIST_ERR_PARSE;
+    }
+    w->depth--;
+    if (w->items[w->depth] && w->prettify) {
+        json_writer_indent(w, w->depth);
+    }
+    str_buf_append(w->outbuf, (dict) ? "}" : "]", 1);
+    return plist_write_status(w->outbuf);
+}
+
+static plist_err_t json_writer_begin_dict(void *user_data)
+{
+    return json_writer_begin((struct json_event_writer*)user_data, 1);
+}
+
+static plist_err_t json_writer_end_dict(void *user_data)
+{
+    return json_writer_end((struct json_event_writer*)user_data, 1);
+}
+
+static plist_err_t json_writer_begin_array(void *user_data)
+{
+    return json_writer_begin((struct json_event_writer*)user_data, 0);
+}
+
+static plist_err_t json_writer_end_array(void *user_data)
+{
+    return json_writer_end((struct json_event_writer*)user_data, 0);
+}
+
+static plist_err_t json_writer_key(void *user_data, const char *key, uint64_t length)
+{
+    struct json_event_writer *w = (struct json_event_writer*)user_data;
+    if (w->depth == 0) {
+        return PLIST_ERR_PARSE;
+    }
+    json_writer_next_item(w);
+    json_write_string(w->outbuf, key, length);
+    if (w->prettify) {
+        str_buf_append(w->outbuf, ": ", 2);
+    } else {
+        str_buf_append(w->outbuf, ":", 1);
+    }
+    return plist_write_status(w->outbuf);
+}
+
+static plist_err_t json_writer_value(void *user_data, plist_type type, const void *value, uint64_t length)
+{
+    struct json_event_writer *w = (struct json_event_writer*)user_data;
+    if (w->depth == 0) {
+        PLIST_JSON_WRITE_ERR("plist data is not valid for JSON format\n");
+        return PLIST_ERR_FORMAT;
+    }
+    if (!w->dict[w->depth-1]) {
+        json_writer_next_item(w);
+    }
+    plist_err_t err = json_write_value(w->outbuf, type, value, length, w->coerce);
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
+    }
+    return plist_write_status(w->outbuf);
+}
+
+static const plist_event_handler_t json_writer_handler = {
+    json_writer_begin_dict,
+    json_writer_end_dict,
+    json_writer_begin_array,
+    json_writer_end_array,
+    json_writer_key,
+    json_writer_value,
+    NULL
+};
+
+plist_err_t plist_convert_to_json(const char *input, uint64_t length, plist_format_t format, bytearray_t *outbuf, plist_write_options_t options)
+{
+    struct json_event_writer w;
+    w.outbuf = outbuf;
+    w.prettify = !(options & PLIST_OPT_COMPACT);
+    w.coerce = options & PLIST_OPT_COERCE;
+    w.depth = 0;
+
+    plist_err_t err = plist_parse_events(input, length, format, &json_writer_handler, &w);
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
+    }
+    if (w.prettify) {
+        str_buf_append(outbuf, "\n", 1);
+    }
+    return plist_write_status(outbuf);
+}
+
 typedef struct {
     jsmntok_t* tokens;
     int count;
-    plist_err_t err;
+    const plist_event_handler_t *handler;
+    void *user_data;
 } jsmntok_info_t;
 
 static int64_t parse_decimal(const char* str, const char* str_end, char** endp)
@@ -599,44 +598,34 @@ static int64_t parse_decimal(const char* str, const char* str_end, char** endp)
     return result;
 }
 
-static plist_t parse_primitive(const char* js, jsmntok_info_t* ti, int* index)
+static plist_err_t parse_primitive(const char* js, jsmntok_info_t* ti, int* index)
 {
     if (ti->tokens[*index].type != JSMN_PRIMITIVE) {
         PLIST_JSON_ERR("%s: token type != JSMN_PRIMITIVE\n", __func__);
-        return NULL;
+        return PLIST_ERR_PARSE;
     }
-    plist_t val = NULL;
+    plist_err_t err = PLIST_ERR_PARSE;
     const char* str_val = js + ti->tokens[*index].start;
     const char* str_end = js + ti->tokens[*index].end;
     size_t str_len = ti->tokens[*index].end - ti->tokens[*index].start;
-    if (!strncmp("false", str_val, str_len)) {
-        val = plist_new_bool(0);
-    } else if (!strncmp("true", str_val, str_len)) {
-        val = plist_new_bool(1);
+    if (!strncmp("false", str_val, str_len) || !strncmp("true", str_val, str_len)) {
+        uint8_t boolval = (str_val[0] == 't');
+        err = PLIST_EVENT(ti->handler, value, ti->user_data, PLIST_BOOLEAN, &boolval, 1);
     } else if (!strncmp("null", str_val, str_len)) {
-        plist_data_t data = plist_new_plist_data();
-        if (!data) {
-            PLIST_JSON_ERR("%s: failed to allocate plist data\n", __func__);
-            return NULL;
-        }
-        data->type = PLIST_NULL;
-        val = plist_new_node(data);
+        err = PLIST_EVENT(ti->handler, value, ti->user_data, PLIST_NULL, NULL, 0);
     } else if (isdigit(str_val[0]) || (str_val[0] == '-' && str_val+1 < str_end && isdigit(str_val[1]))) {
         char* endp = (char*)str_val;
         int is_neg = (str_val[0] == '-');
         int64_t intpart = parse_decimal(str_val, str_end, &endp);
         if (endp >= str_end) {
-            /* integer */
-            if (is_neg || intpart <= INT64_MAX) {
-                val = plist_new_int(intpart);
-            } else {
-                val = plist_new_uint((uint64_t)intpart);
-            }
+            /* integer, parse_decimal() clamps it to the int64_t range */
+            uint64_t intval = (uint64_t)intpart;
+            err = PLIST_EVENT(ti->handler, value, ti->user_data, PLIST_INT, &intval, sizeof(uint64_t));
         } else if ((*endp == '.' && endp+1 < str_end && isdigit(*(endp+1))) || ((*endp == 'e' || *endp == 'E') && endp+1 < str_end && (isdigit(*(endp+1)) || (((*(endp+1) == '-') || (*(endp+1) == '+')) && endp+2 < str_end && isdigit(*(endp+2)))))) {
             /* floating point */
             double dval = (double)intpart;
             char* fendp = endp;
-            int err = 0;
+            int ferr = 0;
             do {
                 if (*endp == '.') {
                     fendp++;
@@ -661,14 +650,14 @@ static plist_t parse_primitive(const char* js, jsmntok_info_t* ti, int* index)
                     dval = dval * pow(10, (double)exp);
                 } else {
                     PLIST_JSON_ERR("%s: invalid character at offset %d when parsing floating point value\n", __func__, (int)(fendp - js));
-                    err++;
+                    ferr++;
                 }
             } while (0);
-            if (!err) {
+            if (!ferr) {
                 if (isinf(dval) || isnan(dval)) {
                    PLIST_JSON_ERR("%s: unrepresentable floating point value at offset %d when parsing numerical value\n", __func__, (int)(str_val - js));
                 } else {
-                    val = plist_new_real(dval);
+                    err = PLIST_EVENT(ti->handler, value, ti->user_data, PLIST_REAL, &dval, sizeof(double));
                 }
             }
         } else {
@@ -677,12 +666,11 @@ static plist_t parse_primitive(const char* js, jsmntok_info_t* ti, int* index)
     } else {
         PLIST_JSON_ERR("%s: invalid primitive value '%.*s' encountered\n", __func__, (int)str_len, str_val);
     }
-    if (!val) {
-        PLIST_JSON_ERR("%s: failed to create node\n", __func__);
-        return NULL;
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
     }
     (*index)++;
-    return val;
+    return PLIST_ERR_SUCCESS;
 }
 
 static char* unescape_string(const char* str_val, size_t str_len, size_t *new_len)
@@ -764,59 +752,83 @@ static char* unescape_string(const char* str_val, size_t str_len, size_t *new_le
     return strval;
 }
 
-static plist_t parse_string(const char* js, jsmntok_info_t* ti, int* index)
+static plist_err_t parse_string(const char* js, jsmntok_info_t* ti, int* index)
 {
     if (ti->tokens[*index].type != JSMN_STRING) {
         PLIST_JSON_ERR("%s: token type != JSMN_STRING\n", __func__);
-        return NULL;
+        return PLIST_ERR_PARSE;
     }
 
-    size_t str_len = 0; ;
-    char* strval = unescape_string(js + ti->tokens[*index].start, ti->tokens[*index].end - ti->tokens[*index].start, &str_len);
-    if (!strval) {
-        return NULL;
-    }
-    plist_t node;
-
-    plist_data_t data = plist_new_plist_data();
-    if (!data) {
-        free(strval);
-        PLIST_JSON_ERR("%s: failed to allocate plist data\n", __func__);
-        return NULL;
+    const char *str_val = js + ti->tokens[*index].start;
+    size_t str_len = ti->tokens[*index].end - ti->tokens[*index].start;
+    plist_err_t err;
+    if (!memchr(str_val, '\\', str_len)) {
+        err = PLIST_EVENT(ti->handler, value, ti->user_data, PLIST_STRING, str_val, str_len);
+    } else {
+        char* strval = unescape_string(str_val, str_len, &str_len);
+        if (!strval) {
+            return PLIST_ERR_PARSE;
+        }
+        err = plist_event_value_owned(ti->handler, ti->user_data, PLIST_STRING, strval, str_len);
     }
-    data->type = PLIST_STRING;
-    data->strval = strval;
-    data->length = str_len;
-    node = plist_new_node(data);
-    if (!node) {
-        plist_free_data(data);
-        PLIST_JSON_ERR("%s: failed to create node\n", __func__);
-        return NULL;
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
     }
 
     (*index)++;
-    return node;
+    return PLIST_ERR_SUCCESS;
 }
 
-static plist_t parse_object(const char* js, jsmntok_info_t* ti, int* index, uint32_t depth);
+static plist_err_t parse_key(const char* js, jsmntok_info_t* ti, int index)
+{
+    const char *str_val = js + ti->tokens[index].start;
+    size_t str_len = ti->tokens[index].end - ti->tokens[index].start;
+    if (!memchr(str_val, '\\', str_len)) {
+        return PLIST_EVENT(ti->handler, key, ti->user_data, str_val, str_len);
+    }
+    char* key = unescape_string(str_val, str_len, &str_len);
+    if (!key) {
+        return PLIST_ERR_PARSE;
+    }
+    plist_err_t err = PLIST_EVENT(ti->handler, key, ti->user_data, key, str_len);
+    free(key);
+    return err;
+}
 
-static plist_t parse_array(const char* js, jsmntok_info_t* ti, int* index, uint32_t depth)
+static plist_err_t parse_object(const char* js, jsmntok_info_t* ti, int* index, uint32_t depth);
+static plist_err_t parse_array(const char* js, jsmntok_info_t* ti, int* index, uint32_t depth);
+
+static plist_err_t parse_value(const char* js, jsmntok_info_t* ti, int* index, uint32_t depth)
+{
+    switch (ti->tokens[*index].type) {
+        case JSMN_OBJECT:
+            return parse_object(js, ti, index, depth);
+        case JSMN_ARRAY:
+            return parse_array(js, ti, index, depth);
+        case JSMN_STRING:
+            return parse_string(js, ti, index);
+        case JSMN_PRIMITIVE:
+            return parse_primitive(js, ti, index);
+        default:
+            break;
+    }
+    return PLIST_ERR_PARSE;
+}
+
+static plist_err_t parse_array(const char* js, jsmntok_info_t* ti, int* index, uint32_t depth)
 {
     if (ti->tokens[*index].type != JSMN_ARRAY) {
         PLIST_JSON_ERR("%s: token type != JSMN_ARRAY\n", __func__);
-        ti->err = PLIST_ERR_PARSE;
-        return NULL;
+        return PLIST_ERR_PARSE;
     }
-    if (depth > PLIST_MAX_NESTING_DEPTH) {
+    /* the children end up one level deeper than this node */
+    if (depth > PLIST_MAX_NESTING_DEPTH || (ti->tokens[*index].size > 0 && depth >= PLIST_MAX_NESTING_DEPTH)) {
         PLIST_JSON_ERR("%s: maximum nesting depth (%u) exceeded\n", __func__, (unsigned)PLIST_MAX_NESTING_DEPTH);
-        ti->err = PLIST_ERR_MAX_NESTING;
-        return NULL;
+        return PLIST_ERR_MAX_NESTING;
     }
-    plist_t arr = plist_new_array();
-    if (!arr) {
-        PLIST_JSON_ERR("%s: failed to create array node\n", __func__);
-        ti->err = PLIST_ERR_NO_MEM;
-        return NULL;
+    plist_err_t err = PLIST_EVENT(ti->handler, begin_array, ti->user_data);
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
     }
     size_t num_tokens = ti->tokens[*index].size;
     size_t num;
@@ -824,146 +836,84 @@ static plist_t parse_array(const char* js, jsmntok_info_t* ti, int* index, uint3
     for (num = 0; num < num_tokens; num++) {
         if (j >= ti->count) {
             PLIST_JSON_ERR("%s: token index out of valid range\n", __func__);
-            plist_free(arr);
-            ti->err = PLIST_ERR_PARSE;
-            return NULL;
-        }
-        plist_t val = NULL;
-        switch (ti->tokens[j].type) {
-            case JSMN_OBJECT:
-                val = parse_object(js, ti, &j, depth+1);
-                break;
-            case JSMN_ARRAY:
-                val = parse_array(js, ti, &j, depth+1);
-                break;
-            case JSMN_STRING:
-                val = parse_string(js, ti, &j);
-                break;
-            case JSMN_PRIMITIVE:
-                val = parse_primitive(js, ti, &j);
-                break;
-            default:
-                break;
+            return PLIST_ERR_PARSE;
         }
-        if (val) {
-            plist_array_append_item(arr, val);
-            // if append failed, val still has no parent, free it and abort
-            if (((node_t)val)->parent == NULL) {
-                plist_free(val);
-                plist_free(arr);
-                ti->err = PLIST_ERR_NO_MEM;
-                return NULL;
-            }
-        } else {
-            plist_free(arr);
-            ti->err = PLIST_ERR_PARSE;
-            return NULL;
+        err = parse_value(js, ti, &j, depth+1);
+        if (err != PLIST_ERR_SUCCESS) {
+            return err;
         }
     }
     *(index) = j;
-    return arr;
+    return PLIST_EVENT(ti->handler, end_array, ti->user_data);
 }
 
-static plist_t parse_object(const char* js, jsmntok_info_t* ti, int* index, uint32_t depth)
+static plist_err_t parse_object(const char* js, jsmntok_info_t* ti, int* index, uint32_t depth)
 {
     if (ti->tokens[*index].type != JSMN_OBJECT) {
         PLIST_JSON_ERR("%s: token type != JSMN_OBJECT\n", __func__);
-        ti->err = PLIST_ERR_PARSE;
-        return NULL;
+        return PLIST_ERR_PARSE;
     }
-    if (depth > PLIST_MAX_NESTING_DEPTH) {
+    /* the children end up one level deeper than this node */
+    if (depth > PLIST_MAX_NESTING_DEPTH || (ti->tokens[*index].size > 0 && depth >= PLIST_MAX_NESTING_DEPTH)) {
         PLIST_JSON_ERR("%s: maximum nesting depth (%u) exceeded\n", __func__, (unsigned)PLIST_MAX_NESTING_DEPTH);
-        ti->err = PLIST_ERR_MAX_NESTING;
-        return NULL;
+        return PLIST_ERR_MAX_NESTING;
     }
     size_t num_tokens = ti->tokens[*index].size;
     size_t num;
     int j = (*index)+1;
     if (num_tokens % 2 != 0) {
         PLIST_JSON_ERR("%s: number of children must be even\n", __func__);
-        ti->err = PLIST_ERR_PARSE;
-        return NULL;
+        return PLIST_ERR_PARSE;
     }
-    plist_t obj = plist_new_dict();
-    if (!obj) {
-        PLIST_JSON_ERR("%s: failed to create dict node\n", __func__);
-        ti->err = PLIST_ERR_NO_MEM;
-        return NULL;
+    plist_err_t err = PLIST_EVENT(ti->handler, begin_dict, ti->user_data);
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
     }
-    for (num = 0; num < num_tokens; num++) {
+    for (num = 0; num < num_tokens; num += 2) {
         if (j+1 >= ti->count) {
             PLIST_JSON_ERR("%s: token index out of valid range\n", __func__);
-            plist_free(obj);
-            ti->err = PLIST_ERR_PARSE;
-            return NULL;
+            return PLIST_ERR_PARSE;
         }
-        if (ti->tokens[j].type == JSMN_STRING) {
-            char* key = unescape_string(js + ti->tokens[j].start, ti->tokens[j].end - ti->tokens[j].start, NULL);
-            if (!key) {
-                plist_free(obj);
-                ti->err = PLIST_ERR_PARSE;
-                return NULL;
-            }
-            plist_t val = NULL;
-            j++;
-            num++;
-            switch (ti->tokens[j].type) {
-                case JSMN_OBJECT:
-                    val = parse_object(js, ti, &j, depth+1);
-                    break;
-                case JSMN_ARRAY:
-                    val = parse_array(js, ti, &j, depth+1);
-                    break;
-                case JSMN_STRING:
-                    val = parse_string(js, ti, &j);
-                    break;
-                case JSMN_PRIMITIVE:
-                    val = parse_primitive(js, ti, &j);
-                    break;
-                default:
-                    break;
-            }
-            if (val) {
-                plist_dict_set_item(obj, key, val);
-                // if set failed, val still has no parent, free it and abort
-                if (((node_t)val)->parent == NULL) {
-                    plist_free(val);
-                    free(key);
-                    plist_free(obj);
-                    ti->err = PLIST_ERR_NO_MEM;
-                    return NULL;
-                }
-            } else {
-                free(key);
-                plist_free(obj);
-                ti->err = PLIST_ERR_PARSE;
-                return NULL;
-            }
-            free(key);
-        } else {
+        if (ti->tokens[j].type != JSMN_STRING) {
             PLIST_JSON_ERR("%s: keys must be of type STRING\n", __func__);
-            plist_free(obj);
-            ti->err = PLIST_ERR_PARSE;
-            return NULL;
+            return PLIST_ERR_PARSE;
+        }
+        err = parse_key(js, ti, j);
+        if (err != PLIST_ERR_SUCCESS) {
+            return err;
+        }
+        j++;
+        err = parse_value(js, ti, &j, depth+1);
+        if (err != PLIST_ERR_SUCCESS) {
+            return err;
         }
     }
     (*index) = j;
-    return obj;
+    return PLIST_EVENT(ti->handler, end_dict, ti->user_data);
 }
 
 plist_err_t plist_from_json(const char *json, uint32_t length, plist_t * plist)
 {
-    if (!plist) {
-        return PLIST_ERR_INVALID_ARG;
-    }
-    *plist = NULL;
-    if (!json || (length == 0)) {
+    return plist_from_json64(json, length, plist);
+}
+
+plist_err_t plist_from_json64(const char *json, uint64_t length, plist_t * plist)
+{
+    return plist_from_json_with_options(json, length, plist, PLIST_PARSE_NONE);
+}
+
+plist_err_t plist_json_parse_events(const char *json, uint64_t length, const plist_event_handler_t *handler, void *user_data)
+{
+    if (!json || (length == 0) || !handler) {
         return PLIST_ERR_INVALID_ARG;
     }
 
     jsmn_parser parser;
     jsmn_init(&parser);
-    unsigned int maxtoks = 256;
+    /* start with a guess based on the input size and grow geometrically,
+     * jsmn_parse() resumes where it stopped when it runs out of tokens */
+    uint64_t guess = length / 64;
+    unsigned int maxtoks = (guess < 256) ? 256 : (guess > INT_MAX / 2) ? INT_MAX / 2 : (unsigned int)guess;
     unsigned int curtoks = 0;
     int r = 0;
     jsmntok_t *tokens = NULL;
@@ -981,11 +931,11 @@ plist_err_t plist_from_json(const char *json, uint32_t length, plist_t * plist)
 
         r = jsmn_parse(&parser, json, length, tokens, maxtoks);
         if (r == JSMN_ERROR_NOMEM) {
-            if (maxtoks > (unsigned int)INT_MAX - 16) {
+            if (maxtoks >= (unsigned int)INT_MAX - 1) {
                 free(tokens);
                 return PLIST_ERR_NO_MEM;
             }
-            maxtoks+=16;
+            maxtoks = (maxtoks > (unsigned int)INT_MAX / 2) ? (unsigned int)INT_MAX - 1 : maxtoks * 2;
             continue;
         } else if (r < 0) {
             break;
@@ -1014,26 +964,36 @@ plist_err_t plist_from_json(const char *json, uint32_t length, plist_t * plist)
     }
 
     int startindex = 0;
-    jsmntok_info_t ti = { tokens, parser.toknext, PLIST_ERR_SUCCESS };
-    switch (tokens[startindex].type) {
-        case JSMN_PRIMITIVE:
-            *plist = parse_primitive(json, &ti, &startindex);
-            break;
-        case JSMN_STRING:
-            *plist = parse_string(json, &ti, &startindex);
-            break;
-        case JSMN_ARRAY:
-            *plist = parse_array(json, &ti, &startindex, 0);
-            break;
-        case JSMN_OBJECT:
-            *plist = parse_object(json, &ti, &startindex, 0);
-            break;
-        default:
-            break;
-    }
+    jsmntok_info_t ti = { tokens, parser.toknext, handler, user_data };
+    plist_err_t err = parse_value(json, &ti, &startindex, 0);
     free(tokens);
-    if (!*plist) {
-        return (ti.err != PLIST_ERR_SUCCESS) ? ti.err : PLIST_ERR_PARSE;
+    return err;
+}
+
+plist_err_t plist_from_json_with_options(const char *json, uint64_t length, plist_t * plist, plist_parse_options_t options)
+{
+    if (!plist) {
+        return PLIST_ERR_INVALID_ARG;
     }
-    return PLIST_ERR_SUCCESS;
+    *plist = NULL;
+    if (!json || (length == 0)) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+
+    hashtable_t *keys = NULL;
+    if (options & PLIST_PARSE_INTERN_KEYS) {
+        keys = plist_key_table_new();
+        if (!keys) {
+            return PLIST_ERR_NO_MEM;
+        }
+    }
+
+    struct plist_tree_builder tb;
+    plist_tree_builder_init(&tb, keys, 0);
+    plist_err_t err = plist_json_parse_events(json, length, &plist_tree_builder_handler, &tb);
+    err = plist_tree_builder_finish(&tb, err, plist);
+    if (keys) {
+        plist_key_table_free(keys);
+    }
+    return err;
 }
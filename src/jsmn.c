@@ -224,7 +224,8 @@ jsmnerr_t jsmn_parse(jsmn_parser *parser, const char *js, size_t length, jsmntok
 						break;
 					}
 					if (token->parent == -1) {
-						break;
+						/* Error if unmatched closing bracket */
+						return JSMN_ERROR_INVAL;
 					}
 					token = &tokens[token->parent];
 				}
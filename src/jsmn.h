@@ -56,6 +56,10 @@ typedef enum {
 	JSMN_SUCCESS = 0
 } jsmnerr_t;
 
+/* Keep a parent index in every token, so a closing bracket finds its
+ * opening token in O(depth) instead of scanning back over all tokens. */
+#define JSMN_PARENT_LINKS
+
 /**
  * JSON token description.
  * @param		type	type (object, array, string etc.)
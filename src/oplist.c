@@ -139,6 +139,10 @@ static const char allowed_unquoted_chars[256] = {
 static int str_needs_quotes(const char* str, size_t len)
 {
     size_t i;
+    if (len == 0) {
+        /* an empty unquoted string would not read back */
+        return 1;
+    }
     for (i = 0; i < len; i++) {
         if (!allowed_unquoted_chars[(unsigned char)str[i]]) {
             return 1;
@@ -147,169 +151,92 @@ static int str_needs_quotes(const char* str, size_t len)
     return 0;
 }
 
-static plist_err_t node_to_openstep(node_t node, bytearray_t **outbuf, uint32_t depth, int prettify, int coerce)
+static void openstep_write_string(bytearray_t *outbuf, const char *str, size_t len)
 {
-    plist_data_t node_data = NULL;
-
-    char *val = NULL;
-    size_t val_len = 0;
+    const char *charmap[32] = {
+        "\\U0000", "\\U0001", "\\U0002", "\\U0003", "\\U0004", "\\U0005", "\\U0006", "\\U0007",
+        "\\b",     "\\t",     "\\n",     "\\U000b", "\\f",     "\\r",     "\\U000e", "\\U000f",
+        "\\U0010", "\\U0011", "\\U0012", "\\U0013", "\\U0014", "\\U0015", "\\U0016", "\\U0017",
+        "\\U0018", "\\U0019", "\\U001a", "\\U001b", "\\U001c", "\\U001d", "\\U001e", "\\U001f",
+    };
+    size_t j = 0;
+    off_t start = 0;
+    off_t cur = 0;
+    int needs_quotes;
+
+    needs_quotes = str_needs_quotes(str, len);
+
+    if (needs_quotes) {
+        str_buf_append(outbuf, "\"", 1);
+    }
 
-    uint32_t i = 0;
+    for (j = 0; j < len; j++) {
+        unsigned char ch = (unsigned char)str[j];
+        if (ch < 0x20) {
+            str_buf_append(outbuf, str + start, cur - start);
+            str_buf_append(outbuf, charmap[ch], (charmap[ch][1] == 'u') ? 6 : 2);
+            start = cur+1;
+        } else if (ch == '"') {
+            str_buf_append(outbuf, str + start, cur - start);
+            str_buf_append(outbuf, "\\\"", 2);
+            start = cur+1;
+        }
+        cur++;
+    }
+    str_buf_append(outbuf, str + start, cur - start);
 
-    if (!node)
-        return PLIST_ERR_INVALID_ARG;
+    if (needs_quotes) {
+        str_buf_append(outbuf, "\"", 1);
+    }
+}
 
-    node_data = plist_get_data(node);
+/* writes a value that is not a container, passed like to
+ * plist_event_handler_t.value() */
+static plist_err_t openstep_write_value(bytearray_t *outbuf, plist_type type, const void *value, uint64_t length, int prettify, int coerce)
+{
+    char val[64];
+    size_t val_len = 0;
 
-    switch (node_data->type)
+    switch (type)
     {
     case PLIST_INT:
-        val = (char*)malloc(64);
-        if (node_data->length == 16) {
-            val_len = snprintf(val, 64, "%" PRIu64, node_data->intval);
+        if (length == 16) {
+            val_len = snprintf(val, sizeof(val), "%" PRIu64, *(const uint64_t*)value);
         } else {
-            val_len = snprintf(val, 64, "%" PRIi64, node_data->intval);
+            val_len = snprintf(val, sizeof(val), "%" PRIi64, *(const int64_t*)value);
         }
-        str_buf_append(*outbuf, val, val_len);
-        free(val);
+        str_buf_append(outbuf, val, val_len);
         break;
 
     case PLIST_REAL:
-        val = (char*)malloc(64);
-        val_len = dtostr(val, 64, node_data->realval);
-        str_buf_append(*outbuf, val, val_len);
-        free(val);
+        val_len = dtostr(val, sizeof(val), *(const double*)value);
+        str_buf_append(outbuf, val, val_len);
         break;
 
     case PLIST_STRING:
-    case PLIST_KEY: {
-        const char *charmap[32] = {
-            "\\U0000", "\\U0001", "\\U0002", "\\U0003", "\\U0004", "\\U0005", "\\U0006", "\\U0007",
-            "\\b",     "\\t",     "\\n",     "\\U000b", "\\f",     "\\r",     "\\U000e", "\\U000f",
-            "\\U0010", "\\U0011", "\\U0012", "\\U0013", "\\U0014", "\\U0015", "\\U0016", "\\U0017",
-            "\\U0018", "\\U0019", "\\U001a", "\\U001b", "\\U001c", "\\U001d", "\\U001e", "\\U001f",
-        };
-        size_t j = 0;
-        size_t len = 0;
-        off_t start = 0;
-        off_t cur = 0;
-        int needs_quotes;
-
-        len = node_data->length;
-
-        needs_quotes = str_needs_quotes(node_data->strval, len);
-
-        if (needs_quotes) {
-            str_buf_append(*outbuf, "\"", 1);
-        }
-
-        for (j = 0; j < len; j++) {
-            unsigned char ch = (unsigned char)node_data->strval[j];
-            if (ch < 0x20) {
-                str_buf_append(*outbuf, node_data->strval + start, cur - start);
-                str_buf_append(*outbuf, charmap[ch], (charmap[ch][1] == 'u') ? 6 : 2);
-                start = cur+1;
-            } else if (ch == '"') {
-                str_buf_append(*outbuf, node_data->strval + start, cur - start);
-                str_buf_append(*outbuf, "\\\"", 2);
-                start = cur+1;
-            }
-            cur++;
-        }
-        str_buf_append(*outbuf, node_data->strval + start, cur - start);
-
-        if (needs_quotes) {
-            str_buf_append(*outbuf, "\"", 1);
-        }
-
-        } break;
+    case PLIST_KEY:
+        openstep_write_string(outbuf, (const char*)value, length);
+        break;
 
-    case PLIST_ARRAY: {
-        str_buf_append(*outbuf, "(", 1);
-        node_t ch;
-        uint32_t cnt = 0;
-        for (ch = node_first_child(node); ch; ch = node_next_sibling(ch)) {
-            if (cnt > 0) {
-                str_buf_append(*outbuf, ",", 1);
-            }
-            if (prettify) {
-                str_buf_append(*outbuf, "\n", 1);
-                for (i = 0; i <= depth; i++) {
-                    str_buf_append(*outbuf, "  ", 2);
-                }
-            }
-            plist_err_t res = node_to_openstep(ch, outbuf, depth+1, prettify, coerce);
-            if (res < 0) {
-                return res;
-            }
-            cnt++;
-        }
-        if (cnt > 0 && prettify) {
-            str_buf_append(*outbuf, "\n", 1);
-            for (i = 0; i < depth; i++) {
-                str_buf_append(*outbuf, "  ", 2);
-            }
-        }
-        str_buf_append(*outbuf, ")", 1);
-        } break;
-    case PLIST_DICT: {
-        str_buf_append(*outbuf, "{", 1);
-        node_t ch;
-        uint32_t cnt = 0;
-        for (ch = node_first_child(node); ch; ch = node_next_sibling(ch)) {
-            if (cnt > 0 && cnt % 2 == 0) {
-                str_buf_append(*outbuf, ";", 1);
-            }
-            if (cnt % 2 == 0 && prettify) {
-                str_buf_append(*outbuf, "\n", 1);
-                for (i = 0; i <= depth; i++) {
-                    str_buf_append(*outbuf, "  ", 2);
-                }
-            }
-            plist_err_t res = node_to_openstep(ch, outbuf, depth+1, prettify, coerce);
-            if (res < 0) {
-                return res;
-            }
-            if (cnt % 2 == 0) {
-                if (prettify) {
-                  str_buf_append(*outbuf, " = ", 3);
-                } else {
-                  str_buf_append(*outbuf, "=", 1);
-                }
-            }
-            cnt++;
-        }
-        if (cnt > 0) {
-          str_buf_append(*outbuf, ";", 1);
-        }
-        if (cnt > 0 && prettify) {
-            str_buf_append(*outbuf, "\n", 1);
-            for (i = 0; i < depth; i++) {
-                str_buf_append(*outbuf, "  ", 2);
-            }
-        }
-        str_buf_append(*outbuf, "}", 1);
-        } break;
     case PLIST_DATA: {
+        const unsigned char *buff = (const unsigned char*)value;
         size_t j = 0;
-        size_t len = 0;
-        str_buf_append(*outbuf, "<", 1);
-        len = node_data->length;
-        for (j = 0; j < len; j++) {
+        str_buf_append(outbuf, "<", 1);
+        for (j = 0; j < length; j++) {
             char charb[4];
             if (prettify && j > 0 && (j % 4 == 0))
-              str_buf_append(*outbuf, " ", 1);
-            sprintf(charb, "%02x", (unsigned char)node_data->buff[j]);
-            str_buf_append(*outbuf, charb, 2);
+              str_buf_append(outbuf, " ", 1);
+            sprintf(charb, "%02x", buff[j]);
+            str_buf_append(outbuf, charb, 2);
         }
-        str_buf_append(*outbuf, ">", 1);
+        str_buf_append(outbuf, ">", 1);
         } break;
     case PLIST_BOOLEAN:
         if (coerce) {
-            if (node_data->boolval) {
-                str_buf_append(*outbuf, "1", 1);
+            if (*(const uint8_t*)value) {
+                str_buf_append(outbuf, "1", 1);
             } else {
-                str_buf_append(*outbuf, "0", 1);
+                str_buf_append(outbuf, "0", 1);
             }
         } else {
             PLIST_OSTEP_WRITE_ERR("PLIST_BOOLEAN type is not valid for OpenStep format\n");
@@ -318,7 +245,7 @@ static plist_err_t node_to_openstep(node_t node, bytearray_t **outbuf, uint32_t
         break;
     case PLIST_NULL:
         if (coerce) {
-            str_buf_append(*outbuf, "NULL", 4);
+            str_buf_append(outbuf, "NULL", 4);
         } else {
             PLIST_OSTEP_WRITE_ERR("PLIST_NULL type is not valid for OpenStep format\n");
             return PLIST_ERR_FORMAT;
@@ -326,7 +253,7 @@ static plist_err_t node_to_openstep(node_t node, bytearray_t **outbuf, uint32_t
         break;
     case PLIST_DATE:
         if (coerce) {
-            Time64_T timev = (Time64_T)node_data->realval + MAC_EPOCH;
+            Time64_T timev = (Time64_T)*(const double*)value + MAC_EPOCH;
             struct TM _btime;
             struct TM *btime = gmtime64_r(&timev, &_btime);
             char datebuf[32];
@@ -339,9 +266,9 @@ static plist_err_t node_to_openstep(node_t node, bytearray_t **outbuf, uint32_t
             if (datelen <= 0) {
                 datelen = snprintf(datebuf, sizeof(datebuf), "1970-01-01T00:00:00Z");
             }
-            str_buf_append(*outbuf, "\"", 1);
-            str_buf_append(*outbuf, datebuf, datelen);
-            str_buf_append(*outbuf, "\"", 1);
+            str_buf_append(outbuf, "\"", 1);
+            str_buf_append(outbuf, datebuf, datelen);
+            str_buf_append(outbuf, "\"", 1);
         } else {
             // NOT VALID FOR OPENSTEP
             PLIST_OSTEP_WRITE_ERR("PLIST_DATE type is not valid for OpenStep format\n");
@@ -350,14 +277,12 @@ static plist_err_t node_to_openstep(node_t node, bytearray_t **outbuf, uint32_t
         break;
     case PLIST_UID:
         if (coerce) {
-            val = (char*)malloc(64);
-            if (node_data->length == 16) {
-                val_len = snprintf(val, 64, "%" PRIu64, node_data->intval);
+            if (length == 16) {
+                val_len = snprintf(val, sizeof(val), "%" PRIu64, *(const uint64_t*)value);
             } else {
-                val_len = snprintf(val, 64, "%" PRIi64, node_data->intval);
+                val_len = snprintf(val, sizeof(val), "%" PRIi64, *(const int64_t*)value);
             }
-            str_buf_append(*outbuf, val, val_len);
-            free(val);
+            str_buf_append(outbuf, val, val_len);
         } else {
             // NOT VALID FOR OPENSTEP
             PLIST_OSTEP_WRITE_ERR("PLIST_UID type is not valid for OpenStep format\n");
@@ -371,181 +296,95 @@ static plist_err_t node_to_openstep(node_t node, bytearray_t **outbuf, uint32_t
     return PLIST_ERR_SUCCESS;
 }
 
-#define PO10i_LIMIT (INT64_MAX/10)
-
-/* based on https://stackoverflow.com/a/4143288 */
-static int num_digits_i(int64_t i)
+static plist_err_t node_to_openstep(node_t node, bytearray_t **outbuf, uint32_t depth, int prettify, int coerce, node_t *path)
 {
-    int n;
-    int64_t po10;
-    n=1;
-    if (i < 0) {
-        i = (i == INT64_MIN) ? INT64_MAX : -i;
-        n++;
-    }
-    po10=10;
-    while (i>=po10) {
-        n++;
-        if (po10 > PO10i_LIMIT) break;
-        po10*=10;
-    }
-    return n;
-}
-
-#define PO10u_LIMIT (UINT64_MAX/10)
+    plist_data_t node_data = NULL;
 
-/* based on https://stackoverflow.com/a/4143288 */
-static int num_digits_u(uint64_t i)
-{
-    int n;
-    uint64_t po10;
-    n=1;
-    po10=10;
-    while (i>=po10) {
-        n++;
-        if (po10 > PO10u_LIMIT) break;
-        po10*=10;
-    }
-    return n;
-}
+    uint32_t i = 0;
 
-static plist_err_t _node_estimate_size(node_t node, uint64_t *size, uint32_t depth, int prettify, int coerce, hashtable_t *visited)
-{
-    plist_data_t data;
-    if (!node) {
+    if (!node)
         return PLIST_ERR_INVALID_ARG;
-    }
-
-    if (depth > PLIST_MAX_NESTING_DEPTH) {
-        PLIST_OSTEP_WRITE_ERR("node tree is nested too deeply\n");
-        return PLIST_ERR_MAX_NESTING;
-    }
 
-    if (hash_table_lookup(visited, node)) {
-        PLIST_OSTEP_WRITE_ERR("circular reference detected\n");
-        return PLIST_ERR_CIRCULAR_REF;
+    plist_err_t err = plist_write_check_node(node, path, depth);
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
     }
 
-    // mark as visited
-    hash_table_insert(visited, node, (void*)1);
+    node_data = plist_get_data(node);
 
-    data = plist_get_data(node);
-    if (node->children) {
+    switch (node_data->type)
+    {
+    case PLIST_ARRAY: {
+        str_buf_append(*outbuf, "(", 1);
         node_t ch;
-        unsigned int n_children = node_n_children(node);
+        uint32_t cnt = 0;
         for (ch = node_first_child(node); ch; ch = node_next_sibling(ch)) {
-            plist_err_t res = _node_estimate_size(ch, size, depth + 1, prettify, coerce, visited);
+            if (cnt > 0) {
+                str_buf_append(*outbuf, ",", 1);
+            }
+            if (prettify) {
+                str_buf_append(*outbuf, "\n", 1);
+                for (i = 0; i <= depth; i++) {
+                    str_buf_append(*outbuf, "  ", 2);
+                }
+            }
+            plist_err_t res = node_to_openstep(ch, outbuf, depth+1, prettify, coerce, path);
             if (res < 0) {
                 return res;
             }
+            cnt++;
         }
-        switch (data->type) {
-        case PLIST_DICT:
-            *size += 2; // '{' and '}'
-            *size += n_children; // number of '=' and ';'
-            if (prettify) {
-                *size += n_children*2; // number of '\n' and extra spaces
-                *size += (uint64_t)n_children * (depth+1); // indent for every 2nd child
-                *size += 1; // additional '\n'
-            }
-            break;
-        case PLIST_ARRAY:
-            *size += 2; // '(' and ')'
-            *size += n_children-1; // number of ','
-            if (prettify) {
-                *size += n_children; // number of '\n'
-                *size += (uint64_t)n_children * ((depth+1)<<1); // indent for every child
-                *size += 1; // additional '\n'
+        if (cnt > 0 && prettify) {
+            str_buf_append(*outbuf, "\n", 1);
+            for (i = 0; i < depth; i++) {
+                str_buf_append(*outbuf, "  ", 2);
             }
-            break;
-        default:
-            break;
-	}
-        if (prettify)
-            *size += (depth << 1); // indent for {} and ()
-    } else {
-        switch (data->type) {
-        case PLIST_STRING:
-        case PLIST_KEY:
-            *size += data->length;
-            *size += 2;
-            break;
-        case PLIST_INT:
-            if (data->length == 16) {
-                *size += num_digits_u(data->intval);
-            } else {
-                *size += num_digits_i((int64_t)data->intval);
+        }
+        str_buf_append(*outbuf, ")", 1);
+        } break;
+    case PLIST_DICT: {
+        str_buf_append(*outbuf, "{", 1);
+        node_t ch;
+        uint32_t cnt = 0;
+        for (ch = node_first_child(node); ch; ch = node_next_sibling(ch)) {
+            if (cnt > 0 && cnt % 2 == 0) {
+                str_buf_append(*outbuf, ";", 1);
             }
-            break;
-        case PLIST_REAL:
-            *size += dtostr(NULL, 0, data->realval);
-            break;
-        case PLIST_DICT:
-        case PLIST_ARRAY:
-            *size += 2;
-            break;
-        case PLIST_DATA:
-            *size += 2; // < and >
-            *size += data->length*2;
-            if (prettify)
-                *size += data->length/4;
-            break;
-        case PLIST_BOOLEAN:
-            if (coerce) {
-                *size += 1;
-            } else {
-                // NOT VALID FOR OPENSTEP
-                PLIST_OSTEP_WRITE_ERR("PLIST_BOOLEAN type is not valid for OpenStep format\n");
-                return PLIST_ERR_FORMAT;
+            if (cnt % 2 == 0 && prettify) {
+                str_buf_append(*outbuf, "\n", 1);
+                for (i = 0; i <= depth; i++) {
+                    str_buf_append(*outbuf, "  ", 2);
+                }
             }
-            break;
-        case PLIST_DATE:
-            if (coerce) {
-                // ISO 8601 string: "YYYY-MM-DDTHH:MM:SSZ" = 22 chars max
-                *size += 24;
-            } else {
-                // NOT VALID FOR OPENSTEP
-                PLIST_OSTEP_WRITE_ERR("PLIST_DATE type is not valid for OpenStep format\n");
-                return PLIST_ERR_FORMAT;
+            plist_err_t res = node_to_openstep(ch, outbuf, depth+1, prettify, coerce, path);
+            if (res < 0) {
+                return res;
             }
-            break;
-        case PLIST_UID:
-            if (coerce) {
-                if (data->length == 16) {
-                    *size += num_digits_u(data->intval);
+            if (cnt % 2 == 0) {
+                if (prettify) {
+                  str_buf_append(*outbuf, " = ", 3);
                 } else {
-                    *size += num_digits_i((int64_t)data->intval);
+                  str_buf_append(*outbuf, "=", 1);
                 }
-            } else {
-                // NOT VALID FOR OPENSTEP
-                PLIST_OSTEP_WRITE_ERR("PLIST_UID type is not valid for OpenStep format\n");
-                return PLIST_ERR_FORMAT;
             }
-            break;
-        case PLIST_NULL:
-            if (coerce) {
-                *size += 4;
-            } else {
-                // NOT VALID FOR OPENSTEP
-                PLIST_OSTEP_WRITE_ERR("PLIST_NULL type is not valid for OpenStep format\n");
-                return PLIST_ERR_FORMAT;
+            cnt++;
+        }
+        if (cnt > 0) {
+          str_buf_append(*outbuf, ";", 1);
+        }
+        if (cnt > 0 && prettify) {
+            str_buf_append(*outbuf, "\n", 1);
+            for (i = 0; i < depth; i++) {
+                str_buf_append(*outbuf, "  ", 2);
             }
-            break;
-        default:
-            PLIST_OSTEP_WRITE_ERR("invalid node type encountered\n");
-            return PLIST_ERR_UNKNOWN;
         }
+        str_buf_append(*outbuf, "}", 1);
+        } break;
+    default:
+        return openstep_write_value(*outbuf, node_data->type, plist_data_value(node_data), node_data->length, prettify, coerce);
     }
-    return PLIST_ERR_SUCCESS;
-}
 
-static plist_err_t node_estimate_size(node_t node, uint64_t *size, uint32_t depth, int prettify, int coerce)
-{
-    hashtable_t *visited = hash_table_new(plist_node_ptr_hash, plist_node_ptr_compare, NULL);
-    if (!visited) return PLIST_ERR_NO_MEM;
-    plist_err_t err = _node_estimate_size(node, size, depth, prettify, coerce, visited);
-    hash_table_destroy(visited);
-    return err;
+    return PLIST_ERR_SUCCESS;
 }
 
 plist_err_t plist_to_openstep(plist_t plist, char **openstep, uint32_t* length, int prettify)
@@ -556,7 +395,16 @@ plist_err_t plist_to_openstep(plist_t plist, char **openstep, uint32_t* length,
 
 plist_err_t plist_to_openstep_with_options(plist_t plist, char **openstep, uint32_t* length, plist_write_options_t options)
 {
-    uint64_t size = 0;
+    uint64_t length64 = 0;
+    if (!length) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+    plist_err_t err = plist_to_openstep64(plist, openstep, &length64, options);
+    return plist_output_length32(err, openstep, length64, length);
+}
+
+plist_err_t plist_to_openstep64(plist_t plist, char **openstep, uint64_t* length, plist_write_options_t options)
+{
     plist_err_t res;
 
     if (!plist || !openstep || !length) {
@@ -566,18 +414,14 @@ plist_err_t plist_to_openstep_with_options(plist_t plist, char **openstep, uint3
     int prettify = !(options & PLIST_OPT_COMPACT);
     int coerce = options & PLIST_OPT_COERCE;
 
-    res = node_estimate_size((node_t)plist, &size, 0, prettify, coerce);
-    if (res < 0) {
-        return res;
-    }
-
-    strbuf_t *outbuf = str_buf_new(size);
+    strbuf_t *outbuf = str_buf_new(0);
     if (!outbuf) {
         PLIST_OSTEP_WRITE_ERR("Could not allocate output buffer");
         return PLIST_ERR_NO_MEM;
     }
 
-    res = node_to_openstep((node_t)plist, &outbuf, 0, prettify, coerce);
+    node_t path[PLIST_WRITE_PATH_SIZE];
+    res = node_to_openstep((node_t)plist, &outbuf, 0, prettify, coerce, path);
     if (res < 0) {
         str_buf_free(outbuf);
         *openstep = NULL;
@@ -599,12 +443,156 @@ plist_err_t plist_to_openstep_with_options(plist_t plist, char **openstep, uint3
     return PLIST_ERR_SUCCESS;
 }
 
+/* writes OpenStep while the input is parsed, see plist_convert() */
+struct openstep_event_writer {
+    bytearray_t *outbuf;
+    int prettify;
+    int coerce;
+    /* number of open containers */
+    uint32_t depth;
+    /* per open container: whether it is a dictionary, and whether it has
+     * items already */
+    uint8_t dict[PLIST_WRITE_PATH_SIZE];
+    uint8_t items[PLIST_WRITE_PATH_SIZE];
+};
+
+static void openstep_writer_indent(struct openstep_event_writer *w, uint32_t depth)
+{
+    uint32_t i;
+    str_buf_append(w->outbuf, "\n", 1);
+    for (i = 0; i < depth; i++) {
+        str_buf_append(w->outbuf, "  ", 2);
+    }
+}
+
+/* separates an array item or a dictionary entry from the previous one */
+static void openstep_writer_next_item(struct openstep_event_writer *w)
+{
+    if (w->items[w->depth-1]) {
+        str_buf_append(w->outbuf, (w->dict[w->depth-1]) ? ";" : ",", 1);
+    }
+    w->items[w->depth-1] = 1;
+    if (w->prettify) {
+        openstep_writer_indent(w, w->depth);
+    }
+}
+
+static plist_err_t openstep_writer_begin(struct openstep_event_writer *w, int dict)
+{
+    if (w->depth >= PLIST_WRITE_PATH_SIZE) {
+        return PLIST_ERR_MAX_NESTING;
+    }
+    if (w->depth > 0 && !w->dict[w->depth-1]) {
+        openstep_writer_next_item(w);
+    }
+    str_buf_append(w->outbuf, (dict) ? "{" : "(", 1);
+    w->dict[w->depth] = (uint8_t)dict;
+    w->items[w->depth] = 0;
+    w->depth++;
+    return plist_write_status(w->outbuf);
+}
+
+static plist_err_t openstep_writer_end(struct openstep_event_writer *w, int dict)
+{
+    if (w->depth == 0) {
+        return PLIST_ERR_PARSE;
+    }
+    w->depth--;
+    if (w->items[w->depth] && dict) {
+        str_buf_append(w->outbuf, ";", 1);
+    }
+    if (w->items[w->depth] && w->prettify) {
+        openstep_writer_indent(w, w->depth);
+    }
+    str_buf_append(w->outbuf, (dict) ? "}" : ")", 1);
+    return plist_write_status(w->outbuf);
+}
+
+static plist_err_t openstep_writer_begin_dict(void *user_data)
+{
+    return openstep_writer_begin((struct openstep_event_writer*)user_data, 1);
+}
+
+static plist_err_t openstep_writer_end_dict(void *user_data)
+{
+    return openstep_writer_end((struct openstep_event_writer*)user_data, 1);
+}
+
+static plist_err_t openstep_writer_begin_array(void *user_data)
+{
+    return openstep_writer_begin((struct openstep_event_writer*)user_data, 0);
+}
+
+static plist_err_t openstep_writer_end_array(void *user_data)
+{
+    return openstep_writer_end((struct openstep_event_writer*)user_data, 0);
+}
+
+static plist_err_t openstep_writer_key(void *user_data, const char *key, uint64_t length)
+{
+    struct openstep_event_writer *w = (struct openstep_event_writer*)user_data;
+    if (w->depth == 0) {
+        return PLIST_ERR_PARSE;
+    }
+    openstep_writer_next_item(w);
+    openstep_write_string(w->outbuf, key, length);
+    if (w->prettify) {
+        str_buf_append(w->outbuf, " = ", 3);
+    } else {
+        str_buf_append(w->outbuf, "=", 1);
+    }
+    return plist_write_status(w->outbuf);
+}
+
+static plist_err_t openstep_writer_value(void *user_data, plist_type type, const void *value, uint64_t length)
+{
+    struct openstep_event_writer *w = (struct openstep_event_writer*)user_data;
+    if (w->depth > 0 && !w->dict[w->depth-1]) {
+        openstep_writer_next_item(w);
+    }
+    plist_err_t err = openstep_write_value(w->outbuf, type, value, length, w->prettify, w->coerce);
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
+    }
+    return plist_write_status(w->outbuf);
+}
+
+static const plist_event_handler_t openstep_writer_handler = {
+    openstep_writer_begin_dict,
+    openstep_writer_end_dict,
+    openstep_writer_begin_array,
+    openstep_writer_end_array,
+    openstep_writer_key,
+    openstep_writer_value,
+    NULL
+};
+
+plist_err_t plist_convert_to_openstep(const char *input, uint64_t length, plist_format_t format, bytearray_t *outbuf, plist_write_options_t options)
+{
+    struct openstep_event_writer w;
+    w.outbuf = outbuf;
+    w.prettify = !(options & PLIST_OPT_COMPACT);
+    w.coerce = options & PLIST_OPT_COERCE;
+    w.depth = 0;
+
+    plist_err_t err = plist_parse_events(input, length, format, &openstep_writer_handler, &w);
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
+    }
+    if (w.prettify) {
+        str_buf_append(outbuf, "\n", 1);
+    }
+    return plist_write_status(outbuf);
+}
+
 struct _parse_ctx {
     const char *start;
     const char *pos;
     const char *end;
     plist_err_t err;
     uint32_t depth;
+    const plist_event_handler_t *handler;
+    void *user_data;
 };
 typedef struct _parse_ctx* parse_ctx;
 
@@ -647,27 +635,172 @@ static void parse_skip_ws(parse_ctx ctx)
 
 #define HEX_DIGIT(x) ((x <= '9') ? (x - '0') : ((x <= 'F') ? (x - 'A' + 10) : (x - 'a' + 10)))
 
-static plist_err_t node_from_openstep(parse_ctx ctx, plist_t *plist);
+/* parses the quoted or unquoted string at ctx->pos. *str points into the
+ * input, or to a malloc()ed and NUL-terminated buffer that is also stored
+ * in *owned if escape sequences had to be replaced */
+static plist_err_t parse_string(parse_ctx ctx, const char **str, size_t *length, char **owned)
+{
+    const char *p = NULL;
+    *owned = NULL;
+    if (*ctx->pos == '"' || *ctx->pos == '\'') {
+        char c = *ctx->pos;
+        ctx->pos++;
+        p = ctx->pos;
+        size_t num_escapes = 0;
+        while (ctx->pos < ctx->end) {
+            if (*ctx->pos == '\\') {
+                num_escapes++;
+            }
+            if ((*ctx->pos == c) && (*(ctx->pos-1) != '\\')) {
+                break;
+            }
+            ctx->pos++;
+        }
+        if (ctx->pos >= ctx->end) {
+            PLIST_OSTEP_ERR("EOF while parsing quoted string at offset %ld\n", (long int)(ctx->pos - ctx->start));
+            ctx->err = PLIST_ERR_PARSE;
+            return ctx->err;
+        }
+        if (*ctx->pos != c) {
+            PLIST_OSTEP_ERR("Missing closing quote (%c) at offset %ld\n", c, (long int)(ctx->pos - ctx->start));
+            ctx->err = PLIST_ERR_PARSE;
+            return ctx->err;
+        }
+        size_t slen = ctx->pos - p;
+        ctx->pos++; // skip the closing quote
+        if (num_escapes == 0) {
+            *str = p;
+            *length = slen;
+            return PLIST_ERR_SUCCESS;
+        }
+        char* strbuf = (char*)malloc(slen+1);
+        if (!strbuf) {
+            ctx->err = PLIST_ERR_NO_MEM;
+            return ctx->err;
+        }
+        size_t i = 0;
+        size_t o = 0;
+        while (i < slen) {
+            if (p[i] == '\\') {
+                /* handle escape sequence */
+                i++;
+                switch (p[i]) {
+                    case '0':
+                    case '1':
+                    case '2':
+                    case '3':
+                    case '4':
+                    case '5':
+                    case '6':
+                    case '7': {
+                        // max 3 digits octal
+                        unsigned char chr = 0;
+                        int maxd = 3;
+                        while ((i < slen) && (p[i] >= '0' && p[i] <= '7') && --maxd) {
+                            chr = (chr << 3) + p[i] - '0';
+                            i++;
+                        }
+                        strbuf[o++] = (char)chr;
+                    }   break;
+                    case 'U': {
+                        i++;
+                        // max 4 digits hex
+                        uint16_t wchr = 0;
+                        int maxd = 4;
+                        while ((i < slen) && isxdigit(p[i]) && maxd--) {
+                            wchr = (wchr << 4) + ((p[i] <= '9') ? (p[i] - '0') : ((p[i] <= 'F') ? (p[i] - 'A' + 10) : (p[i] - 'a' + 10)));
+                            i++;
+                        }
+                        if (wchr >= 0x800) {
+                            strbuf[o++] = (char)(0xE0 + ((wchr >> 12) & 0xF));
+                            strbuf[o++] = (char)(0x80 + ((wchr >> 6) & 0x3F));
+                            strbuf[o++] = (char)(0x80 + (wchr & 0x3F));
+                        } else if (wchr >= 0x80) {
+                            strbuf[o++] = (char)(0xC0 + ((wchr >> 6) & 0x1F));
+                            strbuf[o++] = (char)(0x80 + (wchr & 0x3F));
+                        } else {
+                            strbuf[o++] = (char)(wchr & 0x7F);
+                        }
+                    }   break;
+                    case 'a': strbuf[o++] = '\a'; i++; break;
+                    case 'b': strbuf[o++] = '\b'; i++; break;
+                    case 'f': strbuf[o++] = '\f'; i++; break;
+                    case 'n': strbuf[o++] = '\n'; i++; break;
+                    case 'r': strbuf[o++] = '\r'; i++; break;
+                    case 't': strbuf[o++] = '\t'; i++; break;
+                    case 'v': strbuf[o++] = '\v'; i++; break;
+                    case '"': strbuf[o++] = '"';  i++; break;
+                    case '\'': strbuf[o++] = '\''; i++; break;
+                    default:
+                        break;
+                }
+            } else {
+                strbuf[o++] = p[i++];
+            }
+        }
+        strbuf[o] = '\0';
+        *str = strbuf;
+        *length = o;
+        *owned = strbuf;
+        return PLIST_ERR_SUCCESS;
+    }
+
+    // unquoted string
+    p = ctx->pos;
+    while (ctx->pos < ctx->end) {
+        if (!allowed_unquoted_chars[(uint8_t)*ctx->pos]) {
+            break;
+        }
+        ctx->pos++;
+    }
+    if (ctx->pos == p) {
+        PLIST_OSTEP_ERR("Unexpected character when parsing unquoted string at offset %ld\n", (long int)(ctx->pos - ctx->start));
+        ctx->err = PLIST_ERR_PARSE;
+        return ctx->err;
+    }
+    *str = p;
+    *length = ctx->pos - p;
+    return PLIST_ERR_SUCCESS;
+}
+
+static int check_depth(parse_ctx ctx)
+{
+    if (ctx->depth >= PLIST_MAX_NESTING_DEPTH) {
+        PLIST_OSTEP_ERR("Too many levels of recursion (%u) at offset %ld\n", ctx->depth + 1, (long int)(ctx->pos - ctx->start));
+        ctx->err = PLIST_ERR_MAX_NESTING;
+        return -1;
+    }
+    return 0;
+}
+
+static plist_err_t node_from_openstep(parse_ctx ctx);
 
-static void parse_dict_data(parse_ctx ctx, plist_t dict)
+static void parse_dict_data(parse_ctx ctx)
 {
-    plist_t key = NULL;
-    plist_t val = NULL;
     while (ctx->pos < ctx->end && !ctx->err) {
         parse_skip_ws(ctx);
         if (ctx->pos >= ctx->end || *ctx->pos == '}') {
             break;
         }
-        key = NULL;
-        ctx->err = node_from_openstep(ctx, &key);
-        if (ctx->err != PLIST_ERR_SUCCESS) {
+        if (check_depth(ctx) < 0) {
             break;
         }
-        if (!PLIST_IS_STRING(key)) {
+        if (*ctx->pos == '{' || *ctx->pos == '(' || *ctx->pos == '<') {
             PLIST_OSTEP_ERR("Invalid type for dictionary key at offset %ld\n", (long int)(ctx->pos - ctx->start));
             ctx->err = PLIST_ERR_PARSE;
             break;
         }
+        const char *key = NULL;
+        size_t keylen = 0;
+        char *owned = NULL;
+        if (parse_string(ctx, &key, &keylen, &owned) != PLIST_ERR_SUCCESS) {
+            break;
+        }
+        ctx->err = PLIST_EVENT(ctx->handler, key, ctx->user_data, key, keylen);
+        free(owned);
+        if (ctx->err != PLIST_ERR_SUCCESS) {
+            break;
+        }
         parse_skip_ws(ctx);
         if (ctx->pos >= ctx->end) {
             PLIST_OSTEP_ERR("EOF while parsing dictionary '=' delimiter at offset %ld\n", (long int)(ctx->pos - ctx->start));
@@ -685,16 +818,15 @@ static void parse_dict_data(parse_ctx ctx, plist_t dict)
             ctx->err = PLIST_ERR_PARSE;
             break;
         }
-        val = NULL;
-        ctx->err = node_from_openstep(ctx, &val);
-        if (ctx->err != PLIST_ERR_SUCCESS) {
-            break;
-        }
-        if (!val) {
+        parse_skip_ws(ctx);
+        if (ctx->pos >= ctx->end) {
             PLIST_OSTEP_ERR("Missing value for dictionary item at offset %ld\n", (long int)(ctx->pos - ctx->start));
             ctx->err = PLIST_ERR_PARSE;
             break;
         }
+        if (node_from_openstep(ctx) != PLIST_ERR_SUCCESS) {
+            break;
+        }
         parse_skip_ws(ctx);
         if (ctx->pos >= ctx->end) {
             PLIST_OSTEP_ERR("EOF while parsing dictionary item terminator ';' at offset %ld\n", (long int)(ctx->pos - ctx->start));
@@ -706,311 +838,222 @@ static void parse_dict_data(parse_ctx ctx, plist_t dict)
             ctx->err = PLIST_ERR_PARSE;
             break;
         }
-
-        plist_dict_set_item(dict, plist_get_string_ptr(key, NULL), val);
-        plist_free(key);
-        key = NULL;
-        val = NULL;
-
         ctx->pos++;
     }
-    plist_free(key);
-    plist_free(val);
 }
 
-static plist_err_t node_from_openstep(parse_ctx ctx, plist_t *plist)
+/* parses the value at ctx->pos, which must not point to whitespace, and
+ * reports it to ctx->handler */
+static plist_err_t node_from_openstep(parse_ctx ctx)
 {
-    plist_t subnode = NULL;
-    const char *p = NULL;
-    ctx->depth++;
-    if (ctx->depth > PLIST_MAX_NESTING_DEPTH) {
-        PLIST_OSTEP_ERR("Too many levels of recursion (%u) at offset %ld\n", ctx->depth, (long int)(ctx->pos - ctx->start));
-        ctx->err = PLIST_ERR_MAX_NESTING;
+    if (check_depth(ctx) < 0) {
         return ctx->err;
     }
-    while (ctx->pos < ctx->end && !ctx->err) {
-        parse_skip_ws(ctx);
+    ctx->depth++;
+    if (*ctx->pos == '{') {
+        ctx->pos++;
+        ctx->err = PLIST_EVENT(ctx->handler, begin_dict, ctx->user_data);
+        if (ctx->err == PLIST_ERR_SUCCESS) {
+            parse_dict_data(ctx);
+        }
+        if (ctx->err != PLIST_ERR_SUCCESS) {
+            return ctx->err;
+        }
         if (ctx->pos >= ctx->end) {
-            break;
+            PLIST_OSTEP_ERR("EOF while parsing dictionary terminator '}' at offset %ld\n", (long int)(ctx->pos - ctx->start));
+            ctx->err = PLIST_ERR_PARSE;
+            return ctx->err;
         }
-        plist_data_t data = plist_new_plist_data();
-        if (*ctx->pos == '{') {
-            data->type = PLIST_DICT;
-            subnode = plist_new_node(data);
-            ctx->pos++;
-            parse_dict_data(ctx, subnode);
-            if (ctx->err) {
-                goto err_out;
-            }
-            if (ctx->pos >= ctx->end) {
-                PLIST_OSTEP_ERR("EOF while parsing dictionary terminator '}' at offset %ld\n", (long int)(ctx->pos - ctx->start));
-                ctx->err = PLIST_ERR_PARSE;
+        if (*ctx->pos != '}') {
+            PLIST_OSTEP_ERR("Missing terminating '}' at offset %ld\n", (long int)(ctx->pos - ctx->start));
+            ctx->err = PLIST_ERR_PARSE;
+            return ctx->err;
+        }
+        ctx->pos++;
+        ctx->err = PLIST_EVENT(ctx->handler, end_dict, ctx->user_data);
+    } else if (*ctx->pos == '(') {
+        ctx->pos++;
+        ctx->err = PLIST_EVENT(ctx->handler, begin_array, ctx->user_data);
+        while (ctx->pos < ctx->end && !ctx->err) {
+            parse_skip_ws(ctx);
+            if (ctx->pos >= ctx->end || *ctx->pos == ')') {
                 break;
             }
-            if (*ctx->pos != '}') {
-                PLIST_OSTEP_ERR("Missing terminating '}' at offset %ld\n", (long int)(ctx->pos - ctx->start));
-                ctx->err = PLIST_ERR_PARSE;
-                goto err_out;
+            if (node_from_openstep(ctx) != PLIST_ERR_SUCCESS) {
+                break;
             }
-            ctx->pos++;
-            *plist = subnode;
             parse_skip_ws(ctx);
-            break;
-        } else if (*ctx->pos == '(') {
-            data->type = PLIST_ARRAY;
-            subnode = plist_new_node(data);
-            ctx->pos++;
-            plist_t tmp = NULL;
-            while (ctx->pos < ctx->end && !ctx->err) {
-                parse_skip_ws(ctx);
-                if (ctx->pos >= ctx->end || *ctx->pos == ')') {
-                    break;
-                }
-                ctx->err = node_from_openstep(ctx, &tmp);
-                if (ctx->err != PLIST_ERR_SUCCESS) {
-                    break;
-                }
-                if (!tmp) {
-                    ctx->err = PLIST_ERR_PARSE;
-                    break;
-                }
-                plist_array_append_item(subnode, tmp);
-                tmp = NULL;
-                parse_skip_ws(ctx);
-                if (ctx->pos >= ctx->end) {
-                    PLIST_OSTEP_ERR("EOF while parsing array item delimiter ',' at offset %ld\n", (long int)(ctx->pos - ctx->start));
-                    ctx->err = PLIST_ERR_PARSE;
-                    break;
-                }
-                if (*ctx->pos != ',') {
-                    break;
-                }
-                ctx->pos++;
-            }
-	    plist_free(tmp);
-	    tmp = NULL;
-            if (ctx->err != PLIST_ERR_SUCCESS) {
-                goto err_out;
-            }
             if (ctx->pos >= ctx->end) {
-                PLIST_OSTEP_ERR("EOF while parsing array terminator ')' at offset %ld\n", (long int)(ctx->pos - ctx->start));
+                PLIST_OSTEP_ERR("EOF while parsing array item delimiter ',' at offset %ld\n", (long int)(ctx->pos - ctx->start));
                 ctx->err = PLIST_ERR_PARSE;
                 break;
             }
-            if (*ctx->pos != ')') {
-                PLIST_OSTEP_ERR("Missing terminating ')' at offset %ld\n", (long int)(ctx->pos - ctx->start));
-                ctx->err = PLIST_ERR_PARSE;
-                goto err_out;
+            if (*ctx->pos != ',') {
+                break;
             }
             ctx->pos++;
-            *plist = subnode;
+        }
+        if (ctx->err != PLIST_ERR_SUCCESS) {
+            return ctx->err;
+        }
+        if (ctx->pos >= ctx->end) {
+            PLIST_OSTEP_ERR("EOF while parsing array terminator ')' at offset %ld\n", (long int)(ctx->pos - ctx->start));
+            ctx->err = PLIST_ERR_PARSE;
+            return ctx->err;
+        }
+        if (*ctx->pos != ')') {
+            PLIST_OSTEP_ERR("Missing terminating ')' at offset %ld\n", (long int)(ctx->pos - ctx->start));
+            ctx->err = PLIST_ERR_PARSE;
+            return ctx->err;
+        }
+        ctx->pos++;
+        ctx->err = PLIST_EVENT(ctx->handler, end_array, ctx->user_data);
+    } else if (*ctx->pos == '<') {
+        ctx->pos++;
+        bytearray_t *bytes = byte_array_new(256);
+        if (!bytes) {
+            ctx->err = PLIST_ERR_NO_MEM;
+            return ctx->err;
+        }
+        while (ctx->pos < ctx->end && !ctx->err) {
             parse_skip_ws(ctx);
-            break;
-        } else if (*ctx->pos == '<') {
-            data->type = PLIST_DATA;
-            ctx->pos++;
-            bytearray_t *bytes = byte_array_new(256);
-            while (ctx->pos < ctx->end && !ctx->err) {
-                parse_skip_ws(ctx);
-                if (ctx->pos >= ctx->end) {
-                    PLIST_OSTEP_ERR("EOF while parsing data terminator '>' at offset %ld\n", (long int)(ctx->pos - ctx->start));
-                    ctx->err = PLIST_ERR_PARSE;
-                    break;
-                }
-                if (*ctx->pos == '>') {
-                    break;
-                }
-                if (!isxdigit(*ctx->pos)) {
-                    PLIST_OSTEP_ERR("Invalid byte group in data at offset %ld\n", (long int)(ctx->pos - ctx->start));
-                    ctx->err = PLIST_ERR_PARSE;
-                    break;
-                }
-                uint8_t b = HEX_DIGIT(*ctx->pos);
-                ctx->pos++;
-                if (ctx->pos >= ctx->end) {
-                    PLIST_OSTEP_ERR("Unexpected end of data at offset %ld\n", (long int)(ctx->pos - ctx->start));
-                    ctx->err = PLIST_ERR_PARSE;
-                    break;
-                }
-                if (!isxdigit(*ctx->pos)) {
-                    PLIST_OSTEP_ERR("Invalid byte group in data at offset %ld\n", (long int)(ctx->pos - ctx->start));
-                    ctx->err = PLIST_ERR_PARSE;
-                    break;
-                }
-                b = (b << 4) + HEX_DIGIT(*ctx->pos);
-                byte_array_append(bytes, &b, 1);
-                ctx->pos++;
-            }
-            if (ctx->err) {
-                byte_array_free(bytes);
-                plist_free_data(data);
-                goto err_out;
-            }
             if (ctx->pos >= ctx->end) {
-                byte_array_free(bytes);
-                plist_free_data(data);
                 PLIST_OSTEP_ERR("EOF while parsing data terminator '>' at offset %ld\n", (long int)(ctx->pos - ctx->start));
                 ctx->err = PLIST_ERR_PARSE;
-                goto err_out;
+                break;
             }
-            if (*ctx->pos != '>') {
-                byte_array_free(bytes);
-                plist_free_data(data);
-                PLIST_OSTEP_ERR("Missing terminating '>' at offset %ld\n", (long int)(ctx->pos - ctx->start));
+            if (*ctx->pos == '>') {
+                break;
+            }
+            if (!isxdigit(*ctx->pos)) {
+                PLIST_OSTEP_ERR("Invalid byte group in data at offset %ld\n", (long int)(ctx->pos - ctx->start));
                 ctx->err = PLIST_ERR_PARSE;
-                goto err_out;
+                break;
             }
+            uint8_t b = HEX_DIGIT(*ctx->pos);
             ctx->pos++;
-            data->buff = (uint8_t*)bytes->data;
-            data->length = bytes->len;
-            bytes->data = NULL;
-            byte_array_free(bytes);
-            *plist = plist_new_node(data);
-            parse_skip_ws(ctx);
-            break;
-        } else if (*ctx->pos == '"' || *ctx->pos == '\'') {
-            char c = *ctx->pos;
-            ctx->pos++;
-            p = ctx->pos;
-            size_t num_escapes = 0;
-            while (ctx->pos < ctx->end) {
-                if (*ctx->pos == '\\') {
-                    num_escapes++;
-                }
-                if ((*ctx->pos == c) && (*(ctx->pos-1) != '\\')) {
-                    break;
-                }
-                ctx->pos++;
-            }
             if (ctx->pos >= ctx->end) {
-                plist_free_data(data);
-                PLIST_OSTEP_ERR("EOF while parsing quoted string at offset %ld\n", (long int)(ctx->pos - ctx->start));
+                PLIST_OSTEP_ERR("Unexpected end of data at offset %ld\n", (long int)(ctx->pos - ctx->start));
                 ctx->err = PLIST_ERR_PARSE;
-                goto err_out;
-            }
-            if (*ctx->pos != c) {
-                plist_free_data(data);
-                PLIST_OSTEP_ERR("Missing closing quote (%c) at offset %ld\n", c, (long int)(ctx->pos - ctx->start));
-                ctx->err = PLIST_ERR_PARSE;
-                goto err_out;
-            }
-            size_t slen = ctx->pos - p;
-            ctx->pos++; // skip the closing quote
-            char* strbuf = (char*)malloc(slen+1);
-            if (num_escapes > 0) {
-                size_t i = 0;
-                size_t o = 0;
-                while (i < slen) {
-                    if (p[i] == '\\') {
-                        /* handle escape sequence */
-                        i++;
-                        switch (p[i]) {
-                            case '0':
-                            case '1':
-                            case '2':
-                            case '3':
-                            case '4':
-                            case '5':
-                            case '6':
-                            case '7': {
-                                // max 3 digits octal
-                                unsigned char chr = 0;
-                                int maxd = 3;
-                                while ((i < slen) && (p[i] >= '0' && p[i] <= '7') && --maxd) {
-                                    chr = (chr << 3) + p[i] - '0';
-                                    i++;
-                                }
-                                strbuf[o++] = (char)chr;
-                            }   break;
-                            case 'U': {
-                                i++;
-                                // max 4 digits hex
-                                uint16_t wchr = 0;
-                                int maxd = 4;
-                                while ((i < slen) && isxdigit(p[i]) && maxd--) {
-                                    wchr = (wchr << 4) + ((p[i] <= '9') ? (p[i] - '0') : ((p[i] <= 'F') ? (p[i] - 'A' + 10) : (p[i] - 'a' + 10)));
-                                    i++;
-                                }
-                                if (wchr >= 0x800) {
-                                    strbuf[o++] = (char)(0xE0 + ((wchr >> 12) & 0xF));
-                                    strbuf[o++] = (char)(0x80 + ((wchr >> 6) & 0x3F));
-                                    strbuf[o++] = (char)(0x80 + (wchr & 0x3F));
-                                } else if (wchr >= 0x80) {
-                                    strbuf[o++] = (char)(0xC0 + ((wchr >> 6) & 0x1F));
-                                    strbuf[o++] = (char)(0x80 + (wchr & 0x3F));
-                                } else {
-                                    strbuf[o++] = (char)(wchr & 0x7F);
-                                }
-                            }   break;
-                            case 'a': strbuf[o++] = '\a'; i++; break;
-                            case 'b': strbuf[o++] = '\b'; i++; break;
-                            case 'f': strbuf[o++] = '\f'; i++; break;
-                            case 'n': strbuf[o++] = '\n'; i++; break;
-                            case 'r': strbuf[o++] = '\r'; i++; break;
-                            case 't': strbuf[o++] = '\t'; i++; break;
-                            case 'v': strbuf[o++] = '\v'; i++; break;
-                            case '"': strbuf[o++] = '"';  i++; break;
-                            case '\'': strbuf[o++] = '\''; i++; break;
-                            default:
-                                break;
-                        }
-                    } else {
-                        strbuf[o++] = p[i++];
-                    }
-                }
-                strbuf[o] = '\0';
-                slen = o;
-            } else {
-                strncpy(strbuf, p, slen);
-                strbuf[slen] = '\0';
-            }
-            data->type = PLIST_STRING;
-            data->strval = strbuf;
-            data->length = slen;
-            *plist = plist_new_node(data);
-            parse_skip_ws(ctx);
-            break;
-        } else {
-            // unquoted string
-            size_t slen = 0;
-            parse_skip_ws(ctx);
-            p = ctx->pos;
-            while (ctx->pos < ctx->end) {
-                if (!allowed_unquoted_chars[(uint8_t)*ctx->pos]) {
-                    break;
-                }
-                ctx->pos++;
-            }
-            slen = ctx->pos-p;
-            if (slen > 0) {
-                data->type = PLIST_STRING;
-                data->strval = strndup(p, slen);
-                data->length = slen;
-                *plist = plist_new_node(data);
-                parse_skip_ws(ctx);
                 break;
-            } else {
-                plist_free_data(data);
-                PLIST_OSTEP_ERR("Unexpected character when parsing unquoted string at offset %ld\n", (long int)(ctx->pos - ctx->start));
+            }
+            if (!isxdigit(*ctx->pos)) {
+                PLIST_OSTEP_ERR("Invalid byte group in data at offset %ld\n", (long int)(ctx->pos - ctx->start));
                 ctx->err = PLIST_ERR_PARSE;
                 break;
             }
+            b = (b << 4) + HEX_DIGIT(*ctx->pos);
+            byte_array_append(bytes, &b, 1);
+            ctx->pos++;
+        }
+        if (ctx->err) {
+            byte_array_free(bytes);
+            return ctx->err;
+        }
+        if (ctx->pos >= ctx->end) {
+            byte_array_free(bytes);
+            PLIST_OSTEP_ERR("EOF while parsing data terminator '>' at offset %ld\n", (long int)(ctx->pos - ctx->start));
+            ctx->err = PLIST_ERR_PARSE;
+            return ctx->err;
+        }
+        if (*ctx->pos != '>') {
+            byte_array_free(bytes);
+            PLIST_OSTEP_ERR("Missing terminating '>' at offset %ld\n", (long int)(ctx->pos - ctx->start));
+            ctx->err = PLIST_ERR_PARSE;
+            return ctx->err;
         }
         ctx->pos++;
+        void *buf = bytes->data;
+        uint64_t len = bytes->len;
+        bytes->data = NULL;
+        byte_array_free(bytes);
+        ctx->err = plist_event_value_owned(ctx->handler, ctx->user_data, PLIST_DATA, buf, len);
+    } else {
+        const char *str = NULL;
+        size_t slen = 0;
+        char *owned = NULL;
+        if (parse_string(ctx, &str, &slen, &owned) != PLIST_ERR_SUCCESS) {
+            return ctx->err;
+        }
+        if (owned) {
+            ctx->err = plist_event_value_owned(ctx->handler, ctx->user_data, PLIST_STRING, owned, slen);
+        } else {
+            ctx->err = PLIST_EVENT(ctx->handler, value, ctx->user_data, PLIST_STRING, str, slen);
+        }
+    }
+    if (ctx->err == PLIST_ERR_SUCCESS) {
+        parse_skip_ws(ctx);
     }
     ctx->depth--;
+    return ctx->err;
+}
 
-err_out:
-    if (ctx->err != PLIST_ERR_SUCCESS) {
-        plist_free(subnode);
-        plist_free(*plist);
-        *plist = NULL;
-        return ctx->err;
+plist_err_t plist_openstep_parse_events(const char *plist_ostep, uint64_t length, const plist_event_handler_t *handler, void *user_data)
+{
+    if (!plist_ostep || (length == 0) || !handler) {
+        return PLIST_ERR_INVALID_ARG;
     }
-    return PLIST_ERR_SUCCESS;
+
+    struct _parse_ctx ctx = { plist_ostep, plist_ostep, plist_ostep + length, PLIST_ERR_SUCCESS, 0, handler, user_data };
+
+    parse_skip_ws(&ctx);
+    if (ctx.pos >= ctx.end) {
+        /* whitespace only file is considered an empty dictionary */
+        ctx.err = PLIST_EVENT(handler, begin_dict, user_data);
+        if (ctx.err == PLIST_ERR_SUCCESS) {
+            ctx.err = PLIST_EVENT(handler, end_dict, user_data);
+        }
+        return ctx.err;
+    }
+
+    if (*ctx.pos == '{' || *ctx.pos == '(' || *ctx.pos == '<') {
+        node_from_openstep(&ctx);
+        if (ctx.err == PLIST_ERR_SUCCESS && ctx.pos < ctx.end && *ctx.pos == '=') {
+            PLIST_OSTEP_ERR("Failed to parse strings data\n");
+            ctx.err = PLIST_ERR_PARSE;
+        }
+        return ctx.err;
+    }
+
+    /* a string followed by '=' starts 'strings' data, which is a
+     * dictionary without the braces */
+    const char *str = NULL;
+    size_t slen = 0;
+    char *owned = NULL;
+    if (parse_string(&ctx, &str, &slen, &owned) != PLIST_ERR_SUCCESS) {
+        return ctx.err;
+    }
+    parse_skip_ws(&ctx);
+    if (ctx.pos < ctx.end && *ctx.pos == '=') {
+        free(owned);
+        ctx.pos = plist_ostep;
+        ctx.err = PLIST_EVENT(handler, begin_dict, user_data);
+        if (ctx.err == PLIST_ERR_SUCCESS) {
+            parse_dict_data(&ctx);
+        }
+        if (ctx.err != PLIST_ERR_SUCCESS) {
+            PLIST_OSTEP_ERR("Failed to parse strings data\n");
+            return ctx.err;
+        }
+        return PLIST_EVENT(handler, end_dict, user_data);
+    }
+    if (owned) {
+        return plist_event_value_owned(handler, user_data, PLIST_STRING, owned, slen);
+    }
+    return PLIST_EVENT(handler, value, user_data, PLIST_STRING, str, slen);
 }
 
 plist_err_t plist_from_openstep(const char *plist_ostep, uint32_t length, plist_t * plist)
+{
+    return plist_from_openstep64(plist_ostep, length, plist);
+}
+
+plist_err_t plist_from_openstep64(const char *plist_ostep, uint64_t length, plist_t * plist)
+{
+    return plist_from_openstep_with_options(plist_ostep, length, plist, PLIST_PARSE_NONE);
+}
+
+plist_err_t plist_from_openstep_with_options(const char *plist_ostep, uint64_t length, plist_t * plist, plist_parse_options_t options)
 {
     if (!plist) {
         return PLIST_ERR_INVALID_ARG;
@@ -1020,29 +1063,20 @@ plist_err_t plist_from_openstep(const char *plist_ostep, uint32_t length, plist_
         return PLIST_ERR_INVALID_ARG;
     }
 
-    struct _parse_ctx ctx = { plist_ostep, plist_ostep, plist_ostep + length, 0 , 0 };
-
-    plist_err_t err = node_from_openstep(&ctx, plist);
-    if (err == 0) {
-        if (!*plist) {
-            /* whitespace only file is considered an empty dictionary */
-            *plist = plist_new_dict();
-        } else if (ctx.pos < ctx.end && *ctx.pos == '=') {
-            /* attempt to parse this as 'strings' data */
-            plist_free(*plist);
-            *plist = NULL;
-            plist_t pl = plist_new_dict();
-            ctx.pos = plist_ostep;
-            parse_dict_data(&ctx, pl);
-            if (ctx.err > 0) {
-                plist_free(pl);
-                PLIST_OSTEP_ERR("Failed to parse strings data\n");
-                err = PLIST_ERR_PARSE;
-            } else {
-                *plist = pl;
-            }
+    hashtable_t *keys = NULL;
+    if (options & PLIST_PARSE_INTERN_KEYS) {
+        keys = plist_key_table_new();
+        if (!keys) {
+            return PLIST_ERR_NO_MEM;
         }
     }
 
+    struct plist_tree_builder tb;
+    plist_tree_builder_init(&tb, keys, 0);
+    plist_err_t err = plist_openstep_parse_events(plist_ostep, length, &plist_tree_builder_handler, &tb);
+    err = plist_tree_builder_finish(&tb, err, plist);
+    if (keys) {
+        plist_key_table_free(keys);
+    }
     return err;
 }
@@ -40,7 +40,6 @@
 #include "strbuf.h"
 #include "time64.h"
 #include "base64.h"
-#include "hashtable.h"
 
 #define MAC_EPOCH 978307200
 
@@ -68,7 +67,7 @@ static size_t dtostr(char *buf, size_t bufsize, double realval)
     return len;
 }
 
-static plist_err_t node_to_string(node_t node, bytearray_t **outbuf, uint32_t depth, uint32_t indent)
+static plist_err_t node_to_string(node_t node, bytearray_t **outbuf, uint32_t depth, uint32_t indent, node_t *path)
 {
     plist_data_t node_data = NULL;
 
@@ -81,6 +80,11 @@ static plist_err_t node_to_string(node_t node, bytearray_t **outbuf, uint32_t de
     if (!node)
         return PLIST_ERR_INVALID_ARG;
 
+    plist_err_t err = plist_write_check_node(node, path, depth);
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
+    }
+
     node_data = plist_get_data(node);
 
     switch (node_data->type)
@@ -155,7 +159,7 @@ static plist_err_t node_to_string(node_t node, bytearray_t **outbuf, uint32_t de
             }
             size_t sl = sprintf(buf, "%u: ", cnt);
             str_buf_append(*outbuf, buf, sl);
-            plist_err_t res = node_to_string(ch, outbuf, depth+1, indent);
+            plist_err_t res = node_to_string(ch, outbuf, depth+1, indent, path);
             if (res < 0) {
                 return res;
             }
@@ -172,7 +176,7 @@ static plist_err_t node_to_string(node_t node, bytearray_t **outbuf, uint32_t de
                     str_buf_append(*outbuf, " ", 1);
                 }
             }
-            plist_err_t res = node_to_string(ch, outbuf, depth+1, indent);
+            plist_err_t res = node_to_string(ch, outbuf, depth+1, indent, path);
             if (res < 0) {
                 return res;
             }
@@ -190,7 +194,8 @@ static plist_err_t node_to_string(node_t node, bytearray_t **outbuf, uint32_t de
         } break;
     case PLIST_DATA:
         {
-            val = (char*)malloc(4096);
+            /* 3072 bytes encode to 4096 characters plus the terminating 0 */
+            val = (char*)malloc(4097);
             size_t done = 0;
             while (done < node_data->length) {
                 size_t amount = node_data->length - done;
@@ -201,6 +206,7 @@ static plist_err_t node_to_string(node_t node, bytearray_t **outbuf, uint32_t de
                 str_buf_append(*outbuf, val, bsize);
                 done += amount;
             }
+            free(val);
         }
         break;
     case PLIST_DATE:
@@ -241,152 +247,6 @@ static plist_err_t node_to_string(node_t node, bytearray_t **outbuf, uint32_t de
     return PLIST_ERR_SUCCESS;
 }
 
-#define PO10i_LIMIT (INT64_MAX/10)
-
-/* based on https://stackoverflow.com/a/4143288 */
-static int num_digits_i(int64_t i)
-{
-    int n;
-    int64_t po10;
-    n=1;
-    if (i < 0) {
-        i = (i == INT64_MIN) ? INT64_MAX : -i;
-        n++;
-    }
-    po10=10;
-    while (i>=po10) {
-        n++;
-        if (po10 > PO10i_LIMIT) break;
-        po10*=10;
-    }
-    return n;
-}
-
-#define PO10u_LIMIT (UINT64_MAX/10)
-
-/* based on https://stackoverflow.com/a/4143288 */
-static int num_digits_u(uint64_t i)
-{
-    int n;
-    uint64_t po10;
-    n=1;
-    po10=10;
-    while (i>=po10) {
-        n++;
-        if (po10 > PO10u_LIMIT) break;
-        po10*=10;
-    }
-    return n;
-}
-
-static plist_err_t _node_estimate_size(node_t node, uint64_t *size, uint32_t depth, uint32_t indent, hashtable_t *visited)
-{
-    plist_data_t data;
-    if (!node) {
-        return PLIST_ERR_INVALID_ARG;
-    }
-
-    if (depth > PLIST_MAX_NESTING_DEPTH) {
-#if DEBUG
-        fprintf(stderr, "libplist: ERROR: maximum nesting depth (%u) exceeded\n", (unsigned)PLIST_MAX_NESTING_DEPTH);
-#endif
-        return PLIST_ERR_MAX_NESTING;
-    }
-
-    if (hash_table_lookup(visited, node)) {
-#if DEBUG
-        fprintf(stderr, "libplist: ERROR: circular reference detected\n");
-#endif
-        return PLIST_ERR_CIRCULAR_REF;
-    }
-
-    // mark as visited
-    hash_table_insert(visited, node, (void*)1);
-
-    data = plist_get_data(node);
-    if (node->children) {
-        node_t ch;
-        unsigned int n_children = node_n_children(node);
-        for (ch = node_first_child(node); ch; ch = node_next_sibling(ch)) {
-            plist_err_t res = _node_estimate_size(ch, size, depth + 1, indent, visited);
-            if (res != PLIST_ERR_SUCCESS) {
-                return res;
-            }
-        }
-        switch (data->type) {
-        case PLIST_DICT:
-            *size += n_children-1; // number of ':' and ' '
-            *size += n_children; // number of '\n' and extra space
-            *size += (uint64_t)n_children * (depth+indent+1); // indent for every 2nd child
-            *size += indent+1; // additional '\n'
-            break;
-        case PLIST_ARRAY:
-            *size += n_children-1; // number of ','
-            *size += n_children; // number of '\n'
-            *size += (uint64_t)n_children * ((depth+indent+1)<<1); // indent for every child
-            *size += indent+1; // additional '\n'
-            break;
-        default:
-            break;
-	}
-    } else {
-        switch (data->type) {
-        case PLIST_STRING:
-        case PLIST_KEY:
-            *size += data->length;
-            break;
-        case PLIST_INT:
-            if (data->length == 16) {
-                *size += num_digits_u(data->intval);
-            } else {
-                *size += num_digits_i((int64_t)data->intval);
-            }
-            break;
-        case PLIST_REAL:
-            *size += dtostr(NULL, 0, data->realval);
-            break;
-        case PLIST_BOOLEAN:
-            *size += ((data->boolval) ? 4 : 5);
-            break;
-        case PLIST_NULL:
-            *size += 4;
-            break;
-        case PLIST_DICT:
-        case PLIST_ARRAY:
-            *size += 3;
-            break;
-        case PLIST_DATA:
-            *size += (data->length / 3) * 4 + 4;
-            break;
-        case PLIST_DATE:
-            *size += 23;
-            break;
-        case PLIST_UID:
-            *size += 7; // "CF$UID:"
-            *size += num_digits_u(data->intval);
-            break;
-        default:
-#ifdef DEBUG
-            fprintf(stderr, "%s: invalid node type encountered\n", __func__);
-#endif
-            return PLIST_ERR_UNKNOWN;
-        }
-    }
-    if (depth == 0) {
-        *size += 1; // final newline
-    }
-    return PLIST_ERR_SUCCESS;
-}
-
-static plist_err_t node_estimate_size(node_t node, uint64_t *size, uint32_t depth, uint32_t indent)
-{
-    hashtable_t *visited = hash_table_new(plist_node_ptr_hash, plist_node_ptr_compare, NULL);
-    if (!visited) return PLIST_ERR_NO_MEM;
-    plist_err_t err = _node_estimate_size(node, size, depth, indent, visited);
-    hash_table_destroy(visited);
-    return err;
-}
-
 static plist_err_t _plist_write_to_strbuf(plist_t plist, strbuf_t *outbuf, plist_write_options_t options)
 {
     uint8_t indent = 0;
@@ -397,7 +257,8 @@ static plist_err_t _plist_write_to_strbuf(plist_t plist, strbuf_t *outbuf, plist
     for (i = 0; i < indent; i++) {
         str_buf_append(outbuf, " ", 1);
     }
-    plist_err_t res = node_to_string((node_t)plist, &outbuf, 0, indent);
+    node_t path[PLIST_WRITE_PATH_SIZE];
+    plist_err_t res = node_to_string((node_t)plist, &outbuf, 0, indent, path);
     if (res < 0) {
         return res;
     }
@@ -407,26 +268,15 @@ static plist_err_t _plist_write_to_strbuf(plist_t plist, strbuf_t *outbuf, plist
     return res;
 }
 
-plist_err_t plist_write_to_string_limd(plist_t plist, char **output, uint32_t* length, plist_write_options_t options)
+plist_err_t plist_write_to_string_limd(plist_t plist, char **output, uint64_t* length, plist_write_options_t options)
 {
-    uint64_t size = 0;
     plist_err_t res;
 
     if (!plist || !output || !length) {
         return PLIST_ERR_INVALID_ARG;
     }
 
-    uint8_t indent = 0;
-    if (options & PLIST_OPT_INDENT) {
-        indent = (options >> 24) & 0xFF;
-    }
-
-    res = node_estimate_size((node_t)plist, &size, 0, indent);
-    if (res < 0) {
-        return res;
-    }
-
-    strbuf_t *outbuf = str_buf_new(size);
+    strbuf_t *outbuf = str_buf_new(0);
     if (!outbuf) {
 #if DEBUG
         fprintf(stderr, "%s: Could not allocate output buffer\n", __func__);
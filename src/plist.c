@@ -36,10 +36,27 @@
 #include <float.h>
 #include <ctype.h>
 #include <inttypes.h>
+#include <stddef.h>
+
+#include <errno.h>
+#include <fcntl.h>
 
 #ifdef WIN32
 #include <windows.h>
 #endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef _MSC_VER
+#include <io.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
 
 #include <node.h>
 #include <node_list.h>
@@ -224,78 +241,108 @@ int plist_is_binary(const char *plist_data, uint32_t length)
 
 plist_err_t plist_from_memory(const char *plist_data, uint32_t length, plist_t *plist, plist_format_t *format)
 {
-    plist_err_t res = PLIST_ERR_UNKNOWN;
-    if (!plist) {
-        return PLIST_ERR_INVALID_ARG;
+    return plist_from_memory_ex(plist_data, length, plist, format, PLIST_PARSE_NONE);
+}
+
+plist_err_t plist_from_memory64(const char *plist_data, uint64_t length, plist_t *plist, plist_format_t *format)
+{
+    return plist_from_memory_ex(plist_data, length, plist, format, PLIST_PARSE_NONE);
+}
+
+/* guesses the format of a plist in memory, see plist_from_memory() */
+static plist_err_t plist_detect_format(const char *plist_data, uint64_t length, plist_format_t *format)
+{
+    if (length >= 8 && plist_is_binary(plist_data, 8)) {
+        *format = PLIST_FORMAT_BINARY;
+        return PLIST_ERR_SUCCESS;
     }
-    *plist = NULL;
-    if (!plist_data || length == 0) {
-        return PLIST_ERR_INVALID_ARG;
+    uint64_t pos = 0;
+    int is_json = 0;
+    int is_xml = 0;
+    /* skip whitespace */
+    SKIP_WS(plist_data, pos, length);
+    if (pos >= length) {
+        return PLIST_ERR_PARSE;
     }
-    plist_format_t fmt = PLIST_FORMAT_NONE;
-    if (format) *format = PLIST_FORMAT_NONE;
-    if (plist_is_binary(plist_data, length)) {
-        res = plist_from_bin(plist_data, length, plist);
-        fmt = PLIST_FORMAT_BINARY;
-    } else {
-        uint32_t pos = 0;
-        int is_json = 0;
-        int is_xml = 0;
-        /* skip whitespace */
+    if (plist_data[pos] == '<' && (length-pos > 3) && !isxdigit(plist_data[pos+1]) && !isxdigit(plist_data[pos+2]) && !isxdigit(plist_data[pos+3])) {
+        is_xml = 1;
+    } else if (plist_data[pos] == '[') {
+        /* only valid for json */
+        is_json = 1;
+    } else if (plist_data[pos] == '(') {
+        /* only valid for openstep */
+    } else if (plist_data[pos] == '{') {
+        /* this could be json or openstep */
+        pos++;
         SKIP_WS(plist_data, pos, length);
         if (pos >= length) {
             return PLIST_ERR_PARSE;
         }
-        if (plist_data[pos] == '<' && (length-pos > 3) && !isxdigit(plist_data[pos+1]) && !isxdigit(plist_data[pos+2]) && !isxdigit(plist_data[pos+3])) {
-            is_xml = 1;
-        } else if (plist_data[pos] == '[') {
-            /* only valid for json */
-            is_json = 1;
-        } else if (plist_data[pos] == '(') {
-            /* only valid for openstep */
-        } else if (plist_data[pos] == '{') {
-            /* this could be json or openstep */
+        if (plist_data[pos] == '"') {
+            /* still could be both */
             pos++;
-            SKIP_WS(plist_data, pos, length);
+            while (pos < length) {
+                FIND_NEXT(plist_data, pos, length, '"');
+                if (plist_data[pos-1] != '\\') {
+                    break;
+                }
+                pos++;
+            }
             if (pos >= length) {
                 return PLIST_ERR_PARSE;
             }
             if (plist_data[pos] == '"') {
-                /* still could be both */
                 pos++;
-                while (pos < length) {
-                    FIND_NEXT(plist_data, pos, length, '"');
-                    if (plist_data[pos-1] != '\\') {
-                        break;
-                    }
-                    pos++;
-                }
+                SKIP_WS(plist_data, pos, length);
                 if (pos >= length) {
                     return PLIST_ERR_PARSE;
                 }
-                if (plist_data[pos] == '"') {
-                    pos++;
-                    SKIP_WS(plist_data, pos, length);
-                    if (pos >= length) {
-                        return PLIST_ERR_PARSE;
-                    }
-                    if (plist_data[pos] == ':') {
-                        /* this is definitely json */
-                        is_json = 1;
-                    }
+                if (plist_data[pos] == ':') {
+                    /* this is definitely json */
+                    is_json = 1;
                 }
             }
         }
-        if (is_xml) {
-            res = plist_from_xml(plist_data, length, plist);
-            fmt = PLIST_FORMAT_XML;
-        } else if (is_json) {
-            res = plist_from_json(plist_data, length, plist);
-            fmt = PLIST_FORMAT_JSON;
-        } else {
-            res = plist_from_openstep(plist_data, length, plist);
-            fmt = PLIST_FORMAT_OSTEP;
-        }
+    }
+    if (is_xml) {
+        *format = PLIST_FORMAT_XML;
+    } else if (is_json) {
+        *format = PLIST_FORMAT_JSON;
+    } else {
+        *format = PLIST_FORMAT_OSTEP;
+    }
+    return PLIST_ERR_SUCCESS;
+}
+
+plist_err_t plist_from_memory_ex(const char *plist_data, uint64_t length, plist_t *plist, plist_format_t *format, plist_parse_options_t options)
+{
+    plist_err_t res = PLIST_ERR_UNKNOWN;
+    if (!plist) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+    *plist = NULL;
+    if (!plist_data || length == 0) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+    plist_format_t fmt = PLIST_FORMAT_NONE;
+    if (format) *format = PLIST_FORMAT_NONE;
+    res = plist_detect_format(plist_data, length, &fmt);
+    if (res != PLIST_ERR_SUCCESS) {
+        return res;
+    }
+    switch (fmt) {
+    case PLIST_FORMAT_BINARY:
+        res = plist_from_bin_with_options(plist_data, length, plist, options);
+        break;
+    case PLIST_FORMAT_XML:
+        res = plist_from_xml_with_options(plist_data, length, plist, options);
+        break;
+    case PLIST_FORMAT_JSON:
+        res = plist_from_json_with_options(plist_data, length, plist, options);
+        break;
+    default:
+        res = plist_from_openstep_with_options(plist_data, length, plist, options);
+        break;
     }
     if (format && res == PLIST_ERR_SUCCESS) {
         *format = fmt;
@@ -303,49 +350,269 @@ plist_err_t plist_from_memory(const char *plist_data, uint32_t length, plist_t *
     return res;
 }
 
-plist_err_t plist_read_from_file(const char *filename, plist_t *plist, plist_format_t *format)
+plist_err_t plist_parse_events(const char *plist_data, uint64_t length, plist_format_t format, const plist_event_handler_t *handler, void *user_data)
 {
-    if (!filename || !plist) {
+    if (!plist_data || length == 0 || !handler) {
         return PLIST_ERR_INVALID_ARG;
     }
-    FILE *f = fopen(filename, "rb");
-    if (!f) {
-        return PLIST_ERR_IO;
+    if (format == PLIST_FORMAT_NONE) {
+        plist_err_t err = plist_detect_format(plist_data, length, &format);
+        if (err != PLIST_ERR_SUCCESS) {
+            return err;
+        }
     }
-    struct stat fst;
-    fstat(fileno(f), &fst);
-    if ((uint64_t)fst.st_size > UINT32_MAX) {
-        return PLIST_ERR_NO_MEM;
+    switch (format) {
+    case PLIST_FORMAT_BINARY:
+        return plist_bin_parse_events(plist_data, length, handler, user_data);
+    case PLIST_FORMAT_XML:
+        return plist_xml_parse_events(plist_data, length, handler, user_data);
+    case PLIST_FORMAT_JSON:
+        return plist_json_parse_events(plist_data, length, handler, user_data);
+    case PLIST_FORMAT_OSTEP:
+        return plist_openstep_parse_events(plist_data, length, handler, user_data);
+    default:
+        break;
     }
-    uint32_t total = (uint32_t)fst.st_size;
-    if (total == 0) {
-        return PLIST_ERR_PARSE;
+    return PLIST_ERR_INVALID_ARG;
+}
+
+plist_err_t plist_convert(const char *plist_data, uint64_t length, plist_format_t in_format, plist_format_t out_format, plist_write_options_t options, plist_write_func_t write_func, void *user_data)
+{
+    plist_err_t err;
+
+    if (!plist_data || length == 0 || !write_func) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+    switch (out_format) {
+    case PLIST_FORMAT_XML:
+    case PLIST_FORMAT_JSON:
+    case PLIST_FORMAT_OSTEP:
+    case PLIST_FORMAT_BINARY:
+    case PLIST_FORMAT_PRINT:
+    case PLIST_FORMAT_LIMD:
+    case PLIST_FORMAT_PLUTIL:
+        break;
+    default:
+        return PLIST_ERR_FORMAT;
+    }
+    if (in_format == PLIST_FORMAT_NONE) {
+        err = plist_detect_format(plist_data, length, &in_format);
+        if (err != PLIST_ERR_SUCCESS) {
+            return err;
+        }
+    }
+
+    if (out_format == PLIST_FORMAT_XML || out_format == PLIST_FORMAT_JSON || out_format == PLIST_FORMAT_OSTEP) {
+        bytearray_t *out = byte_array_new_for_callback(write_func, user_data);
+        if (!out) {
+            return PLIST_ERR_NO_MEM;
+        }
+        if (out_format == PLIST_FORMAT_XML) {
+            err = plist_convert_to_xml(plist_data, length, in_format, out);
+        } else if (out_format == PLIST_FORMAT_JSON) {
+            err = plist_convert_to_json(plist_data, length, in_format, out, options);
+        } else {
+            err = plist_convert_to_openstep(plist_data, length, in_format, out, options);
+        }
+        if (byte_array_flush(out) < 0 && err == PLIST_ERR_SUCCESS) {
+            err = PLIST_ERR_IO;
+        }
+        byte_array_free(out);
+        return err;
+    }
+
+    /* the remaining formats are written from a tree. The input outlives
+     * it, so binary values do not need to be copied. */
+    plist_t plist = NULL;
+    if (in_format == PLIST_FORMAT_BINARY) {
+        err = plist_from_bin_with_options(plist_data, length, &plist, PLIST_PARSE_NOCOPY);
+    } else {
+        struct plist_tree_builder tb;
+        plist_tree_builder_init(&tb, NULL, (in_format == PLIST_FORMAT_XML));
+        err = plist_parse_events(plist_data, length, in_format, &plist_tree_builder_handler, &tb);
+        err = plist_tree_builder_finish(&tb, err, &plist);
+    }
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
+    }
+    if (out_format == PLIST_FORMAT_BINARY) {
+        err = plist_to_bin_callback(plist, write_func, user_data, options);
+    } else {
+        char *output = NULL;
+        uint64_t output_len = 0;
+        err = plist_write_to_string64(plist, &output, &output_len, out_format, options);
+        if (err == PLIST_ERR_SUCCESS && write_func(output, output_len, user_data) < output_len) {
+            err = PLIST_ERR_IO;
+        }
+        free(output);
+    }
+    plist_free(plist);
+    return err;
+}
+
+/* Get the contents of fd, preferably as a read-only mapping. With populate
+ * set the whole mapping is faulted in up front, since the caller is going
+ * to read all of it in order. */
+static plist_err_t plist_read_fd_contents(int fd, int populate, void **out_buf, size_t *out_size, int *out_mapped)
+{
+    struct stat fst;
+    size_t total = 0;
+    int known_size = 0;
+
+    if (fstat(fd, &fst) == 0 && S_ISREG(fst.st_mode)) {
+        if ((uint64_t)fst.st_size > SIZE_MAX) {
+            return PLIST_ERR_NO_MEM;
+        }
+        total = (size_t)fst.st_size;
+        known_size = 1;
+        if (total == 0) {
+            return PLIST_ERR_PARSE;
+        }
+#ifdef HAVE_SYS_MMAN_H
+        // only map if the data starts at the beginning of the file
+        if (lseek(fd, 0, SEEK_CUR) == 0) {
+            int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+            if (populate) flags |= MAP_POPULATE;
+#endif
+            void *map = mmap(NULL, total, PROT_READ, flags, fd, 0);
+            if (map != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+                if (populate) madvise(map, total, MADV_SEQUENTIAL);
+#endif
+                *out_buf = map;
+                *out_size = total;
+                *out_mapped = 1;
+                return PLIST_ERR_SUCCESS;
+            }
+        }
+#endif
     }
-    char *buf = (char*)malloc(total);
+
+    // pipes, special files, or mmap not available: read() into a buffer
+    size_t capacity = (known_size) ? total : 65536;
+    size_t done = 0;
+    char *buf = (char*)malloc(capacity);
     if (!buf) {
-        fclose(f);
         return PLIST_ERR_NO_MEM;
     }
-    uint32_t done = 0;
-    while (done < total) {
-        ssize_t r = fread(buf + done, 1, total - done, f);
-        if (r <= 0) {
+    for (;;) {
+        if (done == capacity) {
+            if (known_size) break;
+            if (capacity > SIZE_MAX / 2) {
+                free(buf);
+                return PLIST_ERR_NO_MEM;
+            }
+            char *newbuf = (char*)realloc(buf, capacity * 2);
+            if (!newbuf) {
+                free(buf);
+                return PLIST_ERR_NO_MEM;
+            }
+            buf = newbuf;
+            capacity *= 2;
+        }
+        size_t chunk = capacity - done;
+        if (chunk > INT_MAX) chunk = INT_MAX;
+        ssize_t r = read(fd, buf + done, chunk);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            free(buf);
+            return PLIST_ERR_IO;
+        }
+        if (r == 0) {
             break;
         }
-        done += r;
+        done += (size_t)r;
     }
-    fclose(f);
-    if (done < total) {
+    if (done == 0) {
+        free(buf);
+        return PLIST_ERR_PARSE;
+    }
+    if (known_size && done < total) {
+        // the file was truncated while reading
         free(buf);
         return PLIST_ERR_IO;
     }
-    plist_err_t res = plist_from_memory(buf, total, plist, format);
-    free(buf);
+    *out_buf = buf;
+    *out_size = done;
+    *out_mapped = 0;
+    return PLIST_ERR_SUCCESS;
+}
+
+plist_err_t plist_read_from_fd(int fd, plist_t *plist, plist_format_t *format, plist_parse_options_t options)
+{
+    if (fd < 0 || !plist) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+    *plist = NULL;
+    if (format) *format = PLIST_FORMAT_NONE;
+
+    void *buf = NULL;
+    size_t size = 0;
+    int mapped = 0;
+    plist_err_t res = plist_read_fd_contents(fd, !(options & PLIST_PARSE_LAZY), &buf, &size, &mapped);
+    if (res != PLIST_ERR_SUCCESS) {
+        return res;
+    }
+
+    plist_format_t fmt = PLIST_FORMAT_NONE;
+    res = plist_from_memory_ex((const char*)buf, size, plist, &fmt, options);
+    if (res == PLIST_ERR_SUCCESS && fmt == PLIST_FORMAT_BINARY && (options & (PLIST_PARSE_NOCOPY | PLIST_PARSE_LAZY))) {
+        // the tree points into buf, keep it around until the tree is freed
+        if (plist_set_backing(*plist, buf, size, mapped)) {
+            if (format) *format = fmt;
+            return PLIST_ERR_SUCCESS;
+        }
+        plist_free(*plist);
+        *plist = NULL;
+        res = PLIST_ERR_NO_MEM;
+    }
+#ifdef HAVE_SYS_MMAN_H
+    if (mapped) {
+        munmap(buf, size);
+    } else
+#endif
+    {
+        free(buf);
+    }
+    if (format && res == PLIST_ERR_SUCCESS) {
+        *format = fmt;
+    }
     return res;
 }
 
+plist_err_t plist_read_from_file(const char *filename, plist_t *plist, plist_format_t *format)
+{
+    if (!filename || !plist) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+    int fd = open(filename, O_RDONLY | O_BINARY);
+    if (fd < 0) {
+        return PLIST_ERR_IO;
+    }
+    plist_err_t res = plist_read_from_fd(fd, plist, format, PLIST_PARSE_NONE);
+    close(fd);
+    return res;
+}
+
+/* Nodes created through plist_new_plist_data() + plist_new_node() live in
+ * a single allocation together with their data, followed by the value of
+ * short strings. This saves two heap blocks (and their overhead) per node. */
+struct plist_node_block_s {
+    struct node node;
+    struct plist_data_s data;
+    char str[];
+};
+
+#define PLIST_NODE_BLOCK(d) ((struct plist_node_block_s*)((char*)(d) - offsetof(struct plist_node_block_s, data)))
+
 plist_t plist_new_node(plist_data_t data)
 {
+    if (data->flags & PLIST_DATA_FLAG_EMBEDDED) {
+        node_t node = &PLIST_NODE_BLOCK(data)->node;
+        node->data = data;
+        return (plist_t)node;
+    }
     return (plist_t) node_create(NULL, data);
 }
 
@@ -356,21 +623,357 @@ plist_data_t plist_get_data(plist_t node)
     return (plist_data_t)((node_t)node)->data;
 }
 
+static plist_data_t plist_new_plist_data_block(size_t extra)
+{
+    struct plist_node_block_s *block = (struct plist_node_block_s*)calloc(1, sizeof(struct plist_node_block_s) + extra);
+    if (!block) {
+        return NULL;
+    }
+    block->data.flags = PLIST_DATA_FLAG_EMBEDDED;
+    return &block->data;
+}
+
 plist_data_t plist_new_plist_data(void)
 {
-    return (plist_data_t) calloc(1, sizeof(struct plist_data_s));
+    return plist_new_plist_data_block(0);
 }
 
+/* Returns data holding a copy of the len bytes at str (NUL terminated),
+ * type is left to the caller. */
+plist_data_t plist_new_string_data(const char *str, size_t len)
+{
+    plist_data_t data;
+    if (len < PLIST_INLINE_STRING_MAX) {
+        data = plist_new_plist_data_block(len + 1);
+        if (!data) {
+            return NULL;
+        }
+        data->strval = PLIST_NODE_BLOCK(data)->str;
+        data->flags |= PLIST_DATA_FLAG_INLINE;
+    } else {
+        data = plist_new_plist_data();
+        if (!data) {
+            return NULL;
+        }
+        data->strval = (char*)malloc(len + 1);
+        if (!data->strval) {
+            plist_free_data(data);
+            return NULL;
+        }
+    }
+    memcpy(data->strval, str, len);
+    data->strval[len] = '\0';
+    data->length = len;
+    return data;
+}
+
+plist_data_t plist_new_plist_data_arena(arena_t *arena)
+{
+    plist_data_t data = (plist_data_t)arena_alloc(arena, sizeof(struct plist_data_s));
+    if (data) {
+        data->flags = PLIST_DATA_FLAG_ARENA;
+    }
+    return data;
+}
+
+plist_t plist_new_node_arena(arena_t *arena, plist_data_t data)
+{
+    node_t node = (node_t)arena_alloc(arena, sizeof(struct node));
+    if (!node) {
+        return NULL;
+    }
+    node->data = data;
+    if (data->type == PLIST_ARRAY || data->type == PLIST_DICT) {
+        // allocate the child list upfront so node_attach() won't use the heap;
+        // data->length holds the number of items (or key/value pairs)
+        node->children = (node_list_t)arena_alloc(arena, sizeof(struct node_list));
+        if (!node->children) {
+            return NULL;
+        }
+        uint64_t capacity = (data->type == PLIST_DICT) ? data->length * 2 : data->length;
+        if (capacity > 0 && capacity < UINT_MAX) {
+            node_t *items = (node_t*)arena_alloc(arena, capacity * sizeof(node_t));
+            if (!items) {
+                return NULL;
+            }
+            node_list_use_buffer(node->children, items, (unsigned int)capacity);
+        }
+    }
+    return (plist_t)node;
+}
+
+plist_t plist_set_arena_root(plist_t root, arena_t *arena)
+{
+    struct plist_root_data_s *adata = (struct plist_root_data_s*)arena_alloc(arena, sizeof(struct plist_root_data_s));
+    if (!adata) {
+        return NULL;
+    }
+    memcpy(&adata->data, plist_get_data(root), sizeof(struct plist_data_s));
+    adata->data.flags |= PLIST_DATA_FLAG_ARENA | PLIST_DATA_FLAG_ARENA_ROOT;
+    adata->arena = arena;
+    adata->tracked = NULL;
+    adata->backing = NULL;
+    adata->backing_size = 0;
+    adata->backing_mapped = 0;
+    ((node_t)root)->data = adata;
+    return root;
+}
+
+/* Hand buf over to the tree at root, to be released together with it.
+ * mapped tells if buf is a memory mapping or heap memory. */
+plist_t plist_set_backing(plist_t root, void *buf, size_t size, int mapped)
+{
+    plist_data_t data = plist_get_data(root);
+    struct plist_root_data_s *adata = NULL;
+    if (data->flags & (PLIST_DATA_FLAG_ARENA_ROOT | PLIST_DATA_FLAG_BACKED_ROOT)) {
+        adata = (struct plist_root_data_s*)data;
+    } else {
+        adata = (struct plist_root_data_s*)calloc(1, sizeof(struct plist_root_data_s));
+        if (!adata) {
+            return NULL;
+        }
+        memcpy(&adata->data, data, sizeof(struct plist_data_s));
+        if (data->flags & PLIST_DATA_FLAG_EMBEDDED) {
+            // part of the node's allocation, stays unused from now on
+            adata->data.flags &= ~PLIST_DATA_FLAG_EMBEDDED;
+        } else {
+            free(data);
+        }
+        ((node_t)root)->data = adata;
+    }
+    adata->data.flags |= PLIST_DATA_FLAG_BACKED_ROOT;
+    adata->backing = buf;
+    adata->backing_size = size;
+    adata->backing_mapped = mapped;
+    return root;
+}
+
+static void plist_release_backing(plist_data_t data)
+{
+    if (!data || !(data->flags & PLIST_DATA_FLAG_BACKED_ROOT)) {
+        return;
+    }
+    struct plist_root_data_s *adata = (struct plist_root_data_s*)data;
+#ifdef HAVE_SYS_MMAN_H
+    if (adata->backing_mapped) {
+        munmap(adata->backing, adata->backing_size);
+    } else
+#endif
+    {
+        free(adata->backing);
+    }
+    adata->backing = NULL;
+    adata->data.flags &= ~PLIST_DATA_FLAG_BACKED_ROOT;
+}
+
+/* Remember arena nodes that got heap memory attached (a lookup cache, a
+ * new value or new child nodes), so that releasing the arena can free it
+ * without walking the whole tree. */
+static void plist_arena_track(plist_t node)
+{
+    plist_data_t data = plist_get_data(node);
+    if (!data || !(data->flags & PLIST_DATA_FLAG_ARENA) || (data->flags & PLIST_DATA_FLAG_ARENA_TRACKED)) {
+        return;
+    }
+    node_t root = (node_t)node;
+    while (root && !(((plist_data_t)root->data)->flags & PLIST_DATA_FLAG_ARENA_ROOT)) {
+        root = root->parent;
+    }
+    if (!root) {
+        PLIST_ERR("%s: arena node %p without arena root\n", __func__, node);
+        return;
+    }
+    struct plist_root_data_s *adata = (struct plist_root_data_s*)root->data;
+    if (!adata->tracked) {
+        adata->tracked = ptr_array_new(16);
+        if (!adata->tracked) {
+            return;
+        }
+    }
+    ptr_array_add(adata->tracked, node);
+    data->flags |= PLIST_DATA_FLAG_ARENA_TRACKED;
+}
+
+/* String hashing for dict keys and the binary writer, modeled after wyhash:
+ * the input is consumed in 8 byte words that are folded with a 64x64->128 bit
+ * multiply. Short strings, the common case for keys, take a single multiply. */
+#define STR_HASH_S0 0x2d358dccaa6c78a5ull
+#define STR_HASH_S1 0x8bb84b93962eacc9ull
+#define STR_HASH_S2 0x4b33a62ed433d4a3ull
+
+static inline uint64_t str_hash_mum(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    return lo ^ hi;
+#endif
+}
+
+static inline uint64_t str_hash_r8(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t str_hash_r4(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+unsigned int plist_str_hash(const char *str, size_t len)
+{
+    const unsigned char *p = (const unsigned char*)str;
+    uint64_t seed = STR_HASH_S0;
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (str_hash_r4(p) << 32) | str_hash_r4(p + ((len >> 3) << 2));
+            b = (str_hash_r4(p + len - 4) << 32) | str_hash_r4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        while (i > 16) {
+            seed = str_hash_mum(str_hash_r8(p) ^ STR_HASH_S1, str_hash_r8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = str_hash_r8(p + i - 16);
+        b = str_hash_r8(p + i - 8);
+    }
+    uint64_t h = str_hash_mum(STR_HASH_S1 ^ (uint64_t)len, str_hash_mum(a ^ STR_HASH_S1, b ^ seed) ^ STR_HASH_S2);
+    return (unsigned int)(h ^ (h >> 32));
+}
+
+/* Interned key strings are shared by all keys with the same value (see
+ * plist_key_table_new()). The string is preceded by this header and freed
+ * together with the last key that references it. */
+struct plist_key_string_s {
+    const char *str; /* buf, or the string to look up in a probe */
+    size_t length;
+    unsigned int hash;
+    unsigned int refcount;
+    char buf[];
+};
+
+#define PLIST_KEY_STRING(s) ((struct plist_key_string_s*)((char*)(s) - offsetof(struct plist_key_string_s, buf)))
+
+/* shared keys can end up in different trees, which might be freed concurrently */
+#ifdef _MSC_VER
+#define key_string_ref(ks) InterlockedIncrement((volatile LONG*)&(ks)->refcount)
+#define key_string_unref(ks) InterlockedDecrement((volatile LONG*)&(ks)->refcount)
+#else
+#define key_string_ref(ks) __atomic_add_fetch(&(ks)->refcount, 1, __ATOMIC_RELAXED)
+#define key_string_unref(ks) __atomic_sub_fetch(&(ks)->refcount, 1, __ATOMIC_ACQ_REL)
+#endif
+
+static void key_string_release(void *ptr)
+{
+    struct plist_key_string_s *ks = (struct plist_key_string_s*)ptr;
+    if (key_string_unref(ks) == 0) {
+        free(ks);
+    }
+}
+
+static unsigned int key_string_hash(const void *key)
+{
+    return ((const struct plist_key_string_s*)key)->hash;
+}
+
+static int key_string_compare(const void *a, const void *b)
+{
+    const struct plist_key_string_s *ks_a = (const struct plist_key_string_s*)a;
+    const struct plist_key_string_s *ks_b = (const struct plist_key_string_s*)b;
+    return (ks_a->length == ks_b->length && memcmp(ks_a->str, ks_b->str, ks_a->length) == 0) ? TRUE : FALSE;
+}
+
+/* Creates a table that parsers use to intern dictionary keys. The table
+ * only lives as long as the parse; the strings live on in the keys. */
+hashtable_t* plist_key_table_new(void)
+{
+    return hash_table_new(key_string_hash, key_string_compare, key_string_release);
+}
+
+void plist_key_table_free(hashtable_t *keys)
+{
+    hash_table_destroy(keys);
+}
+
+/* Returns new PLIST_KEY data that shares the string of interned key data */
+plist_data_t plist_new_shared_key_data(const char *interned)
+{
+    struct plist_key_string_s *ks = PLIST_KEY_STRING(interned);
+    plist_data_t data = plist_new_plist_data();
+    if (!data) {
+        return NULL;
+    }
+    key_string_ref(ks);
+    data->type = PLIST_KEY;
+    data->strval = ks->buf;
+    data->length = ks->length;
+    data->hash = ks->hash;
+    data->flags |= PLIST_DATA_FLAG_INTERNED | PLIST_DATA_FLAG_HASHED;
+    return data;
+}
+
+/* Returns new PLIST_KEY data for the len bytes at str, with the string
+ * shared between all keys interned through keys */
+plist_data_t plist_new_interned_key_data(hashtable_t *keys, const char *str, size_t len)
+{
+    struct plist_key_string_s probe;
+    probe.str = str;
+    probe.length = len;
+    probe.hash = plist_str_hash(str, len);
+
+    struct plist_key_string_s *ks = (struct plist_key_string_s*)hash_table_lookup(keys, &probe);
+    if (!ks) {
+        ks = (struct plist_key_string_s*)malloc(sizeof(struct plist_key_string_s) + len + 1);
+        if (!ks) {
+            return NULL;
+        }
+        memcpy(ks->buf, str, len);
+        ks->buf[len] = '\0';
+        ks->str = ks->buf;
+        ks->length = len;
+        ks->hash = probe.hash;
+        // this reference belongs to the table
+        ks->refcount = 1;
+        size_t count = keys->count;
+        hash_table_insert(keys, ks, ks);
+        if (keys->count == count) {
+            // not stored (out of memory), the key is the only user then
+            ks->refcount = 0;
+        }
+    }
+    return plist_new_shared_key_data(ks->buf);
+}
+
+/* Key nodes carry the hash of their name, so (re)building a dict index or
+ * merging dicts doesn't hash the same keys over and over again; only probe
+ * keys without one are hashed here. */
 static unsigned int dict_key_hash(const void *data)
 {
     plist_data_t keydata = (plist_data_t)data;
-    unsigned int hash = 5381;
-    size_t i;
-    char *str = keydata->strval;
-    for (i = 0; i < keydata->length; str++, i++) {
-        hash = ((hash << 5) + hash) + *str;
+    if (keydata->flags & PLIST_DATA_FLAG_HASHED) {
+        return keydata->hash;
     }
-    return hash;
+    return plist_str_hash(keydata->strval, keydata->length);
 }
 
 static int dict_key_compare(const void* a, const void* b)
@@ -380,10 +983,25 @@ static int dict_key_compare(const void* a, const void* b)
     if (data_a->strval == NULL || data_b->strval == NULL) {
         return FALSE;
     }
+    if (data_a->strval == data_b->strval) {
+        // same (interned) string
+        return TRUE;
+    }
+    // the hash table only calls this for equal hashes
     if (data_a->length != data_b->length) {
         return FALSE;
     }
-    return (strcmp(data_a->strval, data_b->strval) == 0) ? TRUE : FALSE;
+    return (memcmp(data_a->strval, data_b->strval, data_a->length) == 0) ? TRUE : FALSE;
+}
+
+/* Adds an entry to a dict index unless the key is in there already; the
+ * binary parser keeps duplicate keys, and like the linear search the
+ * index has to find the first of them. */
+static void _plist_dict_index_add(hashtable_t *ht, plist_data_t key, plist_t value)
+{
+    if (!hash_table_lookup(ht, key)) {
+        hash_table_insert(ht, key, value);
+    }
 }
 
 static void _plist_free_data(plist_data_t data)
@@ -392,18 +1010,35 @@ static void _plist_free_data(plist_data_t data)
     switch (data->type) {
         case PLIST_KEY:
         case PLIST_STRING:
-            free(data->strval);
+            if (data->flags & PLIST_DATA_FLAG_INTERNED) {
+                key_string_release(PLIST_KEY_STRING(data->strval));
+            } else if (!(data->flags & (PLIST_DATA_FLAG_BORROWED | PLIST_DATA_FLAG_INLINE))) {
+                free(data->strval);
+            }
             data->strval = NULL;
+            data->flags &= ~(PLIST_DATA_FLAG_BORROWED | PLIST_DATA_FLAG_INLINE | PLIST_DATA_FLAG_INTERNED | PLIST_DATA_FLAG_HASHED);
             break;
         case PLIST_DATA:
-            free(data->buff);
+            if (!(data->flags & PLIST_DATA_FLAG_BORROWED)) {
+                free(data->buff);
+            }
             data->buff = NULL;
+            data->flags &= ~PLIST_DATA_FLAG_BORROWED;
             break;
         case PLIST_ARRAY:
-            ptr_array_free((ptrarray_t*)data->hashtable);
+            if (data->flags & PLIST_DATA_FLAG_LAZY) {
+                plist_bin_lazy_free(data->hashtable);
+                data->flags &= ~PLIST_DATA_FLAG_LAZY;
+            }
             data->hashtable = NULL;
             break;
         case PLIST_DICT: {
+            if (data->flags & PLIST_DATA_FLAG_LAZY) {
+                plist_bin_lazy_free(data->hashtable);
+                data->flags &= ~PLIST_DATA_FLAG_LAZY;
+                data->hashtable = NULL;
+                break;
+            }
             hashtable_t *ht = (hashtable_t*)data->hashtable;
             // PLIST_DICT hashtables must not own/free values; values are freed via node tree.
             assert(!ht || ht->free_func == NULL);
@@ -421,7 +1056,49 @@ void plist_free_data(plist_data_t data)
 {
     if (!data) return;
     _plist_free_data(data);
-    free(data);
+    if (data->flags & PLIST_DATA_FLAG_EMBEDDED) {
+        // released with its node, unless it never got one
+        struct plist_node_block_s *block = PLIST_NODE_BLOCK(data);
+        if (block->node.data != data) {
+            free(block);
+        }
+    } else if (!(data->flags & PLIST_DATA_FLAG_ARENA)) {
+        free(data);
+    }
+}
+
+static int plist_free_node(node_t root);
+
+static void plist_arena_release(node_t root)
+{
+    struct plist_root_data_s *adata = (struct plist_root_data_s*)root->data;
+    arena_t *arena = adata->arena;
+    ptrarray_t *tracked = adata->tracked;
+    long i;
+
+    for (i = 0; tracked && i < tracked->len; i++) {
+        node_t node = (node_t)ptr_array_index(tracked, i);
+        if (!node->data) {
+            // already freed individually
+            continue;
+        }
+        // free child nodes that are not part of this arena, back to front
+        // so that detaching them doesn't have to move the remaining ones
+        unsigned int n = node_n_children(node);
+        while (n > 0) {
+            node_t ch = node_nth_child(node, --n);
+            plist_data_t chdata = (plist_data_t)ch->data;
+            if (!chdata || !(chdata->flags & PLIST_DATA_FLAG_ARENA) || (chdata->flags & PLIST_DATA_FLAG_ARENA_ROOT)) {
+                plist_free_node(ch);
+            }
+        }
+        // the child list may have outgrown its arena buffer
+        node_list_clear(node->children);
+        _plist_free_data((plist_data_t)node->data);
+    }
+    ptr_array_free(tracked);
+    plist_release_backing(&adata->data);
+    arena_free(arena);
 }
 
 static int plist_free_children(node_t root)
@@ -438,7 +1115,7 @@ static int plist_free_children(node_t root)
 
     // Push *direct* children onto the stack, detached from root.
     for (;;) {
-        node_t ch = node_first_child(root);
+        node_t ch = node_last_child(root);
         if (!ch) break;
 
         int di = node_detach(root, ch);
@@ -462,7 +1139,14 @@ static int plist_free_children(node_t root)
     // Now free the detached subtree nodes (and their descendants).
     while (sp) {
         node_t node = stack[sp - 1];
-        node_t ch = node_first_child(node);
+        plist_data_t data = plist_get_data(node);
+        if (data && (data->flags & PLIST_DATA_FLAG_ARENA_ROOT)) {
+            // a whole arena tree, release it at once
+            plist_arena_release(node);
+            sp--;
+            continue;
+        }
+        node_t ch = node_last_child(node);
         if (ch) {
             int di = node_detach(node, ch);
             if (di < 0) {
@@ -483,11 +1167,17 @@ static int plist_free_children(node_t root)
             continue;
         }
 
-        plist_data_t data = plist_get_data(node);
+        uint32_t flags = (data) ? data->flags : 0;
+        plist_release_backing(data);
         plist_free_data(data);
         node->data = NULL;
 
-        node_destroy(node);
+        if (!(flags & PLIST_DATA_FLAG_ARENA)) {
+            node_destroy(node);
+        } else {
+            // the child list may have outgrown its arena buffer
+            node_list_clear(node->children);
+        }
 
         sp--;
     }
@@ -509,17 +1199,28 @@ static int plist_free_node(node_t root)
         }
     }
 
+    plist_data_t data = plist_get_data(root);
+    if (data && (data->flags & PLIST_DATA_FLAG_ARENA_ROOT)) {
+        plist_arena_release(root);
+        return root_index;
+    }
+
     int r = plist_free_children(root);
     if (r < 0) {
         // root is already detached; caller should treat as error.
         return r;
     }
 
-    plist_data_t data = plist_get_data(root);
+    uint32_t flags = (data) ? data->flags : 0;
+    plist_release_backing(data);
     plist_free_data(data);
     root->data = NULL;
 
-    node_destroy(root);
+    if (!(flags & PLIST_DATA_FLAG_ARENA)) {
+        node_destroy(root);
+    } else {
+        node_list_clear(root->children);
+    }
 
     return root_index;
 }
@@ -547,41 +1248,42 @@ plist_t plist_new_array(void)
 }
 
 //These nodes should not be handled by users
-static plist_t plist_new_key(const char *val)
-{
-    plist_data_t data = plist_new_plist_data();
+/* Creates a key node with the name of key, reusing its hash or its
+ * interned string, or interning the name in keys if that is given */
+static plist_t plist_new_key(plist_data_t key, hashtable_t *keys)
+{
+    plist_data_t data;
+    if (keys) {
+        data = plist_new_interned_key_data(keys, key->strval, key->length);
+    } else if (key->flags & PLIST_DATA_FLAG_INTERNED) {
+        data = plist_new_shared_key_data(key->strval);
+    } else {
+        data = plist_new_string_data(key->strval, key->length);
+        if (data) {
+            data->type = PLIST_KEY;
+            if (key->flags & PLIST_DATA_FLAG_HASHED) {
+                data->hash = key->hash;
+                data->flags |= PLIST_DATA_FLAG_HASHED;
+            } else {
+                plist_key_data_set_hash(data);
+            }
+        }
+    }
     if (!data) {
         PLIST_ERR("%s: failed to allocate plist data\n", __func__);
         return NULL;
     }
-    data->type = PLIST_KEY;
-    data->strval = strdup(val);
-    if (!data->strval) {
-        plist_free_data(data);
-        PLIST_ERR("%s: strdup failed\n", __func__);
-        return NULL;
-    } else {
-        data->length = strlen(val);
-    }
     return plist_new_node(data);
 }
 
 plist_t plist_new_string(const char *val)
 {
-    plist_data_t data = plist_new_plist_data();
+    plist_data_t data = plist_new_string_data(val, strlen(val));
     if (!data) {
         PLIST_ERR("%s: failed to allocate plist data\n", __func__);
         return NULL;
     }
     data->type = PLIST_STRING;
-    data->strval = strdup(val);
-    if (!data->strval) {
-        plist_free_data(data);
-        PLIST_ERR("%s: strdup failed\n", __func__);
-        return NULL;
-    } else {
-        data->length = strlen(val);
-    }
     return plist_new_node(data);
 }
 
@@ -729,15 +1431,32 @@ static int plist_copy_node_shallow(node_t node, plist_t *out_newnode, plist_data
 {
     if (!node || !out_newnode || !out_newdata || !out_type) return NODE_ERR_INVALID_ARG;
 
+    plist_node_expand((plist_t)node);
+
     plist_data_t data = plist_get_data(node);
     if (!data) return NODE_ERR_INVALID_ARG;
 
-    plist_data_t newdata = plist_new_plist_data();
-    if (!newdata) return NODE_ERR_NO_MEM;
-
-    memcpy(newdata, data, sizeof(struct plist_data_s));
-
     plist_type node_type = plist_get_node_type(node);
+    plist_data_t newdata;
+    if (data->flags & PLIST_DATA_FLAG_INTERNED) {
+        newdata = plist_new_shared_key_data(data->strval);
+        if (!newdata) return NODE_ERR_NO_MEM;
+    } else if ((node_type == PLIST_KEY || node_type == PLIST_STRING) && data->strval) {
+        newdata = plist_new_string_data(data->strval, strlen(data->strval));
+        if (!newdata) return NODE_ERR_NO_MEM;
+        newdata->type = node_type;
+        if (newdata->length == data->length) {
+            newdata->hash = data->hash;
+            newdata->flags |= (data->flags & PLIST_DATA_FLAG_HASHED);
+        }
+    } else {
+        newdata = plist_new_plist_data();
+        if (!newdata) return NODE_ERR_NO_MEM;
+        uint32_t flags = newdata->flags;
+        memcpy(newdata, data, sizeof(struct plist_data_s));
+        newdata->flags = flags;
+    }
+
     switch (node_type) {
         case PLIST_DATA:
             if (data->buff) {
@@ -755,30 +1474,13 @@ static int plist_copy_node_shallow(node_t node, plist_t *out_newnode, plist_data
 
         case PLIST_KEY:
         case PLIST_STRING:
-            if (data->strval) {
-                size_t n = strlen(data->strval);
-                newdata->strval = (char*)malloc(n+1);
-                if (!newdata->strval) {
-                    plist_free_data(newdata);
-                    return NODE_ERR_NO_MEM;
-                }
-                memcpy(newdata->strval, data->strval, n+1);
-                newdata->length = (uint64_t)n;
-            } else {
-                newdata->strval = NULL;
+            if (!data->strval) {
                 newdata->length = 0;
             }
             break;
 
         case PLIST_ARRAY:
-            if (data->hashtable) {
-                ptrarray_t* pa = ptr_array_new(((ptrarray_t*)data->hashtable)->capacity);
-                if (!pa) {
-                    plist_free_data(newdata);
-                    return NODE_ERR_NO_MEM;
-                }
-                newdata->hashtable = pa;
-            }
+            newdata->hashtable = NULL;
             break;
 
         case PLIST_DICT:
@@ -788,6 +1490,7 @@ static int plist_copy_node_shallow(node_t node, plist_t *out_newnode, plist_data
                     plist_free_data(newdata);
                     return NODE_ERR_NO_MEM;
                 }
+                hash_table_reserve(ht, ((hashtable_t*)data->hashtable)->count);
                 newdata->hashtable = ht;
             }
             break;
@@ -850,6 +1553,9 @@ static plist_t plist_copy_node(node_t root)
     cf.node_index = 0;
     cf.depth = 0;
     st[sp++] = cf;
+    if (cf.next_child) {
+        node_reserve_children((node_t)newroot, node_n_children(root));
+    }
 
     while (sp) {
         copy_frame_t *f = &st[sp - 1];
@@ -884,8 +1590,10 @@ static plist_t plist_copy_node(node_t root)
             return NULL;
         }
 
-        // attach child to copied parent
-        r = node_attach((node_t)f->copy, (node_t)newch);
+        // attach child to copied parent; the copy has the same shape as
+        // the original, so the depth (checked above) and cycle checks of
+        // node_attach() can be skipped
+        r = node_attach_unchecked((node_t)f->copy, (node_t)newch);
         if (r != NODE_ERR_SUCCESS) {
             plist_free_node((node_t)newch);
             plist_free_node((node_t)newroot);
@@ -896,17 +1604,11 @@ static plist_t plist_copy_node(node_t root)
 
         // update lookup cache on the *parent* copy
         switch (f->type) {
-            case PLIST_ARRAY:
-                if (f->copydata->hashtable) {
-                    ptr_array_add((ptrarray_t*)f->copydata->hashtable, newch);
-                }
-                break;
-
             case PLIST_DICT:
                 if (f->copydata->hashtable && (f->node_index % 2 != 0)) {
                     node_t new_key = node_prev_sibling((node_t)newch);
                     if (new_key) {
-                        hash_table_insert((hashtable_t*)f->copydata->hashtable, new_key->data, newch);
+                        _plist_dict_index_add((hashtable_t*)f->copydata->hashtable, new_key->data, newch);
                     }
                 }
                 break;
@@ -939,6 +1641,10 @@ static plist_t plist_copy_node(node_t root)
         nf.node_index = 0;
         nf.depth = f->depth + 1;
         st[sp++] = nf;
+        if (nf.next_child) {
+            // the copy gets exactly as many children as the original
+            node_reserve_children((node_t)newch, node_n_children(ch));
+        }
     }
 
     free(st);
@@ -955,6 +1661,7 @@ uint32_t plist_array_get_size(plist_t node)
     uint32_t ret = 0;
     if (node && PLIST_ARRAY == plist_get_node_type(node))
     {
+        plist_node_expand(node);
         ret = node_n_children((node_t)node);
     }
     return ret;
@@ -965,12 +1672,8 @@ plist_t plist_array_get_item(plist_t node, uint32_t n)
     plist_t ret = NULL;
     if (node && PLIST_ARRAY == plist_get_node_type(node) && n < INT_MAX)
     {
-        ptrarray_t *pa = (ptrarray_t*)((plist_data_t)((node_t)node)->data)->hashtable;
-        if (pa) {
-            ret = (plist_t)ptr_array_index(pa, n);
-        } else {
-            ret = (plist_t)node_nth_child((node_t)node, n);
-        }
+        plist_node_expand(node);
+        ret = (plist_t)node_nth_child((node_t)node, n);
     }
     return ret;
 }
@@ -985,60 +1688,6 @@ uint32_t plist_array_get_item_index(plist_t node)
     return UINT_MAX;
 }
 
-static void _plist_array_post_insert(plist_t node, plist_t item, long n)
-{
-    ptrarray_t *pa = (ptrarray_t*)((plist_data_t)((node_t)node)->data)->hashtable;
-    if (pa) {
-        /* store pointer to item in array */
-        ptr_array_insert(pa, item, n);
-        return;
-    }
-
-    if (((node_t)node)->count > 100) {
-       /* make new lookup array */
-       pa = ptr_array_new(128);
-       plist_t current = NULL;
-       for (current = (plist_t)node_first_child((node_t)node);
-            pa && current;
-            current = (plist_t)node_next_sibling((node_t)current))
-       {
-           ptr_array_add(pa, current);
-       }
-       ((plist_data_t)((node_t)node)->data)->hashtable = pa;
-    }
-}
-
-static void _plist_array_post_set(plist_t node, plist_t item, long n)
-{
-    ptrarray_t *pa = (ptrarray_t*)((plist_data_t)((node_t)node)->data)->hashtable;
-
-    if (pa) {
-        if (n < 0 || n >= pa->len) {
-           PLIST_ERR("%s: cache index out of range (n=%ld len=%ld)\n", __func__, n, pa->len);
-           return;
-        }
-        ptr_array_set(pa, item, n);
-        return;
-    }
-
-    if (((node_t)node)->count > 100) {
-        pa = ptr_array_new(128);
-        plist_t current = NULL;
-        for (current = (plist_t)node_first_child((node_t)node);
-             pa && current;
-             current = (plist_t)node_next_sibling((node_t)current))
-        {
-            ptr_array_add(pa, current);
-        }
-        ((plist_data_t)((node_t)node)->data)->hashtable = pa;
-
-        // Now that it exists (and is filled), apply the set (will no-op if out of range)
-        if (pa) {
-            ptr_array_set(pa, item, n);
-        }
-    }
-}
-
 void plist_array_set_item(plist_t node, plist_t item, uint32_t n)
 {
     if (!PLIST_IS_ARRAY(node) || !item || n >= INT_MAX) {
@@ -1054,29 +1703,17 @@ void plist_array_set_item(plist_t node, plist_t item, uint32_t n)
     plist_t old_item = plist_array_get_item(node, n);
     if (!old_item) return;
 
-    int idx = node_detach((node_t)node, (node_t)old_item);
-    if (idx < 0) {
-        PLIST_ERR("%s: Failed to detach old item (err=%d)\n", __func__, idx);
-        return;
-    }
-
-    int r = node_insert((node_t)node, (unsigned)idx, (node_t)item);
-    if (r != NODE_ERR_SUCCESS) {
-        int rb = node_insert((node_t)node, (unsigned)idx, (node_t)old_item);
-        if (rb == NODE_ERR_SUCCESS) {
-            _plist_array_post_set(node, old_item, idx); // restore cache correctly
-            PLIST_ERR("%s: failed to insert replacement (idx=%d err=%d); rollback succeeded\n", __func__, idx, r);
-        } else {
-            PLIST_ERR("%s: insert failed (err=%d) and rollback failed (err=%d); array now missing element at idx=%d\n", __func__, r, rb, idx);
-        }
+    int r = node_replace((node_t)node, (node_t)old_item, (node_t)item);
+    if (r < 0) {
+        PLIST_ERR("%s: failed to replace item (err=%d)\n", __func__, r);
         return;
     }
 
-    _plist_array_post_set(node, item, idx); // update cache
+    plist_arena_track(node);
     plist_free_node((node_t)old_item);
 }
 
-void plist_array_append_item(plist_t node, plist_t item)
+static void _plist_array_append_item(plist_t node, plist_t item, int parsed)
 {
     if (!PLIST_IS_ARRAY(node) || !item) {
         PLIST_ERR("invalid argument passed to %s (node=%p, item=%p)\n", __func__, node, item);
@@ -1088,13 +1725,24 @@ void plist_array_append_item(plist_t node, plist_t item)
         PLIST_ERR("%s: item already has a parent; use plist_copy() or detach first\n", __func__);
         return;
     }
+    plist_node_expand(node);
 
-    int r = node_attach((node_t)node, (node_t)item);
+    int r = (parsed) ? node_attach_unchecked((node_t)node, (node_t)item) : node_attach((node_t)node, (node_t)item);
     if (r != NODE_ERR_SUCCESS) {
         PLIST_ERR("%s: failed to append item (err=%d)\n", __func__, r);
         return;
     }
-    _plist_array_post_insert(node, item, -1);
+    plist_arena_track(node);
+}
+
+void plist_array_append_item(plist_t node, plist_t item)
+{
+    _plist_array_append_item(node, item, 0);
+}
+
+void plist_array_append_parsed(plist_t node, plist_t item)
+{
+    _plist_array_append_item(node, item, 1);
 }
 
 void plist_array_insert_item(plist_t node, plist_t item, uint32_t n)
@@ -1109,13 +1757,14 @@ void plist_array_insert_item(plist_t node, plist_t item, uint32_t n)
         PLIST_ERR("%s: item already has a parent; use plist_copy() or detach first\n", __func__);
         return;
     }
+    plist_node_expand(node);
 
     int r = node_insert((node_t)node, n, (node_t)item);
     if (r != NODE_ERR_SUCCESS) {
         PLIST_ERR("%s: Failed to insert item at index %u (err=%d)\n", __func__, n, r);
         return;
     }
-    _plist_array_post_insert(node, item, (long)n);
+    plist_arena_track(node);
 }
 
 void plist_array_remove_item(plist_t node, uint32_t n)
@@ -1125,10 +1774,6 @@ void plist_array_remove_item(plist_t node, uint32_t n)
         plist_t old_item = plist_array_get_item(node, n);
         if (old_item)
         {
-            ptrarray_t* pa = (ptrarray_t*)((plist_data_t)((node_t)node)->data)->hashtable;
-            if (pa) {
-                ptr_array_remove(pa, n);
-            }
             plist_free(old_item);
         }
     }
@@ -1139,12 +1784,6 @@ void plist_array_item_remove(plist_t node)
     plist_t father = plist_get_parent(node);
     if (PLIST_ARRAY == plist_get_node_type(father))
     {
-        int n = node_child_position((node_t)father, (node_t)node);
-        if (n < 0) return;
-        ptrarray_t* pa = (ptrarray_t*)((plist_data_t)((node_t)father)->data)->hashtable;
-        if (pa) {
-            ptr_array_remove(pa, n);
-        }
         plist_free(node);
     }
 }
@@ -1161,6 +1800,7 @@ void plist_array_new_iter(plist_t node, plist_array_iter *iter)
 
     plist_array_iter_private* it = (plist_array_iter_private*)malloc(sizeof(*it));
     if (!it) return;
+    plist_node_expand(node);
     it->cur = node_first_child((node_t)node);
     *iter = (plist_array_iter)it;
 }
@@ -1191,6 +1831,7 @@ uint32_t plist_dict_get_size(plist_t node)
     uint32_t ret = 0;
     if (node && PLIST_DICT == plist_get_node_type(node))
     {
+        plist_node_expand(node);
         ret = node_n_children((node_t)node) / 2;
     }
     return ret;
@@ -1208,6 +1849,7 @@ void plist_dict_new_iter(plist_t node, plist_dict_iter *iter)
 
     plist_dict_iter_private* it = (plist_dict_iter_private*)malloc(sizeof(*it));
     if (!it) return;
+    plist_node_expand(node);
     it->cur = node_first_child((node_t)node);
     *iter = (plist_dict_iter)it;
 }
@@ -1271,25 +1913,44 @@ plist_t plist_dict_item_get_key(plist_t node)
     return ret;
 }
 
-plist_t plist_dict_get_item(plist_t node, const char* key)
+static hashtable_t* _plist_dict_build_index(plist_t node)
 {
-    plist_t ret = NULL;
-    if (!PLIST_IS_DICT(node) || !key) {
-        PLIST_ERR("invalid argument passed to %s (node=%p, key=%p)\n", __func__, node, key);
+    hashtable_t *ht = hash_table_new(dict_key_hash, dict_key_compare, NULL);
+    if (!ht) {
         return NULL;
     }
+    hash_table_reserve(ht, ((node_t)node)->count / 2);
+    // calculate the hashes for all entries we have so far
+    plist_t current = NULL;
+    for (current = (plist_t)node_first_child((node_t)node);
+         current && node_next_sibling((node_t)current);
+         current = (plist_t)node_next_sibling(node_next_sibling((node_t)current)))
+    {
+        _plist_dict_index_add(ht, ((node_t)current)->data, node_next_sibling((node_t)current));
+    }
+    ((plist_data_t)((node_t)node)->data)->hashtable = ht;
+    plist_arena_track(node);
+    return ht;
+}
+
+void plist_dict_index_parsed(plist_t node)
+{
     plist_data_t data = plist_get_data(node);
-    if (!data) {
-        PLIST_ERR("%s: invalid node\n", __func__);
-        return NULL;
+    if (!data->hashtable && ((node_t)node)->count > PLIST_DICT_HASH_THRESHOLD) {
+        _plist_dict_build_index(node);
     }
-    size_t keylen = strlen(key);
+}
+
+/* looks up the value for the key described by the (probe) key data; the
+ * dict must be expanded already. Lookups never build an index, so that
+ * reading a tree does not modify it. */
+static plist_t _plist_dict_lookup(plist_t node, plist_data_t key)
+{
+    plist_t ret = NULL;
+    plist_data_t data = plist_get_data(node);
     hashtable_t *ht = (hashtable_t*)data->hashtable;
     if (ht) {
-        struct plist_data_s sdata = { 0 };
-        sdata.strval = (char*)key;
-        sdata.length = keylen;
-        return (plist_t)hash_table_lookup(ht, &sdata);
+        return (plist_t)hash_table_lookup(ht, key);
     } else {
         plist_t k = NULL;
         for (k = (plist_t)node_first_child((node_t)node); k; ) {
@@ -1301,7 +1962,7 @@ plist_t plist_dict_get_item(plist_t node, const char* key)
                 PLIST_ERR("invalid key node at %p\n", k);
                 break;
             }
-            if (data->length == keylen && !memcmp(key, data->strval, keylen+1)) {
+            if (data->length == key->length && (data->strval == key->strval || !memcmp(key->strval, data->strval, key->length))) {
                 ret = v;
                 break;
             }
@@ -1311,7 +1972,25 @@ plist_t plist_dict_get_item(plist_t node, const char* key)
     return ret;
 }
 
-void plist_dict_set_item(plist_t node, const char* key, plist_t item)
+plist_t plist_dict_get_item(plist_t node, const char* key)
+{
+    if (!PLIST_IS_DICT(node) || !key) {
+        PLIST_ERR("invalid argument passed to %s (node=%p, key=%p)\n", __func__, node, key);
+        return NULL;
+    }
+    plist_data_t data = plist_get_data(node);
+    if (!data) {
+        PLIST_ERR("%s: invalid node\n", __func__);
+        return NULL;
+    }
+    plist_node_expand(node);
+    struct plist_data_s sdata = { 0 };
+    sdata.strval = (char*)key;
+    sdata.length = strlen(key);
+    return _plist_dict_lookup(node, &sdata);
+}
+
+static void _plist_dict_set_item(plist_t node, plist_data_t key, plist_t item, int parsed, hashtable_t *keys)
 {
     if (!PLIST_IS_DICT(node) || !key || !item) {
         PLIST_ERR("invalid argument passed to %s (node=%p, key=%p, item=%p)\n", __func__, node, key, item);
@@ -1323,10 +2002,11 @@ void plist_dict_set_item(plist_t node, const char* key, plist_t item)
         PLIST_ERR("%s: item already has a parent\n", __func__);
         return;
     }
+    plist_node_expand(node);
 
     hashtable_t *ht = (hashtable_t*)((plist_data_t)((node_t)node)->data)->hashtable;
 
-    plist_t old_item = plist_dict_get_item(node, key);
+    plist_t old_item = _plist_dict_lookup(node, key);
     plist_t key_node = NULL;
 
     if (old_item) {
@@ -1342,21 +2022,9 @@ void plist_dict_set_item(plist_t node, const char* key, plist_t item)
             return;
         }
 
-        // detach old value (do NOT free yet)
-        int idx = node_detach((node_t)node, old_val);
-        if (idx < 0) {
-            PLIST_ERR("%s: failed to detach old value (err=%d)\n", __func__, idx);
-            return;
-        }
-
-        // insert new value at same position
-        int r = node_insert((node_t)node, (unsigned)idx, (node_t)item);
-        if (r != NODE_ERR_SUCCESS) {
-            // rollback: reinsert old value
-            int rb = node_insert((node_t)node, (unsigned)idx, old_val);
-            if (rb == NODE_ERR_SUCCESS && ht) {
-                hash_table_insert(ht, ((node_t)old_key)->data, old_item);
-            }
+        // put the new value in place of the old one (do NOT free it yet)
+        int r = node_replace((node_t)node, old_val, (node_t)item);
+        if (r < 0) {
             PLIST_ERR("%s: failed to replace dict value (err=%d)\n", __func__, r);
             return;
         }
@@ -1366,21 +2034,22 @@ void plist_dict_set_item(plist_t node, const char* key, plist_t item)
         if (ht) {
             hash_table_insert(ht, (plist_data_t)((node_t)key_node)->data, item);
         }
+        plist_arena_track(node);
 
         // now it’s safe to free old value
         plist_free_node(old_val);
     } else {
         // --- INSERT NEW KEY/VALUE PAIR ---
-        key_node = plist_new_key(key);
+        key_node = plist_new_key(key, keys);
         if (!key_node) return;
 
-        int r = node_attach((node_t)node, (node_t)key_node);
+        int r = (parsed) ? node_attach_unchecked((node_t)node, (node_t)key_node) : node_attach((node_t)node, (node_t)key_node);
         if (r != NODE_ERR_SUCCESS) {
             plist_free_node((node_t)key_node);
             PLIST_ERR("%s: failed to attach dict key (err=%d)\n", __func__, r);
             return;
         }
-        r = node_attach((node_t)node, (node_t)item);
+        r = (parsed) ? node_attach_unchecked((node_t)node, (node_t)item) : node_attach((node_t)node, (node_t)item);
         if (r != NODE_ERR_SUCCESS) {
             // rollback key insertion
             node_detach((node_t)node, (node_t)key_node);
@@ -1389,23 +2058,275 @@ void plist_dict_set_item(plist_t node, const char* key, plist_t item)
             return;
         }
 
+        plist_arena_track(node);
         if (ht) {
             // store pointer to item in hash table
             hash_table_insert(ht, (plist_data_t)((node_t)key_node)->data, item);
-        } else if (((node_t)node)->count > 500) {
+        } else if (((node_t)node)->count > PLIST_DICT_HASH_THRESHOLD) {
             // make new hash table
-            ht = hash_table_new(dict_key_hash, dict_key_compare, NULL);
-            // calculate the hashes for all entries we have so far
-            plist_t current = NULL;
-            for (current = (plist_t)node_first_child((node_t)node);
-                 ht && current;
-                 current = (plist_t)node_next_sibling(node_next_sibling((node_t)current)))
-            {
-                hash_table_insert(ht, ((node_t)current)->data, node_next_sibling((node_t)current));
+            _plist_dict_build_index(node);
+        }
+    }
+}
+
+void plist_dict_set_item(plist_t node, const char* key, plist_t item)
+{
+    struct plist_data_s sdata = { 0 };
+    sdata.strval = (char*)key;
+    sdata.length = (key) ? strlen(key) : 0;
+    if (key) {
+        // hashed once for the lookup and the new key
+        plist_key_data_set_hash(&sdata);
+    }
+    _plist_dict_set_item(node, (key) ? &sdata : NULL, item, 0, NULL);
+}
+
+void plist_dict_set_parsed(plist_t node, const char* key, plist_t item, hashtable_t *keys)
+{
+    struct plist_data_s sdata = { 0 };
+    sdata.strval = (char*)key;
+    sdata.length = (key) ? strlen(key) : 0;
+    if (key) {
+        plist_key_data_set_hash(&sdata);
+    }
+    _plist_dict_set_item(node, (key) ? &sdata : NULL, item, 1, keys);
+}
+
+/*
+ * Tree builder. The text parsers report what they parse as events, see
+ * plist_parse_events(), and this handler turns them into nodes. Every
+ * node is attached to its parent as soon as it is created, so on error
+ * freeing the root releases everything built so far.
+ */
+void plist_tree_builder_init(struct plist_tree_builder *tb, hashtable_t *keys, int uid_dicts)
+{
+    memset(tb, 0, sizeof(struct plist_tree_builder));
+    tb->keys = keys;
+    tb->uid_dicts = uid_dicts;
+}
+
+plist_err_t plist_tree_builder_finish(struct plist_tree_builder *tb, plist_err_t err, plist_t *plist)
+{
+    if (err == PLIST_ERR_SUCCESS && tb->parent) {
+        PLIST_ERR("%s: incomplete event sequence\n", __func__);
+        err = PLIST_ERR_PARSE;
+    }
+    if (err != PLIST_ERR_SUCCESS) {
+        plist_free(tb->root);
+        tb->root = NULL;
+    }
+    *plist = tb->root;
+    free(tb->key);
+    plist_tree_builder_init(tb, tb->keys, tb->uid_dicts);
+    return err;
+}
+
+static plist_err_t tree_builder_attach(struct plist_tree_builder *tb, plist_t node)
+{
+    if (!node) {
+        return PLIST_ERR_NO_MEM;
+    }
+    if (!tb->parent) {
+        if (tb->root) {
+            PLIST_ERR("%s: more than one root value\n", __func__);
+            plist_free(node);
+            return PLIST_ERR_PARSE;
+        }
+        tb->root = node;
+        return PLIST_ERR_SUCCESS;
+    }
+    if (PLIST_IS_DICT(tb->parent)) {
+        if (!tb->have_key) {
+            PLIST_ERR("%s: dictionary value without key\n", __func__);
+            plist_free(node);
+            return PLIST_ERR_PARSE;
+        }
+        struct plist_data_s sdata = { 0 };
+        sdata.strval = tb->key;
+        sdata.length = tb->key_len;
+        plist_key_data_set_hash(&sdata);
+        _plist_dict_set_item(tb->parent, &sdata, node, 1, tb->keys);
+        tb->have_key = 0;
+    } else {
+        _plist_array_append_item(tb->parent, node, 1);
+    }
+    if (((node_t)node)->parent == NULL) {
+        plist_free(node);
+        return PLIST_ERR_NO_MEM;
+    }
+    return PLIST_ERR_SUCCESS;
+}
+
+static plist_err_t tree_builder_begin(struct plist_tree_builder *tb, plist_t node)
+{
+    plist_err_t err = tree_builder_attach(tb, node);
+    if (err == PLIST_ERR_SUCCESS) {
+        tb->parent = node;
+    }
+    return err;
+}
+
+static plist_err_t tree_builder_end(struct plist_tree_builder *tb, plist_type type)
+{
+    if (!tb->parent || plist_get_node_type(tb->parent) != type) {
+        PLIST_ERR("%s: unbalanced end of container\n", __func__);
+        return PLIST_ERR_PARSE;
+    }
+    plist_t node = tb->parent;
+    tb->parent = ((node_t)node)->parent;
+    tb->have_key = 0;
+
+    if (type == PLIST_DICT && tb->uid_dicts && ((node_t)node)->count == 2) {
+        plist_t uid = plist_dict_get_item(node, "CF$UID");
+        if (uid) {
+            uint64_t val = 0;
+            if (plist_get_node_type(uid) != PLIST_INT) {
+                PLIST_ERR("%s: invalid node type for CF$UID dict entry (must be PLIST_INT)\n", __func__);
+                return PLIST_ERR_PARSE;
+            }
+            plist_get_uint_val(uid, &val);
+            plist_set_uid_val(node, val);
+        }
+    }
+    return PLIST_ERR_SUCCESS;
+}
+
+static plist_err_t tree_builder_begin_dict(void *user_data)
+{
+    return tree_builder_begin((struct plist_tree_builder*)user_data, plist_new_dict());
+}
+
+static plist_err_t tree_builder_end_dict(void *user_data)
+{
+    return tree_builder_end((struct plist_tree_builder*)user_data, PLIST_DICT);
+}
+
+static plist_err_t tree_builder_begin_array(void *user_data)
+{
+    return tree_builder_begin((struct plist_tree_builder*)user_data, plist_new_array());
+}
+
+static plist_err_t tree_builder_end_array(void *user_data)
+{
+    return tree_builder_end((struct plist_tree_builder*)user_data, PLIST_ARRAY);
+}
+
+static plist_err_t tree_builder_key(void *user_data, const char *key, uint64_t length)
+{
+    struct plist_tree_builder *tb = (struct plist_tree_builder*)user_data;
+    /* key nodes hold C strings */
+    size_t len = strnlen(key, length);
+    if (len >= tb->key_cap) {
+        size_t cap = (tb->key_cap) ? tb->key_cap : 64;
+        while (cap <= len) {
+            cap *= 2;
+        }
+        char *buf = (char*)realloc(tb->key, cap);
+        if (!buf) {
+            return PLIST_ERR_NO_MEM;
+        }
+        tb->key = buf;
+        tb->key_cap = cap;
+    }
+    memcpy(tb->key, key, len);
+    tb->key[len] = '\0';
+    tb->key_len = len;
+    tb->have_key = 1;
+    return PLIST_ERR_SUCCESS;
+}
+
+static plist_err_t tree_builder_value(void *user_data, plist_type type, const void *value, uint64_t length)
+{
+    struct plist_tree_builder *tb = (struct plist_tree_builder*)user_data;
+    plist_data_t data;
+
+    if (type == PLIST_STRING) {
+        data = plist_new_string_data((const char*)value, length);
+    } else {
+        data = plist_new_plist_data();
+    }
+    if (!data) {
+        PLIST_ERR("%s: failed to allocate plist data\n", __func__);
+        return PLIST_ERR_NO_MEM;
+    }
+    data->type = type;
+    switch (type) {
+    case PLIST_BOOLEAN:
+        data->boolval = *(const uint8_t*)value;
+        data->length = 1;
+        break;
+    case PLIST_INT:
+    case PLIST_UID:
+        data->intval = *(const uint64_t*)value;
+        data->length = (type == PLIST_INT && length == 16) ? 16 : sizeof(uint64_t);
+        break;
+    case PLIST_REAL:
+    case PLIST_DATE:
+        data->realval = *(const double*)value;
+        data->length = sizeof(double);
+        break;
+    case PLIST_STRING:
+    case PLIST_NULL:
+        break;
+    case PLIST_DATA:
+        if (length > 0) {
+            data->buff = (uint8_t*)malloc(length);
+            if (!data->buff) {
+                plist_free_data(data);
+                return PLIST_ERR_NO_MEM;
             }
-            ((plist_data_t)((node_t)node)->data)->hashtable = ht;
+            memcpy(data->buff, value, length);
+        }
+        data->length = length;
+        break;
+    default:
+        plist_free_data(data);
+        return PLIST_ERR_INVALID_ARG;
+    }
+    return tree_builder_attach(tb, plist_new_node(data));
+}
+
+/* long strings and data are kept without copying them */
+static plist_err_t tree_builder_value_owned(void *user_data, plist_type type, void *buf, uint64_t length)
+{
+    if ((type == PLIST_STRING && length >= PLIST_INLINE_STRING_MAX) || type == PLIST_DATA) {
+        plist_data_t data = plist_new_plist_data();
+        if (!data) {
+            free(buf);
+            return PLIST_ERR_NO_MEM;
         }
+        data->type = type;
+        if (type == PLIST_STRING) {
+            data->strval = (char*)buf;
+        } else {
+            data->buff = (uint8_t*)buf;
+        }
+        data->length = length;
+        return tree_builder_attach((struct plist_tree_builder*)user_data, plist_new_node(data));
+    }
+    plist_err_t err = tree_builder_value(user_data, type, buf, length);
+    free(buf);
+    return err;
+}
+
+const plist_event_handler_t plist_tree_builder_handler = {
+    tree_builder_begin_dict,
+    tree_builder_end_dict,
+    tree_builder_begin_array,
+    tree_builder_end_array,
+    tree_builder_key,
+    tree_builder_value,
+    tree_builder_value_owned
+};
+
+plist_err_t plist_event_value_owned(const plist_event_handler_t *handler, void *user_data, plist_type type, void *buf, uint64_t length)
+{
+    if (handler->value_owned) {
+        return handler->value_owned(user_data, type, buf, length);
     }
+    plist_err_t err = PLIST_EVENT(handler, value, user_data, type, buf, length);
+    free(buf);
+    return err;
 }
 
 void plist_dict_remove_item(plist_t node, const char* key)
@@ -1431,23 +2352,19 @@ void plist_dict_merge(plist_t *target, plist_t source)
 	if (!target || !*target || (plist_get_node_type(*target) != PLIST_DICT) || !source || (plist_get_node_type(source) != PLIST_DICT))
 		return;
 
-	char* key = NULL;
-	plist_dict_iter it = NULL;
-	plist_t subnode = NULL;
-	plist_dict_new_iter(source, &it);
-	if (!it)
-		return;
+	plist_node_expand(source);
 
-	do {
-		plist_dict_next_item(source, it, &key, &subnode);
-		if (!key)
+	/* use the source keys directly, so their hashes are reused */
+	node_t k = node_first_child((node_t)source);
+	while (k) {
+		node_t v = node_next_sibling(k);
+		if (!v)
 			break;
+		node_t next = node_next_sibling(v);
 
-		plist_dict_set_item(*target, key, plist_copy(subnode));
-		free(key);
-		key = NULL;
-	} while (1);
-	free(it);
+		_plist_dict_set_item(*target, (plist_data_t)k->data, plist_copy((plist_t)v), 0, NULL);
+		k = next;
+	}
 }
 
 uint8_t plist_dict_get_bool(plist_t dict, const char *key)
@@ -1991,6 +2908,9 @@ static plist_err_t plist_set_element_val(plist_t node, plist_type type, const vo
             PLIST_ERR("%s: strdup failed\n", __func__);
             return PLIST_ERR_NO_MEM;
         }
+        if (type == PLIST_KEY) {
+            plist_key_data_set_hash(data);
+        }
         break;
     case PLIST_DATA:
         data->buff = (uint8_t *) malloc(length);
@@ -2005,6 +2925,9 @@ static plist_err_t plist_set_element_val(plist_t node, plist_type type, const vo
     default:
         break;
     }
+    if (type == PLIST_KEY || type == PLIST_STRING || type == PLIST_DATA) {
+        plist_arena_track(node);
+    }
     return PLIST_ERR_SUCCESS;
 }
 
@@ -2015,7 +2938,16 @@ void plist_set_key_val(plist_t node, const char *val)
     if (item) {
         return;
     }
+    hashtable_t *ht = (PLIST_IS_DICT(father)) ? (hashtable_t*)((plist_data_t)((node_t)father)->data)->hashtable : NULL;
+    item = (ht) ? (plist_t)node_next_sibling((node_t)node) : NULL;
+    if (item) {
+        // the index is keyed by the key string, so take it out while it changes
+        hash_table_remove(ht, ((node_t)node)->data);
+    }
     plist_set_element_val(node, PLIST_KEY, val, strlen(val));
+    if (item) {
+        hash_table_insert(ht, ((node_t)node)->data, item);
+    }
 }
 
 void plist_set_string_val(plist_t node, const char *val)
@@ -2329,6 +3261,22 @@ void plist_set_debug(int debug)
     plist_ostep_set_debug(debug);
 }
 
+typedef struct {
+    node_t key;
+    node_t val;
+} plist_sort_pair_t;
+
+static int plist_sort_pair_compare(const void *a, const void *b)
+{
+    const plist_sort_pair_t *pa = (const plist_sort_pair_t*)a;
+    const plist_sort_pair_t *pb = (const plist_sort_pair_t*)b;
+    int res = strcmp(((plist_data_t)pa->key->data)->strval, ((plist_data_t)pb->key->data)->strval);
+    if (res == 0) {
+        res = (pa->key->index < pb->key->index) ? -1 : (pa->key->index > pb->key->index);
+    }
+    return res;
+}
+
 void plist_sort(plist_t plist)
 {
     if (!plist) {
@@ -2343,6 +3291,7 @@ void plist_sort(plist_t plist)
     } else if (PLIST_IS_DICT(plist)) {
         node_t node = (node_t)plist;
         node_t ch;
+        plist_node_expand(plist);
         if (!node_first_child(node)) {
             return;
         }
@@ -2350,64 +3299,91 @@ void plist_sort(plist_t plist)
             ch = node_next_sibling(ch);
             plist_sort((plist_t)ch);
         }
-        #define KEY_DATA(x) (x->data)
-        #define NEXT_KEY(x) (x->next->next)
-        #define KEY_STRVAL(x) ((plist_data_t)(KEY_DATA(x)))->strval
-        int swapped = 0;
-        do {
-            swapped = 0;
-            node_t lptr = NULL;
-            node_t cur_key = node_first_child((node_t)plist);
-
-            while (NEXT_KEY(cur_key) != lptr) {
-                node_t next_key = NEXT_KEY(cur_key);
-                if (strcmp(KEY_STRVAL(cur_key), KEY_STRVAL(next_key)) > 0) {
-                    node_t cur_val = cur_key->next;
-                    node_t next_val = next_key->next;
-                    // we need to swap 2 consecutive nodes with the 2 after them
-                    // a -> b -> [c] -> [d] -> [e] -> [f] -> g -> h
-                    //              cur           next
-                    // swapped:
-                    // a -> b -> [e] -> [f] -> [c] -> [d] -> g -> h
-                    //              next           cur
-                    node_t tmp_prev = cur_key->prev;
-                    node_t tmp_next = next_val->next;
-                    cur_key->prev = next_val;
-                    cur_val->next = tmp_next;
-                    next_val->next = cur_key;
-                    next_key->prev = tmp_prev;
-                    if (tmp_prev) {
-                        tmp_prev->next = next_key;
-                    } else {
-                        ((node_t)plist)->children->begin = next_key;
-                    }
-                    if (tmp_next) {
-                        tmp_next->prev = cur_val;
-                    } else {
-                        ((node_t)plist)->children->end = cur_val;
-                    }
-                    cur_key = next_key;
-                    swapped = 1;
+        // sort the key/value pairs in place; ties keep their original
+        // order (via the key's position) so the result matches a stable sort
+        node_list_t list = node->children;
+        unsigned int npairs = list->count / 2;
+        if (npairs < 2) {
+            return;
+        }
+        plist_sort_pair_t *pairs = (plist_sort_pair_t*)malloc(npairs * sizeof(plist_sort_pair_t));
+        if (!pairs) {
+            PLIST_ERR("%s: out of memory\n", __func__);
+            return;
+        }
+        unsigned int i;
+        for (i = 0; i < npairs; i++) {
+            pairs[i].key = list->items[i*2];
+            pairs[i].val = list->items[i*2+1];
+        }
+        qsort(pairs, npairs, sizeof(plist_sort_pair_t), plist_sort_pair_compare);
+        for (i = 0; i < npairs; i++) {
+            list->items[i*2] = pairs[i].key;
+            list->items[i*2]->index = i*2;
+            list->items[i*2+1] = pairs[i].val;
+            list->items[i*2+1]->index = i*2+1;
+        }
+        free(pairs);
+    }
+}
+
+/*
+ * The text writers check the nesting depth while they write instead of in
+ * a separate pass. path[] holds the containers above the node. Attaching
+ * a node that already has a parent fails, so a circular reference can only
+ * come from a corrupted tree; it makes the writer descend until it hits
+ * the depth limit, and only then the path is searched for a node that
+ * appears twice to tell the two errors apart.
+ *
+ * Like dict lookups, the writers only read the tree (apart from decoding
+ * lazily parsed containers), so several threads can write the same plist
+ * at once; test/concurrent_test.c checks that.
+ */
+plist_err_t plist_write_check_node(node_t node, node_t *path, uint32_t depth)
+{
+    if (depth > PLIST_MAX_NESTING_DEPTH) {
+        uint32_t i, j;
+        for (i = 0; i < PLIST_WRITE_PATH_SIZE; i++) {
+            if (path[i] == node) {
+                return PLIST_ERR_CIRCULAR_REF;
+            }
+            for (j = i + 1; j < PLIST_WRITE_PATH_SIZE; j++) {
+                if (path[i] == path[j]) {
+                    return PLIST_ERR_CIRCULAR_REF;
                 }
-                cur_key = NEXT_KEY(cur_key);
             }
-            lptr = cur_key;
-        } while (swapped);
+        }
+        return PLIST_ERR_MAX_NESTING;
+    }
+    path[depth] = node;
+    if (plist_node_expand(node) != PLIST_ERR_SUCCESS) {
+        return PLIST_ERR_PARSE;
     }
+    return PLIST_ERR_SUCCESS;
 }
 
 plist_err_t plist_write_to_string(plist_t plist, char **output, uint32_t* length, plist_format_t format, plist_write_options_t options)
+{
+    uint64_t length64 = 0;
+    if (!length) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+    plist_err_t err = plist_write_to_string64(plist, output, &length64, format, options);
+    return plist_output_length32(err, output, length64, length);
+}
+
+plist_err_t plist_write_to_string64(plist_t plist, char **output, uint64_t* length, plist_format_t format, plist_write_options_t options)
 {
     plist_err_t err = PLIST_ERR_UNKNOWN;
     switch (format) {
         case PLIST_FORMAT_XML:
-            err = plist_to_xml(plist, output, length);
+            err = plist_to_xml64(plist, output, length);
             break;
         case PLIST_FORMAT_JSON:
-            err = plist_to_json_with_options(plist, output, length, options);
+            err = plist_to_json64(plist, output, length, options);
             break;
         case PLIST_FORMAT_OSTEP:
-            err = plist_to_openstep_with_options(plist, output, length, options);
+            err = plist_to_openstep64(plist, output, length, options);
             break;
         case PLIST_FORMAT_PRINT:
             err = plist_write_to_string_default(plist, output, length, options);
@@ -2433,19 +3409,19 @@ plist_err_t plist_write_to_stream(plist_t plist, FILE *stream, plist_format_t fo
     }
     plist_err_t err = PLIST_ERR_UNKNOWN;
     char *output = NULL;
-    uint32_t length = 0;
+    uint64_t length = 0;
     switch (format) {
         case PLIST_FORMAT_BINARY:
-            err = plist_to_bin(plist, &output, &length);
+            err = plist_to_bin_stream(plist, stream, options);
             break;
         case PLIST_FORMAT_XML:
-            err = plist_to_xml(plist, &output, &length);
+            err = plist_to_xml64(plist, &output, &length);
             break;
         case PLIST_FORMAT_JSON:
-            err = plist_to_json_with_options(plist, &output, &length, options);
+            err = plist_to_json64(plist, &output, &length, options);
             break;
         case PLIST_FORMAT_OSTEP:
-            err = plist_to_openstep_with_options(plist, &output, &length, options);
+            err = plist_to_openstep64(plist, &output, &length, options);
             break;
         case PLIST_FORMAT_PRINT:
             err = plist_write_to_stream_default(plist, stream, options);
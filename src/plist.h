@@ -50,6 +50,10 @@
 #endif
 
 #include "node.h"
+#include "arena.h"
+#include "ptrarray.h"
+#include "hashtable.h"
+#include "bytearray.h"
 
 #ifndef PLIST_MAX_NESTING_DEPTH
 #ifdef NODE_MAX_DEPTH
@@ -61,6 +65,9 @@
 
 #include "plist/plist.h"
 
+/* number of child nodes (keys + values) after which a dict gets a hash index */
+#define PLIST_DICT_HASH_THRESHOLD 32
+
 struct plist_data_s
 {
     union
@@ -73,24 +80,204 @@ struct plist_data_s
         void *hashtable;
     };
     uint64_t length;
-    plist_type type;
+    /* hash of strval, valid with PLIST_DATA_FLAG_HASHED */
+    uint32_t hash;
+    uint16_t flags;
+    /* a plist_type, narrowed so the struct stays at 24 bytes */
+    int8_t type;
 };
 
 typedef struct plist_data_s *plist_data_t;
 
+/* node, data and child list are allocated from an arena */
+#define PLIST_DATA_FLAG_ARENA       (1 << 0)
+/* root of an arena tree, data is a struct plist_root_data_s */
+#define PLIST_DATA_FLAG_ARENA_ROOT  (1 << 1)
+/* strval/buff is not owned by the node and must not be freed */
+#define PLIST_DATA_FLAG_BORROWED    (1 << 2)
+/* arena node that references heap memory that needs to be released */
+#define PLIST_DATA_FLAG_ARENA_TRACKED (1 << 3)
+/* container whose children are not decoded yet, hashtable holds the decoder state */
+#define PLIST_DATA_FLAG_LAZY        (1 << 4)
+/* root of a tree that owns the buffer its borrowed values point into,
+ * data is a struct plist_root_data_s */
+#define PLIST_DATA_FLAG_BACKED_ROOT (1 << 5)
+/* data shares one allocation with its node, see plist_new_plist_data() */
+#define PLIST_DATA_FLAG_EMBEDDED    (1 << 6)
+/* strval is stored inline, right behind the embedded data */
+#define PLIST_DATA_FLAG_INLINE      (1 << 7)
+
+/* strval is a shared key string, see plist_new_interned_key_data() */
+#define PLIST_DATA_FLAG_INTERNED    (1 << 8)
+/* hash holds plist_str_hash() of strval; cleared whenever strval changes */
+#define PLIST_DATA_FLAG_HASHED      (1 << 9)
+
+/* strings shorter than this are stored in the node's own allocation */
+#define PLIST_INLINE_STRING_MAX 32
+
+struct plist_root_data_s
+{
+    struct plist_data_s data;
+    arena_t *arena;
+    ptrarray_t *tracked;
+    void *backing;
+    size_t backing_size;
+    int backing_mapped;
+};
+
 plist_t plist_new_node(plist_data_t data);
 plist_data_t plist_get_data(plist_t node);
 plist_data_t plist_new_plist_data(void);
+plist_data_t plist_new_string_data(const char *str, size_t len);
+
+unsigned int plist_str_hash(const char *str, size_t len);
+
+/* Keys get the hash of their name when they are created or renamed, so
+ * that dict lookups and the writers only ever read it. */
+static inline void plist_key_data_set_hash(plist_data_t data)
+{
+    data->hash = plist_str_hash(data->strval, data->length);
+    data->flags |= PLIST_DATA_FLAG_HASHED;
+}
+
+hashtable_t* plist_key_table_new(void);
+void plist_key_table_free(hashtable_t *keys);
+plist_data_t plist_new_interned_key_data(hashtable_t *keys, const char *str, size_t len);
+plist_data_t plist_new_shared_key_data(const char *interned);
 void plist_free_data(plist_data_t data);
 int plist_data_compare(const void *a, const void *b);
+/* gives a dict that a parser filled with node_attach() its hash index,
+ * once all entries are attached */
+void plist_dict_index_parsed(plist_t node);
+
+plist_t plist_new_node_arena(arena_t *arena, plist_data_t data);
+plist_data_t plist_new_plist_data_arena(arena_t *arena);
+plist_t plist_set_arena_root(plist_t root, arena_t *arena);
+plist_t plist_set_backing(plist_t root, void *buf, size_t size, int mapped);
+
+/* like plist_array_append_item()/plist_dict_set_item(), for parsers adding
+ * freshly parsed items; they skip the cycle and depth checks of
+ * node_attach() since the parsers enforce PLIST_MAX_NESTING_DEPTH.
+ * If keys is not NULL, the new dict key is interned in that table. */
+void plist_array_append_parsed(plist_t node, plist_t item);
+void plist_dict_set_parsed(plist_t node, const char* key, plist_t item, hashtable_t *keys);
+
+/* event handler that builds a tree, see plist_parse_events(). The text
+ * parsers are drivers for it; the binary parser builds its trees directly. */
+struct plist_tree_builder {
+    plist_t root;
+    plist_t parent;
+    /* name for the next entry of parent, copied since the pointer passed
+     * to the key callback does not stay valid */
+    char *key;
+    size_t key_len;
+    size_t key_cap;
+    int have_key;
+    hashtable_t *keys;
+    /* replace { "CF$UID" = <integer> } dictionaries with PLIST_UID nodes */
+    int uid_dicts;
+};
+
+extern const plist_event_handler_t plist_tree_builder_handler;
+void plist_tree_builder_init(struct plist_tree_builder *tb, hashtable_t *keys, int uid_dicts);
+/* returns err, or the tree in plist if err is PLIST_ERR_SUCCESS (NULL if
+ * there were no events); the builder is reset either way */
+plist_err_t plist_tree_builder_finish(struct plist_tree_builder *tb, plist_err_t err, plist_t *plist);
+
+/* passes a value in a malloc()ed buffer to handler->value_owned(), or to
+ * handler->value() if there is none and frees buf then; strings must be
+ * NUL-terminated */
+plist_err_t plist_event_value_owned(const plist_event_handler_t *handler, void *user_data, plist_type type, void *buf, uint64_t length);
 
-extern plist_err_t plist_write_to_string_default(plist_t plist, char **output, uint32_t* length, plist_write_options_t options);
-extern plist_err_t plist_write_to_string_limd(plist_t plist, char **output, uint32_t* length, plist_write_options_t options);
-extern plist_err_t plist_write_to_string_plutil(plist_t plist, char **output, uint32_t* length, plist_write_options_t options);
+extern plist_err_t plist_xml_parse_events(const char *plist_xml, uint64_t length, const plist_event_handler_t *handler, void *user_data);
+extern plist_err_t plist_json_parse_events(const char *json, uint64_t length, const plist_event_handler_t *handler, void *user_data);
+extern plist_err_t plist_openstep_parse_events(const char *plist_ostep, uint64_t length, const plist_event_handler_t *handler, void *user_data);
+extern plist_err_t plist_bin_parse_events(const char *plist_bin, uint64_t length, const plist_event_handler_t *handler, void *user_data);
+
+/* call an optional callback of an event handler */
+#define PLIST_EVENT(handler, cb, ...) (((handler)->cb) ? (handler)->cb(__VA_ARGS__) : PLIST_ERR_SUCCESS)
+
+extern plist_err_t plist_from_bin_with_options(const char *plist_bin, uint64_t length, plist_t *plist, plist_parse_options_t options);
+extern plist_err_t plist_from_xml_with_options(const char *plist_xml, uint64_t length, plist_t *plist, plist_parse_options_t options);
+extern plist_err_t plist_from_json_with_options(const char *json, uint64_t length, plist_t *plist, plist_parse_options_t options);
+extern plist_err_t plist_from_openstep_with_options(const char *plist_ostep, uint64_t length, plist_t *plist, plist_parse_options_t options);
+extern plist_err_t plist_bin_lazy_expand(plist_t node);
+extern void plist_bin_lazy_free(void *lazy_state);
+
+/* decode the children of a lazily parsed container if not done yet */
+static inline plist_err_t plist_node_expand(plist_t node)
+{
+    plist_data_t data = (plist_data_t)((node_t)node)->data;
+    if (data && (data->flags & PLIST_DATA_FLAG_LAZY)) {
+        return plist_bin_lazy_expand(node);
+    }
+    return PLIST_ERR_SUCCESS;
+}
+
+extern plist_err_t plist_write_to_string_default(plist_t plist, char **output, uint64_t* length, plist_write_options_t options);
+extern plist_err_t plist_write_to_string_limd(plist_t plist, char **output, uint64_t* length, plist_write_options_t options);
+extern plist_err_t plist_write_to_string_plutil(plist_t plist, char **output, uint64_t* length, plist_write_options_t options);
+extern plist_err_t plist_to_bin_stream(plist_t plist, FILE *stream, plist_write_options_t options);
+extern plist_err_t plist_to_bin_callback(plist_t plist, plist_write_func_t write_func, void *user_data, plist_write_options_t options);
 extern plist_err_t plist_write_to_stream_default(plist_t plist, FILE *stream, plist_write_options_t options);
 extern plist_err_t plist_write_to_stream_limd(plist_t plist, FILE *stream, plist_write_options_t options);
 extern plist_err_t plist_write_to_stream_plutil(plist_t plist, FILE *stream, plist_write_options_t options);
 
+/* hand out the result of a 64-bit writer through the legacy 32-bit API */
+static inline plist_err_t plist_output_length32(plist_err_t err, char **output, uint64_t length64, uint32_t *length)
+{
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
+    }
+    if (length64 > UINT32_MAX) {
+        free(*output);
+        *output = NULL;
+        *length = 0;
+        return PLIST_ERR_NO_MEM;
+    }
+    *length = (uint32_t)length64;
+    return PLIST_ERR_SUCCESS;
+}
+
+/* the value of a node that is not a container, as it is passed to
+ * plist_event_handler_t.value() */
+static inline const void* plist_data_value(plist_data_t data)
+{
+    switch (data->type) {
+    case PLIST_BOOLEAN:
+        return &data->boolval;
+    case PLIST_REAL:
+    case PLIST_DATE:
+        return &data->realval;
+    case PLIST_STRING:
+    case PLIST_KEY:
+        return data->strval;
+    case PLIST_DATA:
+        return data->buff;
+    case PLIST_NULL:
+        return NULL;
+    default:
+        return &data->intval;
+    }
+}
+
+/* write the text formats while the input is parsed, see plist_convert() */
+extern plist_err_t plist_convert_to_xml(const char *input, uint64_t length, plist_format_t format, bytearray_t *outbuf);
+extern plist_err_t plist_convert_to_json(const char *input, uint64_t length, plist_format_t format, bytearray_t *outbuf, plist_write_options_t options);
+extern plist_err_t plist_convert_to_openstep(const char *input, uint64_t length, plist_format_t format, bytearray_t *outbuf, plist_write_options_t options);
+
+/* result of an event writer callback, PLIST_ERR_IO once writing failed */
+static inline plist_err_t plist_write_status(bytearray_t *outbuf)
+{
+    return (outbuf->error) ? PLIST_ERR_IO : PLIST_ERR_SUCCESS;
+}
+
+/* number of entries the text writers need in their path array */
+#define PLIST_WRITE_PATH_SIZE (PLIST_MAX_NESTING_DEPTH + 1)
+
+/* called by the text writers for each node before writing it, see plist.c */
+plist_err_t plist_write_check_node(node_t node, node_t *path, uint32_t depth);
+
 static inline unsigned int plist_node_ptr_hash(const void *ptr)
 {
     uintptr_t h = (uintptr_t)ptr;
@@ -0,0 +1,116 @@
+/*
+ * thread.c
+ * minimal portable thread helpers
+ *
+ * Copyright (c) 2026 Nikias Bassen, All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <stdlib.h>
+#include "thread.h"
+
+#ifdef WIN32
+struct thread_start {
+	thread_func_t func;
+	void* data;
+};
+
+static DWORD WINAPI thread_entry(LPVOID arg)
+{
+	struct thread_start start = *(struct thread_start*)arg;
+	free(arg);
+	start.func(start.data);
+	return 0;
+}
+#endif
+
+int thread_new(THREAD_T* thread, thread_func_t thread_func, void* data)
+{
+#if defined(WIN32)
+	struct thread_start* start = (struct thread_start*)malloc(sizeof(struct thread_start));
+	if (!start) {
+		return -1;
+	}
+	start->func = thread_func;
+	start->data = data;
+	HANDLE th = CreateThread(NULL, 0, thread_entry, start, 0, NULL);
+	if (th == NULL) {
+		free(start);
+		return -1;
+	}
+	*thread = th;
+	return 0;
+#elif defined(HAVE_PTHREAD)
+	return (pthread_create(thread, NULL, thread_func, data) == 0) ? 0 : -1;
+#else
+	(void)thread;
+	(void)thread_func;
+	(void)data;
+	return -1;
+#endif
+}
+
+void thread_join(THREAD_T thread)
+{
+#if defined(WIN32)
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+#elif defined(HAVE_PTHREAD)
+	pthread_join(thread, NULL);
+#else
+	(void)thread;
+#endif
+}
+
+void thread_once(thread_once_t *once_control, void (*init_routine)(void))
+{
+#if defined(WIN32)
+	while (InterlockedExchange(&(once_control->lock), 1) != 0) {
+		Sleep(1);
+	}
+	if (!once_control->state) {
+		once_control->state = 1;
+		init_routine();
+	}
+	InterlockedExchange(&(once_control->lock), 0);
+#elif defined(HAVE_PTHREAD)
+	pthread_once(once_control, init_routine);
+#else
+	if (!*once_control) {
+		*once_control = 1;
+		init_routine();
+	}
+#endif
+}
+
+unsigned int thread_cpu_count(void)
+{
+#if defined(WIN32)
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return (si.dwNumberOfProcessors > 0) ? (unsigned int)si.dwNumberOfProcessors : 1;
+#elif defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0) ? (unsigned int)n : 1;
+#else
+	return 1;
+#endif
+}
@@ -0,0 +1,65 @@
+/*
+ * thread.h
+ * header file for minimal portable thread helpers
+ *
+ * Copyright (c) 2026 Nikias Bassen, All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef THREAD_H
+#define THREAD_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if defined(WIN32)
+#include <windows.h>
+typedef HANDLE THREAD_T;
+typedef volatile struct {
+	LONG lock;
+	int state;
+} thread_once_t;
+#define THREAD_ONCE_INIT {0, 0}
+#elif defined(HAVE_PTHREAD)
+#include <pthread.h>
+typedef pthread_t THREAD_T;
+typedef pthread_once_t thread_once_t;
+#define THREAD_ONCE_INIT PTHREAD_ONCE_INIT
+#else
+typedef int THREAD_T;
+typedef int thread_once_t;
+#define THREAD_ONCE_INIT 0
+#endif
+
+typedef void* (*thread_func_t)(void* data);
+
+/* Runs thread_func(data) in a new thread. Returns 0 on success, or -1 if
+ * no thread could be started (or threads are not supported at all), in
+ * which case the caller is expected to do the work itself. */
+int thread_new(THREAD_T* thread, thread_func_t thread_func, void* data);
+
+/* Waits for a thread started with thread_new() and releases it. */
+void thread_join(THREAD_T thread);
+
+/* Returns the number of online processors, at least 1. */
+unsigned int thread_cpu_count(void);
+
+/* Calls init_routine() exactly once for once_control, which must be
+ * initialized with THREAD_ONCE_INIT. Concurrent callers wait until it has
+ * returned. */
+void thread_once(thread_once_t *once_control, void (*init_routine)(void));
+
+#endif
@@ -0,0 +1,490 @@
+/*
+ * unicode.c
+ * ASCII classification and UTF-8/UTF-16BE transcoding for the binary
+ * plist codec
+ *
+ * Copyright (c) 2026 Nikias Bassen, All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <string.h>
+#include <stdint.h>
+#include "unicode.h"
+#include "thread.h"
+
+/*
+ * The transcoding kernels work on blocks of 16 bytes of UTF-8 or 8 code
+ * units of UTF-16 in which all characters have the same encoded length:
+ * runs of ASCII, of 2-byte sequences (Latin, Greek, Cyrillic, ...) or of
+ * 3-byte sequences (CJK and most other BMP scripts). Everything else,
+ * including 4-byte sequences, surrogates and invalid input, is handled by
+ * the scalar code one step at a time, after which the kernels are tried
+ * again. The kernels are compiled with a target attribute and only
+ * selected at runtime when the CPU supports them, like in base64.c.
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define UNICODE_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* the kernels return the number of input bytes (is_ascii, to_utf16) or
+ * code units (to_utf8, utf8_length) they processed */
+typedef size_t (*is_ascii_func_t)(const unsigned char *s, size_t len);
+typedef size_t (*to_utf16_func_t)(const unsigned char *in, size_t len, unsigned char *out, size_t *units);
+typedef size_t (*to_utf8_func_t)(const unsigned char *in, size_t units, char *out, size_t *written);
+typedef size_t (*utf8_length_func_t)(const unsigned char *in, size_t units, size_t *length);
+
+#ifdef UNICODE_SIMD
+#define ctz32(x) ((unsigned int)__builtin_ctz(x))
+#define popcount32(x) ((unsigned int)__builtin_popcount(x))
+
+__attribute__((target("sse2")))
+static size_t is_ascii_sse2(const unsigned char *s, size_t len)
+{
+	size_t n = 0;
+	while (len - n >= 64) {
+		__m128i x = _mm_or_si128(_mm_or_si128(_mm_loadu_si128((const __m128i*)(s + n)), _mm_loadu_si128((const __m128i*)(s + n + 16))),
+		                         _mm_or_si128(_mm_loadu_si128((const __m128i*)(s + n + 32)), _mm_loadu_si128((const __m128i*)(s + n + 48))));
+		if (_mm_movemask_epi8(x)) {
+			break;
+		}
+		n += 64;
+	}
+	while (len - n >= 16) {
+		if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(s + n)))) {
+			break;
+		}
+		n += 16;
+	}
+	return n;
+}
+
+__attribute__((target("avx2")))
+static size_t is_ascii_avx2(const unsigned char *s, size_t len)
+{
+	size_t n = 0;
+	while (len - n >= 128) {
+		__m256i x = _mm256_or_si256(_mm256_or_si256(_mm256_loadu_si256((const __m256i*)(s + n)), _mm256_loadu_si256((const __m256i*)(s + n + 32))),
+		                            _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(s + n + 64)), _mm256_loadu_si256((const __m256i*)(s + n + 96))));
+		if (_mm256_movemask_epi8(x)) {
+			break;
+		}
+		n += 128;
+	}
+	while (len - n >= 32) {
+		if (_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)(s + n)))) {
+			break;
+		}
+		n += 32;
+	}
+	/* the compiler does not always do this before the SSE code below */
+	_mm256_zeroupper();
+	return n + is_ascii_sse2(s + n, len - n);
+}
+
+__attribute__((target("ssse3")))
+static size_t to_utf16_ssse3(const unsigned char *in, size_t len, unsigned char *out, size_t *units)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i mask2 = _mm_set1_epi16((short)0xC0E0);
+	const __m128i pat2 = _mm_set1_epi16((short)0x80C0);
+	const __m128i mask3 = _mm_setr_epi8(0xF0, 0xC0, 0xC0, 0xF0, 0xC0, 0xC0, 0xF0, 0xC0, 0xC0, 0xF0, 0xC0, 0xC0, 0xF0, 0xC0, 0xC0, 0);
+	const __m128i pat3 = _mm_setr_epi8(0xE0, 0x80, 0x80, 0xE0, 0x80, 0x80, 0xE0, 0x80, 0x80, 0xE0, 0x80, 0x80, 0xE0, 0x80, 0x80, 0);
+	const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	const __m128i low6 = _mm_set1_epi16(0x3F);
+	size_t n = 0;
+	size_t p = 0;
+	/* at most one code unit is written per input byte, so out always
+	 * has room for the 32 bytes stored below while 16 bytes are left */
+	while (len - n >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(in + n));
+		uint32_t m = (uint32_t)_mm_movemask_epi8(v);
+		if ((m & 1) == 0) {
+			/* ASCII, up to the first byte with the high bit set */
+			unsigned int cnt = (m) ? ctz32(m) : 16;
+			_mm_storeu_si128((__m128i*)(out + 2*p), _mm_unpacklo_epi8(zero, v));
+			_mm_storeu_si128((__m128i*)(out + 2*p + 16), _mm_unpackhi_epi8(zero, v));
+			n += cnt;
+			p += cnt;
+			continue;
+		}
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(v, mask2), pat2)) == 0xFFFF) {
+			/* 8 sequences of 2 bytes; C0 and C1 leads are overlong */
+			__m128i w = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0x1F)), 6),
+			                         _mm_and_si128(_mm_srli_epi16(v, 8), low6));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(w, _mm_set1_epi16(0x780)), zero))) {
+				break;
+			}
+			_mm_storeu_si128((__m128i*)(out + 2*p), _mm_shuffle_epi8(w, swap));
+			n += 16;
+			p += 8;
+			continue;
+		}
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(v, mask3), pat3)) == 0xFFFF) {
+			/* 5 sequences of 3 bytes, checked for overlong forms and surrogates */
+			__m128i x = _mm_shuffle_epi8(v, _mm_setr_epi8(1, 0, 4, 3, 7, 6, 10, 9, 13, 12, -1, -1, -1, -1, -1, -1));
+			__m128i y = _mm_shuffle_epi8(v, _mm_setr_epi8(2, -1, 5, -1, 8, -1, 11, -1, 14, -1, -1, -1, -1, -1, -1, -1));
+			__m128i w = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(_mm_and_si128(x, _mm_set1_epi16(0x0F00)), 4),
+			                                      _mm_slli_epi16(_mm_and_si128(x, low6), 6)),
+			                         _mm_and_si128(y, low6));
+			__m128i hi = _mm_and_si128(w, _mm_set1_epi16((short)0xF800));
+			__m128i bad = _mm_or_si128(_mm_cmpeq_epi16(hi, zero), _mm_cmpeq_epi16(hi, _mm_set1_epi16((short)0xD800)));
+			if (_mm_movemask_epi8(bad) & 0x3FF) {
+				break;
+			}
+			_mm_storeu_si128((__m128i*)(out + 2*p), _mm_shuffle_epi8(w, swap));
+			n += 15;
+			p += 5;
+			continue;
+		}
+		break;
+	}
+	*units = p;
+	return n;
+}
+
+__attribute__((target("ssse3")))
+static size_t to_utf8_ssse3(const unsigned char *in, size_t units, char *out, size_t *written)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i low6 = _mm_set1_epi16(0x3F);
+	const __m128i cont = _mm_set1_epi16(0x80);
+	size_t n = 0;
+	size_t p = 0;
+	/* only the bytes that belong to the output are stored, out is sized exactly */
+	while (units - n >= 8) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(in + 2*n));
+		__m128i w = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		__m128i hi = _mm_and_si128(w, _mm_set1_epi16((short)0xF800));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(w, _mm_set1_epi16((short)0xFF80)), zero)) == 0xFFFF) {
+			_mm_storel_epi64((__m128i*)(out + p), _mm_packus_epi16(w, w));
+			n += 8;
+			p += 8;
+			continue;
+		}
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(hi, zero)) == 0xFFFF) {
+			/* 2 bytes each, unless ASCII is mixed in */
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(w, _mm_set1_epi16(0x780)), zero))) {
+				break;
+			}
+			__m128i b0 = _mm_or_si128(_mm_srli_epi16(w, 6), _mm_set1_epi16(0xC0));
+			__m128i b1 = _mm_or_si128(_mm_and_si128(w, low6), cont);
+			_mm_storeu_si128((__m128i*)(out + p), _mm_or_si128(b0, _mm_slli_epi16(b1, 8)));
+			n += 8;
+			p += 16;
+			continue;
+		}
+		if (_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi16(hi, zero), _mm_cmpeq_epi16(hi, _mm_set1_epi16((short)0xD800)))) == 0) {
+			/* 3 bytes each: a holds the lead bytes followed by the
+			 * middle bytes, b the last bytes; interleave them */
+			__m128i b0 = _mm_or_si128(_mm_srli_epi16(w, 12), _mm_set1_epi16(0xE0));
+			__m128i b1 = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(w, 6), low6), cont);
+			__m128i b2 = _mm_or_si128(_mm_and_si128(w, low6), cont);
+			__m128i a = _mm_packus_epi16(b0, b1);
+			__m128i b = _mm_packus_epi16(b2, b2);
+			__m128i o0 = _mm_or_si128(_mm_shuffle_epi8(a, _mm_setr_epi8(0, 8, -1, 1, 9, -1, 2, 10, -1, 3, 11, -1, 4, 12, -1, 5)),
+			                          _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1)));
+			__m128i o1 = _mm_or_si128(_mm_shuffle_epi8(a, _mm_setr_epi8(13, -1, 6, 14, -1, 7, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+			                          _mm_shuffle_epi8(b, _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1)));
+			_mm_storeu_si128((__m128i*)(out + p), o0);
+			_mm_storel_epi64((__m128i*)(out + p + 16), o1);
+			n += 8;
+			p += 24;
+			continue;
+		}
+		break;
+	}
+	*written = p;
+	return n;
+}
+
+__attribute__((target("sse2")))
+static size_t utf8_length_sse2(const unsigned char *in, size_t units, size_t *length)
+{
+	const __m128i zero = _mm_setzero_si128();
+	size_t n = 0;
+	size_t len = 0;
+	/* surrogates need the scalar state machine */
+	while (units - n >= 8) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(in + 2*n));
+		__m128i w = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		__m128i hi = _mm_and_si128(w, _mm_set1_epi16((short)0xF800));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(hi, _mm_set1_epi16((short)0xD800)))) {
+			break;
+		}
+		uint32_t one = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(w, _mm_set1_epi16((short)0xFF80)), zero));
+		uint32_t two = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi16(hi, zero));
+		len += 24 - popcount32(one) / 2 - popcount32(two) / 2;
+		n += 8;
+	}
+	*length = len;
+	return n;
+}
+#endif
+
+static size_t is_ascii_none(const unsigned char *s, size_t len)
+{
+	return 0;
+}
+
+static size_t to_utf16_none(const unsigned char *in, size_t len, unsigned char *out, size_t *units)
+{
+	*units = 0;
+	return 0;
+}
+
+static size_t to_utf8_none(const unsigned char *in, size_t units, char *out, size_t *written)
+{
+	*written = 0;
+	return 0;
+}
+
+static size_t utf8_length_none(const unsigned char *in, size_t units, size_t *length)
+{
+	*length = 0;
+	return 0;
+}
+
+static is_ascii_func_t is_ascii_impl = NULL;
+static to_utf16_func_t to_utf16_impl = NULL;
+static to_utf8_func_t to_utf8_impl = NULL;
+static utf8_length_func_t utf8_length_impl = NULL;
+static thread_once_t unicode_once = THREAD_ONCE_INIT;
+
+/* Picks the kernels for the running CPU, called once through thread_once() */
+static void unicode_select(void)
+{
+	is_ascii_func_t ia = is_ascii_none;
+	to_utf16_func_t t16 = to_utf16_none;
+	to_utf8_func_t t8 = to_utf8_none;
+	utf8_length_func_t u8l = utf8_length_none;
+#ifdef UNICODE_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2")) {
+		ia = is_ascii_sse2;
+		u8l = utf8_length_sse2;
+	}
+	if (__builtin_cpu_supports("ssse3")) {
+		t16 = to_utf16_ssse3;
+		t8 = to_utf8_ssse3;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		ia = is_ascii_avx2;
+	}
+#endif
+	is_ascii_impl = ia;
+	to_utf16_impl = t16;
+	to_utf8_impl = t8;
+	utf8_length_impl = u8l;
+}
+
+int utf8_is_ascii(const char *s, size_t len)
+{
+	const unsigned char *u = (const unsigned char*)s;
+	size_t n = 0;
+	if (len >= 16) {
+		thread_once(&unicode_once, unicode_select);
+		n = is_ascii_impl(u, len);
+	}
+	while (len - n >= 8) {
+		uint64_t x;
+		memcpy(&x, u + n, sizeof(x));
+		if (x & 0x8080808080808080ULL) {
+			return 0;
+		}
+		n += 8;
+	}
+	for (; n < len; n++) {
+		if (u[n] & 0x80) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static inline void put_unit(unsigned char *out, size_t p, uint32_t w)
+{
+	out[2*p] = (unsigned char)(w >> 8);
+	out[2*p+1] = (unsigned char)w;
+}
+
+size_t utf8_to_utf16be(const char *in, size_t len, unsigned char *out, size_t *items_read)
+{
+	const unsigned char *u = (const unsigned char*)in;
+	size_t i = 0;
+	size_t p = 0;
+
+	while (i < len) {
+		if (len - i >= 16) {
+			size_t units = 0;
+			thread_once(&unicode_once, unicode_select);
+			i += to_utf16_impl(u + i, len - i, out + 2*p, &units);
+			p += units;
+			if (i >= len) {
+				break;
+			}
+		}
+		unsigned char c0 = u[i];
+		unsigned char c1 = (i+1 < len) ? u[i+1] : 0;
+		unsigned char c2 = (i+2 < len) ? u[i+2] : 0;
+		unsigned char c3 = (i+3 < len) ? u[i+3] : 0;
+		if ((c0 >= 0xF0 && c0 <= 0xF4) && (i+3 < len) && ((c1 & 0xC0) == 0x80) && ((c2 & 0xC0) == 0x80) && ((c3 & 0xC0) == 0x80)) {
+			// 4 byte sequence.  Need to generate UTF-16 surrogate pair
+			/* lead-specific second-byte constraints */
+			if ((c0 == 0xF0 && c1 < 0x90) ||     /* overlong (< U+10000) */
+			    (c0 == 0xF4 && c1 > 0x8F))       /* > U+10FFFF */
+			{
+				break;
+			}
+			uint32_t w = ((uint32_t)(c3 & 0x3F)) | ((uint32_t)(c2 & 0x3F) << 6) | ((uint32_t)(c1 & 0x3F) << 12) | ((uint32_t)(c0 & 0x07) << 18);
+			w -= 0x10000;
+			put_unit(out, p++, 0xD800 + (w >> 10));
+			put_unit(out, p++, 0xDC00 + (w & 0x3FF));
+			i += 4;
+		} else if (((c0 & 0xF0) == 0xE0) && (i+2 < len) && ((c1 & 0xC0) == 0x80) && ((c2 & 0xC0) == 0x80)) {
+			// 3 byte sequence
+			if ((c0 == 0xE0 && c1 < 0xA0) ||     /* overlong (< U+0800) */
+			    (c0 == 0xED && c1 > 0x9F))       /* UTF-16 surrogate range */
+			{
+				break;
+			}
+			put_unit(out, p++, ((uint32_t)(c2 & 0x3F)) | ((uint32_t)(c1 & 0x3F) << 6) | ((uint32_t)(c0 & 0x0F) << 12));
+			i += 3;
+		} else if ((c0 >= 0xC2 && c0 <= 0xDF) && (i+1 < len) && ((c1 & 0xC0) == 0x80)) {
+			// 2 byte sequence
+			put_unit(out, p++, ((uint32_t)(c1 & 0x3F)) | ((uint32_t)(c0 & 0x1F) << 6));
+			i += 2;
+		} else if (c0 < 0x80) {
+			// 1 byte sequence
+			put_unit(out, p++, c0);
+			i += 1;
+		} else {
+			// invalid character
+			break;
+		}
+	}
+	if (items_read) {
+		*items_read = i;
+	}
+	return p;
+}
+
+/* state of the UTF-16 decoder between code units */
+struct utf16_state {
+	int lead;
+	uint32_t w;
+};
+
+/* Converts units code units, or counts the output bytes if out is NULL.
+ * Unpaired surrogates are skipped; a lead surrogate followed by another
+ * lead surrogate is dropped together with it. */
+static size_t utf16be_to_utf8_scalar(struct utf16_state *st, const unsigned char *in, size_t units, char *out)
+{
+	size_t i;
+	size_t p = 0;
+	for (i = 0; i < units; i++) {
+		uint32_t wc = ((uint32_t)in[2*i] << 8) | in[2*i+1];
+		if (wc >= 0xD800 && wc <= 0xDBFF) {
+			if (!st->lead) {
+				st->lead = 1;
+				st->w = 0x010000 + ((wc & 0x3FF) << 10);
+			} else {
+				st->lead = 0;
+			}
+		} else if (wc >= 0xDC00 && wc <= 0xDFFF) {
+			if (st->lead) {
+				uint32_t w = st->w | (wc & 0x3FF);
+				st->lead = 0;
+				if (out) {
+					out[p] = (char)(0xF0 + ((w >> 18) & 0x7));
+					out[p+1] = (char)(0x80 + ((w >> 12) & 0x3F));
+					out[p+2] = (char)(0x80 + ((w >> 6) & 0x3F));
+					out[p+3] = (char)(0x80 + (w & 0x3F));
+				}
+				p += 4;
+			}
+		} else if (wc >= 0x800) {
+			if (out) {
+				out[p] = (char)(0xE0 + ((wc >> 12) & 0xF));
+				out[p+1] = (char)(0x80 + ((wc >> 6) & 0x3F));
+				out[p+2] = (char)(0x80 + (wc & 0x3F));
+			}
+			p += 3;
+		} else if (wc >= 0x80) {
+			if (out) {
+				out[p] = (char)(0xC0 + ((wc >> 6) & 0x1F));
+				out[p+1] = (char)(0x80 + (wc & 0x3F));
+			}
+			p += 2;
+		} else {
+			if (out) {
+				out[p] = (char)wc;
+			}
+			p += 1;
+		}
+	}
+	return p;
+}
+
+size_t utf16be_utf8_length(const unsigned char *in, size_t units)
+{
+	struct utf16_state st = { 0, 0 };
+	size_t i = 0;
+	size_t len = 0;
+
+	/* code units outside the surrogate range leave the state alone, so
+	 * the kernel can take over whole blocks of them at any point */
+	while (i < units) {
+		size_t n = units - i;
+		if (n >= 8) {
+			size_t l = 0;
+			thread_once(&unicode_once, unicode_select);
+			i += utf8_length_impl(in + 2*i, units - i, &l);
+			len += l;
+			n = units - i;
+		}
+		if (n > 8) {
+			n = 8;
+		}
+		len += utf16be_to_utf8_scalar(&st, in + 2*i, n, NULL);
+		i += n;
+	}
+	return len;
+}
+
+size_t utf16be_to_utf8(const unsigned char *in, size_t units, char *out)
+{
+	struct utf16_state st = { 0, 0 };
+	size_t i = 0;
+	size_t p = 0;
+
+	while (i < units) {
+		size_t n = units - i;
+		if (n >= 8) {
+			size_t written = 0;
+			thread_once(&unicode_once, unicode_select);
+			i += to_utf8_impl(in + 2*i, units - i, out + p, &written);
+			p += written;
+			n = units - i;
+		}
+		if (n > 8) {
+			n = 8;
+		}
+		p += utf16be_to_utf8_scalar(&st, in + 2*i, n, out + p);
+		i += n;
+	}
+	return p;
+}
@@ -0,0 +1,45 @@
+/*
+ * unicode.h
+ * header file for ASCII classification and UTF-8/UTF-16BE transcoding
+ *
+ * Copyright (c) 2026 Nikias Bassen, All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UNICODE_H
+#define UNICODE_H
+#include <stddef.h>
+
+/* Returns 1 if none of the len bytes at s has the high bit set. */
+int utf8_is_ascii(const char *s, size_t len);
+
+/* Converts len bytes of UTF-8 to big-endian UTF-16 code units, stored as
+ * bytes so out does not need to be aligned. out must have room for 2*len
+ * bytes. Conversion stops at the first invalid sequence; items_read, if
+ * not NULL, receives the number of bytes converted. Returns the number of
+ * code units written. */
+size_t utf8_to_utf16be(const char *in, size_t len, unsigned char *out, size_t *items_read);
+
+/* Returns the number of bytes utf16be_to_utf8() produces for the given
+ * units code units of big-endian UTF-16 at in. */
+size_t utf16be_utf8_length(const unsigned char *in, size_t units);
+
+/* Converts units big-endian UTF-16 code units to UTF-8. Unpaired
+ * surrogates are skipped. out must have room for utf16be_utf8_length()
+ * bytes; no terminating 0 is written. Returns the number of bytes
+ * written. */
+size_t utf16be_to_utf8(const unsigned char *in, size_t units, char *out);
+
+#endif
@@ -48,6 +48,7 @@
 #include "strbuf.h"
 #include "time64.h"
 #include "hashtable.h"
+#include "charscan.h"
 
 #define XPLIST_KEY	"key"
 #define XPLIST_KEY_LEN 3
@@ -135,11 +136,18 @@ static size_t dtostr(char *buf, size_t bufsize, double realval)
     return len;
 }
 
-static plist_err_t node_to_xml(node_t node, bytearray_t **outbuf, uint32_t depth)
+static void xml_write_indent(bytearray_t *outbuf, uint32_t depth)
 {
-    plist_data_t node_data = NULL;
+    uint32_t i;
+    for (i = 0; i < depth; i++) {
+        str_buf_append(outbuf, "\t", 1);
+    }
+}
 
-    char isStruct = FALSE;
+/* writes a value that is not a container at the given depth, passed like
+ * to plist_event_handler_t.value(); PLIST_KEY writes a <key> */
+static plist_err_t xml_write_value(bytearray_t *outbuf, uint32_t depth, plist_type type, const void *value, uint64_t length)
+{
     char tagOpen = FALSE;
 
     const char *tag = NULL;
@@ -149,18 +157,11 @@ static plist_err_t node_to_xml(node_t node, bytearray_t **outbuf, uint32_t depth
 
     uint32_t i = 0;
 
-    if (!node) {
-        PLIST_XML_WRITE_ERR("Encountered invalid empty node in property list\n");
-        return PLIST_ERR_INVALID_ARG;
-    }
-
-    node_data = plist_get_data(node);
-
-    switch (node_data->type)
+    switch (type)
     {
     case PLIST_BOOLEAN:
     {
-        if (node_data->boolval) {
+        if (*(const uint8_t*)value) {
             tag = XPLIST_TRUE;
             tag_len = XPLIST_TRUE_LEN;
         } else {
@@ -173,17 +174,17 @@ static plist_err_t node_to_xml(node_t node, bytearray_t **outbuf, uint32_t depth
     case PLIST_INT:
         tag = XPLIST_INT;
         tag_len = XPLIST_INT_LEN;
-        if (node_data->length == 16) {
-            val_len = snprintf(val, sizeof(val), "%" PRIu64, node_data->intval);
+        if (length == 16) {
+            val_len = snprintf(val, sizeof(val), "%" PRIu64, *(const uint64_t*)value);
         } else {
-            val_len = snprintf(val, sizeof(val), "%" PRIi64, node_data->intval);
+            val_len = snprintf(val, sizeof(val), "%" PRIi64, *(const int64_t*)value);
         }
         break;
 
     case PLIST_REAL:
         tag = XPLIST_REAL;
         tag_len = XPLIST_REAL_LEN;
-        val_len = dtostr(val, sizeof(val), node_data->realval);
+        val_len = dtostr(val, sizeof(val), *(const double*)value);
         break;
 
     case PLIST_STRING:
@@ -203,21 +204,11 @@ static plist_err_t node_to_xml(node_t node, bytearray_t **outbuf, uint32_t depth
         tag_len = XPLIST_DATA_LEN;
         /* contents processed directly below */
         break;
-    case PLIST_ARRAY:
-        tag = XPLIST_ARRAY;
-        tag_len = XPLIST_ARRAY_LEN;
-        isStruct = (node->children) ? TRUE : FALSE;
-        break;
-    case PLIST_DICT:
-        tag = XPLIST_DICT;
-        tag_len = XPLIST_DICT_LEN;
-        isStruct = (node->children) ? TRUE : FALSE;
-        break;
     case PLIST_DATE:
         tag = XPLIST_DATE;
         tag_len = XPLIST_DATE_LEN;
         {
-            Time64_T timev = (Time64_T)node_data->realval + MAC_EPOCH;
+            Time64_T timev = (Time64_T)*(const double*)value + MAC_EPOCH;
             struct TM _btime;
             struct TM *btime = gmtime64_r(&timev, &_btime);
             if (btime) {
@@ -233,10 +224,10 @@ static plist_err_t node_to_xml(node_t node, bytearray_t **outbuf, uint32_t depth
     case PLIST_UID:
         tag = XPLIST_DICT;
         tag_len = XPLIST_DICT_LEN;
-        if (node_data->length == 16) {
-            val_len = snprintf(val, sizeof(val), "%" PRIu64, node_data->intval);
+        if (length == 16) {
+            val_len = snprintf(val, sizeof(val), "%" PRIu64, *(const uint64_t*)value);
         } else {
-            val_len = snprintf(val, sizeof(val), "%" PRIi64, node_data->intval);
+            val_len = snprintf(val, sizeof(val), "%" PRIi64, *(const int64_t*)value);
         }
         break;
     case PLIST_NULL:
@@ -246,40 +237,37 @@ static plist_err_t node_to_xml(node_t node, bytearray_t **outbuf, uint32_t depth
         return PLIST_ERR_UNKNOWN;
     }
 
-    for (i = 0; i < depth; i++) {
-        str_buf_append(*outbuf, "\t", 1);
-    }
+    xml_write_indent(outbuf, depth);
 
     /* append tag */
-    str_buf_append(*outbuf, "<", 1);
-    str_buf_append(*outbuf, tag, tag_len);
-    if ((node_data->type == PLIST_STRING || node_data->type == PLIST_KEY) && node_data->length > 0) {
+    str_buf_append(outbuf, "<", 1);
+    str_buf_append(outbuf, tag, tag_len);
+    if ((type == PLIST_STRING || type == PLIST_KEY) && length > 0) {
+        const char *strval = (const char*)value;
         size_t j;
-        size_t len;
         off_t start = 0;
         off_t cur = 0;
 
-        str_buf_append(*outbuf, ">", 1);
+        str_buf_append(outbuf, ">", 1);
         tagOpen = TRUE;
 
         /* make sure we convert the following predefined xml entities */
         /* < = &lt; > = &gt; & = &amp; */
-        len = node_data->length;
-        for (j = 0; j < len; j++) {
-            switch (node_data->strval[j]) {
+        for (j = 0; j < length; j++) {
+            switch (strval[j]) {
             case '<':
-                str_buf_append(*outbuf, node_data->strval + start, cur - start);
-                str_buf_append(*outbuf, "&lt;", 4);
+                str_buf_append(outbuf, strval + start, cur - start);
+                str_buf_append(outbuf, "&lt;", 4);
                 start = cur+1;
                 break;
             case '>':
-                str_buf_append(*outbuf, node_data->strval + start, cur - start);
-                str_buf_append(*outbuf, "&gt;", 4);
+                str_buf_append(outbuf, strval + start, cur - start);
+                str_buf_append(outbuf, "&gt;", 4);
                 start = cur+1;
                 break;
             case '&':
-                str_buf_append(*outbuf, node_data->strval + start, cur - start);
-                str_buf_append(*outbuf, "&amp;", 5);
+                str_buf_append(outbuf, strval + start, cur - start);
+                str_buf_append(outbuf, "&amp;", 5);
                 start = cur+1;
                 break;
             default:
@@ -287,98 +275,139 @@ static plist_err_t node_to_xml(node_t node, bytearray_t **outbuf, uint32_t depth
             }
             cur++;
         }
-        str_buf_append(*outbuf, node_data->strval + start, cur - start);
-    } else if (node_data->type == PLIST_DATA) {
-        str_buf_append(*outbuf, ">", 1);
+        str_buf_append(outbuf, strval + start, cur - start);
+    } else if (type == PLIST_DATA) {
+        str_buf_append(outbuf, ">", 1);
         tagOpen = TRUE;
-        str_buf_append(*outbuf, "\n", 1);
-        if (node_data->length > 0) {
-            uint32_t j = 0;
+        str_buf_append(outbuf, "\n", 1);
+        if (length > 0) {
+            const unsigned char *buff = (const unsigned char*)value;
+            uint64_t j = 0;
             uint32_t indent = (depth > 8) ? 8 : depth;
             uint32_t maxread = MAX_DATA_BYTES_PER_LINE(indent);
             size_t count = 0;
-            size_t amount = (node_data->length / 3 * 4) + 4 + (((node_data->length / maxread) + 1) * (indent+1));
-            if ((*outbuf)->len + amount > (*outbuf)->capacity) {
-                str_buf_grow(*outbuf, amount);
+            size_t amount = (length / 3 * 4) + 4 + (((length / maxread) + 1) * (indent+1));
+            if (outbuf->len + amount > outbuf->capacity) {
+                str_buf_grow(outbuf, amount);
             }
-            while (j < node_data->length) {
+            while (j < length) {
                 for (i = 0; i < indent; i++) {
-                    str_buf_append(*outbuf, "\t", 1);
+                    str_buf_append(outbuf, "\t", 1);
+                }
+                count = (length-j < maxread) ? length-j : maxread;
+                if (outbuf->write_func || outbuf->stream) {
+                    /* the output is not buffered as a whole */
+                    char b64[MAX_DATA_BYTES_PER_LINE(0) / 3 * 4 + 4];
+                    str_buf_append(outbuf, b64, base64encode(b64, buff + j, count));
+                } else {
+                    assert(outbuf->len + count < outbuf->capacity);
+                    outbuf->len += base64encode((char*)outbuf->data + outbuf->len, buff + j, count);
                 }
-                count = (node_data->length-j < maxread) ? node_data->length-j : maxread;
-                assert((*outbuf)->len + count < (*outbuf)->capacity);
-                (*outbuf)->len += base64encode((char*)(*outbuf)->data + (*outbuf)->len, node_data->buff + j, count);
-                str_buf_append(*outbuf, "\n", 1);
+                str_buf_append(outbuf, "\n", 1);
                 j+=count;
             }
         }
-        for (i = 0; i < depth; i++) {
-            str_buf_append(*outbuf, "\t", 1);
-        }
-    } else if (node_data->type == PLIST_UID) {
+        xml_write_indent(outbuf, depth);
+    } else if (type == PLIST_UID) {
         /* special case for UID nodes: create a DICT */
-        str_buf_append(*outbuf, ">", 1);
+        str_buf_append(outbuf, ">", 1);
         tagOpen = TRUE;
-        str_buf_append(*outbuf, "\n", 1);
+        str_buf_append(outbuf, "\n", 1);
 
         /* add CF$UID key */
-        for (i = 0; i < depth+1; i++) {
-            str_buf_append(*outbuf, "\t", 1);
-        }
-        str_buf_append(*outbuf, "<key>CF$UID</key>", 17);
-        str_buf_append(*outbuf, "\n", 1);
+        xml_write_indent(outbuf, depth+1);
+        str_buf_append(outbuf, "<key>CF$UID</key>", 17);
+        str_buf_append(outbuf, "\n", 1);
 
         /* add UID value */
-        for (i = 0; i < depth+1; i++) {
-            str_buf_append(*outbuf, "\t", 1);
-        }
-        str_buf_append(*outbuf, "<integer>", 9);
-        str_buf_append(*outbuf, val, val_len);
-        str_buf_append(*outbuf, "</integer>", 10);
-        str_buf_append(*outbuf, "\n", 1);
+        xml_write_indent(outbuf, depth+1);
+        str_buf_append(outbuf, "<integer>", 9);
+        str_buf_append(outbuf, val, val_len);
+        str_buf_append(outbuf, "</integer>", 10);
+        str_buf_append(outbuf, "\n", 1);
 
-        for (i = 0; i < depth; i++) {
-            str_buf_append(*outbuf, "\t", 1);
-        }
+        xml_write_indent(outbuf, depth);
     } else if (val_len > 0) {
-        str_buf_append(*outbuf, ">", 1);
-        tagOpen = TRUE;
-        str_buf_append(*outbuf, val, val_len);
-    } else if (isStruct) {
+        str_buf_append(outbuf, ">", 1);
         tagOpen = TRUE;
-        str_buf_append(*outbuf, ">", 1);
+        str_buf_append(outbuf, val, val_len);
     } else {
         tagOpen = FALSE;
-        str_buf_append(*outbuf, "/>", 2);
+        str_buf_append(outbuf, "/>", 2);
     }
 
-    if (isStruct) {
-        /* add newline for structured types */
-        str_buf_append(*outbuf, "\n", 1);
+    if (tagOpen) {
+        /* add closing tag */
+        str_buf_append(outbuf, "</", 2);
+        str_buf_append(outbuf, tag, tag_len);
+        str_buf_append(outbuf, ">", 1);
+    }
+    str_buf_append(outbuf, "\n", 1);
+    return PLIST_ERR_SUCCESS;
+}
 
-        /* add child nodes */
-        if (node_data->type == PLIST_DICT && node->children) {
-            assert((node->children->count % 2) == 0);
-        }
-        node_t ch;
-        for (ch = node_first_child(node); ch; ch = node_next_sibling(ch)) {
-            plist_err_t res = node_to_xml(ch, outbuf, depth+1);
-            if (res < 0) return res;
-        }
+static plist_err_t node_to_xml(node_t node, bytearray_t **outbuf, uint32_t depth, node_t *path)
+{
+    plist_data_t node_data = NULL;
 
-        /* fix indent for structured types */
-        for (i = 0; i < depth; i++) {
-            str_buf_append(*outbuf, "\t", 1);
-        }
+    const char *tag = NULL;
+    size_t tag_len = 0;
+
+    if (!node) {
+        PLIST_XML_WRITE_ERR("Encountered invalid empty node in property list\n");
+        return PLIST_ERR_INVALID_ARG;
     }
 
-    if (tagOpen) {
-        /* add closing tag */
-        str_buf_append(*outbuf, "</", 2);
-        str_buf_append(*outbuf, tag, tag_len);
-        str_buf_append(*outbuf, ">", 1);
+    plist_err_t err = plist_write_check_node(node, path, depth);
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
+    }
+
+    node_data = plist_get_data(node);
+
+    switch (node_data->type)
+    {
+    case PLIST_ARRAY:
+        tag = XPLIST_ARRAY;
+        tag_len = XPLIST_ARRAY_LEN;
+        break;
+    case PLIST_DICT:
+        tag = XPLIST_DICT;
+        tag_len = XPLIST_DICT_LEN;
+        break;
+    default:
+        return xml_write_value(*outbuf, depth, node_data->type, plist_data_value(node_data), node_data->length);
+    }
+
+    xml_write_indent(*outbuf, depth);
+
+    /* append tag */
+    str_buf_append(*outbuf, "<", 1);
+    str_buf_append(*outbuf, tag, tag_len);
+    if (!node->children) {
+        str_buf_append(*outbuf, "/>\n", 3);
+        return PLIST_ERR_SUCCESS;
+    }
+    /* add newline for structured types */
+    str_buf_append(*outbuf, ">\n", 2);
+
+    /* add child nodes */
+    if (node_data->type == PLIST_DICT) {
+        assert((node->children->count % 2) == 0);
+    }
+    node_t ch;
+    for (ch = node_first_child(node); ch; ch = node_next_sibling(ch)) {
+        plist_err_t res = node_to_xml(ch, outbuf, depth+1, path);
+        if (res < 0) return res;
     }
-    str_buf_append(*outbuf, "\n", 1);
+
+    /* fix indent for structured types */
+    xml_write_indent(*outbuf, depth);
+
+    /* add closing tag */
+    str_buf_append(*outbuf, "</", 2);
+    str_buf_append(*outbuf, tag, tag_len);
+    str_buf_append(*outbuf, ">\n", 2);
     return PLIST_ERR_SUCCESS;
 }
 
@@ -422,171 +451,15 @@ static int parse_date(const char *strval, struct TM *btime)
     return 0;
 }
 
-#define PO10i_LIMIT (INT64_MAX/10)
-
-/* based on https://stackoverflow.com/a/4143288 */
-static int num_digits_i(int64_t i)
-{
-    int n;
-    int64_t po10;
-    n=1;
-    if (i < 0) {
-        i = (i == INT64_MIN) ? INT64_MAX : -i;
-        n++;
-    }
-    po10=10;
-    while (i>=po10) {
-        n++;
-        if (po10 > PO10i_LIMIT) break;
-        po10*=10;
-    }
-    return n;
-}
-
-#define PO10u_LIMIT (UINT64_MAX/10)
-
-/* based on https://stackoverflow.com/a/4143288 */
-static int num_digits_u(uint64_t i)
-{
-    int n;
-    uint64_t po10;
-    n=1;
-    po10=10;
-    while (i>=po10) {
-        n++;
-        if (po10 > PO10u_LIMIT) break;
-        po10*=10;
-    }
-    return n;
-}
-
-static plist_err_t _node_estimate_size(node_t node, uint64_t *size, uint32_t depth, hashtable_t *visited)
-{
-    plist_data_t data;
-    if (!node) {
-        return PLIST_ERR_INVALID_ARG;
-    }
-
-    if (depth > PLIST_MAX_NESTING_DEPTH) {
-        PLIST_XML_WRITE_ERR("maximum nesting depth (%u) exceeded\n", (unsigned)PLIST_MAX_NESTING_DEPTH);
-        return PLIST_ERR_MAX_NESTING;
-    }
-
-    if (hash_table_lookup(visited, node)) {
-        PLIST_XML_WRITE_ERR("circular reference detected\n");
-        return PLIST_ERR_CIRCULAR_REF;
-    }
-
-    // mark as visited
-    hash_table_insert(visited, node, (void*)1);
-
-    data = plist_get_data(node);
-    if (node->children) {
-        node_t ch;
-        for (ch = node_first_child(node); ch; ch = node_next_sibling(ch)) {
-            plist_err_t err = _node_estimate_size(ch, size, depth + 1, visited);
-            if (err != PLIST_ERR_SUCCESS) {
-                return err;
-            }
-        }
-        switch (data->type) {
-        case PLIST_DICT:
-            *size += (XPLIST_DICT_LEN << 1) + 7;
-            break;
-        case PLIST_ARRAY:
-            *size += (XPLIST_ARRAY_LEN << 1) + 7;
-            break;
-        default:
-            break;
-	}
-        *size += (depth << 1);
-    } else {
-        uint32_t indent = (depth > 8) ? 8 : depth;
-        switch (data->type) {
-        case PLIST_DATA: {
-            uint32_t req_lines = (data->length / MAX_DATA_BYTES_PER_LINE(indent)) + 1;
-            uint32_t b64len = data->length + (data->length / 3);
-            b64len += b64len % 4;
-            *size += b64len;
-            *size += (XPLIST_DATA_LEN << 1) + 5 + (indent+1) * (req_lines+1) + 1;
-        }   break;
-        case PLIST_STRING:
-            *size += data->length;
-            *size += (XPLIST_STRING_LEN << 1) + 6;
-            break;
-        case PLIST_KEY:
-            *size += data->length;
-            *size += (XPLIST_KEY_LEN << 1) + 6;
-            break;
-        case PLIST_INT:
-            if (data->length == 16) {
-                *size += num_digits_u(data->intval);
-            } else {
-                *size += num_digits_i((int64_t)data->intval);
-            }
-            *size += (XPLIST_INT_LEN << 1) + 6;
-            break;
-        case PLIST_REAL:
-            *size += dtostr(NULL, 0, data->realval);
-            *size += (XPLIST_REAL_LEN << 1) + 6;
-            break;
-        case PLIST_DATE:
-            *size += 20; /* YYYY-MM-DDThh:mm:ssZ */
-            *size += (XPLIST_DATE_LEN << 1) + 6;
-            break;
-        case PLIST_BOOLEAN:
-            *size += ((data->boolval) ? XPLIST_TRUE_LEN : XPLIST_FALSE_LEN) + 4;
-            break;
-        case PLIST_DICT:
-            *size += XPLIST_DICT_LEN + 4; /* <dict/> */
-            break;
-        case PLIST_ARRAY:
-            *size += XPLIST_ARRAY_LEN + 4; /* <array/> */
-            break;
-        case PLIST_UID:
-            *size += num_digits_i((int64_t)data->intval);
-            *size += (XPLIST_DICT_LEN << 1) + 7;
-            *size += indent + ((indent+1) << 1);
-            *size += 18; /* <key>CF$UID</key> */
-            *size += (XPLIST_INT_LEN << 1) + 6;
-            break;
-        case PLIST_NULL:
-            PLIST_XML_WRITE_ERR("PLIST_NULL type is not valid for XML format\n");
-            return PLIST_ERR_FORMAT;
-        default:
-            PLIST_XML_WRITE_ERR("invalid node type encountered\n");
-            return PLIST_ERR_UNKNOWN;
-        }
-        *size += indent;
-    }
-    return PLIST_ERR_SUCCESS;
-}
-
-static plist_err_t node_estimate_size(node_t node, uint64_t *size, uint32_t depth)
-{
-    hashtable_t *visited = hash_table_new(plist_node_ptr_hash, plist_node_ptr_compare, NULL);
-    if (!visited) return PLIST_ERR_NO_MEM;
-    plist_err_t err = _node_estimate_size(node, size, depth, visited);
-    hash_table_destroy(visited);
-    return err;
-}
-
-plist_err_t plist_to_xml(plist_t plist, char **plist_xml, uint32_t * length)
+plist_err_t plist_to_xml64(plist_t plist, char **plist_xml, uint64_t * length)
 {
-    uint64_t size = 0;
     plist_err_t res;
 
     if (!plist || !plist_xml || !length) {
         return PLIST_ERR_INVALID_ARG;
     }
 
-    res = node_estimate_size((node_t)plist, &size, 0);
-    if (res < 0) {
-        return res;
-    }
-    size += sizeof(XML_PLIST_PROLOG) + sizeof(XML_PLIST_EPILOG) - 1;
-
-    strbuf_t *outbuf = str_buf_new(size);
+    strbuf_t *outbuf = str_buf_new(0);
     if (!outbuf) {
         PLIST_XML_WRITE_ERR("Could not allocate output buffer\n");
         return PLIST_ERR_NO_MEM;
@@ -594,7 +467,8 @@ plist_err_t plist_to_xml(plist_t plist, char **plist_xml, uint32_t * length)
 
     str_buf_append(outbuf, XML_PLIST_PROLOG, sizeof(XML_PLIST_PROLOG)-1);
 
-    res = node_to_xml((node_t)plist, &outbuf, 0);
+    node_t path[PLIST_WRITE_PATH_SIZE];
+    res = node_to_xml((node_t)plist, &outbuf, 0, path);
     if (res < 0) {
         str_buf_free(outbuf);
         *plist_xml = NULL;
@@ -613,6 +487,143 @@ plist_err_t plist_to_xml(plist_t plist, char **plist_xml, uint32_t * length)
     return PLIST_ERR_SUCCESS;
 }
 
+plist_err_t plist_to_xml(plist_t plist, char **plist_xml, uint32_t * length)
+{
+    uint64_t length64 = 0;
+    if (!length) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+    plist_err_t err = plist_to_xml64(plist, plist_xml, &length64);
+    return plist_output_length32(err, plist_xml, length64, length);
+}
+
+/* writes XML while the input is parsed, see plist_convert() */
+struct xml_event_writer {
+    bytearray_t *outbuf;
+    /* number of open containers */
+    uint32_t depth;
+    /* per open container: whether it is a dictionary */
+    uint8_t dict[PLIST_WRITE_PATH_SIZE];
+    /* the start tag of the innermost container is not written yet, it
+     * becomes <dict/> or <array/> if no items follow */
+    int pending;
+};
+
+static void xml_writer_start_tag(struct xml_event_writer *w)
+{
+    if (w->pending) {
+        xml_write_indent(w->outbuf, w->depth-1);
+        if (w->dict[w->depth-1]) {
+            str_buf_append(w->outbuf, "<" XPLIST_DICT ">\n", 2 + XPLIST_DICT_LEN + 1);
+        } else {
+            str_buf_append(w->outbuf, "<" XPLIST_ARRAY ">\n", 2 + XPLIST_ARRAY_LEN + 1);
+        }
+        w->pending = 0;
+    }
+}
+
+static plist_err_t xml_writer_begin(struct xml_event_writer *w, int dict)
+{
+    if (w->depth >= PLIST_WRITE_PATH_SIZE) {
+        return PLIST_ERR_MAX_NESTING;
+    }
+    xml_writer_start_tag(w);
+    w->dict[w->depth] = (uint8_t)dict;
+    w->depth++;
+    w->pending = 1;
+    return plist_write_status(w->outbuf);
+}
+
+static plist_err_t xml_writer_end(struct xml_event_writer *w, int dict)
+{
+    const char *tag = (dict) ? XPLIST_DICT : XPLIST_ARRAY;
+    size_t tag_len = (dict) ? XPLIST_DICT_LEN : XPLIST_ARRAY_LEN;
+    if (w->depth == 0) {
+        return PLIST_ERR_PARSE;
+    }
+    w->depth--;
+    xml_write_indent(w->outbuf, w->depth);
+    if (w->pending) {
+        str_buf_append(w->outbuf, "<", 1);
+        str_buf_append(w->outbuf, tag, tag_len);
+        str_buf_append(w->outbuf, "/>\n", 3);
+        w->pending = 0;
+    } else {
+        str_buf_append(w->outbuf, "</", 2);
+        str_buf_append(w->outbuf, tag, tag_len);
+        str_buf_append(w->outbuf, ">\n", 2);
+    }
+    return plist_write_status(w->outbuf);
+}
+
+static plist_err_t xml_writer_begin_dict(void *user_data)
+{
+    return xml_writer_begin((struct xml_event_writer*)user_data, 1);
+}
+
+static plist_err_t xml_writer_end_dict(void *user_data)
+{
+    return xml_writer_end((struct xml_event_writer*)user_data, 1);
+}
+
+static plist_err_t xml_writer_begin_array(void *user_data)
+{
+    return xml_writer_begin((struct xml_event_writer*)user_data, 0);
+}
+
+static plist_err_t xml_writer_end_array(void *user_data)
+{
+    return xml_writer_end((struct xml_event_writer*)user_data, 0);
+}
+
+static plist_err_t xml_writer_key(void *user_data, const char *key, uint64_t length)
+{
+    struct xml_event_writer *w = (struct xml_event_writer*)user_data;
+    xml_writer_start_tag(w);
+    plist_err_t err = xml_write_value(w->outbuf, w->depth, PLIST_KEY, key, length);
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
+    }
+    return plist_write_status(w->outbuf);
+}
+
+static plist_err_t xml_writer_value(void *user_data, plist_type type, const void *value, uint64_t length)
+{
+    struct xml_event_writer *w = (struct xml_event_writer*)user_data;
+    xml_writer_start_tag(w);
+    plist_err_t err = xml_write_value(w->outbuf, w->depth, type, value, length);
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
+    }
+    return plist_write_status(w->outbuf);
+}
+
+static const plist_event_handler_t xml_writer_handler = {
+    xml_writer_begin_dict,
+    xml_writer_end_dict,
+    xml_writer_begin_array,
+    xml_writer_end_array,
+    xml_writer_key,
+    xml_writer_value,
+    NULL
+};
+
+plist_err_t plist_convert_to_xml(const char *input, uint64_t length, plist_format_t format, bytearray_t *outbuf)
+{
+    struct xml_event_writer w;
+    w.outbuf = outbuf;
+    w.depth = 0;
+    w.pending = 0;
+
+    str_buf_append(outbuf, XML_PLIST_PROLOG, sizeof(XML_PLIST_PROLOG)-1);
+    plist_err_t err = plist_parse_events(input, length, format, &xml_writer_handler, &w);
+    if (err != PLIST_ERR_SUCCESS) {
+        return err;
+    }
+    str_buf_append(outbuf, XML_PLIST_EPILOG, sizeof(XML_PLIST_EPILOG)-1);
+    return plist_write_status(outbuf);
+}
+
 struct _parse_ctx {
     const char *pos;
     const char *end;
@@ -627,25 +638,32 @@ static inline int is_xml_ws(unsigned char c)
 
 static void parse_skip_ws(parse_ctx ctx)
 {
-    while (ctx->pos < ctx->end && is_xml_ws(*(ctx->pos))) {
-        ctx->pos++;
+    ctx->pos = char_scan_skip_ws(ctx->pos, ctx->end);
+}
+
+/* skips a quoted run; on entry ctx->pos is at the opening quote, on success
+ * it is left at the closing quote. Returns 0 on success, -1 on EOF. */
+static int skip_quoted(parse_ctx ctx)
+{
+    ctx->pos = char_scan_find_any(ctx->pos+1, ctx->end, "\"", 1);
+    if (ctx->pos >= ctx->end) {
+        PLIST_XML_ERR("EOF while looking for matching double quote\n");
+        return -1;
     }
+    return 0;
 }
 
 static void find_char(parse_ctx ctx, char c, int skip_quotes)
 {
-    while (ctx->pos < ctx->end && (*(ctx->pos) != c)) {
-        if (skip_quotes && (c != '"') && (*(ctx->pos) == '"')) {
-            ctx->pos++;
-            find_char(ctx, '"', 0);
-            if (ctx->pos >= ctx->end) {
-                PLIST_XML_ERR("EOF while looking for matching double quote\n");
-                return;
-            }
-            if (*(ctx->pos) != '"') {
-                PLIST_XML_ERR("Unmatched double quote\n");
-                return;
-            }
+    char set[2] = { c, '"' };
+    int numchars = (skip_quotes && c != '"') ? 2 : 1;
+    while (ctx->pos < ctx->end) {
+        ctx->pos = char_scan_find_any(ctx->pos, ctx->end, set, numchars);
+        if (ctx->pos >= ctx->end || *(ctx->pos) == c) {
+            return;
+        }
+        if (skip_quoted(ctx) < 0) {
+            return;
         }
         ctx->pos++;
     }
@@ -653,19 +671,19 @@ static void find_char(parse_ctx ctx, char c, int skip_quotes)
 
 static void find_str(parse_ctx ctx, const char *str, size_t len, int skip_quotes)
 {
-    while (ctx->pos < (ctx->end - len)) {
-        if (!strncmp(ctx->pos, str, len)) {
+    const char *limit = ctx->end - len;
+    char set[2] = { str[0], '"' };
+    int numchars = (skip_quotes && str[0] != '"') ? 2 : 1;
+    while (ctx->pos < limit) {
+        ctx->pos = char_scan_find_any(ctx->pos, limit, set, numchars);
+        if (ctx->pos >= limit) {
+            return;
+        }
+        if (*(ctx->pos) == str[0] && !memcmp(ctx->pos, str, len)) {
             break;
         }
         if (skip_quotes && (*(ctx->pos) == '"')) {
-            ctx->pos++;
-            find_char(ctx, '"', 0);
-            if (ctx->pos >= ctx->end) {
-                PLIST_XML_ERR("EOF while looking for matching double quote\n");
-                return;
-            }
-            if (*(ctx->pos) != '"') {
-                PLIST_XML_ERR("Unmatched double quote\n");
+            if (skip_quoted(ctx) < 0) {
                 return;
             }
         }
@@ -675,17 +693,21 @@ static void find_str(parse_ctx ctx, const char *str, size_t len, int skip_quotes
 
 static void find_next(parse_ctx ctx, const char *nextchars, int numchars, int skip_quotes)
 {
+    char set[CHAR_SCAN_MAX_SET];
+    int setlen = numchars;
     int i = 0;
+    assert(numchars < CHAR_SCAN_MAX_SET);
+    memcpy(set, nextchars, numchars);
+    if (skip_quotes && !memchr(nextchars, '"', numchars)) {
+        set[setlen++] = '"';
+    }
     while (ctx->pos < ctx->end) {
+        ctx->pos = char_scan_find_any(ctx->pos, ctx->end, set, setlen);
+        if (ctx->pos >= ctx->end) {
+            return;
+        }
         if (skip_quotes && (*(ctx->pos) == '"')) {
-            ctx->pos++;
-            find_char(ctx, '"', 0);
-            if (ctx->pos >= ctx->end) {
-                PLIST_XML_ERR("EOF while looking for matching double quote\n");
-                return;
-            }
-            if (*(ctx->pos) != '"') {
-                PLIST_XML_ERR("Unmatched double quote\n");
+            if (skip_quoted(ctx) < 0) {
                 return;
             }
         }
@@ -863,6 +885,10 @@ static int unescape_entities(char *str, size_t *length)
     size_t i = 0;
     size_t len = *length;
     while (len > 0 && i < len-1) {
+        i = (size_t)(char_scan_find_any(str+i, str+len-1, "&", 1) - str);
+        if (i >= len-1) {
+            break;
+        }
         if (str[i] == '&') {
             char *entp = str + i + 1;
             while (i < len && str[i] != ';') {
@@ -978,7 +1004,8 @@ static char* text_parts_get_content(text_part_t *tp, int unesc_entities, int tri
         return NULL;
     }
     char *p;
-    if (requires_free && !tp->next && !unesc_entities && !trim_ws) {
+    /* a single part without anything to unescape can be used in place */
+    if (requires_free && tp->begin && !tp->next && !trim_ws && (!unesc_entities || tp->is_cdata || !memchr(tp->begin, '&', tp->length))) {
         *requires_free = 0;
         if (length) {
             *length = tp->length;
@@ -1032,609 +1059,622 @@ static char* text_parts_get_content(text_part_t *tp, int unesc_entities, int tri
     return str;
 }
 
-static plist_err_t node_from_xml(parse_ctx ctx, plist_t *plist)
+struct node_path_item {
+    const char *type;
+    struct node_path_item *prev;
+};
+
+struct xml_parse_state {
+    const plist_event_handler_t *handler;
+    void *user_data;
+    /* name of the next dict entry, reported together with its value */
+    char *keyname;
+    size_t keylen;
+    struct node_path_item *node_path;
+    int depth;
+    int have_root;
+};
+
+/* checks that a value may follow at this point, and reports the pending
+ * key name if the value is a dict entry */
+static plist_err_t xml_begin_value(parse_ctx ctx, struct xml_parse_state *st, const char *tag)
+{
+    if (!st->node_path || !strcmp(st->node_path->type, "plist")) {
+        if (st->have_root) {
+            /* We already produced root, and we're not inside a container */
+            PLIST_XML_ERR("Unexpected tag <%s> found while </plist> is expected\n", tag);
+            ctx->err = PLIST_ERR_PARSE;
+            return ctx->err;
+        }
+        st->have_root = 1;
+        return PLIST_ERR_SUCCESS;
+    }
+    if (!strcmp(st->node_path->type, XPLIST_DICT)) {
+        if (!st->keyname) {
+            PLIST_XML_ERR("missing key name while adding dict item\n");
+            ctx->err = PLIST_ERR_PARSE;
+            return ctx->err;
+        }
+        ctx->err = PLIST_EVENT(st->handler, key, st->user_data, st->keyname, st->keylen);
+        free(st->keyname);
+        st->keyname = NULL;
+    }
+    return ctx->err;
+}
+
+static plist_err_t xml_value(parse_ctx ctx, struct xml_parse_state *st, const char *tag, plist_type type, const void *value, uint64_t length)
+{
+    if (xml_begin_value(ctx, st, tag) == PLIST_ERR_SUCCESS) {
+        ctx->err = PLIST_EVENT(st->handler, value, st->user_data, type, value, length);
+    }
+    return ctx->err;
+}
+
+/* like xml_value() for a malloc()ed value, see plist_event_value_owned() */
+static plist_err_t xml_value_owned(parse_ctx ctx, struct xml_parse_state *st, const char *tag, plist_type type, void *buf, uint64_t length)
+{
+    if (xml_begin_value(ctx, st, tag) != PLIST_ERR_SUCCESS) {
+        free(buf);
+        return ctx->err;
+    }
+    ctx->err = plist_event_value_owned(st->handler, st->user_data, type, buf, length);
+    return ctx->err;
+}
+
+/* parses the markup item at ctx->pos (and for value tags also its content
+ * and closing tag) and reports it to st->handler; ctx->pos must not point
+ * to whitespace */
+static plist_err_t node_from_xml_item(parse_ctx ctx, struct xml_parse_state *st)
 {
     char tag[16] = { 0 };
-    char *keyname = NULL;
-    plist_t subnode = NULL;
     const char *p = NULL;
-    plist_t parent = NULL;
 
-    struct node_path_item {
-        const char *type;
-        struct node_path_item *prev;
-    };
-    struct node_path_item* node_path = NULL;
-    int depth = 0;
+    if (*ctx->pos != '<') {
+        p = ctx->pos;
+        find_next(ctx, " \t\r\n", 4, 0);
+        PLIST_XML_ERR("Expected: opening tag, found: %.*s\n", (int)(ctx->pos - p), p);
+        ctx->err = PLIST_ERR_PARSE;
+        goto err_out;
+    }
+    ctx->pos++;
+    if (ctx->pos >= ctx->end) {
+        PLIST_XML_ERR("EOF while parsing tag\n");
+        ctx->err = PLIST_ERR_PARSE;
+        goto err_out;
+    }
 
-    while (ctx->pos < ctx->end && !ctx->err) {
-        parse_skip_ws(ctx);
-        if (ctx->pos >= ctx->end) {
-            break;
-        }
-        if (*ctx->pos != '<') {
-            p = ctx->pos;
-            find_next(ctx, " \t\r\n", 4, 0);
-            PLIST_XML_ERR("Expected: opening tag, found: %.*s\n", (int)(ctx->pos - p), p);
+    if (*(ctx->pos) == '?') {
+        find_str(ctx, "?>", 2, 1);
+        if (ctx->pos > ctx->end-2) {
+            PLIST_XML_ERR("EOF while looking for <? tag closing marker\n");
             ctx->err = PLIST_ERR_PARSE;
             goto err_out;
         }
-        ctx->pos++;
-        if (ctx->pos >= ctx->end) {
-            PLIST_XML_ERR("EOF while parsing tag\n");
+        if (strncmp(ctx->pos, "?>", 2) != 0) {
+            PLIST_XML_ERR("Couldn't find <? tag closing marker\n");
             ctx->err = PLIST_ERR_PARSE;
             goto err_out;
         }
-
-        if (*(ctx->pos) == '?') {
-            find_str(ctx, "?>", 2, 1);
-            if (ctx->pos > ctx->end-2) {
-                PLIST_XML_ERR("EOF while looking for <? tag closing marker\n");
-                ctx->err = PLIST_ERR_PARSE;
-                goto err_out;
-            }
-            if (strncmp(ctx->pos, "?>", 2) != 0) {
-                PLIST_XML_ERR("Couldn't find <? tag closing marker\n");
+        ctx->pos += 2;
+        return PLIST_ERR_SUCCESS;
+    } else if (*(ctx->pos) == '!') {
+        /* comment or DTD */
+        if (((ctx->end - ctx->pos) > 3) && !strncmp(ctx->pos, "!--", 3)) {
+            ctx->pos += 3;
+            find_str(ctx, "-->", 3, 0);
+            if (ctx->pos > ctx->end-3 || strncmp(ctx->pos, "-->", 3) != 0) {
+                PLIST_XML_ERR("Couldn't find end of comment\n");
                 ctx->err = PLIST_ERR_PARSE;
                 goto err_out;
             }
-            ctx->pos += 2;
-            continue;
-        } else if (*(ctx->pos) == '!') {
-            /* comment or DTD */
-            if (((ctx->end - ctx->pos) > 3) && !strncmp(ctx->pos, "!--", 3)) {
-                ctx->pos += 3;
-                find_str(ctx, "-->", 3, 0);
-                if (ctx->pos > ctx->end-3 || strncmp(ctx->pos, "-->", 3) != 0) {
-                    PLIST_XML_ERR("Couldn't find end of comment\n");
+            ctx->pos+=3;
+        } else if (((ctx->end - ctx->pos) > 8) && !strncmp(ctx->pos, "!DOCTYPE", 8)) {
+            int embedded_dtd = 0;
+            ctx->pos+=8;
+            while (ctx->pos < ctx->end) {
+                find_next(ctx, " \t\r\n[>", 6, 1);
+                if (ctx->pos >= ctx->end) {
+                    PLIST_XML_ERR("EOF while parsing !DOCTYPE\n");
                     ctx->err = PLIST_ERR_PARSE;
                     goto err_out;
                 }
-                ctx->pos+=3;
-            } else if (((ctx->end - ctx->pos) > 8) && !strncmp(ctx->pos, "!DOCTYPE", 8)) {
-                int embedded_dtd = 0;
-                ctx->pos+=8;
-                while (ctx->pos < ctx->end) {
-                    find_next(ctx, " \t\r\n[>", 6, 1);
-                    if (ctx->pos >= ctx->end) {
-                        PLIST_XML_ERR("EOF while parsing !DOCTYPE\n");
-                        ctx->err = PLIST_ERR_PARSE;
-                        goto err_out;
-                    }
-                    if (*ctx->pos == '[') {
-                        embedded_dtd = 1;
-                        break;
-                    } else if (*ctx->pos == '>') {
-                        /* end of DOCTYPE found already */
-                        ctx->pos++;
-                        break;
-                    } else {
-                        parse_skip_ws(ctx);
-                    }
+                if (*ctx->pos == '[') {
+                    embedded_dtd = 1;
+                    break;
+                } else if (*ctx->pos == '>') {
+                    /* end of DOCTYPE found already */
+                    ctx->pos++;
+                    break;
+                } else {
+                    parse_skip_ws(ctx);
                 }
-                if (embedded_dtd) {
-                    find_str(ctx, "]>", 2, 1);
-                    if (ctx->pos > ctx->end-2 || strncmp(ctx->pos, "]>", 2) != 0) {
-                        PLIST_XML_ERR("Couldn't find end of DOCTYPE\n");
-                        ctx->err = PLIST_ERR_PARSE;
-                        goto err_out;
-                    }
-                    ctx->pos += 2;
+            }
+            if (embedded_dtd) {
+                find_str(ctx, "]>", 2, 1);
+                if (ctx->pos > ctx->end-2 || strncmp(ctx->pos, "]>", 2) != 0) {
+                    PLIST_XML_ERR("Couldn't find end of DOCTYPE\n");
+                    ctx->err = PLIST_ERR_PARSE;
+                    goto err_out;
                 }
-            } else {
-                p = ctx->pos;
-                find_next(ctx, " \r\n\t>", 5, 1);
-                PLIST_XML_ERR("Invalid or incomplete special tag <%.*s> encountered\n", (int)(ctx->pos - p), p);
-                ctx->err = PLIST_ERR_PARSE;
-                goto err_out;
+                ctx->pos += 2;
             }
-            continue;
         } else {
-            int is_empty = 0;
-            int closing_tag = 0;
             p = ctx->pos;
-            find_next(ctx, " \r\n\t<>", 6, 0);
-            if (ctx->pos >= ctx->end) {
-                PLIST_XML_ERR("Unexpected EOF while parsing XML\n");
+            find_next(ctx, " \r\n\t>", 5, 1);
+            PLIST_XML_ERR("Invalid or incomplete special tag <%.*s> encountered\n", (int)(ctx->pos - p), p);
+            ctx->err = PLIST_ERR_PARSE;
+            goto err_out;
+        }
+        return PLIST_ERR_SUCCESS;
+    } else {
+        int is_empty = 0;
+        p = ctx->pos;
+        find_next(ctx, " \r\n\t<>", 6, 0);
+        if (ctx->pos >= ctx->end) {
+            PLIST_XML_ERR("Unexpected EOF while parsing XML\n");
+            ctx->err = PLIST_ERR_PARSE;
+            goto err_out;
+        }
+        size_t taglen = ctx->pos - p;
+        if (taglen >= sizeof(tag)) {
+            PLIST_XML_ERR("Unexpected tag <%.*s> encountered\n", (int)taglen, p);
+            ctx->pos = ctx->end;
+            ctx->err = PLIST_ERR_PARSE;
+            goto err_out;
+        }
+        memcpy(tag, p, taglen);
+        tag[taglen] = '\0';
+        if (*ctx->pos != '>') {
+            find_next(ctx, "<>", 2, 1);
+        }
+        if (ctx->pos >= ctx->end) {
+            PLIST_XML_ERR("Unexpected EOF while parsing XML\n");
+            ctx->err = PLIST_ERR_PARSE;
+            goto err_out;
+        }
+        if (*ctx->pos != '>') {
+            PLIST_XML_ERR("Missing '>' for tag <%s\n", tag);
+            ctx->err = PLIST_ERR_PARSE;
+            goto err_out;
+        }
+        if (*(ctx->pos-1) == '/') {
+            size_t idx = ctx->pos - p - 1;
+            if (idx < taglen)
+                tag[idx] = '\0';
+            is_empty = 1;
+        }
+        ctx->pos++;
+        if (!strcmp(tag, "plist")) {
+            if (!st->node_path && st->have_root) {
+                PLIST_XML_ERR("Multiple top-level <plist> elements encountered\n");
                 ctx->err = PLIST_ERR_PARSE;
                 goto err_out;
             }
-            size_t taglen = ctx->pos - p;
-            if (taglen >= sizeof(tag)) {
-                PLIST_XML_ERR("Unexpected tag <%.*s> encountered\n", (int)taglen, p);
-                ctx->pos = ctx->end;
+            if (is_empty) {
+                PLIST_XML_ERR("Empty plist tag\n");
                 ctx->err = PLIST_ERR_PARSE;
                 goto err_out;
             }
-            memcpy(tag, p, taglen);
-            tag[taglen] = '\0';
-            if (*ctx->pos != '>') {
-                find_next(ctx, "<>", 2, 1);
+
+            struct node_path_item *path_item = (struct node_path_item*)malloc(sizeof(struct node_path_item));
+            if (!path_item) {
+                PLIST_XML_ERR("out of memory when allocating node path item\n");
+                ctx->err = PLIST_ERR_PARSE;
+                goto err_out;
             }
-            if (ctx->pos >= ctx->end) {
-                PLIST_XML_ERR("Unexpected EOF while parsing XML\n");
+            path_item->type = "plist";
+            path_item->prev = st->node_path;
+            st->node_path = path_item;
+
+            return PLIST_ERR_SUCCESS;
+        } else if (!strcmp(tag, "/plist")) {
+            if (!st->have_root) {
+                PLIST_XML_ERR("encountered empty plist tag\n");
                 ctx->err = PLIST_ERR_PARSE;
                 goto err_out;
             }
-            if (*ctx->pos != '>') {
-                PLIST_XML_ERR("Missing '>' for tag <%s\n", tag);
+            if (!st->node_path) {
+                PLIST_XML_ERR("node path is empty while trying to match closing tag with opening tag\n");
                 ctx->err = PLIST_ERR_PARSE;
                 goto err_out;
             }
-            if (*(ctx->pos-1) == '/') {
-                size_t idx = ctx->pos - p - 1;
-                if (idx < taglen)
-                    tag[idx] = '\0';
-                is_empty = 1;
+            if (strcmp(st->node_path->type, tag+1) != 0) {
+                PLIST_XML_ERR("mismatching closing tag <%s> found for opening tag <%s>\n", tag, st->node_path->type);
+                ctx->err = PLIST_ERR_PARSE;
+                goto err_out;
             }
-            ctx->pos++;
-            if (!strcmp(tag, "plist")) {
-                if (!node_path && *plist) {
-                    PLIST_XML_ERR("Multiple top-level <plist> elements encountered\n");
-                    ctx->err = PLIST_ERR_PARSE;
-                    goto err_out;
-                }
-                if (is_empty) {
-                    PLIST_XML_ERR("Empty plist tag\n");
-                    ctx->err = PLIST_ERR_PARSE;
+            struct node_path_item *path_item = st->node_path;
+            st->node_path = (struct node_path_item*)st->node_path->prev;
+            free(path_item);
+            return PLIST_ERR_SUCCESS;
+        }
+        if (tag[0] == '/') {
+            if (!st->node_path) {
+                PLIST_XML_ERR("node path is empty while trying to match closing tag with opening tag\n");
+                ctx->err = PLIST_ERR_PARSE;
+                goto err_out;
+            }
+            if (strcmp(st->node_path->type, tag+1) != 0) {
+                PLIST_XML_ERR("unexpected %s found (for opening %s)\n", tag, st->node_path->type);
+                ctx->err = PLIST_ERR_PARSE;
+                goto err_out;
+            }
+            int is_dict = !strcmp(st->node_path->type, XPLIST_DICT);
+            if (st->depth > 0) st->depth--;
+            struct node_path_item *path_item = st->node_path;
+            st->node_path = (struct node_path_item*)st->node_path->prev;
+            free(path_item);
+            /* a key without value is dropped */
+            free(st->keyname);
+            st->keyname = NULL;
+            if (is_dict) {
+                ctx->err = PLIST_EVENT(st->handler, end_dict, st->user_data);
+            } else {
+                ctx->err = PLIST_EVENT(st->handler, end_array, st->user_data);
+            }
+            return ctx->err;
+        }
+
+        if (!strcmp(tag, XPLIST_DICT) || !strcmp(tag, XPLIST_ARRAY)) {
+            int is_dict = !strcmp(tag, XPLIST_DICT);
+            if (xml_begin_value(ctx, st, tag) != PLIST_ERR_SUCCESS) {
+                goto err_out;
+            }
+            if (!is_empty) {
+                if (st->depth >= PLIST_MAX_NESTING_DEPTH) {
+                    PLIST_XML_ERR("maximum nesting depth (%u) exceeded\n", (unsigned)PLIST_MAX_NESTING_DEPTH);
+                    ctx->err = PLIST_ERR_MAX_NESTING;
                     goto err_out;
                 }
-
                 struct node_path_item *path_item = (struct node_path_item*)malloc(sizeof(struct node_path_item));
                 if (!path_item) {
                     PLIST_XML_ERR("out of memory when allocating node path item\n");
                     ctx->err = PLIST_ERR_PARSE;
                     goto err_out;
                 }
-                path_item->type = "plist";
-                path_item->prev = node_path;
-                node_path = path_item;
-
-                continue;
-            } else if (!strcmp(tag, "/plist")) {
-                if (!*plist) {
-                    PLIST_XML_ERR("encountered empty plist tag\n");
-                    ctx->err = PLIST_ERR_PARSE;
-                    goto err_out;
+                path_item->type = (is_dict) ? XPLIST_DICT : XPLIST_ARRAY;
+                path_item->prev = st->node_path;
+                st->node_path = path_item;
+                st->depth++;
+            }
+            if (is_dict) {
+                ctx->err = PLIST_EVENT(st->handler, begin_dict, st->user_data);
+                if (is_empty && ctx->err == PLIST_ERR_SUCCESS) {
+                    ctx->err = PLIST_EVENT(st->handler, end_dict, st->user_data);
                 }
-                if (!node_path) {
-                    PLIST_XML_ERR("node path is empty while trying to match closing tag with opening tag\n");
-                    ctx->err = PLIST_ERR_PARSE;
-                    goto err_out;
+            } else {
+                ctx->err = PLIST_EVENT(st->handler, begin_array, st->user_data);
+                if (is_empty && ctx->err == PLIST_ERR_SUCCESS) {
+                    ctx->err = PLIST_EVENT(st->handler, end_array, st->user_data);
                 }
-                if (strcmp(node_path->type, tag+1) != 0) {
-                    PLIST_XML_ERR("mismatching closing tag <%s> found for opening tag <%s>\n", tag, node_path->type);
+            }
+        } else if (!strcmp(tag, XPLIST_INT)) {
+            uint64_t intval = 0;
+            uint64_t length = 8;
+            if (!is_empty) {
+                text_part_t first_part = { NULL, 0, 0, NULL };
+                text_part_t *tp = get_text_parts(ctx, tag, taglen, 1, &first_part);
+                if (!tp) {
+                    PLIST_XML_ERR("Could not parse text content for '%s' node\n", tag);
+                    text_parts_free((text_part_t*)first_part.next);
                     ctx->err = PLIST_ERR_PARSE;
                     goto err_out;
                 }
-                struct node_path_item *path_item = node_path;
-                node_path = (struct node_path_item*)node_path->prev;
-                free(path_item);
-                continue;
-            }
-            if (tag[0] == '/') {
-                closing_tag = 1;
-                goto handle_closing;
-            }
-            plist_data_t data = plist_new_plist_data();
-            if (!data) {
-                PLIST_XML_ERR("failed to allocate plist data\n");
-                ctx->err = PLIST_ERR_NO_MEM;
-                goto err_out;
-            }
-            subnode = plist_new_node(data);
-            if (!subnode) {
-                PLIST_XML_ERR("failed to create node\n");
-                ctx->err = PLIST_ERR_NO_MEM;
-                goto err_out;
-            }
-
-            if (!strcmp(tag, XPLIST_DICT)) {
-                data->type = PLIST_DICT;
-            } else if (!strcmp(tag, XPLIST_ARRAY)) {
-                data->type = PLIST_ARRAY;
-            } else if (!strcmp(tag, XPLIST_INT)) {
-                if (!is_empty) {
-                    text_part_t first_part = { NULL, 0, 0, NULL };
-                    text_part_t *tp = get_text_parts(ctx, tag, taglen, 1, &first_part);
-                    if (!tp) {
-                        PLIST_XML_ERR("Could not parse text content for '%s' node\n", tag);
+                if (tp->begin) {
+                    char *str_content = text_parts_get_content(tp, 0, 1, NULL, NULL);
+                    if (!str_content) {
+                        PLIST_XML_ERR("Could not get text content for '%s' node\n", tag);
                         text_parts_free((text_part_t*)first_part.next);
                         ctx->err = PLIST_ERR_PARSE;
                         goto err_out;
                     }
-                    if (tp->begin) {
-                        char *str_content = text_parts_get_content(tp, 0, 1, NULL, NULL);
-                        if (!str_content) {
-                            PLIST_XML_ERR("Could not get text content for '%s' node\n", tag);
-                            text_parts_free((text_part_t*)first_part.next);
-                            ctx->err = PLIST_ERR_PARSE;
-                            goto err_out;
-                        }
-                        char *str = str_content;
-                        int is_negative = 0;
-                        if ((str[0] == '-') || (str[0] == '+')) {
-                            if (str[0] == '-') {
-                                is_negative = 1;
-                            }
-                            str++;
-                        }
-                        errno = 0;
-                        char* endp = NULL;
-                        data->intval = strtoull(str, &endp, 0);
-                        if (errno == ERANGE) {
-                            PLIST_XML_ERR("Integer overflow detected while parsing '%.20s'\n", str_content);
-                            text_parts_free((text_part_t*)first_part.next);
-                            ctx->err = PLIST_ERR_PARSE;
-                            free(str_content);
-                            goto err_out;
-                        }
-                        if (endp == str || *endp != '\0') {
-                            PLIST_XML_ERR("Invalid characters while parsing integer value '%.20s'\n", str_content);
-                            text_parts_free((text_part_t*)first_part.next);
-                            ctx->err = PLIST_ERR_PARSE;
-                            free(str_content);
-                            goto err_out;
-                        }
-                        if (is_negative && data->intval > ((uint64_t)INT64_MAX + 1)) {
-                            PLIST_XML_ERR("Signed integer value out of range while parsing '%.20s'\n", str_content);
-                            text_parts_free((text_part_t*)first_part.next);
-                            ctx->err = PLIST_ERR_PARSE;
-                            free(str_content);
-                            goto err_out;
-                        }
-                        if (is_negative || (data->intval <= INT64_MAX)) {
-                            uint64_t v = data->intval;
-                            if (is_negative) {
-                                v = -v;
-                            }
-                            data->intval = v;
-                            data->length = 8;
-                        } else {
-                            data->length = 16;
+                    char *str = str_content;
+                    int is_negative = 0;
+                    if ((str[0] == '-') || (str[0] == '+')) {
+                        if (str[0] == '-') {
+                            is_negative = 1;
                         }
+                        str++;
+                    }
+                    errno = 0;
+                    char* endp = NULL;
+                    intval = strtoull(str, &endp, 0);
+                    if (errno == ERANGE) {
+                        PLIST_XML_ERR("Integer overflow detected while parsing '%.20s'\n", str_content);
+                        text_parts_free((text_part_t*)first_part.next);
+                        ctx->err = PLIST_ERR_PARSE;
                         free(str_content);
-                    } else {
-                        is_empty = 1;
+                        goto err_out;
                     }
-                    text_parts_free((text_part_t*)first_part.next);
-                }
-                if (is_empty) {
-                    PLIST_XML_ERR("Encountered empty " XPLIST_INT " tag\n");
-                    ctx->err = PLIST_ERR_PARSE;
-                    goto err_out;
-                }
-                data->type = PLIST_INT;
-            } else if (!strcmp(tag, XPLIST_REAL)) {
-                if (!is_empty) {
-                    text_part_t first_part = { NULL, 0, 0, NULL };
-                    text_part_t *tp = get_text_parts(ctx, tag, taglen, 1, &first_part);
-                    if (!tp) {
-                        PLIST_XML_ERR("Could not parse text content for '%s' node\n", tag);
+                    if (endp == str || *endp != '\0') {
+                        PLIST_XML_ERR("Invalid characters while parsing integer value '%.20s'\n", str_content);
                         text_parts_free((text_part_t*)first_part.next);
                         ctx->err = PLIST_ERR_PARSE;
+                        free(str_content);
                         goto err_out;
                     }
-                    if (tp->begin) {
-                        char *str_content = text_parts_get_content(tp, 0, 1, NULL, NULL);
-                        if (!str_content) {
-                            PLIST_XML_ERR("Could not get text content for '%s' node\n", tag);
-                            text_parts_free((text_part_t*)first_part.next);
-                            ctx->err = PLIST_ERR_PARSE;
-                            goto err_out;
-                        }
-                        errno = 0;
-                        char *endp = NULL;
-                        data->realval = strtod(str_content, &endp);
-                        if (errno == ERANGE) {
-                            PLIST_XML_ERR("Invalid range while parsing value for '%s' node\n", tag);
-                            text_parts_free((text_part_t*)first_part.next);
-                            ctx->err = PLIST_ERR_PARSE;
-                            free(str_content);
-                            goto err_out;
-                        }
-                        if (endp == str_content || *endp != '\0') {
-                            PLIST_XML_ERR("Could not parse value for '%s' node\n", tag);
-                            text_parts_free((text_part_t*)first_part.next);
-                            ctx->err = PLIST_ERR_PARSE;
-                            free(str_content);
-                            goto err_out;
-
-                        }
-                        if (!isfinite(data->realval)) {
-                            PLIST_XML_ERR("Invalid real value while parsing '%.20s'\n", str_content);
-                            text_parts_free((text_part_t*)first_part.next);
-                            ctx->err = PLIST_ERR_PARSE;
-                            free(str_content);
-                            goto err_out;
-                        }
+                    if (is_negative && intval > ((uint64_t)INT64_MAX + 1)) {
+                        PLIST_XML_ERR("Signed integer value out of range while parsing '%.20s'\n", str_content);
+                        text_parts_free((text_part_t*)first_part.next);
+                        ctx->err = PLIST_ERR_PARSE;
                         free(str_content);
+                        goto err_out;
+                    }
+                    if (is_negative || (intval <= INT64_MAX)) {
+                        if (is_negative) {
+                            intval = -intval;
+                        }
                     } else {
-                        is_empty = 1;
+                        length = 16;
                     }
-                    text_parts_free((text_part_t*)first_part.next);
+                    free(str_content);
+                } else {
+                    is_empty = 1;
                 }
-                if (is_empty) {
-                    PLIST_XML_ERR("Encountered empty " XPLIST_REAL " tag\n");
+                text_parts_free((text_part_t*)first_part.next);
+            }
+            if (is_empty) {
+                PLIST_XML_ERR("Encountered empty " XPLIST_INT " tag\n");
+                ctx->err = PLIST_ERR_PARSE;
+                goto err_out;
+            }
+            xml_value(ctx, st, tag, PLIST_INT, &intval, length);
+        } else if (!strcmp(tag, XPLIST_REAL)) {
+            double realval = 0;
+            if (!is_empty) {
+                text_part_t first_part = { NULL, 0, 0, NULL };
+                text_part_t *tp = get_text_parts(ctx, tag, taglen, 1, &first_part);
+                if (!tp) {
+                    PLIST_XML_ERR("Could not parse text content for '%s' node\n", tag);
+                    text_parts_free((text_part_t*)first_part.next);
                     ctx->err = PLIST_ERR_PARSE;
                     goto err_out;
                 }
-                data->type = PLIST_REAL;
-                data->length = 8;
-            } else if (!strcmp(tag, XPLIST_TRUE)) {
-                if (!is_empty) {
-                    get_text_parts(ctx, tag, taglen, 1, NULL);
-                }
-                data->type = PLIST_BOOLEAN;
-                data->boolval = 1;
-                data->length = 1;
-            } else if (!strcmp(tag, XPLIST_FALSE)) {
-                if (!is_empty) {
-                    get_text_parts(ctx, tag, taglen, 1, NULL);
-                }
-                data->type = PLIST_BOOLEAN;
-                data->boolval = 0;
-                data->length = 1;
-            } else if (!strcmp(tag, XPLIST_STRING) || !strcmp(tag, XPLIST_KEY)) {
-                if (!is_empty) {
-                    text_part_t first_part = { NULL, 0, 0, NULL };
-                    text_part_t *tp = get_text_parts(ctx, tag, taglen, 0, &first_part);
-                    char *str = NULL;
-                    size_t length = 0;
-                    if (!tp) {
-                        PLIST_XML_ERR("Could not parse text content for '%s' node\n", tag);
+                if (tp->begin) {
+                    char *str_content = text_parts_get_content(tp, 0, 1, NULL, NULL);
+                    if (!str_content) {
+                        PLIST_XML_ERR("Could not get text content for '%s' node\n", tag);
                         text_parts_free((text_part_t*)first_part.next);
                         ctx->err = PLIST_ERR_PARSE;
                         goto err_out;
                     }
-                    str = text_parts_get_content(tp, 1, 0, &length, NULL);
-                    text_parts_free((text_part_t*)first_part.next);
-                    if (!str) {
-                        PLIST_XML_ERR("Could not get text content for '%s' node\n", tag);
+                    errno = 0;
+                    char *endp = NULL;
+                    realval = strtod(str_content, &endp);
+                    if (errno == ERANGE) {
+                        PLIST_XML_ERR("Invalid range while parsing value for '%s' node\n", tag);
+                        text_parts_free((text_part_t*)first_part.next);
                         ctx->err = PLIST_ERR_PARSE;
+                        free(str_content);
                         goto err_out;
                     }
-                    if (!strcmp(tag, "key") && !keyname && parent && (plist_get_node_type(parent) == PLIST_DICT)) {
-                        keyname = str;
-                        plist_free(subnode);
-                        subnode = NULL;
-                        continue;
-                    } else {
-                        data->strval = str;
-                        data->length = length;
-                    }
-                } else {
-                    data->strval = strdup("");
-                    data->length = 0;
-                }
-                data->type = PLIST_STRING;
-            } else if (!strcmp(tag, XPLIST_DATA)) {
-                if (!is_empty) {
-                    text_part_t first_part = { NULL, 0, 0, NULL };
-                    text_part_t *tp = get_text_parts(ctx, tag, taglen, 1, &first_part);
-                    if (!tp) {
-                        PLIST_XML_ERR("Could not parse text content for '%s' node\n", tag);
+                    if (endp == str_content || *endp != '\0') {
+                        PLIST_XML_ERR("Could not parse value for '%s' node\n", tag);
                         text_parts_free((text_part_t*)first_part.next);
                         ctx->err = PLIST_ERR_PARSE;
+                        free(str_content);
                         goto err_out;
-                    }
-                    if (tp->begin) {
-                        int requires_free = 0;
-                        char *str_content = text_parts_get_content(tp, 0, 0, NULL, &requires_free);
-                        if (!str_content) {
-                            PLIST_XML_ERR("Could not get text content for '%s' node\n", tag);
-                            text_parts_free((text_part_t*)first_part.next);
-                            ctx->err = PLIST_ERR_PARSE;
-                            goto err_out;
-                        }
-                        size_t size = tp->length;
-                        if (size > 0) {
-                            data->buff = base64decode(str_content, &size);
-                            if (!data->buff) {
-                                text_parts_free((text_part_t*)first_part.next);
-                                PLIST_XML_ERR("failed to decode base64 stream\n");
-                                ctx->err = PLIST_ERR_NO_MEM;
-                                goto err_out;
-                            }
-                            data->length = size;
-                        }
 
-                        if (requires_free) {
-                            free(str_content);
-                        }
                     }
-                    text_parts_free((text_part_t*)first_part.next);
-                }
-                data->type = PLIST_DATA;
-            } else if (!strcmp(tag, XPLIST_DATE)) {
-                if (!is_empty) {
-                    text_part_t first_part = { NULL, 0, 0, NULL };
-                    text_part_t *tp = get_text_parts(ctx, tag, taglen, 1, &first_part);
-                    if (!tp) {
-                        PLIST_XML_ERR("Could not parse text content for '%s' node\n", tag);
+                    if (!isfinite(realval)) {
+                        PLIST_XML_ERR("Invalid real value while parsing '%.20s'\n", str_content);
                         text_parts_free((text_part_t*)first_part.next);
                         ctx->err = PLIST_ERR_PARSE;
-                        goto err_out;
-                    }
-                    Time64_T timev = 0;
-                    if (tp->begin) {
-                        char *str_content = text_parts_get_content(tp, 0, 1, NULL, NULL);
-                        if (!str_content) {
-                            PLIST_XML_ERR("Could not get text content for '%s' node\n", tag);
-                            text_parts_free((text_part_t*)first_part.next);
-                            ctx->err = PLIST_ERR_PARSE;
-                            goto err_out;
-                        }
-                        struct TM btime;
-                        if (parse_date(str_content, &btime) < 0) {
-                            PLIST_XML_ERR("Failed to parse date node\n");
-                            text_parts_free((text_part_t*)first_part.next);
-                            ctx->err = PLIST_ERR_PARSE;
-                            free(str_content);
-                            goto err_out;
-                        }
-                        timev = timegm64(&btime);
                         free(str_content);
-                    } else {
-                        is_empty = 1;
+                        goto err_out;
                     }
+                    free(str_content);
+                } else {
+                    is_empty = 1;
+                }
+                text_parts_free((text_part_t*)first_part.next);
+            }
+            if (is_empty) {
+                PLIST_XML_ERR("Encountered empty " XPLIST_REAL " tag\n");
+                ctx->err = PLIST_ERR_PARSE;
+                goto err_out;
+            }
+            xml_value(ctx, st, tag, PLIST_REAL, &realval, sizeof(double));
+        } else if (!strcmp(tag, XPLIST_TRUE) || !strcmp(tag, XPLIST_FALSE)) {
+            uint8_t boolval = (tag[0] == 't');
+            if (!is_empty && !get_text_parts(ctx, tag, taglen, 1, NULL)) {
+                goto err_out;
+            }
+            xml_value(ctx, st, tag, PLIST_BOOLEAN, &boolval, 1);
+        } else if (!strcmp(tag, XPLIST_STRING) || !strcmp(tag, XPLIST_KEY)) {
+            char *str = (char*)"";
+            size_t length = 0;
+            int requires_free = 0;
+            if (!is_empty) {
+                text_part_t first_part = { NULL, 0, 0, NULL };
+                text_part_t *tp = get_text_parts(ctx, tag, taglen, 0, &first_part);
+                if (!tp) {
+                    PLIST_XML_ERR("Could not parse text content for '%s' node\n", tag);
                     text_parts_free((text_part_t*)first_part.next);
-                    data->realval = (double)(timev - MAC_EPOCH);
+                    ctx->err = PLIST_ERR_PARSE;
+                    goto err_out;
+                }
+                if (tp->begin) {
+                    str = text_parts_get_content(tp, 1, 0, &length, &requires_free);
                 }
-                if (is_empty) {
-                    PLIST_XML_ERR("Encountered empty " XPLIST_DATE " tag\n");
+                text_parts_free((text_part_t*)first_part.next);
+                if (!str) {
+                    PLIST_XML_ERR("Could not get text content for '%s' node\n", tag);
                     ctx->err = PLIST_ERR_PARSE;
                     goto err_out;
                 }
-                data->length = sizeof(double);
-                data->type = PLIST_DATE;
+            }
+            if (!strcmp(tag, "key") && !st->keyname && st->node_path && !strcmp(st->node_path->type, XPLIST_DICT)) {
+                /* in push mode the input is gone by the time the value follows */
+                if (!requires_free) {
+                    char *keyname = (char*)malloc(length + 1);
+                    if (!keyname) {
+                        ctx->err = PLIST_ERR_NO_MEM;
+                        goto err_out;
+                    }
+                    memcpy(keyname, str, length);
+                    keyname[length] = '\0';
+                    str = keyname;
+                }
+                st->keyname = str;
+                st->keylen = length;
+                return PLIST_ERR_SUCCESS;
+            }
+            if (requires_free) {
+                xml_value_owned(ctx, st, tag, PLIST_STRING, str, length);
             } else {
-                PLIST_XML_ERR("Unexpected tag <%s%s> encountered\n", tag, (is_empty) ? "/" : "");
-                ctx->pos = ctx->end;
-                ctx->err = PLIST_ERR_PARSE;
-                goto err_out;
+                xml_value(ctx, st, tag, PLIST_STRING, str, length);
             }
-            if (subnode && !closing_tag) {
-                if (!*plist) {
-                    /* first value node inside <plist> */
-                    *plist = subnode;
-
-                    if (data->type == PLIST_DICT || data->type == PLIST_ARRAY) {
-                        parent = subnode;
-                    } else {
-                        /* scalar root: keep parsing until </plist> */
-                        parent = NULL;
+        } else if (!strcmp(tag, XPLIST_DATA)) {
+            uint8_t *buff = NULL;
+            size_t size = 0;
+            if (!is_empty) {
+                text_part_t first_part = { NULL, 0, 0, NULL };
+                text_part_t *tp = get_text_parts(ctx, tag, taglen, 1, &first_part);
+                if (!tp) {
+                    PLIST_XML_ERR("Could not parse text content for '%s' node\n", tag);
+                    text_parts_free((text_part_t*)first_part.next);
+                    ctx->err = PLIST_ERR_PARSE;
+                    goto err_out;
+                }
+                if (tp->begin) {
+                    /* decode all parts directly into the data buffer */
+                    size_t total = 0;
+                    text_part_t *part;
+                    for (part = tp; part && part->begin; part = (text_part_t*)part->next) {
+                        total += part->length;
                     }
-                } else if (parent) {
-                    switch (plist_get_node_type(parent)) {
-                    case PLIST_DICT:
-                        if (!keyname) {
-                            PLIST_XML_ERR("missing key name while adding dict item\n");
-                            ctx->err = PLIST_ERR_PARSE;
+                    if (total > 0) {
+                        size_t bufsize = BASE64_DECODE_MAX_SIZE(total);
+                        base64_decoder_t dec;
+                        buff = (uint8_t*)malloc(bufsize);
+                        if (!buff) {
+                            text_parts_free((text_part_t*)first_part.next);
+                            PLIST_XML_ERR("failed to decode base64 stream\n");
+                            ctx->err = PLIST_ERR_NO_MEM;
                             goto err_out;
                         }
-                        plist_dict_set_item(parent, keyname, subnode);
-                        break;
-                    case PLIST_ARRAY:
-                        plist_array_append_item(parent, subnode);
-                        break;
-                    default:
-                        /* should not happen */
-                        PLIST_XML_ERR("parent is not a structured node\n");
-                        ctx->err = PLIST_ERR_PARSE;
-                        goto err_out;
+                        base64decode_init(&dec);
+                        for (part = tp; part && part->begin; part = (text_part_t*)part->next) {
+                            size += base64decode_update(&dec, buff + size, bufsize - size, part->begin, part->length);
+                        }
                     }
-                } else {
-                    /* We already produced root, and we're not inside a container */
-                    PLIST_XML_ERR("Unexpected tag <%s> found while </plist> is expected\n", tag);
+                }
+                text_parts_free((text_part_t*)first_part.next);
+            }
+            if (buff) {
+                xml_value_owned(ctx, st, tag, PLIST_DATA, buff, size);
+            } else {
+                xml_value(ctx, st, tag, PLIST_DATA, "", 0);
+            }
+        } else if (!strcmp(tag, XPLIST_DATE)) {
+            double realval = 0;
+            if (!is_empty) {
+                text_part_t first_part = { NULL, 0, 0, NULL };
+                text_part_t *tp = get_text_parts(ctx, tag, taglen, 1, &first_part);
+                if (!tp) {
+                    PLIST_XML_ERR("Could not parse text content for '%s' node\n", tag);
+                    text_parts_free((text_part_t*)first_part.next);
                     ctx->err = PLIST_ERR_PARSE;
                     goto err_out;
                 }
-                if (!is_empty && (data->type == PLIST_DICT || data->type == PLIST_ARRAY)) {
-                    if (depth >= PLIST_MAX_NESTING_DEPTH) {
-                        PLIST_XML_ERR("maximum nesting depth (%u) exceeded\n", (unsigned)PLIST_MAX_NESTING_DEPTH);
-                        ctx->err = PLIST_ERR_MAX_NESTING;
+                Time64_T timev = 0;
+                if (tp->begin) {
+                    char *str_content = text_parts_get_content(tp, 0, 1, NULL, NULL);
+                    if (!str_content) {
+                        PLIST_XML_ERR("Could not get text content for '%s' node\n", tag);
+                        text_parts_free((text_part_t*)first_part.next);
+                        ctx->err = PLIST_ERR_PARSE;
                         goto err_out;
                     }
-                    struct node_path_item *path_item = (struct node_path_item*)malloc(sizeof(struct node_path_item));
-                    if (!path_item) {
-                        PLIST_XML_ERR("out of memory when allocating node path item\n");
+                    struct TM btime;
+                    if (parse_date(str_content, &btime) < 0) {
+                        PLIST_XML_ERR("Failed to parse date node\n");
+                        text_parts_free((text_part_t*)first_part.next);
                         ctx->err = PLIST_ERR_PARSE;
+                        free(str_content);
                         goto err_out;
                     }
-                    path_item->type = (data->type == PLIST_DICT) ? XPLIST_DICT : XPLIST_ARRAY;
-                    path_item->prev = node_path;
-                    node_path = path_item;
-
-                    depth++;
-                    parent = subnode;
+                    timev = timegm64(&btime);
+                    free(str_content);
                 } else {
-                    /* If we inserted a child scalar into a container, nothing to push. */
+                    is_empty = 1;
                 }
-                subnode = NULL;
+                text_parts_free((text_part_t*)first_part.next);
+                realval = (double)(timev - MAC_EPOCH);
             }
-handle_closing:
-            if (closing_tag) {
-                if (!node_path) {
-                    PLIST_XML_ERR("node path is empty while trying to match closing tag with opening tag\n");
-                    ctx->err = PLIST_ERR_PARSE;
-                    goto err_out;
-                }
-                if (strcmp(node_path->type, tag+1) != 0) {
-                    PLIST_XML_ERR("unexpected %s found (for opening %s)\n", tag, node_path->type);
-                    ctx->err = PLIST_ERR_PARSE;
-                    goto err_out;
-                }
-
-                /* When closing a dictionary, convert a single-entry
-                   { "CF$UID" : <integer> } dictionary into a PLIST_UID node.
-                   Perform the conversion before moving to the parent node. */
-                if (!strcmp(node_path->type, XPLIST_DICT) && parent && plist_get_node_type(parent) == PLIST_DICT) {
-                    if (plist_dict_get_size(parent) == 1) {
-                        plist_t uid = plist_dict_get_item(parent, "CF$UID");
-                        if (uid) {
-                            uint64_t val = 0;
-                            if (plist_get_node_type(uid) != PLIST_INT) {
-                                ctx->err = PLIST_ERR_PARSE;
-                                PLIST_XML_ERR("Invalid node type for CF$UID dict entry (must be PLIST_INT)\n");
-                                goto err_out;
-                            }
-                            plist_get_uint_val(uid, &val);
-                            plist_set_uid_val(parent, val);
-                        }
-                    }
-                }
-
-                if (depth > 0) depth--;
-                struct node_path_item *path_item = node_path;
-                node_path = (struct node_path_item*)node_path->prev;
-                free(path_item);
-                parent = (parent) ? ((node_t)parent)->parent : NULL;
+            if (is_empty) {
+                PLIST_XML_ERR("Encountered empty " XPLIST_DATE " tag\n");
+                ctx->err = PLIST_ERR_PARSE;
+                goto err_out;
             }
-            free(keyname);
-            keyname = NULL;
-            plist_free(subnode);
-            subnode = NULL;
+            xml_value(ctx, st, tag, PLIST_DATE, &realval, sizeof(double));
+        } else {
+            PLIST_XML_ERR("Unexpected tag <%s%s> encountered\n", tag, (is_empty) ? "/" : "");
+            ctx->pos = ctx->end;
+            ctx->err = PLIST_ERR_PARSE;
+            goto err_out;
         }
     }
 
-    if (node_path) {
-        PLIST_XML_ERR("EOF encountered while </%s> was expected\n", node_path->type);
+err_out:
+    return ctx->err;
+}
+
+/* checks that the document is complete and resets st for the next one */
+static plist_err_t node_from_xml_finish(parse_ctx ctx, struct xml_parse_state *st)
+{
+    if (!ctx->err && st->node_path) {
+        PLIST_XML_ERR("EOF encountered while </%s> was expected\n", st->node_path->type);
         ctx->err = PLIST_ERR_PARSE;
     }
 
-err_out:
-    free(keyname);
-    plist_free(subnode);
+    free(st->keyname);
+    st->keyname = NULL;
 
     /* clean up node_path if required */
-    while (node_path) {
-        struct node_path_item *path_item = node_path;
-        node_path = (struct node_path_item*)path_item->prev;
+    while (st->node_path) {
+        struct node_path_item *path_item = st->node_path;
+        st->node_path = (struct node_path_item*)path_item->prev;
         free(path_item);
     }
+    st->depth = 0;
+    st->have_root = 0;
 
-    if (ctx->err != PLIST_ERR_SUCCESS) {
-        plist_free(*plist);
-        *plist = NULL;
-        return ctx->err;
+    return ctx->err;
+}
+
+plist_err_t plist_xml_parse_events(const char *plist_xml, uint64_t length, const plist_event_handler_t *handler, void *user_data)
+{
+    if (!plist_xml || (length == 0) || !handler) {
+        return PLIST_ERR_INVALID_ARG;
     }
 
-    /* check if we have a UID "dict" so we can replace it with a proper UID node */
-    if (PLIST_IS_DICT(*plist) && plist_dict_get_size(*plist) == 1) {
-        plist_t value = plist_dict_get_item(*plist, "CF$UID");
-        if (PLIST_IS_INT(value)) {
-            uint64_t u64val = 0;
-            plist_get_uint_val(value, &u64val);
-            plist_free(*plist);
-            *plist = plist_new_uid(u64val);
+    struct _parse_ctx ctx = { plist_xml, plist_xml + length, PLIST_ERR_SUCCESS };
+    struct xml_parse_state st = { handler, user_data, NULL, 0, NULL, 0, 0 };
+
+    while (ctx.pos < ctx.end && !ctx.err) {
+        parse_skip_ws(&ctx);
+        if (ctx.pos >= ctx.end) {
+            break;
         }
+        node_from_xml_item(&ctx, &st);
     }
 
-    return PLIST_ERR_SUCCESS;
+    return node_from_xml_finish(&ctx, &st);
 }
 
 plist_err_t plist_from_xml(const char *plist_xml, uint32_t length, plist_t * plist)
+{
+    return plist_from_xml64(plist_xml, length, plist);
+}
+
+plist_err_t plist_from_xml64(const char *plist_xml, uint64_t length, plist_t * plist)
+{
+    return plist_from_xml_with_options(plist_xml, length, plist, PLIST_PARSE_NONE);
+}
+
+plist_err_t plist_from_xml_with_options(const char *plist_xml, uint64_t length, plist_t * plist, plist_parse_options_t options)
 {
     if (!plist) {
         return PLIST_ERR_INVALID_ARG;
@@ -1644,7 +1684,332 @@ plist_err_t plist_from_xml(const char *plist_xml, uint32_t length, plist_t * pli
         return PLIST_ERR_INVALID_ARG;
     }
 
-    struct _parse_ctx ctx = { plist_xml, plist_xml + length, PLIST_ERR_SUCCESS };
+    hashtable_t *keys = NULL;
+    if (options & PLIST_PARSE_INTERN_KEYS) {
+        keys = plist_key_table_new();
+        if (!keys) {
+            return PLIST_ERR_NO_MEM;
+        }
+    }
+
+    struct plist_tree_builder tb;
+    plist_tree_builder_init(&tb, keys, 1);
+    plist_err_t err = plist_xml_parse_events(plist_xml, length, &plist_tree_builder_handler, &tb);
+    err = plist_tree_builder_finish(&tb, err, plist);
+    if (keys) {
+        plist_key_table_free(keys);
+    }
+    return err;
+}
+
+/* quote-aware search for str in [p, end), matching what find_str() accepts;
+ * returns NULL if the data ends before str is found */
+static const char* xml_scan_str(const char *p, const char *end, const char *str, size_t len, int skip_quotes)
+{
+    char set[2] = { str[0], '"' };
+    while (p < end) {
+        p = char_scan_find_any(p, end, set, (skip_quotes) ? 2 : 1);
+        if (p >= end) {
+            return NULL;
+        }
+        if (*p == str[0]) {
+            if ((size_t)(end - p) < len) {
+                return NULL;
+            }
+            if (!memcmp(p, str, len)) {
+                return p;
+            }
+        } else {
+            p = char_scan_find_any(p+1, end, "\"", 1);
+            if (p >= end) {
+                return NULL;
+            }
+        }
+        p++;
+    }
+    return NULL;
+}
+
+/* quote-aware search for any of the given characters, like find_next() */
+static const char* xml_scan_any(const char *p, const char *end, const char *chars, int numchars)
+{
+    char set[CHAR_SCAN_MAX_SET];
+    assert(numchars < CHAR_SCAN_MAX_SET);
+    memcpy(set, chars, numchars);
+    set[numchars] = '"';
+    while (p < end) {
+        p = char_scan_find_any(p, end, set, numchars+1);
+        if (p >= end) {
+            return NULL;
+        }
+        if (*p != '"') {
+            return p;
+        }
+        p = char_scan_find_any(p+1, end, "\"", 1);
+        if (p >= end) {
+            return NULL;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+static int xml_is_value_tag(const char *name, size_t len)
+{
+    static const char *value_tags[] = { XPLIST_INT, XPLIST_REAL, XPLIST_TRUE, XPLIST_FALSE, XPLIST_STRING, XPLIST_KEY, XPLIST_DATA, XPLIST_DATE };
+    size_t i;
+    for (i = 0; i < sizeof(value_tags)/sizeof(value_tags[0]); i++) {
+        if (strlen(value_tags[i]) == len && !memcmp(value_tags[i], name, len)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Checks whether the markup item starting at p (not whitespace) has been
+ * received completely, i.e. whether node_from_xml_item() can handle it
+ * without running into the end of the buffer. Returns 0 if more data is
+ * needed. Malformed input counts as complete so that the parser reports it. */
+static int xml_item_complete(const char *p, const char *end)
+{
+    const char *q = NULL;
+    const char *name = NULL;
+    size_t namelen = 0;
+
+    if (*p != '<') {
+        return 1;
+    }
+    if (++p >= end) {
+        return 0;
+    }
+    if (*p == '?') {
+        return xml_scan_str(p, end, "?>", 2, 1) != NULL;
+    }
+    if (*p == '!') {
+        if (end - p > 3 && !strncmp(p, "!--", 3)) {
+            return xml_scan_str(p+3, end, "-->", 3, 0) != NULL;
+        }
+        if (end - p <= 8) {
+            return 0;
+        }
+        if (strncmp(p, "!DOCTYPE", 8) != 0) {
+            return 1;
+        }
+        q = xml_scan_any(p+8, end, "[>", 2);
+        if (!q) {
+            return 0;
+        }
+        if (*q == '>') {
+            return 1;
+        }
+        return xml_scan_str(q, end, "]>", 2, 1) != NULL;
+    }
+
+    /* start tag */
+    name = p;
+    q = char_scan_find_any(p, end, " \r\n\t<>", 6);
+    if (q >= end) {
+        return 0;
+    }
+    namelen = q - name;
+    if (*q != '>') {
+        q = xml_scan_any(q, end, "<>", 2);
+        if (!q) {
+            return 0;
+        }
+        if (*q == '<') {
+            return 1;
+        }
+    }
+    if (*(q-1) == '/' || !xml_is_value_tag(name, namelen)) {
+        return 1;
+    }
+
+    /* text content up to the closing tag, see get_text_parts() */
+    p = q+1;
+    do {
+        p = char_scan_find_any(p, end, "<", 1);
+        if (p >= end || ++p >= end) {
+            return 0;
+        }
+        if (*p == '!') {
+            p++;
+            if (p >= end-1) {
+                return 0;
+            }
+            if (*p == '-' && *(p+1) == '-') {
+                p = xml_scan_str(p+2, end, "-->", 3, 0);
+                if (!p) {
+                    return 0;
+                }
+                p += 3;
+            } else if (*p == '[') {
+                p++;
+                if (end - p <= 8) {
+                    return 0;
+                }
+                if (strncmp(p, "CDATA[", 6) != 0) {
+                    return 1;
+                }
+                p = xml_scan_str(p+6, end, "]]>", 3, 0);
+                if (!p) {
+                    return 0;
+                }
+                p += 3;
+            } else {
+                return 1;
+            }
+        } else if (*p == '/') {
+            break;
+        } else {
+            return 1;
+        }
+    } while (1);
+    p++;
+    if ((size_t)(end - p) <= namelen) {
+        return 0;
+    }
+    if (memcmp(p, name, namelen) != 0) {
+        return 1;
+    }
+    p = char_scan_skip_ws(p + namelen, end);
+    return p < end;
+}
+
+struct plist_xml_parser_s {
+    struct xml_parse_state st;
+    struct plist_tree_builder tb;
+    plist_err_t err;
+    char *buf;
+    size_t len;
+    size_t capacity;
+    uint64_t total;
+    int stalled;
+};
+
+plist_xml_parser_t plist_xml_parser_new(void)
+{
+    struct plist_xml_parser_s *xp = (struct plist_xml_parser_s*)calloc(1, sizeof(struct plist_xml_parser_s));
+    if (!xp) {
+        return NULL;
+    }
+    plist_tree_builder_init(&xp->tb, NULL, 1);
+    xp->st.handler = &plist_tree_builder_handler;
+    xp->st.user_data = &xp->tb;
+    return (plist_xml_parser_t)xp;
+}
+
+plist_err_t plist_xml_parser_feed(plist_xml_parser_t parser, const char *buf, size_t len)
+{
+    struct plist_xml_parser_s *xp = (struct plist_xml_parser_s*)parser;
+    if (!xp || (!buf && len > 0)) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+    if (xp->err != PLIST_ERR_SUCCESS) {
+        return xp->err;
+    }
+    if (len == 0) {
+        return PLIST_ERR_SUCCESS;
+    }
+    if (len > SIZE_MAX - xp->len) {
+        xp->err = PLIST_ERR_NO_MEM;
+        return xp->err;
+    }
+    if (xp->len + len > xp->capacity) {
+        size_t newcap = (xp->capacity > 0) ? xp->capacity : 4096;
+        while (newcap < xp->len + len) {
+            newcap = (newcap > SIZE_MAX / 2) ? xp->len + len : newcap * 2;
+        }
+        char *newbuf = (char*)realloc(xp->buf, newcap);
+        if (!newbuf) {
+            xp->err = PLIST_ERR_NO_MEM;
+            return xp->err;
+        }
+        xp->buf = newbuf;
+        xp->capacity = newcap;
+    }
+    memcpy(xp->buf + xp->len, buf, len);
+    xp->len += len;
+    xp->total += len;
+
+    /* every markup item ends with '>', so an item that was incomplete
+     * before can't be complete now unless the new data contains one */
+    if (xp->stalled && !memchr(buf, '>', len)) {
+        return PLIST_ERR_SUCCESS;
+    }
+    xp->stalled = 0;
+
+    struct _parse_ctx ctx = { xp->buf, xp->buf + xp->len, PLIST_ERR_SUCCESS };
+    while (ctx.pos < ctx.end) {
+        parse_skip_ws(&ctx);
+        if (ctx.pos >= ctx.end) {
+            break;
+        }
+        if (!xml_item_complete(ctx.pos, ctx.end)) {
+            xp->stalled = 1;
+            break;
+        }
+        if (node_from_xml_item(&ctx, &xp->st) != PLIST_ERR_SUCCESS) {
+            xp->err = ctx.err;
+            return xp->err;
+        }
+    }
+
+    /* only keep the data that hasn't been consumed yet */
+    size_t consumed = ctx.pos - xp->buf;
+    if (consumed > 0) {
+        memmove(xp->buf, ctx.pos, xp->len - consumed);
+        xp->len -= consumed;
+    }
+
+    return PLIST_ERR_SUCCESS;
+}
+
+plist_err_t plist_xml_parser_finish(plist_xml_parser_t parser, plist_t *plist)
+{
+    struct plist_xml_parser_s *xp = (struct plist_xml_parser_s*)parser;
+    if (!xp || !plist) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+    *plist = NULL;
+
+    struct _parse_ctx ctx = { xp->buf, xp->buf + xp->len, xp->err };
+    if (ctx.err == PLIST_ERR_SUCCESS && xp->total == 0) {
+        ctx.err = PLIST_ERR_INVALID_ARG;
+    }
+    while (ctx.pos < ctx.end && !ctx.err) {
+        parse_skip_ws(&ctx);
+        if (ctx.pos >= ctx.end) {
+            break;
+        }
+        node_from_xml_item(&ctx, &xp->st);
+    }
+    plist_err_t err = node_from_xml_finish(&ctx, &xp->st);
+    err = plist_tree_builder_finish(&xp->tb, err, plist);
 
-    return node_from_xml(&ctx, plist);
+    /* reset for the next document */
+    xp->err = PLIST_ERR_SUCCESS;
+    xp->len = 0;
+    xp->total = 0;
+    xp->stalled = 0;
+
+    return err;
+}
+
+void plist_xml_parser_free(plist_xml_parser_t parser)
+{
+    struct plist_xml_parser_s *xp = (struct plist_xml_parser_s*)parser;
+    if (!xp) {
+        return;
+    }
+    free(xp->st.keyname);
+    while (xp->st.node_path) {
+        struct node_path_item *path_item = xp->st.node_path;
+        xp->st.node_path = path_item->prev;
+        free(path_item);
+    }
+    plist_free(xp->tb.root);
+    free(xp->tb.key);
+    free(xp->buf);
+    free(xp);
 }
@@ -0,0 +1,189 @@
+/*
+ * bin_depth_test.c
+ * checks nesting depth and circular reference detection of the binary
+ * plist parser on generated chains of nested arrays, and that the text
+ * writers accept the deepest tree the API allows to build
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <plist/plist.h>
+
+/* same as PLIST_MAX_NESTING_DEPTH in the library */
+#define MAX_DEPTH 512
+
+static void put_be(unsigned char *p, unsigned int size, uint64_t val)
+{
+	while (size--) {
+		p[size] = (unsigned char)(val & 0xFF);
+		val >>= 8;
+	}
+}
+
+/*
+ * Writes a binary plist of num arrays where array i refers to array i+1
+ * and the last array refers to object last_ref (or is empty if last_ref is
+ * negative). The first SHARED_LEVELS arrays hold their child twice, so the
+ * same objects are reached on different paths without forming a cycle.
+ */
+#define SHARED_LEVELS 6
+
+static char *make_chain(uint32_t num, int64_t last_ref, uint64_t *len)
+{
+	uint64_t size = 8 + (uint64_t)num * 5 + (uint64_t)num * 4 + 32;
+	unsigned char *buf = (unsigned char*)calloc(1, size);
+	unsigned char *p;
+	uint32_t i;
+	if (!buf) {
+		return NULL;
+	}
+	memcpy(buf, "bplist00", 8);
+	p = buf + 8;
+	for (i = 0; i < num; i++) {
+		if (i < num - 1 && i < SHARED_LEVELS) {
+			*p++ = 0xA2;
+			put_be(p, 2, i + 1);
+			put_be(p + 2, 2, i + 1);
+			p += 4;
+		} else if (i < num - 1) {
+			*p++ = 0xA1;
+			put_be(p, 2, i + 1);
+			p += 2;
+		} else if (last_ref >= 0) {
+			*p++ = 0xA1;
+			put_be(p, 2, (uint64_t)last_ref);
+			p += 2;
+		} else {
+			*p++ = 0xA0;
+		}
+	}
+	unsigned char *offsets = p;
+	for (i = 0, p = buf + 8; i < num; i++) {
+		put_be(offsets + i * 4, 4, (uint64_t)(p - buf));
+		p += (*p == 0xA2) ? 5 : ((*p == 0xA1) ? 3 : 1);
+	}
+	p = offsets + num * 4;
+	p[6] = 4;
+	p[7] = 2;
+	put_be(p + 8, 8, num);
+	put_be(p + 16, 8, 0);
+	put_be(p + 24, 8, (uint64_t)(offsets - buf));
+	*len = (uint64_t)(p + 32 - buf);
+	return (char*)buf;
+}
+
+static uint32_t get_depth(plist_t node)
+{
+	uint32_t depth = 0;
+	while (plist_get_node_type(node) == PLIST_ARRAY && plist_array_get_size(node) > 0) {
+		node = plist_array_get_item(node, 0);
+		depth++;
+	}
+	return depth;
+}
+
+static int check(const char *what, uint32_t num, int64_t last_ref, plist_err_t expected)
+{
+	static const plist_parse_options_t options[] = { PLIST_PARSE_NONE, PLIST_PARSE_ARENA, PLIST_PARSE_LAZY };
+	uint64_t len = 0;
+	char *bin = make_chain(num, last_ref, &len);
+	unsigned int i;
+	int err = 0;
+	if (!bin) {
+		printf("ERROR: %s: out of memory\n", what);
+		return -1;
+	}
+	for (i = 0; i < sizeof(options)/sizeof(options[0]); i++) {
+		plist_t root = NULL;
+		plist_err_t res = plist_from_memory_ex(bin, len, &root, NULL, options[i]);
+		uint32_t depth = 0;
+		if (res == PLIST_ERR_SUCCESS && options[i] == PLIST_PARSE_LAZY && expected != PLIST_ERR_SUCCESS) {
+			/* errors only show up on access, as an empty container */
+			depth = get_depth(root);
+			if (depth <= num - 1) {
+				res = expected;
+			}
+		} else if (res == PLIST_ERR_SUCCESS) {
+			depth = get_depth(root);
+		}
+		if (res != expected) {
+			printf("ERROR: %s (options %d): got %d, expected %d\n", what, options[i], res, expected);
+			err = -1;
+		} else if (res == PLIST_ERR_SUCCESS && depth != num - 1) {
+			printf("ERROR: %s (options %d): depth %u, expected %u\n", what, options[i], depth, num - 1);
+			err = -1;
+		}
+		plist_free(root);
+	}
+	if (plist_validate_bin(bin, len, NULL, NULL) != expected) {
+		printf("ERROR: %s: validation did not return %d\n", what, expected);
+		err = -1;
+	}
+	if (!err) {
+		printf("SUCCESS: %s\n", what);
+	}
+	free(bin);
+	return err;
+}
+
+/* all text writers must write num nested arrays or fail with expected */
+static int check_write(const char *what, uint32_t num, plist_err_t expected)
+{
+	static const plist_format_t formats[] = { PLIST_FORMAT_XML, PLIST_FORMAT_JSON, PLIST_FORMAT_OSTEP, PLIST_FORMAT_PRINT, PLIST_FORMAT_LIMD, PLIST_FORMAT_PLUTIL };
+	plist_t root = plist_new_array();
+	plist_t node = root;
+	unsigned int i;
+	int err = 0;
+
+	for (i = 1; i < num; i++) {
+		plist_t child = plist_new_array();
+		plist_array_append_item(node, child);
+		node = child;
+	}
+	for (i = 0; i < sizeof(formats)/sizeof(formats[0]); i++) {
+		char *out = NULL;
+		uint32_t len = 0;
+		plist_err_t res = plist_write_to_string(root, &out, &len, formats[i], PLIST_OPT_NONE);
+		if (res != expected || (res == PLIST_ERR_SUCCESS) != (out != NULL)) {
+			printf("ERROR: %s: format %d: got error %d, expected %d\n", what, formats[i], res, expected);
+			err = -1;
+		}
+		plist_mem_free(out);
+	}
+	plist_free(root);
+	if (!err) {
+		printf("SUCCESS: %s (writers)\n", what);
+	}
+	return err;
+}
+
+int main(int argc, char** argv)
+{
+	int err = 0;
+
+	err |= check("maximum depth", MAX_DEPTH + 1, -1, PLIST_ERR_SUCCESS);
+	err |= check("too deep", MAX_DEPTH + 2, -1, PLIST_ERR_MAX_NESTING);
+	err |= check("much too deep", 60000, -1, PLIST_ERR_MAX_NESTING);
+	err |= check("cycle to root", 100, 0, PLIST_ERR_CIRCULAR_REF);
+	err |= check("cycle to parent", 100, 98, PLIST_ERR_CIRCULAR_REF);
+	err |= check("self reference", 100, 99, PLIST_ERR_CIRCULAR_REF);
+	err |= check_write("maximum depth", MAX_DEPTH + 1, PLIST_ERR_SUCCESS);
+
+	return (err) ? 1 : 0;
+}
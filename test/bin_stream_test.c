@@ -0,0 +1,344 @@
+/*
+ * bin_stream_test.c
+ * checks that the streaming and 64-bit binary plist writers produce
+ * the same output as plist_to_bin()
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <plist/plist.h>
+
+struct sink {
+	char *buf;
+	size_t len;
+	size_t capacity;
+	size_t limit;
+	unsigned int calls;
+};
+
+static size_t sink_write(const void *buf, size_t len, void *user_data)
+{
+	struct sink *s = (struct sink*)user_data;
+	s->calls++;
+	if (s->limit && s->len + len > s->limit) {
+		return 0;
+	}
+	if (s->len + len > s->capacity) {
+		size_t newcap = (s->capacity) ? s->capacity : 4096;
+		while (newcap < s->len + len) newcap <<= 1;
+		char *newbuf = (char*)realloc(s->buf, newcap);
+		if (!newbuf) return 0;
+		s->buf = newbuf;
+		s->capacity = newcap;
+	}
+	memcpy(s->buf + s->len, buf, len);
+	s->len += len;
+	return len;
+}
+
+static int compare_output(const char *what, const char *a, size_t len_a, const char *b, size_t len_b)
+{
+	if (len_a != len_b || memcmp(a, b, len_a) != 0) {
+		printf("ERROR: %s: output differs\n", what);
+		return -1;
+	}
+	printf("SUCCESS: %s\n", what);
+	return 0;
+}
+
+/* equal data values are written once, wherever they are allocated */
+static int check_data_merge(void)
+{
+	plist_t array = plist_new_array();
+	char *bin = NULL;
+	uint32_t bin_len = 0;
+	uint64_t num_objects = 0;
+	int i;
+	for (i = 0; i < 16; i++) {
+		plist_array_append_item(array, plist_new_data("payload", 7));
+	}
+	plist_to_bin(array, &bin, &bin_len);
+	plist_free(array);
+	/* the object count is stored big-endian in the trailer */
+	for (i = 0; bin && bin_len >= 32 && i < 8; i++) {
+		num_objects = (num_objects << 8) | (unsigned char)bin[bin_len - 24 + i];
+	}
+	plist_mem_free(bin);
+	if (num_objects != 2) {
+		printf("ERROR: 16 equal data values were written as %" PRIu64 " objects with their array\n", num_objects);
+		return -1;
+	}
+	printf("SUCCESS: equal data values merged\n");
+	return 0;
+}
+
+/* enough objects to be split across several threads */
+static plist_t new_large_plist(void)
+{
+	plist_t root = plist_new_dict();
+	plist_t items = plist_new_array();
+	uint32_t i;
+	for (i = 0; i < 20000; i++) {
+		char str[64];
+		uint8_t data[40];
+		plist_t item = plist_new_dict();
+		snprintf(str, sizeof(str), "item %u", i);
+		plist_dict_set_item(item, "Name", plist_new_string(str));
+		snprintf(str, sizeof(str), "\xc3\xa4\xc3\xb6\xc3\xbc %u", i % 100);
+		plist_dict_set_item(item, "Label", plist_new_string(str));
+		plist_dict_set_item(item, "Index", plist_new_uint(i));
+		plist_dict_set_item(item, "Value", plist_new_real(i / 3.0));
+		memset(data, (int)(i & 0xFF), sizeof(data));
+		plist_dict_set_item(item, "Blob", plist_new_data((const char*)data, (i % 7) * 6));
+		plist_array_append_item(items, item);
+	}
+	plist_dict_set_item(root, "Items", items);
+	return root;
+}
+
+static int check_threads(const char *what, plist_t root)
+{
+	static const unsigned int threads[] = { 2, 3, 8, 0 };
+	char *bin = NULL;
+	uint64_t bin_len = 0;
+	unsigned int i;
+	int err = 0;
+	if (plist_to_bin_ex(root, &bin, &bin_len, PLIST_OPT_NONE, 1) != PLIST_ERR_SUCCESS) {
+		printf("ERROR: %s: plist_to_bin_ex failed\n", what);
+		return -1;
+	}
+	for (i = 0; i < sizeof(threads)/sizeof(threads[0]); i++) {
+		char name[64];
+		char *out = NULL;
+		uint64_t out_len = 0;
+		snprintf(name, sizeof(name), "%s, %u threads", what, threads[i]);
+		if (plist_to_bin_ex(root, &out, &out_len, PLIST_OPT_NONE, threads[i]) != PLIST_ERR_SUCCESS) {
+			printf("ERROR: %s: plist_to_bin_ex failed\n", name);
+			err = -1;
+			continue;
+		}
+		err |= compare_output(name, bin, bin_len, out, out_len);
+		plist_mem_free(out);
+	}
+	plist_mem_free(bin);
+	return err;
+}
+
+static uint64_t get_be(const unsigned char *p, unsigned int size)
+{
+	uint64_t val = 0;
+	unsigned int i;
+	for (i = 0; i < size; i++) {
+		val = (val << 8) | p[i];
+	}
+	return val;
+}
+
+static void set_be(unsigned char *p, unsigned int size, uint64_t val)
+{
+	while (size--) {
+		p[size] = (unsigned char)(val & 0xFF);
+		val >>= 8;
+	}
+}
+
+static int check_parse_threads(const char *what, plist_t root)
+{
+	static const unsigned int threads[] = { 2, 3, 8, 0 };
+	char *bin = NULL;
+	uint64_t bin_len = 0;
+	plist_t parsed = NULL;
+	unsigned int i;
+	int err = 0;
+	if (plist_to_bin64(root, &bin, &bin_len) != PLIST_ERR_SUCCESS) {
+		printf("ERROR: %s: plist_to_bin64 failed\n", what);
+		return -1;
+	}
+	for (i = 0; i < sizeof(threads)/sizeof(threads[0]); i++) {
+		char name[64];
+		char *out = NULL;
+		uint64_t out_len = 0;
+		snprintf(name, sizeof(name), "%s, parsed with %u threads", what, threads[i]);
+		if (plist_from_bin_ex(bin, bin_len, &parsed, (i & 1) ? PLIST_PARSE_INTERN_KEYS : PLIST_PARSE_NONE, threads[i]) != PLIST_ERR_SUCCESS) {
+			printf("ERROR: %s: plist_from_bin_ex failed\n", name);
+			err = -1;
+			continue;
+		}
+		plist_to_bin64(parsed, &out, &out_len);
+		err |= compare_output(name, bin, bin_len, out, out_len);
+		plist_mem_free(out);
+		plist_free(parsed);
+	}
+
+	/* let an item deep down in the top level array refer to the array */
+	const unsigned char *trailer = (const unsigned char*)bin + bin_len - 32;
+	unsigned int offset_size = trailer[6];
+	unsigned int ref_size = trailer[7];
+	uint64_t num_objects = get_be(trailer + 8, 8);
+	uint64_t offset_table = get_be(trailer + 24, 8);
+	uint64_t array_index = 0;
+	unsigned char *array = NULL;
+	for (i = 0; i < num_objects && !array; i++) {
+		unsigned char *obj = (unsigned char*)bin + get_be((const unsigned char*)bin + offset_table + i * offset_size, offset_size);
+		if (obj[0] == 0xAF) {
+			array = obj;
+			array_index = i;
+		}
+	}
+	if (!array) {
+		printf("ERROR: %s: no large array found\n", what);
+		plist_mem_free(bin);
+		return -1;
+	}
+	uint64_t count = get_be(array + 2, 1 << (array[1] & 0xF));
+	unsigned char *refs = array + 2 + (1 << (array[1] & 0xF));
+	unsigned char *item = (unsigned char*)bin + get_be((const unsigned char*)bin + offset_table + get_be(refs + (count - count / 3) * ref_size, ref_size) * offset_size, offset_size);
+	/* the first value of the item dict */
+	set_be(item + 1 + (item[0] & 0xF) * ref_size, ref_size, array_index);
+
+	plist_err_t ref_err = plist_from_bin_ex(bin, bin_len, &parsed, PLIST_PARSE_NONE, 1);
+	if (ref_err != PLIST_ERR_CIRCULAR_REF) {
+		printf("ERROR: %s: circular reference not detected (%d)\n", what, ref_err);
+		err = -1;
+	}
+	for (i = 0; i < sizeof(threads)/sizeof(threads[0]); i++) {
+		plist_err_t res = plist_from_bin_ex(bin, bin_len, &parsed, PLIST_PARSE_NONE, threads[i]);
+		if (res != ref_err || parsed) {
+			printf("ERROR: %s: parsing with %u threads returned %d, expected %d\n", what, threads[i], res, ref_err);
+			plist_free(parsed);
+			err = -1;
+		}
+	}
+	if (!err) {
+		printf("SUCCESS: %s, circular reference\n", what);
+	}
+	plist_mem_free(bin);
+	return err;
+}
+
+int main(int argc, char** argv)
+{
+	plist_t root = NULL;
+	char *bin = NULL;
+	uint32_t bin_len = 0;
+	int err = 0;
+
+	if (argc < 2) {
+		printf("Usage: %s FILE|--large\n", argv[0]);
+		return 1;
+	}
+
+	if (!strcmp(argv[1], "--large")) {
+		/* threaded writer and parser on a generated plist */
+		plist_t large = new_large_plist();
+		err |= check_threads("large", large);
+		err |= check_parse_threads("large", large);
+		plist_free(large);
+		return (err) ? 1 : 0;
+	}
+
+	if (plist_read_from_file(argv[1], &root, NULL) != PLIST_ERR_SUCCESS) {
+		printf("ERROR: could not parse %s\n", argv[1]);
+		return 1;
+	}
+	if (plist_to_bin(root, &bin, &bin_len) != PLIST_ERR_SUCCESS) {
+		printf("ERROR: plist_to_bin failed\n");
+		plist_free(root);
+		return 1;
+	}
+
+	/* 64-bit length variants */
+	char *bin64 = NULL;
+	uint64_t bin64_len = 0;
+	if (plist_to_bin64(root, &bin64, &bin64_len) != PLIST_ERR_SUCCESS) {
+		printf("ERROR: plist_to_bin64 failed\n");
+		err = -1;
+	} else {
+		err |= compare_output("bin64", bin, bin_len, bin64, bin64_len);
+		plist_t root64 = NULL;
+		char *bin_again = NULL;
+		uint32_t bin_again_len = 0;
+		if (plist_from_memory64(bin64, bin64_len, &root64, NULL) != PLIST_ERR_SUCCESS) {
+			printf("ERROR: plist_from_memory64 failed\n");
+			err = -1;
+		} else {
+			plist_to_bin(root64, &bin_again, &bin_again_len);
+			err |= compare_output("from_memory64", bin, bin_len, bin_again, bin_again_len);
+			plist_mem_free(bin_again);
+			plist_free(root64);
+		}
+		plist_mem_free(bin64);
+	}
+
+	/* callback */
+	struct sink s = { 0 };
+	if (plist_to_bin_with_callback(root, sink_write, &s) != PLIST_ERR_SUCCESS) {
+		printf("ERROR: plist_to_bin_with_callback failed\n");
+		err = -1;
+	} else {
+		err |= compare_output("callback", bin, bin_len, s.buf, s.len);
+	}
+
+	/* a failing callback aborts the write */
+	size_t full_len = s.len;
+	s.len = 0;
+	s.limit = full_len / 2;
+	if (plist_to_bin_with_callback(root, sink_write, &s) != PLIST_ERR_IO) {
+		printf("ERROR: write error not reported\n");
+		err = -1;
+	} else {
+		printf("SUCCESS: write error\n");
+	}
+	free(s.buf);
+
+	/* FILE stream */
+	FILE *f = tmpfile();
+	if (!f) {
+		printf("ERROR: could not create temporary file\n");
+		err = -1;
+	} else {
+		if (plist_write_to_stream(root, f, PLIST_FORMAT_BINARY, PLIST_OPT_NONE) != PLIST_ERR_SUCCESS) {
+			printf("ERROR: plist_write_to_stream failed\n");
+			err = -1;
+		} else {
+			long flen = ftell(f);
+			char *fbuf = (char*)malloc((flen > 0) ? flen : 1);
+			rewind(f);
+			if (!fbuf || fread(fbuf, 1, flen, f) != (size_t)flen) {
+				printf("ERROR: could not read back temporary file\n");
+				err = -1;
+			} else {
+				err |= compare_output("stream", bin, bin_len, fbuf, flen);
+			}
+			free(fbuf);
+		}
+		fclose(f);
+	}
+
+	err |= check_data_merge();
+
+	/* threaded writer */
+	err |= check_threads(argv[1], root);
+
+	plist_mem_free(bin);
+	plist_free(root);
+
+	return (err) ? 1 : 0;
+}
@@ -0,0 +1,354 @@
+/*
+ * bin_unicode_test.c
+ * checks the UTF-8/UTF-16 conversion of strings in binary plists against
+ * a simple reference implementation, for all kinds of character mixes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <plist/plist.h>
+
+#define MAX_CHARS 300
+
+static uint32_t rnd_state = 1;
+
+static uint32_t rnd(void)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return rnd_state >> 8;
+}
+
+static size_t put_utf8(char *out, uint32_t c)
+{
+	if (c < 0x80) {
+		out[0] = (char)c;
+		return 1;
+	} else if (c < 0x800) {
+		out[0] = (char)(0xC0 | (c >> 6));
+		out[1] = (char)(0x80 | (c & 0x3F));
+		return 2;
+	} else if (c < 0x10000) {
+		out[0] = (char)(0xE0 | (c >> 12));
+		out[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+		out[2] = (char)(0x80 | (c & 0x3F));
+		return 3;
+	}
+	out[0] = (char)(0xF0 | (c >> 18));
+	out[1] = (char)(0x80 | ((c >> 12) & 0x3F));
+	out[2] = (char)(0x80 | ((c >> 6) & 0x3F));
+	out[3] = (char)(0x80 | (c & 0x3F));
+	return 4;
+}
+
+/* a random code point, mostly from one class so that long runs of
+ * characters of the same encoded length occur */
+static uint32_t random_char(unsigned int cls)
+{
+	uint32_t c;
+	if (rnd() % 8 == 0) {
+		cls = rnd() % 4;
+	}
+	switch (cls) {
+	case 0:
+		return 1 + rnd() % 0x7F;
+	case 1:
+		return 0x80 + rnd() % 0x780;
+	case 2:
+		do {
+			c = 0x800 + rnd() % 0xF800;
+		} while (c >= 0xD800 && c <= 0xDFFF);
+		return c;
+	default:
+		return 0x10000 + rnd() % 0x100000;
+	}
+}
+
+/* UTF-16 code units of valid UTF-8 */
+static size_t ref_utf16(uint16_t *out, const char *s, size_t len)
+{
+	const unsigned char *u = (const unsigned char*)s;
+	size_t i = 0, n = 0;
+	while (i < len) {
+		uint32_t c;
+		if (u[i] < 0x80) {
+			c = u[i++];
+		} else if (u[i] < 0xE0) {
+			c = ((uint32_t)(u[i] & 0x1F) << 6) | (u[i+1] & 0x3F);
+			i += 2;
+		} else if (u[i] < 0xF0) {
+			c = ((uint32_t)(u[i] & 0x0F) << 12) | ((uint32_t)(u[i+1] & 0x3F) << 6) | (u[i+2] & 0x3F);
+			i += 3;
+		} else {
+			c = ((uint32_t)(u[i] & 0x07) << 18) | ((uint32_t)(u[i+1] & 0x3F) << 12) | ((uint32_t)(u[i+2] & 0x3F) << 6) | (u[i+3] & 0x3F);
+			i += 4;
+		}
+		if (c >= 0x10000) {
+			c -= 0x10000;
+			out[n++] = (uint16_t)(0xD800 + (c >> 10));
+			out[n++] = (uint16_t)(0xDC00 + (c & 0x3FF));
+		} else {
+			out[n++] = (uint16_t)c;
+		}
+	}
+	return n;
+}
+
+/* the documented decoding of arbitrary UTF-16, unpaired surrogates are skipped */
+static size_t ref_utf8(char *out, const uint16_t *units, size_t num)
+{
+	size_t i, n = 0;
+	int lead = 0;
+	uint32_t w = 0;
+	for (i = 0; i < num; i++) {
+		uint32_t c = units[i];
+		if (c >= 0xD800 && c <= 0xDBFF) {
+			if (!lead) {
+				w = 0x10000 + ((c & 0x3FF) << 10);
+			}
+			lead = !lead;
+		} else if (c >= 0xDC00 && c <= 0xDFFF) {
+			if (lead) {
+				n += put_utf8(out + n, w | (c & 0x3FF));
+				lead = 0;
+			}
+		} else {
+			n += put_utf8(out + n, c);
+		}
+	}
+	return n;
+}
+
+/* position of the first object of a binary plist, i.e. the root */
+#define BPLIST_HEADER_SIZE 8
+
+static size_t object_length(const unsigned char *obj, size_t *hdr)
+{
+	if ((obj[0] & 0x0F) != 0x0F) {
+		*hdr = 1;
+		return obj[0] & 0x0F;
+	}
+	size_t nbytes = (size_t)1 << (obj[1] & 0x0F);
+	size_t len = 0, i;
+	for (i = 0; i < nbytes; i++) {
+		len = (len << 8) | obj[2 + i];
+	}
+	*hdr = 2 + nbytes;
+	return len;
+}
+
+static int check_write(const char *what, const char *str, size_t len)
+{
+	uint16_t expected[2 * MAX_CHARS];
+	size_t num = ref_utf16(expected, str, len);
+	int ascii = (num == len);
+	plist_t plist = plist_new_string(str);
+	plist_t parsed = NULL;
+	char *bin = NULL;
+	uint32_t bin_len = 0;
+	int err = 0;
+
+	plist_to_bin(plist, &bin, &bin_len);
+	if (!bin) {
+		printf("ERROR: %s: could not write binary plist\n", what);
+		plist_free(plist);
+		return -1;
+	}
+	const unsigned char *obj = (const unsigned char*)bin + BPLIST_HEADER_SIZE;
+	size_t hdr = 0;
+	size_t objlen = object_length(obj, &hdr);
+	if ((obj[0] >> 4) != (ascii ? 0x5 : 0x6) || objlen != num) {
+		printf("ERROR: %s: wrong marker 0x%02x or length %zu, expected %zu units\n", what, obj[0], objlen, num);
+		err = -1;
+	} else if (!ascii) {
+		size_t i;
+		for (i = 0; i < num; i++) {
+			if (((uint16_t)obj[hdr + 2*i] << 8 | obj[hdr + 2*i + 1]) != expected[i]) {
+				printf("ERROR: %s: code unit %zu differs\n", what, i);
+				err = -1;
+				break;
+			}
+		}
+	}
+
+	plist_from_bin(bin, bin_len, &parsed);
+	const char *val = plist_get_string_ptr(parsed, NULL);
+	if (!val || strlen(val) != len || memcmp(val, str, len) != 0) {
+		printf("ERROR: %s: round trip failed\n", what);
+		err = -1;
+	}
+	plist_free(parsed);
+	plist_mem_free(bin);
+	plist_free(plist);
+	return err;
+}
+
+static int check_strings(void)
+{
+	char str[4 * MAX_CHARS + 1];
+	unsigned int iter;
+	int err = 0;
+
+	for (iter = 0; iter < 4000 && !err; iter++) {
+		unsigned int num = rnd() % MAX_CHARS;
+		unsigned int cls = iter % 5;
+		size_t len = 0;
+		unsigned int i;
+		char what[64];
+		for (i = 0; i < num; i++) {
+			/* class 4 is mostly ASCII with the occasional other character */
+			len += put_utf8(str + len, random_char((cls == 4) ? 0 : cls));
+		}
+		str[len] = '\0';
+		snprintf(what, sizeof(what), "string %u", iter);
+		err |= check_write(what, str, len);
+	}
+	return err;
+}
+
+/* binary plist with a single UTF-16 string of num units as root */
+static char* make_bplist(const uint16_t *units, size_t num, size_t *size)
+{
+	char *bin = (char*)malloc(BPLIST_HEADER_SIZE + 7 + 2*num + 8 + 32);
+	size_t n = 0, i;
+	memcpy(bin, "bplist00", BPLIST_HEADER_SIZE);
+	n = BPLIST_HEADER_SIZE;
+	bin[n++] = (char)0x6F;
+	bin[n++] = 0x13;
+	for (i = 0; i < 8; i++) {
+		bin[n++] = (char)(((uint64_t)num >> (56 - 8*i)) & 0xFF);
+	}
+	for (i = 0; i < num; i++) {
+		bin[n++] = (char)(units[i] >> 8);
+		bin[n++] = (char)(units[i] & 0xFF);
+	}
+	size_t table = n;
+	bin[n++] = BPLIST_HEADER_SIZE;
+	memset(bin + n, 0, 32);
+	bin[n + 6] = 1;
+	bin[n + 7] = 1;
+	bin[n + 15] = 1;
+	for (i = 0; i < 8; i++) {
+		bin[n + 24 + i] = (char)(((uint64_t)table >> (56 - 8*i)) & 0xFF);
+	}
+	*size = n + 32;
+	return bin;
+}
+
+/* random code units including broken surrogate pairs must decode like the reference */
+static int check_read(void)
+{
+	uint16_t units[MAX_CHARS];
+	char expected[3 * MAX_CHARS];
+	unsigned int iter;
+	int err = 0;
+
+	for (iter = 0; iter < 4000 && !err; iter++) {
+		size_t num = 1 + rnd() % (MAX_CHARS - 1);
+		unsigned int cls = iter % 4;
+		size_t i, len, size = 0;
+		for (i = 0; i < num; i++) {
+			if (rnd() % 50 == 0) {
+				units[i] = (uint16_t)(0xD800 + rnd() % 0x800);
+			} else {
+				uint32_t c = random_char(cls);
+				if (c >= 0x10000 && i + 1 < num) {
+					c -= 0x10000;
+					units[i++] = (uint16_t)(0xD800 + (c >> 10));
+					units[i] = (uint16_t)(0xDC00 + (c & 0x3FF));
+				} else {
+					units[i] = (uint16_t)((c >= 0x10000) ? 'x' : c);
+				}
+			}
+		}
+		len = ref_utf8(expected, units, num);
+		char *bin = make_bplist(units, num, &size);
+		plist_t parsed = NULL;
+		plist_from_bin(bin, (uint32_t)size, &parsed);
+		const char *val = plist_get_string_ptr(parsed, NULL);
+		if (!val || strlen(val) != len || memcmp(val, expected, len) != 0) {
+			printf("ERROR: decoding %zu code units failed in iteration %u\n", num, iter);
+			err = -1;
+		}
+		plist_free(parsed);
+		free(bin);
+	}
+	return err;
+}
+
+/* writing stops at the first invalid UTF-8 sequence */
+static int check_invalid(void)
+{
+	static const char str[] = "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xc0\xaf" "abcdefghijklmnopqrstuvw";
+	plist_t plist = plist_new_string(str);
+	char *bin = NULL;
+	uint32_t bin_len = 0;
+	size_t hdr = 0;
+	int err = 0;
+
+	plist_to_bin(plist, &bin, &bin_len);
+	if (!bin || object_length((const unsigned char*)bin + BPLIST_HEADER_SIZE, &hdr) != 6) {
+		printf("ERROR: invalid UTF-8 was not cut off\n");
+		err = -1;
+	}
+	plist_mem_free(bin);
+	plist_free(plist);
+	return err;
+}
+
+/* the writer remembers whether a string is ASCII until it changes */
+static int check_changed(void)
+{
+	plist_t plist = plist_new_string("\xc3\xa4\xc3\xb6\xc3\xbc");
+	char *bin = NULL;
+	uint32_t bin_len = 0;
+	int err = 0;
+
+	plist_to_bin(plist, &bin, &bin_len);
+	if (!bin || ((unsigned char)bin[BPLIST_HEADER_SIZE] >> 4) != 0x6) {
+		printf("ERROR: non-ASCII string not written as UTF-16\n");
+		err = -1;
+	}
+	plist_mem_free(bin);
+	bin = NULL;
+	plist_set_string_val(plist, "abc");
+	plist_to_bin(plist, &bin, &bin_len);
+	if (!bin || ((unsigned char)bin[BPLIST_HEADER_SIZE] >> 4) != 0x5) {
+		printf("ERROR: changed string not written as ASCII\n");
+		err = -1;
+	}
+	plist_mem_free(bin);
+	plist_free(plist);
+	return err;
+}
+
+int main(int argc, char** argv)
+{
+	int err = 0;
+
+	err |= check_strings();
+	err |= check_read();
+	err |= check_invalid();
+	err |= check_changed();
+
+	if (err) {
+		return 1;
+	}
+	printf("SUCCESS\n");
+	return 0;
+}
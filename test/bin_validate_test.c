@@ -0,0 +1,208 @@
+/*
+ * bin_validate_test.c
+ * checks that plist_validate_bin() agrees with the binary parser, on the
+ * given files and on corrupted copies of them
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <plist/plist.h>
+
+#define NUM_MUTATIONS 2000
+
+static uint32_t rnd_state = 1;
+
+static uint32_t rnd(void)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return rnd_state >> 8;
+}
+
+/* counts the nodes like plist_bin_report_t does, keys included */
+static void count_nodes(plist_t node, uint32_t depth, uint64_t *nodes, uint32_t *max_depth)
+{
+	(*nodes)++;
+	if (depth > *max_depth) {
+		*max_depth = depth;
+	}
+	if (plist_get_node_type(node) == PLIST_ARRAY) {
+		uint32_t i;
+		for (i = 0; i < plist_array_get_size(node); i++) {
+			count_nodes(plist_array_get_item(node, i), depth + 1, nodes, max_depth);
+		}
+	} else if (plist_get_node_type(node) == PLIST_DICT) {
+		plist_dict_iter iter = NULL;
+		plist_t val = NULL;
+		plist_dict_new_iter(node, &iter);
+		do {
+			val = NULL;
+			plist_dict_next_item(node, iter, NULL, &val);
+			if (val) {
+				(*nodes)++;
+				count_nodes(val, depth + 1, nodes, max_depth);
+			}
+		} while (val);
+		free(iter);
+	}
+}
+
+/* validates buf and compares the outcome with a real parse */
+static int check(const char *name, const char *buf, uint64_t len, int verbose)
+{
+	plist_bin_report_t report;
+	plist_bin_limits_t limits;
+	plist_t root = NULL;
+	plist_err_t res = plist_validate_bin(buf, len, NULL, &report);
+	plist_err_t expected = plist_from_bin_ex(buf, len, &root, PLIST_PARSE_NONE, 1);
+	uint64_t nodes = 0;
+	uint32_t depth = 0;
+
+	if (res != expected) {
+		printf("ERROR: %s: validation returned %d, parsing %d\n", name, res, expected);
+		plist_free(root);
+		return -1;
+	}
+	if (!root) {
+		if (verbose) {
+			printf("SUCCESS: %s (result %d at offset %" PRIu64 ")\n", name, res, report.error_offset);
+		}
+		return 0;
+	}
+	count_nodes(root, 0, &nodes, &depth);
+	plist_free(root);
+	if (report.num_nodes != nodes || report.max_depth != depth) {
+		printf("ERROR: %s: reported %" PRIu64 " nodes and depth %u, parsed %" PRIu64 " nodes and depth %u\n", name, report.num_nodes, report.max_depth, nodes, depth);
+		return -1;
+	}
+
+	/* every limit is enforced */
+	memset(&limits, 0, sizeof(limits));
+	limits.max_nodes = nodes - 1;
+	if (nodes > 1 && plist_validate_bin(buf, len, &limits, NULL) != PLIST_ERR_LIMIT) {
+		printf("ERROR: %s: node limit not enforced\n", name);
+		return -1;
+	}
+	memset(&limits, 0, sizeof(limits));
+	limits.max_depth = depth - 1;
+	if (depth > 1 && plist_validate_bin(buf, len, &limits, NULL) != PLIST_ERR_MAX_NESTING) {
+		printf("ERROR: %s: depth limit not enforced\n", name);
+		return -1;
+	}
+	memset(&limits, 0, sizeof(limits));
+	limits.max_objects = report.num_objects - 1;
+	limits.max_string_bytes = report.string_bytes;
+	limits.max_data_bytes = report.data_bytes;
+	if (report.num_objects > 1 && plist_validate_bin(buf, len, &limits, NULL) != PLIST_ERR_LIMIT) {
+		printf("ERROR: %s: object limit not enforced\n", name);
+		return -1;
+	}
+	limits.max_objects = report.num_objects;
+	if (plist_validate_bin(buf, len, &limits, NULL) != PLIST_ERR_SUCCESS) {
+		printf("ERROR: %s: failed with limits that are not exceeded\n", name);
+		return -1;
+	}
+	if (verbose) {
+		printf("SUCCESS: %s (%" PRIu64 " objects, %" PRIu64 " nodes, depth %u)\n", name, report.num_objects, nodes, depth);
+	}
+	return 0;
+}
+
+static char *read_file(const char *path, uint64_t *len)
+{
+	FILE *f = fopen(path, "rb");
+	char *buf = NULL;
+	long size;
+	if (!f) {
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (size > 0) {
+		buf = (char*)malloc(size);
+		if (buf && fread(buf, 1, size, f) != (size_t)size) {
+			free(buf);
+			buf = NULL;
+		}
+	}
+	fclose(f);
+	*len = (buf) ? (uint64_t)size : 0;
+	return buf;
+}
+
+int main(int argc, char** argv)
+{
+	int err = 0;
+	int i;
+
+	if (argc < 2) {
+		printf("Usage: %s FILE...\n", argv[0]);
+		return 1;
+	}
+
+	for (i = 1; i < argc; i++) {
+		uint64_t len = 0;
+		char *buf = read_file(argv[i], &len);
+		char *copy;
+		int m;
+
+		if (!buf) {
+			printf("ERROR: could not read %s\n", argv[i]);
+			return 1;
+		}
+		if (!plist_is_binary(buf, (uint32_t)len)) {
+			/* other formats are converted first */
+			plist_t root = NULL;
+			uint32_t blen = 0;
+			plist_from_memory(buf, (uint32_t)len, &root, NULL);
+			free(buf);
+			buf = NULL;
+			plist_to_bin(root, &buf, &blen);
+			plist_free(root);
+			len = blen;
+			if (!buf) {
+				printf("ERROR: could not convert %s\n", argv[i]);
+				return 1;
+			}
+		}
+		if (check(argv[i], buf, len, 1) < 0) {
+			err = 1;
+		}
+
+		copy = (char*)malloc(len);
+		for (m = 0; m < NUM_MUTATIONS && copy; m++) {
+			int n = 1 + rnd() % 3;
+			char name[256];
+			memcpy(copy, buf, len);
+			while (n-- > 0) {
+				copy[rnd() % len] = (char)rnd();
+			}
+			snprintf(name, sizeof(name), "%s, mutation %d", argv[i], m);
+			if (check(name, copy, len, 0) < 0) {
+				err = 1;
+				break;
+			}
+		}
+		free(copy);
+		free(buf);
+	}
+
+	return err;
+}
@@ -0,0 +1,200 @@
+/*
+ * concurrent_test.c
+ * checks that several threads can write and read the same plist at once:
+ * writing and looking up items must not modify the tree
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include <plist/plist.h>
+
+#ifdef HAVE_PTHREAD
+#define NUM_THREADS 4
+#define NUM_ROUNDS 8
+#define NUM_ITEMS 2000
+
+static const struct {
+	plist_format_t format;
+	plist_write_options_t options;
+	unsigned int threads;
+	const char *name;
+} outputs[] = {
+	{ PLIST_FORMAT_BINARY, PLIST_OPT_NONE, 1, "binary" },
+	{ PLIST_FORMAT_BINARY, PLIST_OPT_NONE, 2, "binary, 2 threads" },
+	{ PLIST_FORMAT_XML, PLIST_OPT_NONE, 1, "xml" },
+	{ PLIST_FORMAT_JSON, PLIST_OPT_COERCE, 1, "json" },
+	{ PLIST_FORMAT_OSTEP, PLIST_OPT_COERCE, 1, "openstep" },
+	{ PLIST_FORMAT_LIMD, PLIST_OPT_NONE, 1, "limd" },
+};
+
+#define NUM_OUTPUTS (sizeof(outputs) / sizeof(outputs[0]))
+
+static plist_err_t write_plist(plist_t root, size_t i, char **out, uint64_t *len)
+{
+	if (outputs[i].format == PLIST_FORMAT_BINARY) {
+		return plist_to_bin_ex(root, out, len, outputs[i].options, outputs[i].threads);
+	}
+	return plist_write_to_string64(root, out, len, outputs[i].format, outputs[i].options);
+}
+
+/* large dicts (with a hash index), non-ASCII strings and repeated data */
+static plist_t new_plist(void)
+{
+	plist_t root = plist_new_dict();
+	plist_t items = plist_new_array();
+	char str[64];
+	unsigned char data[48];
+	uint32_t i;
+	for (i = 0; i < NUM_ITEMS; i++) {
+		plist_t item = plist_new_dict();
+		uint32_t k;
+		snprintf(str, sizeof(str), "Item %u", i);
+		plist_dict_set_item(item, "Name", plist_new_string(str));
+		snprintf(str, sizeof(str), "\xc3\xa4\xc3\xb6\xc3\xbc %u", i % 100);
+		plist_dict_set_item(item, "Label", plist_new_string(str));
+		memset(data, (int)(i % 5), sizeof(data));
+		plist_dict_set_item(item, "Blob", plist_new_data((const char*)data, sizeof(data)));
+		if (i % 100 == 0) {
+			for (k = 0; k < 40; k++) {
+				snprintf(str, sizeof(str), "field%u", k);
+				plist_dict_set_item(item, str, plist_new_uint(k));
+			}
+		}
+		plist_array_append_item(items, item);
+	}
+	plist_dict_set_item(root, "Items", items);
+	for (i = 0; i < 100; i++) {
+		snprintf(str, sizeof(str), "key%u", i);
+		plist_dict_set_item(root, str, plist_new_uint(i));
+	}
+	return root;
+}
+
+struct worker {
+	plist_t root;
+	char *expected[NUM_OUTPUTS];
+	uint64_t expected_len[NUM_OUTPUTS];
+	size_t first;
+	int failed;
+};
+
+static void *worker_run(void *arg)
+{
+	struct worker *w = (struct worker*)arg;
+	size_t n;
+	for (n = 0; n < NUM_OUTPUTS; n++) {
+		size_t i = (w->first + n) % NUM_OUTPUTS;
+		char *out = NULL;
+		uint64_t len = 0;
+		char key[32];
+		if (write_plist(w->root, i, &out, &len) != PLIST_ERR_SUCCESS || len != w->expected_len[i] || memcmp(out, w->expected[i], len) != 0) {
+			printf("ERROR: %s output differs when written concurrently\n", outputs[i].name);
+			w->failed = 1;
+		}
+		plist_mem_free(out);
+		snprintf(key, sizeof(key), "key%u", (unsigned int)(n * 7));
+		if (!plist_dict_get_item(w->root, key) || !plist_dict_get_item(plist_array_get_item(plist_dict_get_item(w->root, "Items"), 100), "field39")) {
+			printf("ERROR: lookup failed while writing concurrently\n");
+			w->failed = 1;
+		}
+	}
+	return NULL;
+}
+
+/* every round writes a fresh tree, so the threads race on the first
+ * write of each node */
+static int check_concurrent(const char *what, const char *bin, uint64_t bin_len)
+{
+	struct worker w[NUM_THREADS];
+	pthread_t threads[NUM_THREADS];
+	plist_t ref = NULL;
+	char *expected[NUM_OUTPUTS];
+	uint64_t expected_len[NUM_OUTPUTS];
+	int err = 0;
+	size_t i;
+	int r, t;
+
+	plist_from_bin(bin, (uint32_t)bin_len, &ref);
+	for (i = 0; i < NUM_OUTPUTS; i++) {
+		expected[i] = NULL;
+		expected_len[i] = 0;
+		write_plist(ref, i, &expected[i], &expected_len[i]);
+	}
+	plist_free(ref);
+
+	for (r = 0; r < NUM_ROUNDS && !err; r++) {
+		plist_t root = NULL;
+		plist_from_bin(bin, (uint32_t)bin_len, &root);
+		for (t = 0; t < NUM_THREADS; t++) {
+			w[t].root = root;
+			memcpy(w[t].expected, expected, sizeof(expected));
+			memcpy(w[t].expected_len, expected_len, sizeof(expected_len));
+			w[t].first = (size_t)t;
+			w[t].failed = 0;
+			if (pthread_create(&threads[t], NULL, worker_run, &w[t]) != 0) {
+				printf("ERROR: could not start thread\n");
+				return -1;
+			}
+		}
+		for (t = 0; t < NUM_THREADS; t++) {
+			pthread_join(threads[t], NULL);
+			err |= w[t].failed;
+		}
+		plist_free(root);
+	}
+
+	for (i = 0; i < NUM_OUTPUTS; i++) {
+		plist_mem_free(expected[i]);
+	}
+	if (err) {
+		return -1;
+	}
+	printf("SUCCESS: %s\n", what);
+	return 0;
+}
+#endif
+
+int main(void)
+{
+#ifdef HAVE_PTHREAD
+	plist_t root = new_plist();
+	char *bin = NULL;
+	uint32_t bin_len = 0;
+	int err;
+
+	plist_to_bin(root, &bin, &bin_len);
+	plist_free(root);
+	if (!bin) {
+		printf("ERROR: could not create test data\n");
+		return 1;
+	}
+	err = check_concurrent("concurrent writers and readers", bin, bin_len);
+	plist_mem_free(bin);
+	return (err < 0) ? 1 : 0;
+#else
+	printf("SKIP: no thread support\n");
+	return 77;
+#endif
+}
@@ -0,0 +1,335 @@
+/*
+ * convert_test.c
+ * checks that plist_convert() writes the same output as parsing the given
+ * files and writing the tree does, for each output format
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <plist/plist.h>
+
+struct sink {
+	char *buf;
+	size_t len;
+	size_t cap;
+	/* accept only this many bytes, unless 0 */
+	size_t limit;
+};
+
+static size_t sink_write(const void *buf, size_t len, void *user_data)
+{
+	struct sink *s = (struct sink*)user_data;
+	if (s->limit > 0 && s->len + len > s->limit) {
+		len = s->limit - s->len;
+	}
+	if (s->len + len > s->cap) {
+		s->cap = (s->len + len) * 2;
+		s->buf = (char*)realloc(s->buf, s->cap);
+	}
+	memcpy(s->buf + s->len, buf, len);
+	s->len += len;
+	return len;
+}
+
+static const struct {
+	plist_format_t format;
+	plist_write_options_t options;
+	const char *name;
+} outputs[] = {
+	{ PLIST_FORMAT_XML, PLIST_OPT_NONE, "xml" },
+	{ PLIST_FORMAT_JSON, PLIST_OPT_NONE, "json" },
+	{ PLIST_FORMAT_JSON, PLIST_OPT_COMPACT | PLIST_OPT_COERCE, "compact coerced json" },
+	{ PLIST_FORMAT_OSTEP, PLIST_OPT_NONE, "openstep" },
+	{ PLIST_FORMAT_OSTEP, PLIST_OPT_COMPACT | PLIST_OPT_COERCE, "compact coerced openstep" },
+	{ PLIST_FORMAT_BINARY, PLIST_OPT_NONE, "binary" },
+	{ PLIST_FORMAT_PRINT, PLIST_OPT_NONE, "print" },
+	{ PLIST_FORMAT_LIMD, PLIST_OPT_NONE, "limd" },
+};
+
+/* counts the keys reported by the parser, to find duplicates */
+static plist_err_t count_key(void *user_data, const char *key, uint64_t len)
+{
+	(void)key;
+	(void)len;
+	(*(uint64_t*)user_data)++;
+	return PLIST_ERR_SUCCESS;
+}
+
+static const plist_event_handler_t key_counter = {
+	NULL, NULL, NULL, NULL, count_key, NULL, NULL
+};
+
+static uint64_t count_tree_keys(plist_t node)
+{
+	uint64_t n = 0;
+	if (PLIST_IS_DICT(node)) {
+		plist_dict_iter it = NULL;
+		plist_t val = NULL;
+		plist_dict_new_iter(node, &it);
+		do {
+			plist_dict_next_item(node, it, NULL, &val);
+			if (val) {
+				n += 1 + count_tree_keys(val);
+			}
+		} while (val);
+		free(it);
+	} else if (PLIST_IS_ARRAY(node)) {
+		uint32_t i;
+		for (i = 0; i < plist_array_get_size(node); i++) {
+			n += count_tree_keys(plist_array_get_item(node, i));
+		}
+	}
+	return n;
+}
+
+static plist_err_t write_tree(plist_t root, plist_format_t format, plist_write_options_t options, char **out, uint64_t *len)
+{
+	if (format == PLIST_FORMAT_BINARY) {
+		uint32_t blen = 0;
+		plist_err_t err = plist_to_bin(root, out, &blen);
+		*len = blen;
+		return err;
+	}
+	return plist_write_to_string64(root, out, len, format, options);
+}
+
+/* duplicate keys are converted as they are, but have to read back as the
+ * same tree */
+static int reads_back(const char *buf, uint64_t len, size_t i, const char *expected, uint64_t expected_len)
+{
+	plist_t root = NULL;
+	char *out = NULL;
+	uint64_t out_len = 0;
+	int res;
+	if (plist_from_memory(buf, (uint32_t)len, &root, NULL) != PLIST_ERR_SUCCESS) {
+		return 0;
+	}
+	res = write_tree(root, outputs[i].format, outputs[i].options, &out, &out_len) == PLIST_ERR_SUCCESS
+		&& out_len == expected_len && memcmp(out, expected, out_len) == 0;
+	free(out);
+	plist_free(root);
+	return res;
+}
+
+static int check(const char *name, const char *buf, uint64_t len)
+{
+	plist_t root = NULL;
+	uint64_t keys = 0;
+	int duplicates;
+	int res = 0;
+	size_t i;
+
+	if (plist_from_memory(buf, (uint32_t)len, &root, NULL) != PLIST_ERR_SUCCESS) {
+		/* invalid input fails the conversion too */
+		for (i = 0; i < sizeof(outputs) / sizeof(outputs[0]); i++) {
+			struct sink s;
+			memset(&s, 0, sizeof(s));
+			if (plist_convert(buf, len, PLIST_FORMAT_NONE, outputs[i].format, outputs[i].options, sink_write, &s) == PLIST_ERR_SUCCESS) {
+				printf("ERROR: %s: %s conversion of invalid input succeeded\n", name, outputs[i].name);
+				res = -1;
+			}
+			free(s.buf);
+		}
+		if (res == 0) {
+			printf("SUCCESS: %s (invalid)\n", name);
+		}
+		return res;
+	}
+	plist_parse_events(buf, len, PLIST_FORMAT_NONE, &key_counter, &keys);
+	duplicates = (keys != count_tree_keys(root));
+	for (i = 0; i < sizeof(outputs) / sizeof(outputs[0]); i++) {
+		struct sink s;
+		char *expected = NULL;
+		uint64_t expected_len = 0;
+		plist_err_t ref = write_tree(root, outputs[i].format, outputs[i].options, &expected, &expected_len);
+		plist_err_t err;
+
+		memset(&s, 0, sizeof(s));
+		err = plist_convert(buf, len, PLIST_FORMAT_NONE, outputs[i].format, outputs[i].options, sink_write, &s);
+		if ((err == PLIST_ERR_SUCCESS) != (ref == PLIST_ERR_SUCCESS)) {
+			printf("ERROR: %s: %s conversion returned %d, writing the tree %d\n", name, outputs[i].name, err, ref);
+			res = -1;
+		} else if (err == PLIST_ERR_SUCCESS && (s.len != expected_len || memcmp(s.buf, expected, s.len) != 0)
+				&& !(duplicates && reads_back(s.buf, s.len, i, expected, expected_len))) {
+			printf("ERROR: %s: %s conversion differs\n", name, outputs[i].name);
+			res = -1;
+		} else if (err == PLIST_ERR_SUCCESS && s.len > 1) {
+			/* a sink that stops accepting data fails the conversion */
+			size_t full = s.len;
+			s.len = 0;
+			s.limit = full / 2;
+			err = plist_convert(buf, len, PLIST_FORMAT_NONE, outputs[i].format, outputs[i].options, sink_write, &s);
+			if (err != PLIST_ERR_IO) {
+				printf("ERROR: %s: %s conversion returned %d after a short write\n", name, outputs[i].name, err);
+				res = -1;
+			}
+		}
+		free(s.buf);
+		free(expected);
+	}
+	plist_free(root);
+	if (res == 0) {
+		printf("SUCCESS: %s%s\n", name, (duplicates) ? " (duplicate keys)" : "");
+	}
+	return res;
+}
+
+static int check_duplicate_keys(void)
+{
+	static const char json[] = "{\"a\":1,\"b\":3,\"a\":2}";
+	struct sink s;
+	plist_err_t err;
+	int res = 0;
+
+	memset(&s, 0, sizeof(s));
+	err = plist_convert(json, sizeof(json) - 1, PLIST_FORMAT_JSON, PLIST_FORMAT_JSON, PLIST_OPT_COMPACT, sink_write, &s);
+	if (err != PLIST_ERR_SUCCESS || s.len != sizeof(json) - 1 || memcmp(s.buf, json, s.len) != 0) {
+		printf("ERROR: duplicate keys were not written as they are (%d)\n", err);
+		res = -1;
+	}
+	free(s.buf);
+	if (check("duplicate keys", json, sizeof(json) - 1) < 0) {
+		res = -1;
+	}
+	return res;
+}
+
+/* CF$UID dictionaries are only turned into UIDs when a tree is built */
+static int check_uid_dict(void)
+{
+	static const char xml[] =
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<plist version=\"1.0\"><dict><key>CF$UID</key><integer>7</integer></dict></plist>\n";
+	plist_t root = NULL;
+	uint64_t uid = 0;
+	struct sink s;
+	plist_err_t err;
+	int res = 0;
+
+	memset(&s, 0, sizeof(s));
+	err = plist_convert(xml, sizeof(xml) - 1, PLIST_FORMAT_XML, PLIST_FORMAT_JSON, PLIST_OPT_COMPACT, sink_write, &s);
+	if (err != PLIST_ERR_SUCCESS || s.len != 12 || memcmp(s.buf, "{\"CF$UID\":7}", 12) != 0) {
+		printf("ERROR: CF$UID dictionary was not kept in JSON output (%d)\n", err);
+		res = -1;
+	}
+	s.len = 0;
+	err = plist_convert(xml, sizeof(xml) - 1, PLIST_FORMAT_XML, PLIST_FORMAT_BINARY, PLIST_OPT_NONE, sink_write, &s);
+	if (err == PLIST_ERR_SUCCESS) {
+		plist_from_bin(s.buf, (uint32_t)s.len, &root);
+	}
+	plist_get_uid_val(root, &uid);
+	if (plist_get_node_type(root) != PLIST_UID || uid != 7) {
+		printf("ERROR: CF$UID dictionary was not converted to a UID in binary output (%d)\n", err);
+		res = -1;
+	}
+	plist_free(root);
+	free(s.buf);
+
+	memset(&s, 0, sizeof(s));
+	if (plist_convert(xml, sizeof(xml) - 1, PLIST_FORMAT_XML, PLIST_FORMAT_NONE, PLIST_OPT_NONE, sink_write, &s) != PLIST_ERR_FORMAT) {
+		printf("ERROR: conversion to an invalid format did not fail\n");
+		res = -1;
+	}
+	return res;
+}
+
+/* data longer than one base64 chunk of the limd writer */
+static int check_large_data(void)
+{
+	plist_t root = plist_new_dict();
+	unsigned char data[10000];
+	char *xml = NULL;
+	uint32_t xml_len = 0;
+	size_t i;
+	int res;
+
+	for (i = 0; i < sizeof(data); i++) {
+		data[i] = (unsigned char)(i * 7);
+	}
+	plist_dict_set_item(root, "Data", plist_new_data((const char*)data, sizeof(data)));
+	plist_to_xml(root, &xml, &xml_len);
+	plist_free(root);
+	if (!xml) {
+		printf("ERROR: could not create test data\n");
+		return -1;
+	}
+	res = check("large data", xml, xml_len);
+	plist_mem_free(xml);
+	return res;
+}
+
+static char *read_file(const char *path, uint64_t *len)
+{
+	FILE *f = fopen(path, "rb");
+	char *buf = NULL;
+	long size;
+	if (!f) {
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (size > 0) {
+		buf = (char*)malloc(size);
+		if (buf && fread(buf, 1, size, f) != (size_t)size) {
+			free(buf);
+			buf = NULL;
+		}
+	}
+	fclose(f);
+	*len = (buf) ? (uint64_t)size : 0;
+	return buf;
+}
+
+int main(int argc, char** argv)
+{
+	int err = 0;
+	int i;
+
+	if (argc < 2) {
+		printf("Usage: %s FILE...\n", argv[0]);
+		return 1;
+	}
+
+	if (check_uid_dict() < 0) {
+		err = 1;
+	}
+	if (check_large_data() < 0) {
+		err = 1;
+	}
+	if (check_duplicate_keys() < 0) {
+		err = 1;
+	}
+	for (i = 1; i < argc; i++) {
+		uint64_t len = 0;
+		char *buf = read_file(argv[i], &len);
+
+		if (!buf) {
+			printf("ERROR: could not read %s\n", argv[i]);
+			return 1;
+		}
+		if (check(argv[i], buf, len) < 0) {
+			err = 1;
+		}
+		free(buf);
+	}
+
+	return err;
+}
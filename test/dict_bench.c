@@ -0,0 +1,309 @@
+/*
+ * dict_bench.c
+ * dictionary index correctness checks and lookup microbenchmark
+ *
+ * Usage: dict_bench [NUM_KEYS [ROUNDS]]
+ *        dict_bench --sweep [MAX_KEYS]
+ *
+ * The sweep times insert and lookup per key for 1K keys and every tenfold
+ * size up to MAX_KEYS (default 10M), which should stay flat as the dict
+ * grows.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <plist/plist.h>
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int check_dict(plist_t dict, uint32_t num, int removed_odd)
+{
+	char key[32];
+	uint32_t i;
+	for (i = 0; i < num; i++) {
+		snprintf(key, sizeof(key), "key%u", i);
+		plist_t val = plist_dict_get_item(dict, key);
+		if (removed_odd && (i & 1)) {
+			if (val) {
+				printf("ERROR: removed key '%s' still present\n", key);
+				return -1;
+			}
+			continue;
+		}
+		uint64_t u = 0;
+		if (!val) {
+			printf("ERROR: key '%s' not found\n", key);
+			return -1;
+		}
+		plist_get_uint_val(val, &u);
+		if (u != i) {
+			printf("ERROR: key '%s' has wrong value %" PRIu64 "\n", key, u);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* a parsed binary dict with a duplicate key must resolve it the same way
+ * with and without a hash index: the first entry wins */
+static int check_duplicate_keys(void)
+{
+	static const plist_parse_options_t options[] = { PLIST_PARSE_NONE, PLIST_PARSE_ARENA, PLIST_PARSE_LAZY };
+	char key[32];
+	uint32_t num, i, o;
+	for (num = 8; num <= 40; num += 32) {
+		plist_t dict = plist_new_dict();
+		char *bin = NULL;
+		uint32_t blen = 0;
+		char *dup = NULL;
+		for (i = 0; i < num; i++) {
+			snprintf(key, sizeof(key), "key%u", i + 10);
+			plist_dict_set_item(dict, key, plist_new_uint(i));
+		}
+		plist_to_bin(dict, &bin, &blen);
+		plist_free(dict);
+		/* rename the last key to the name of the first one */
+		snprintf(key, sizeof(key), "key%u", num + 9);
+		for (i = 0; bin && i + strlen(key) <= blen; i++) {
+			if (!memcmp(bin + i, key, strlen(key))) {
+				dup = bin + i;
+				break;
+			}
+		}
+		if (!dup) {
+			printf("ERROR: could not find key '%s' in binary output\n", key);
+			free(bin);
+			return -1;
+		}
+		memcpy(dup, "key10", 5);
+		for (o = 0; o < sizeof(options) / sizeof(options[0]); o++) {
+			plist_t parsed = NULL;
+			uint64_t u = 1;
+			plist_from_memory_ex(bin, blen, &parsed, NULL, options[o]);
+			if (plist_dict_get_size(parsed) != num) {
+				printf("ERROR: parsed dict with duplicate key has %u items, expected %u\n", plist_dict_get_size(parsed), num);
+				plist_free(parsed);
+				free(bin);
+				return -1;
+			}
+			plist_get_uint_val(plist_dict_get_item(parsed, "key10"), &u);
+			plist_free(parsed);
+			if (u != 0) {
+				printf("ERROR: duplicate key in a dict with %u items resolved to entry %" PRIu64 " (options %d)\n", num, u, options[o]);
+				free(bin);
+				return -1;
+			}
+		}
+		free(bin);
+	}
+	return 0;
+}
+
+#define SWEEP_KEY_SIZE 16
+
+static int sweep(uint64_t max_keys)
+{
+	uint64_t num;
+	printf("%10s %12s %12s\n", "keys", "ns/insert", "ns/lookup");
+	for (num = 1000; num <= max_keys; num *= 10) {
+		char *keys = (char*)malloc(num * SWEEP_KEY_SIZE);
+		plist_t dict;
+		double t_insert, t_lookup;
+		uint64_t i;
+		if (!keys) {
+			printf("ERROR: out of memory\n");
+			return -1;
+		}
+		for (i = 0; i < num; i++) {
+			snprintf(keys + i * SWEEP_KEY_SIZE, SWEEP_KEY_SIZE, "key%" PRIu64, i);
+		}
+
+		dict = plist_new_dict();
+		t_insert = now_ms();
+		for (i = 0; i < num; i++) {
+			plist_dict_set_item(dict, keys + i * SWEEP_KEY_SIZE, plist_new_uint(i));
+		}
+		t_insert = now_ms() - t_insert;
+
+		t_lookup = now_ms();
+		for (i = 0; i < num; i++) {
+			uint64_t u = num;
+			plist_get_uint_val(plist_dict_get_item(dict, keys + i * SWEEP_KEY_SIZE), &u);
+			if (u != i) {
+				printf("ERROR: key '%s' has wrong value %" PRIu64 "\n", keys + i * SWEEP_KEY_SIZE, u);
+				plist_free(dict);
+				free(keys);
+				return -1;
+			}
+		}
+		t_lookup = now_ms() - t_lookup;
+
+		printf("%10" PRIu64 " %12.1f %12.1f\n", num, t_insert * 1000000.0 / num, t_lookup * 1000000.0 / num);
+		plist_free(dict);
+		free(keys);
+	}
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t num = 10000;
+	uint32_t rounds = 10;
+	char key[32];
+	uint32_t i, r;
+	double t0;
+
+	if (argc > 1 && !strcmp(argv[1], "--sweep")) {
+		uint64_t max_keys = 10000000;
+		if (argc > 2) max_keys = strtoull(argv[2], NULL, 10);
+		return (sweep(max_keys) < 0) ? 1 : 0;
+	}
+
+	if (argc > 1) num = (uint32_t)strtoul(argv[1], NULL, 10);
+	if (argc > 2) rounds = (uint32_t)strtoul(argv[2], NULL, 10);
+
+	plist_t dict = plist_new_dict();
+
+	t0 = now_ms();
+	for (i = 0; i < num; i++) {
+		snprintf(key, sizeof(key), "key%u", i);
+		plist_dict_set_item(dict, key, plist_new_uint(i));
+	}
+	printf("insert: %u keys in %.3f ms\n", num, now_ms() - t0);
+	if (plist_dict_get_size(dict) != num) {
+		printf("ERROR: dict has %u items, expected %u\n", plist_dict_get_size(dict), num);
+		return 1;
+	}
+
+	/* replace every value, the index must follow */
+	t0 = now_ms();
+	for (i = 0; i < num; i++) {
+		snprintf(key, sizeof(key), "key%u", i);
+		plist_dict_set_item(dict, key, plist_new_uint(i));
+	}
+	printf("replace: %u keys in %.3f ms\n", num, now_ms() - t0);
+
+	t0 = now_ms();
+	for (r = 0; r < rounds; r++) {
+		if (check_dict(dict, num, 0) < 0) {
+			return 1;
+		}
+	}
+	printf("lookup: %u x %u keys in %.3f ms\n", rounds, num, now_ms() - t0);
+
+	/* miss lookups */
+	t0 = now_ms();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < num; i++) {
+			snprintf(key, sizeof(key), "nokey%u", i);
+			if (plist_dict_get_item(dict, key)) {
+				printf("ERROR: unexpected key '%s' found\n", key);
+				return 1;
+			}
+		}
+	}
+	printf("miss:   %u x %u keys in %.3f ms\n", rounds, num, now_ms() - t0);
+
+	/* copies must carry a working index */
+	t0 = now_ms();
+	plist_t copy = plist_copy(dict);
+	printf("copy:   %u keys in %.3f ms\n", num, now_ms() - t0);
+	if (check_dict(copy, num, 0) < 0) {
+		return 1;
+	}
+	plist_free(copy);
+
+	/* merging into an empty dict adds every key, merging into a copy
+	 * replaces every value */
+	t0 = now_ms();
+	copy = plist_new_dict();
+	plist_dict_merge(&copy, dict);
+	plist_dict_merge(&copy, dict);
+	printf("merge:  2 x %u keys in %.3f ms\n", num, now_ms() - t0);
+	if (check_dict(copy, num, 0) < 0) {
+		return 1;
+	}
+	plist_free(copy);
+
+	/* rename one key through its key node */
+	if (num > 0) {
+		plist_dict_iter it = NULL;
+		plist_t val = NULL;
+		char *first = NULL;
+		plist_dict_new_iter(dict, &it);
+		plist_dict_next_item(dict, it, &first, &val);
+		free(it);
+		if (first && val) {
+			plist_t keynode = plist_dict_item_get_key(val);
+			plist_set_key_val(keynode, "renamed");
+			if (plist_dict_get_item(dict, first) || plist_dict_get_item(dict, "renamed") != val) {
+				printf("ERROR: index not updated after key rename\n");
+				return 1;
+			}
+			plist_set_key_val(keynode, first);
+		}
+		free(first);
+	}
+
+	/* remove every other key */
+	t0 = now_ms();
+	for (i = 1; i < num; i += 2) {
+		snprintf(key, sizeof(key), "key%u", i);
+		plist_dict_remove_item(dict, key);
+	}
+	printf("remove: %u keys in %.3f ms\n", num / 2, now_ms() - t0);
+	if (check_dict(dict, num, 1) < 0) {
+		return 1;
+	}
+
+	/* binary round trip exercises the writer's reference table */
+	char *bin = NULL;
+	uint32_t blen = 0;
+	t0 = now_ms();
+	if (plist_to_bin(dict, &bin, &blen) != PLIST_ERR_SUCCESS) {
+		printf("ERROR: plist_to_bin failed\n");
+		return 1;
+	}
+	printf("to_bin: %u bytes in %.3f ms\n", blen, now_ms() - t0);
+	plist_t parsed = NULL;
+	t0 = now_ms();
+	plist_from_bin(bin, blen, &parsed);
+	printf("parse:  %u bytes in %.3f ms\n", blen, now_ms() - t0);
+	free(bin);
+	if (!parsed || plist_dict_get_size(parsed) != plist_dict_get_size(dict) || check_dict(parsed, num, 1) < 0) {
+		printf("ERROR: binary round trip failed\n");
+		return 1;
+	}
+	plist_free(parsed);
+
+	plist_free(dict);
+
+	if (check_duplicate_keys() < 0) {
+		return 1;
+	}
+	printf("SUCCESS\n");
+	return 0;
+}
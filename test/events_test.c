@@ -0,0 +1,409 @@
+/*
+ * events_test.c
+ * checks that plist_parse_events() reports the same tree as the regular
+ * parsers on the given files, and that it fails where they fail on
+ * corrupted binary copies of them
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <plist/plist.h>
+
+#define NUM_MUTATIONS 500
+#define MAX_DEPTH 600
+
+static uint32_t rnd_state = 1;
+
+static uint32_t rnd(void)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return rnd_state >> 8;
+}
+
+/* builds a tree from the events with the public API only */
+struct builder {
+	plist_t stack[MAX_DEPTH];
+	uint32_t depth;
+	plist_t root;
+	char *key;
+	uint64_t events;
+	uint64_t abort_after;
+};
+
+static plist_err_t count_event(struct builder *b)
+{
+	b->events++;
+	if (b->abort_after > 0 && b->events >= b->abort_after) {
+		return PLIST_ERR_UNKNOWN;
+	}
+	return PLIST_ERR_SUCCESS;
+}
+
+static plist_err_t attach(struct builder *b, plist_t node)
+{
+	if (b->depth == 0) {
+		if (b->root) {
+			plist_free(node);
+			return PLIST_ERR_PARSE;
+		}
+		b->root = node;
+	} else if (plist_get_node_type(b->stack[b->depth - 1]) == PLIST_DICT) {
+		if (!b->key) {
+			plist_free(node);
+			return PLIST_ERR_PARSE;
+		}
+		plist_dict_set_item(b->stack[b->depth - 1], b->key, node);
+		free(b->key);
+		b->key = NULL;
+	} else {
+		plist_array_append_item(b->stack[b->depth - 1], node);
+	}
+	return PLIST_ERR_SUCCESS;
+}
+
+static plist_err_t begin(struct builder *b, plist_t node)
+{
+	plist_err_t err = count_event(b);
+	if (err == PLIST_ERR_SUCCESS) {
+		err = attach(b, node);
+	} else {
+		plist_free(node);
+	}
+	if (err == PLIST_ERR_SUCCESS) {
+		if (b->depth >= MAX_DEPTH) {
+			return PLIST_ERR_MAX_NESTING;
+		}
+		b->stack[b->depth++] = node;
+	}
+	return err;
+}
+
+static plist_err_t end(struct builder *b, plist_type type)
+{
+	plist_err_t err = count_event(b);
+	if (err != PLIST_ERR_SUCCESS) {
+		return err;
+	}
+	if (b->depth == 0 || plist_get_node_type(b->stack[b->depth - 1]) != type) {
+		return PLIST_ERR_PARSE;
+	}
+	b->depth--;
+	return PLIST_ERR_SUCCESS;
+}
+
+static plist_err_t on_begin_dict(void *user_data)
+{
+	return begin((struct builder*)user_data, plist_new_dict());
+}
+
+static plist_err_t on_end_dict(void *user_data)
+{
+	return end((struct builder*)user_data, PLIST_DICT);
+}
+
+static plist_err_t on_begin_array(void *user_data)
+{
+	return begin((struct builder*)user_data, plist_new_array());
+}
+
+static plist_err_t on_end_array(void *user_data)
+{
+	return end((struct builder*)user_data, PLIST_ARRAY);
+}
+
+static plist_err_t on_key(void *user_data, const char *key, uint64_t length)
+{
+	struct builder *b = (struct builder*)user_data;
+	plist_err_t err = count_event(b);
+	if (err != PLIST_ERR_SUCCESS) {
+		return err;
+	}
+	free(b->key);
+	b->key = (char*)malloc(length + 1);
+	memcpy(b->key, key, length);
+	b->key[length] = '\0';
+	return PLIST_ERR_SUCCESS;
+}
+
+static plist_err_t on_value(void *user_data, plist_type type, const void *value, uint64_t length)
+{
+	struct builder *b = (struct builder*)user_data;
+	plist_t node = NULL;
+	plist_err_t err = count_event(b);
+	if (err != PLIST_ERR_SUCCESS) {
+		return err;
+	}
+	switch (type) {
+	case PLIST_BOOLEAN:
+		node = plist_new_bool(*(const uint8_t*)value);
+		break;
+	case PLIST_INT:
+		if (length == 16) {
+			node = plist_new_uint(*(const uint64_t*)value);
+		} else {
+			node = plist_new_int((int64_t)*(const uint64_t*)value);
+		}
+		break;
+	case PLIST_REAL:
+		node = plist_new_real(*(const double*)value);
+		break;
+	case PLIST_DATE:
+		/* seconds since 01/01/2001 */
+		node = plist_new_unix_date((int64_t)*(const double*)value + 978307200);
+		break;
+	case PLIST_STRING: {
+		char *str = (char*)malloc(length + 1);
+		memcpy(str, value, length);
+		str[length] = '\0';
+		node = plist_new_string(str);
+		free(str);
+	}	break;
+	case PLIST_DATA:
+		node = plist_new_data((const char*)value, length);
+		break;
+	case PLIST_UID:
+		node = plist_new_uid(*(const uint64_t*)value);
+		break;
+	case PLIST_NULL:
+		node = plist_new_null();
+		break;
+	default:
+		return PLIST_ERR_PARSE;
+	}
+	return attach(b, node);
+}
+
+static const plist_event_handler_t handler = {
+	on_begin_dict, on_end_dict, on_begin_array, on_end_array, on_key, on_value, NULL
+};
+
+static plist_err_t parse_events(const char *buf, uint64_t len, uint64_t abort_after, plist_t *root, uint64_t *events)
+{
+	struct builder b;
+	plist_err_t err;
+	memset(&b, 0, sizeof(b));
+	b.abort_after = abort_after;
+	err = plist_parse_events(buf, len, PLIST_FORMAT_NONE, &handler, &b);
+	free(b.key);
+	if (err == PLIST_ERR_SUCCESS && b.depth > 0) {
+		err = PLIST_ERR_PARSE;
+	}
+	if (err != PLIST_ERR_SUCCESS) {
+		plist_free(b.root);
+		b.root = NULL;
+	}
+	*root = b.root;
+	*events = b.events;
+	return err;
+}
+
+/* compares two trees; dates only to the second, since that is what the
+ * public API offers to build them */
+static int equal(plist_t a, plist_t b)
+{
+	plist_type type = plist_get_node_type(a);
+	if (type != plist_get_node_type(b)) {
+		return 0;
+	}
+	switch (type) {
+	case PLIST_INT: {
+		uint64_t va = 0, vb = 0;
+		plist_get_uint_val(a, &va);
+		plist_get_uint_val(b, &vb);
+		return va == vb && plist_int_val_is_negative(a) == plist_int_val_is_negative(b);
+	}
+	case PLIST_DATE: {
+		int64_t va = 0, vb = 0;
+		plist_get_unix_date_val(a, &va);
+		plist_get_unix_date_val(b, &vb);
+		return va == vb;
+	}
+	case PLIST_ARRAY: {
+		uint32_t i;
+		if (plist_array_get_size(a) != plist_array_get_size(b)) {
+			return 0;
+		}
+		for (i = 0; i < plist_array_get_size(a); i++) {
+			if (!equal(plist_array_get_item(a, i), plist_array_get_item(b, i))) {
+				return 0;
+			}
+		}
+		return 1;
+	}
+	case PLIST_DICT: {
+		plist_dict_iter iter = NULL;
+		char *key = NULL;
+		plist_t val = NULL;
+		int res = 1;
+		if (plist_dict_get_size(a) != plist_dict_get_size(b)) {
+			return 0;
+		}
+		plist_dict_new_iter(a, &iter);
+		do {
+			key = NULL;
+			val = NULL;
+			plist_dict_next_item(a, iter, &key, &val);
+			if (val && !equal(val, plist_dict_get_item(b, key))) {
+				res = 0;
+			}
+			free(key);
+		} while (val && res);
+		free(iter);
+		return res;
+	}
+	default:
+		return plist_compare_node_value(a, b);
+	}
+}
+
+/* parses buf with events and compares the outcome with a real parse */
+static int check(const char *name, const char *buf, uint64_t len, int verbose)
+{
+	plist_t expected = NULL;
+	plist_t root = NULL;
+	uint64_t events = 0;
+	uint64_t n = 0;
+	plist_err_t res = parse_events(buf, len, 0, &root, &events);
+	plist_err_t ref = plist_from_memory(buf, (uint32_t)len, &expected, NULL);
+
+	if ((res == PLIST_ERR_SUCCESS) != (ref == PLIST_ERR_SUCCESS)) {
+		printf("ERROR: %s: parsing events returned %d, parsing %d\n", name, res, ref);
+		plist_free(root);
+		plist_free(expected);
+		return -1;
+	}
+	if (res != PLIST_ERR_SUCCESS) {
+		if (verbose) {
+			printf("SUCCESS: %s (result %d)\n", name, res);
+		}
+		return 0;
+	}
+	/* corrupted copies are only checked for the outcome, the binary parser
+	 * keeps duplicate keys and keys with 0 bytes in them, which the public
+	 * API cannot reproduce */
+	if (verbose && !equal(root, expected)) {
+		printf("ERROR: %s: trees differ\n", name);
+		plist_free(root);
+		plist_free(expected);
+		return -1;
+	}
+	plist_free(root);
+	plist_free(expected);
+
+	/* a callback can stop parsing at any event */
+	if (events > 1) {
+		res = parse_events(buf, len, events / 2, &root, &n);
+		if (res != PLIST_ERR_UNKNOWN || n != events / 2) {
+			printf("ERROR: %s: returned %d after %" PRIu64 " of %" PRIu64 " events when stopped\n", name, res, n, events / 2);
+			return -1;
+		}
+	}
+	if (verbose) {
+		printf("SUCCESS: %s (%" PRIu64 " events)\n", name, events);
+	}
+	return 0;
+}
+
+static char *read_file(const char *path, uint64_t *len)
+{
+	FILE *f = fopen(path, "rb");
+	char *buf = NULL;
+	long size;
+	if (!f) {
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (size > 0) {
+		buf = (char*)malloc(size);
+		if (buf && fread(buf, 1, size, f) != (size_t)size) {
+			free(buf);
+			buf = NULL;
+		}
+	}
+	fclose(f);
+	*len = (buf) ? (uint64_t)size : 0;
+	return buf;
+}
+
+int main(int argc, char** argv)
+{
+	int err = 0;
+	int i;
+
+	if (argc < 2) {
+		printf("Usage: %s FILE...\n", argv[0]);
+		return 1;
+	}
+
+	for (i = 1; i < argc; i++) {
+		uint64_t len = 0;
+		char *buf = read_file(argv[i], &len);
+		char *copy;
+		char name[256];
+		int m;
+
+		if (!buf) {
+			printf("ERROR: could not read %s\n", argv[i]);
+			return 1;
+		}
+		if (check(argv[i], buf, len, 1) < 0) {
+			err = 1;
+		}
+		if (!plist_is_binary(buf, (uint32_t)len)) {
+			/* the binary parser is checked on a converted copy */
+			plist_t root = NULL;
+			uint32_t blen = 0;
+			plist_from_memory(buf, (uint32_t)len, &root, NULL);
+			free(buf);
+			buf = NULL;
+			plist_to_bin(root, &buf, &blen);
+			plist_free(root);
+			len = blen;
+			if (!buf) {
+				printf("ERROR: could not convert %s\n", argv[i]);
+				return 1;
+			}
+			snprintf(name, sizeof(name), "%s, binary", argv[i]);
+			if (check(name, buf, len, 1) < 0) {
+				err = 1;
+			}
+		}
+
+		copy = (char*)malloc(len);
+		for (m = 0; m < NUM_MUTATIONS && copy; m++) {
+			int n = 1 + rnd() % 3;
+			memcpy(copy, buf, len);
+			while (n-- > 0) {
+				copy[rnd() % len] = (char)rnd();
+			}
+			snprintf(name, sizeof(name), "%s, mutation %d", argv[i], m);
+			if (check(name, copy, len, 0) < 0) {
+				err = 1;
+				break;
+			}
+		}
+		free(copy);
+		free(buf);
+	}
+
+	return err;
+}
@@ -0,0 +1,141 @@
+/*
+ * json_bench.c
+ * times plist_from_json() on generated documents of growing size
+ * to make sure parsing scales linearly
+ *
+ * Usage: json_bench [SIZE]
+ *        json_bench --sweep [MAX_SIZE]
+ *
+ * Without --sweep, one document of about SIZE bytes (default 64K) is parsed
+ * and checked. The sweep parses documents from 1K and every tenfold size up
+ * to MAX_SIZE bytes (default 100M), which should all parse at the same rate.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <plist/plist.h>
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* an array of small records, about 100 bytes and 9 tokens each */
+static char *make_json(size_t target, uint32_t *count, size_t *len)
+{
+	size_t cap = target + 256;
+	char *buf = (char*)malloc(cap);
+	size_t pos = 0;
+	uint32_t n = 0;
+	if (!buf) return NULL;
+	buf[pos++] = '[';
+	while (pos < target) {
+		int w = snprintf(buf + pos, cap - pos, "%s{\"id\":%u,\"name\":\"item %u\",\"tags\":[\"a\",\"b\"],\"valid\":true}", (n > 0) ? "," : "", n, n);
+		if (w < 0 || (size_t)w >= cap - pos) break;
+		pos += w;
+		n++;
+	}
+	buf[pos++] = ']';
+	*count = n;
+	*len = pos;
+	return buf;
+}
+
+/* closing brackets without an open container must fail to parse */
+static int check_unmatched(void)
+{
+	static const char *docs[] = {
+		"{\"a\":1}}",
+		"[1,2]]",
+		"{\"a\":1}/3,\"b\":2}",
+	};
+	size_t i;
+	int err = 0;
+	for (i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+		plist_t root = NULL;
+		if (plist_from_json(docs[i], (uint32_t)strlen(docs[i]), &root) != PLIST_ERR_PARSE) {
+			printf("ERROR: %s did not fail to parse\n", docs[i]);
+			err = 1;
+		}
+		plist_free(root);
+	}
+	return err;
+}
+
+/* parses a generated document of about size bytes and checks the result */
+static int parse_one(size_t size)
+{
+	uint32_t count = 0;
+	size_t len = 0;
+	char *json = make_json(size, &count, &len);
+	if (!json) {
+		printf("ERROR: out of memory\n");
+		return -1;
+	}
+	plist_t root = NULL;
+	double t0 = now_ms();
+	plist_err_t err = plist_from_json64(json, len, &root);
+	double t = now_ms() - t0;
+	free(json);
+	if (err != PLIST_ERR_SUCCESS || plist_array_get_size(root) != count) {
+		printf("ERROR: failed to parse %zu bytes\n", len);
+		plist_free(root);
+		return -1;
+	}
+	plist_t last = plist_array_get_item(root, count - 1);
+	uint64_t id = 0;
+	plist_get_uint_val(plist_dict_get_item(last, "id"), &id);
+	plist_free(root);
+	if (id != count - 1) {
+		printf("ERROR: wrong value %" PRIu64 " in last record\n", id);
+		return -1;
+	}
+	double rate = (t > 0) ? (len / 1024.0 / 1024.0) / (t / 1000.0) : 0;
+	printf("parse: %9zu bytes, %7u records in %9.3f ms (%.1f MB/s)\n", len, count, t, rate);
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	size_t size = 64*1024;
+
+	if (argc > 1 && !strcmp(argv[1], "--sweep")) {
+		size_t max_size = 100*1000*1000;
+		if (argc > 2) max_size = (size_t)strtoull(argv[2], NULL, 10);
+		for (size = 1000; size <= max_size; size *= 10) {
+			if (parse_one(size) < 0) {
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	if (argc > 1) size = (size_t)strtoul(argv[1], NULL, 10);
+	if (size == 0) size = 1;
+
+	if (check_unmatched() != 0 || parse_one(size) < 0) {
+		return 1;
+	}
+	printf("SUCCESS\n");
+	return 0;
+}
@@ -0,0 +1,285 @@
+/*
+ * mem_bench.c
+ * value checks for compact nodes and a heap usage benchmark
+ *
+ * Usage: mem_bench [NUM_ITEMS]
+ *        mem_bench --sweep [MAX_ITEMS]
+ *
+ * The sweep measures 1K items and every tenfold count up to MAX_ITEMS
+ * (default 10M); the bytes per node should not depend on the count.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <plist/plist.h>
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#include <malloc.h>
+#define HAVE_HEAP_USAGE 1
+static size_t heap_used(void)
+{
+	struct mallinfo2 mi = mallinfo2();
+	return mi.uordblks + mi.hblkhd;
+}
+#endif
+
+typedef plist_t (*new_item_func_t)(uint32_t i);
+
+static plist_t new_uint_item(uint32_t i)
+{
+	return plist_new_uint((uint64_t)i * 2654435761u);
+}
+
+static plist_t new_real_item(uint32_t i)
+{
+	return plist_new_real(i * 0.25);
+}
+
+static plist_t new_bool_item(uint32_t i)
+{
+	return plist_new_bool(i & 1);
+}
+
+static plist_t new_short_string_item(uint32_t i)
+{
+	char str[32];
+	snprintf(str, sizeof(str), "item%u", i);
+	return plist_new_string(str);
+}
+
+static plist_t new_long_string_item(uint32_t i)
+{
+	char str[96];
+	snprintf(str, sizeof(str), "a somewhat longer string value that does not fit inline, number %u", i);
+	return plist_new_string(str);
+}
+
+static int check_array(plist_t array, uint32_t num, new_item_func_t new_item)
+{
+	uint32_t i;
+	if (plist_array_get_size(array) != num) {
+		printf("ERROR: array has %u items, expected %u\n", plist_array_get_size(array), num);
+		return -1;
+	}
+	for (i = 0; i < num; i++) {
+		plist_t expected = new_item(i);
+		plist_t item = plist_array_get_item(array, i);
+		int same = plist_compare_node_value(item, expected);
+		plist_free(expected);
+		if (!same) {
+			printf("ERROR: item %u has the wrong value\n", i);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int run(const char *name, uint32_t num, new_item_func_t new_item)
+{
+	plist_t array;
+	char *bin = NULL;
+	uint32_t blen = 0;
+	uint32_t i;
+#ifdef HAVE_HEAP_USAGE
+	size_t before = heap_used();
+#endif
+
+	array = plist_new_array();
+	for (i = 0; i < num; i++) {
+		plist_array_append_item(array, new_item(i));
+	}
+#ifdef HAVE_HEAP_USAGE
+	size_t built = heap_used() - before;
+#endif
+	if (check_array(array, num, new_item) < 0) {
+		return -1;
+	}
+
+	plist_to_bin(array, &bin, &blen);
+	plist_free(array);
+	if (!bin) {
+		printf("ERROR: plist_to_bin failed\n");
+		return -1;
+	}
+
+#ifdef HAVE_HEAP_USAGE
+	before = heap_used();
+#endif
+	array = NULL;
+	plist_from_bin(bin, blen, &array);
+#ifdef HAVE_HEAP_USAGE
+	size_t parsed = heap_used() - before;
+#endif
+	if (!array || check_array(array, num, new_item) < 0) {
+		printf("ERROR: binary round trip failed\n");
+		free(bin);
+		return -1;
+	}
+
+	plist_t copy = plist_copy(array);
+	if (check_array(copy, num, new_item) < 0) {
+		printf("ERROR: copy differs\n");
+		free(bin);
+		return -1;
+	}
+	plist_free(copy);
+	plist_free(array);
+
+#ifdef HAVE_HEAP_USAGE
+	printf("%-13s %6.1f bytes/node built, %6.1f bytes/node parsed, %5.1f bytes/node bplist\n", name,
+		(double)built / num, (double)parsed / num, (double)blen / num);
+#else
+	printf("%-13s %5.1f bytes/node bplist (heap usage not available)\n", name, (double)blen / num);
+#endif
+	free(bin);
+	return 0;
+}
+
+/* arrays of dictionaries with the same keys, as used for records */
+static plist_t new_record_item(uint32_t i)
+{
+	static const char *keys[] = { "CFBundleIdentifier", "CFBundleShortVersionString", "ApplicationType", "IsRemovable", "StaticDiskUsage", "SignerIdentity" };
+	plist_t dict = plist_new_dict();
+	unsigned int k;
+	for (k = 0; k < sizeof(keys)/sizeof(keys[0]); k++) {
+		plist_dict_set_item(dict, keys[k], plist_new_uint(i + k));
+	}
+	return dict;
+}
+
+static int run_records(uint32_t num)
+{
+	plist_t array = plist_new_array();
+	char *bin = NULL;
+	uint32_t blen = 0;
+	uint32_t i;
+	int o;
+
+	for (i = 0; i < num; i++) {
+		plist_array_append_item(array, new_record_item(i));
+	}
+	plist_to_bin(array, &bin, &blen);
+	if (!bin) {
+		printf("ERROR: plist_to_bin failed\n");
+		plist_free(array);
+		return -1;
+	}
+
+	for (o = 0; o < 2; o++) {
+		plist_parse_options_t options = (o) ? PLIST_PARSE_INTERN_KEYS : PLIST_PARSE_NONE;
+		plist_t parsed = NULL;
+#ifdef HAVE_HEAP_USAGE
+		size_t before = heap_used();
+#endif
+		plist_from_memory_ex(bin, blen, &parsed, NULL, options);
+#ifdef HAVE_HEAP_USAGE
+		size_t used = heap_used() - before;
+#endif
+		if (!parsed || plist_array_get_size(parsed) != num) {
+			printf("ERROR: failed to parse records\n");
+			plist_free(parsed);
+			plist_free(array);
+			free(bin);
+			return -1;
+		}
+		for (i = 0; i < num; i++) {
+			if (!plist_compare_node_value(plist_dict_get_item(plist_array_get_item(parsed, i), "StaticDiskUsage"),
+			                              plist_dict_get_item(plist_array_get_item(array, i), "StaticDiskUsage"))) {
+				printf("ERROR: record %u has the wrong value\n", i);
+				plist_free(parsed);
+				plist_free(array);
+				free(bin);
+				return -1;
+			}
+		}
+#ifdef HAVE_HEAP_USAGE
+		printf("%-13s %6.1f bytes/record parsed\n", (o) ? "records/intern" : "records", (double)used / num);
+#endif
+		plist_free(parsed);
+	}
+	plist_free(array);
+	free(bin);
+	return 0;
+}
+
+static int check_string_updates(void)
+{
+	static const char *values[] = { "", "short", "exactly thirty-one characters..", "a string that is definitely too long to be stored inline", "x" };
+	plist_t str = plist_new_string(values[0]);
+	unsigned int i;
+	for (i = 0; i < sizeof(values)/sizeof(values[0]); i++) {
+		const char *val;
+		uint64_t len = 0;
+		plist_set_string_val(str, values[i]);
+		val = plist_get_string_ptr(str, &len);
+		if (!val || strcmp(val, values[i]) != 0 || len != strlen(values[i])) {
+			printf("ERROR: string update %u failed\n", i);
+			plist_free(str);
+			return -1;
+		}
+	}
+	/* change the type of a node that stored its value inline */
+	plist_set_uint_val(str, 42);
+	plist_free(str);
+	return 0;
+}
+
+static int run_all(uint32_t num)
+{
+	int err = 0;
+	err |= run("uint", num, new_uint_item);
+	err |= run("real", num, new_real_item);
+	err |= run("bool", num, new_bool_item);
+	err |= run("short string", num, new_short_string_item);
+	err |= run("long string", num, new_long_string_item);
+	err |= run_records(num / 8);
+	return err;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t num = 100000;
+	int err = 0;
+
+	if (argc > 1 && !strcmp(argv[1], "--sweep")) {
+		uint64_t max_items = 10000000;
+		uint64_t n;
+		if (argc > 2) max_items = strtoull(argv[2], NULL, 10);
+		for (n = 1000; n <= max_items && n <= UINT32_MAX; n *= 10) {
+			printf("%" PRIu64 " items:\n", n);
+			if (run_all((uint32_t)n) != 0) {
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	if (argc > 1) num = (uint32_t)strtoul(argv[1], NULL, 10);
+	if (num == 0) num = 1;
+
+	err |= check_string_updates();
+	err |= run_all(num);
+
+	if (err) {
+		return 1;
+	}
+	printf("SUCCESS\n");
+	return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * parse_options_test.c
+ * checks trees created with plist_from_memory_ex() parse options
+ * against regularly parsed trees, before and after modification
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <plist/plist.h>
+
+static int compare_xml(plist_t a, plist_t b, const char *what)
+{
+	char *xml_a = NULL;
+	char *xml_b = NULL;
+	uint32_t len_a = 0;
+	uint32_t len_b = 0;
+	int res = 0;
+	plist_to_xml(a, &xml_a, &len_a);
+	plist_to_xml(b, &xml_b, &len_b);
+	if (!xml_a || !xml_b || len_a != len_b || memcmp(xml_a, xml_b, len_a) != 0) {
+		printf("ERROR: %s: output differs\n", what);
+		res = -1;
+	} else {
+		printf("SUCCESS: %s\n", what);
+	}
+	free(xml_a);
+	free(xml_b);
+	return res;
+}
+
+static plist_t find_container(plist_t node, plist_type type, int depth)
+{
+	if (plist_get_node_type(node) == type && depth > 0) {
+		return node;
+	}
+	if (PLIST_IS_DICT(node)) {
+		plist_dict_iter it = NULL;
+		plist_t val = NULL;
+		plist_t res = NULL;
+		plist_dict_new_iter(node, &it);
+		do {
+			plist_dict_next_item(node, it, NULL, &val);
+			if (val) res = find_container(val, type, depth+1);
+		} while (val && !res);
+		free(it);
+		return res;
+	} else if (PLIST_IS_ARRAY(node)) {
+		uint32_t i;
+		for (i = 0; i < plist_array_get_size(node); i++) {
+			plist_t res = find_container(plist_array_get_item(node, i), type, depth+1);
+			if (res) return res;
+		}
+	}
+	return NULL;
+}
+
+/* apply the same set of modifications to a tree */
+static void modify(plist_t root)
+{
+	plist_t dict = PLIST_IS_DICT(root) ? root : find_container(root, PLIST_DICT, 1);
+	plist_t array = NULL;
+	if (dict) {
+		plist_dict_iter it = NULL;
+		char *key = NULL;
+		plist_t val = NULL;
+		uint32_t n = 0;
+		plist_dict_new_iter(dict, &it);
+		plist_dict_next_item(dict, it, &key, &val);
+		while (val) {
+			if (n == 0) {
+				/* replace a value */
+				plist_dict_set_item(dict, key, plist_new_uint(n));
+			} else if (n == 1 && PLIST_IS_STRING(val)) {
+				plist_set_string_val(val, "modified string value");
+			} else if (n == 2) {
+				plist_set_key_val(plist_dict_item_get_key(val), "renamed key");
+			}
+			free(key);
+			key = NULL;
+			if (++n > 2) break;
+			plist_dict_next_item(dict, it, &key, &val);
+		}
+		free(key);
+		free(it);
+		plist_dict_set_item(dict, "new key", plist_new_string("new value"));
+		plist_t sub = plist_new_dict();
+		plist_dict_set_item(sub, "nested", plist_new_data("\x01\x02\x03", 3));
+		plist_dict_set_item(dict, "new dict", sub);
+	}
+	/* looked up after the dict changes, which might replace it */
+	array = find_container(root, PLIST_ARRAY, 1);
+	if (array) {
+		uint32_t i;
+		for (i = 0; i < 200; i++) {
+			plist_array_append_item(array, plist_new_uint(i));
+		}
+		plist_array_insert_item(array, plist_new_bool(1), 0);
+		plist_array_set_item(array, plist_new_string("replaced"), 1);
+		plist_array_remove_item(array, 2);
+	}
+	plist_t data = find_container(root, PLIST_DATA, 1);
+	if (data) {
+		plist_set_data_val(data, "\xde\xad\xbe\xef", 4);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	FILE *f = NULL;
+	char *buf = NULL;
+	long len = 0;
+	char *bin = NULL;
+	uint32_t bin_len = 0;
+	plist_t heap = NULL;
+	plist_t opt = NULL;
+	plist_t opt2 = NULL;
+	plist_parse_options_t options = PLIST_PARSE_ARENA;
+	int err = 0;
+
+	if (argc < 2) {
+		printf("Usage: %s FILE [arena|lazy|nocopy|intern]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 2) {
+		options = PLIST_PARSE_NONE;
+		if (strstr(argv[2], "arena")) options |= PLIST_PARSE_ARENA;
+		if (strstr(argv[2], "lazy")) options |= PLIST_PARSE_LAZY;
+		if (strstr(argv[2], "nocopy")) options |= PLIST_PARSE_NOCOPY;
+		if (strstr(argv[2], "intern")) options |= PLIST_PARSE_INTERN_KEYS;
+	}
+
+	f = fopen(argv[1], "rb");
+	if (!f) {
+		printf("ERROR: could not open %s\n", argv[1]);
+		return 1;
+	}
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = (char*)malloc(len);
+	if (fread(buf, 1, len, f) != (size_t)len) {
+		fclose(f);
+		printf("ERROR: could not read %s\n", argv[1]);
+		return 1;
+	}
+	fclose(f);
+
+	/* always go through the binary format */
+	plist_from_memory(buf, len, &heap, NULL);
+	if (!heap) {
+		printf("ERROR: could not parse %s\n", argv[1]);
+		return 1;
+	}
+	/* the text parsers only support some of the options */
+	if (options & PLIST_PARSE_INTERN_KEYS) {
+		if (plist_from_memory_ex(buf, len, &opt, NULL, options) != PLIST_ERR_SUCCESS) {
+			printf("ERROR: could not parse %s with options 0x%x\n", argv[1], options);
+			return 1;
+		}
+		err |= compare_xml(heap, opt, "parse input");
+		plist_free(opt);
+		opt = NULL;
+	}
+	free(buf);
+	plist_to_bin(heap, &bin, &bin_len);
+
+	if (plist_from_memory_ex(bin, bin_len, &opt, NULL, options) != PLIST_ERR_SUCCESS) {
+		printf("ERROR: could not parse binary data with options 0x%x\n", options);
+		return 1;
+	}
+	err |= compare_xml(heap, opt, "parse");
+
+	/* read through a file descriptor; with borrowing options the tree
+	 * keeps the file contents alive after the descriptor is closed */
+	plist_t fdtree = NULL;
+	FILE *tmp = tmpfile();
+	if (!tmp || fwrite(bin, 1, bin_len, tmp) != bin_len || fflush(tmp) != 0) {
+		printf("ERROR: could not write temporary file\n");
+		return 1;
+	}
+	rewind(tmp);
+	if (plist_read_from_fd(fileno(tmp), &fdtree, NULL, options) != PLIST_ERR_SUCCESS) {
+		printf("ERROR: could not read binary data from file descriptor\n");
+		return 1;
+	}
+	fclose(tmp);
+	err |= compare_xml(heap, fdtree, "read_from_fd");
+	plist_free(fdtree);
+
+	modify(heap);
+	modify(opt);
+	err |= compare_xml(heap, opt, "modify");
+
+	/* copies are independent of the source tree */
+	plist_t copy = plist_copy(opt);
+	plist_free(opt);
+	err |= compare_xml(heap, copy, "copy");
+	plist_free(copy);
+
+	/* attach parsed trees to other trees */
+	plist_from_memory_ex(bin, bin_len, &opt, NULL, options);
+	plist_from_memory_ex(bin, bin_len, &opt2, NULL, options);
+	plist_t array = plist_new_array();
+	plist_array_append_item(array, opt);
+	if (PLIST_IS_DICT(opt)) {
+		plist_dict_set_item(opt, "other tree", opt2);
+	} else {
+		plist_array_append_item(array, opt2);
+	}
+	plist_free(array);
+
+	plist_free(heap);
+	free(bin);
+
+	return (err) ? 1 : 0;
+}
@@ -0,0 +1,213 @@
+/*
+ * xml_data_test.c
+ * checks base64 encoding and decoding of <data> values against a simple
+ * reference implementation, including line-wrapped and malformed input
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <plist/plist.h>
+
+static const char b64chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static uint32_t rnd_state = 1;
+
+static uint32_t rnd(void)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return rnd_state >> 8;
+}
+
+static void fill_random(unsigned char *buf, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; i++) {
+		buf[i] = (unsigned char)rnd();
+	}
+}
+
+static size_t ref_encode(char *out, const unsigned char *buf, size_t len)
+{
+	size_t i, m = 0;
+	for (i = 0; i < len; i += 3) {
+		uint32_t v = (uint32_t)buf[i] << 16;
+		if (i+1 < len) v |= (uint32_t)buf[i+1] << 8;
+		if (i+2 < len) v |= buf[i+2];
+		out[m++] = b64chars[v >> 18];
+		out[m++] = b64chars[(v >> 12) & 63];
+		out[m++] = (i+1 < len) ? b64chars[(v >> 6) & 63] : '=';
+		out[m++] = (i+2 < len) ? b64chars[v & 63] : '=';
+	}
+	return m;
+}
+
+/* whitespace and invalid characters are skipped, '=' counts as part of a
+ * quartet and suppresses the bytes it is involved in, a 0 byte ends it */
+static size_t ref_decode(unsigned char *out, const char *str, size_t len)
+{
+	int vals[4];
+	int cnt = 0;
+	size_t i, m = 0;
+	for (i = 0; i < len && str[i] != '\0'; i++) {
+		const char *p = strchr(b64chars, str[i]);
+		int v;
+		if (str[i] == '=') {
+			v = -2;
+		} else if (p) {
+			v = (int)(p - b64chars);
+		} else {
+			continue;
+		}
+		vals[cnt++] = v;
+		if (cnt == 4) {
+			cnt = 0;
+			if (vals[0] >= 0 && vals[1] >= 0) out[m++] = (unsigned char)((vals[0] << 2) | (vals[1] >> 4));
+			if (vals[1] >= 0 && vals[2] >= 0) out[m++] = (unsigned char)((vals[1] << 4) | (vals[2] >> 2));
+			if (vals[2] >= 0 && vals[3] >= 0) out[m++] = (unsigned char)((vals[2] << 6) | vals[3]);
+		}
+	}
+	return m;
+}
+
+static int check_decoded(const char *what, const char *xml, size_t xml_len, const unsigned char *expected, size_t expected_len)
+{
+	plist_t plist = NULL;
+	const char *val;
+	uint64_t len = 0;
+	plist_from_xml(xml, (uint32_t)xml_len, &plist);
+	if (!plist || plist_get_node_type(plist) != PLIST_DATA) {
+		printf("ERROR: %s: could not parse data node\n", what);
+		plist_free(plist);
+		return -1;
+	}
+	val = plist_get_data_ptr(plist, &len);
+	if (len != expected_len || (len > 0 && memcmp(val, expected, len) != 0)) {
+		printf("ERROR: %s: decoded %llu bytes that differ from the %zu expected\n", what, (unsigned long long)len, expected_len);
+		plist_free(plist);
+		return -1;
+	}
+	plist_free(plist);
+	return 0;
+}
+
+/* data of many sizes at different nesting depths, which changes the line length */
+static int check_roundtrip(void)
+{
+	static const uint32_t sizes[] = { 0, 1, 2, 3, 4, 11, 12, 13, 15, 16, 17, 27, 28, 29, 47, 48, 56, 57, 58, 100, 1000, 65537 };
+	unsigned char *buf = (unsigned char*)malloc(65537);
+	unsigned int s, depth;
+	int err = 0;
+
+	for (depth = 0; depth < 11; depth++) {
+		for (s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+			plist_t root = plist_new_array();
+			plist_t node = root;
+			plist_t parsed = NULL;
+			plist_t data;
+			char *xml = NULL;
+			uint32_t xml_len = 0;
+			unsigned int i;
+
+			fill_random(buf, sizes[s]);
+			for (i = 1; i < depth; i++) {
+				plist_t child = plist_new_array();
+				plist_array_append_item(node, child);
+				node = child;
+			}
+			data = plist_new_data((const char*)buf, sizes[s]);
+			plist_array_append_item(node, data);
+			plist_to_xml(root, &xml, &xml_len);
+			plist_from_xml(xml, xml_len, &parsed);
+			node = parsed;
+			while (plist_get_node_type(node) == PLIST_ARRAY) {
+				node = plist_array_get_item(node, 0);
+			}
+			if (!node || !plist_compare_node_value(data, node)) {
+				printf("ERROR: round trip of %u bytes at depth %u failed\n", sizes[s], depth);
+				err = -1;
+			}
+			plist_mem_free(xml);
+			plist_free(parsed);
+			plist_free(root);
+		}
+	}
+	free(buf);
+	return err;
+}
+
+/* unwrapped and randomly damaged base64 must decode like the reference */
+static int check_malformed(void)
+{
+	static const char junk[] = " \t\r\n=====!#$%*-.:;?@[]^_`{|}~\x7f\x80\xc3\xff";
+	unsigned char *data = (unsigned char*)malloc(3000);
+	unsigned char *expected = (unsigned char*)malloc(3000);
+	char *b64 = (char*)malloc(4100);
+	char *xml = (char*)malloc(4200);
+	unsigned int iter;
+	int err = 0;
+
+	for (iter = 0; iter < 3000 && !err; iter++) {
+		size_t len = rnd() % 3000;
+		size_t b64_len;
+		size_t expected_len;
+		int xml_len;
+		char what[64];
+
+		fill_random(data, len);
+		b64_len = ref_encode(b64, data, len);
+		if (iter % 3 != 0 && b64_len > 0) {
+			/* replace a few characters, every byte value occurs at some point */
+			unsigned int k, num = 1 + rnd() % 4;
+			for (k = 0; k < num; k++) {
+				char c = (k == 0) ? (char)(iter & 0xFF) : junk[rnd() % (sizeof(junk) - 1)];
+				if (c == '\0' || c == '<') {
+					c = '!';
+				}
+				b64[rnd() % b64_len] = c;
+			}
+		}
+		expected_len = ref_decode(expected, b64, b64_len);
+		xml_len = snprintf(xml, 4200, "<plist version=\"1.0\"><data>%.*s</data></plist>", (int)b64_len, b64);
+		snprintf(what, sizeof(what), "malformed input %u", iter);
+		err |= check_decoded(what, xml, xml_len, expected, expected_len);
+	}
+	free(data);
+	free(expected);
+	free(b64);
+	free(xml);
+	return err;
+}
+
+int main(int argc, char** argv)
+{
+	static const char split[] = "<plist version=\"1.0\"><data>AAEC<!-- comment -->AwQF<![CDATA[Bg]]>cI\n\tCQ==</data></plist>";
+	static const unsigned char split_data[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+	int err = 0;
+
+	err |= check_roundtrip();
+	err |= check_malformed();
+	/* quartets may span comments and CDATA sections */
+	err |= check_decoded("split input", split, sizeof(split) - 1, split_data, sizeof(split_data));
+
+	if (err) {
+		return 1;
+	}
+	printf("SUCCESS\n");
+	return 0;
+}
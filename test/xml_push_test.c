@@ -0,0 +1,132 @@
+/*
+ * xml_push_test.c
+ * checks that the incremental XML parser gives the same result as
+ * plist_from_xml() regardless of how the input is split into chunks
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <plist/plist.h>
+
+static char *read_file(const char *path, size_t *len)
+{
+	FILE *f = fopen(path, "rb");
+	char *buf = NULL;
+	long size;
+	if (!f) {
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (size > 0) {
+		buf = (char*)malloc(size);
+		if (buf && fread(buf, 1, size, f) != (size_t)size) {
+			free(buf);
+			buf = NULL;
+		}
+	}
+	fclose(f);
+	*len = (buf) ? (size_t)size : 0;
+	return buf;
+}
+
+static int same_plist(plist_t a, plist_t b)
+{
+	char *xml_a = NULL;
+	char *xml_b = NULL;
+	uint32_t len_a = 0;
+	uint32_t len_b = 0;
+	int res;
+	plist_to_xml(a, &xml_a, &len_a);
+	plist_to_xml(b, &xml_b, &len_b);
+	res = (xml_a && xml_b && len_a == len_b && memcmp(xml_a, xml_b, len_a) == 0);
+	plist_mem_free(xml_a);
+	plist_mem_free(xml_b);
+	return res;
+}
+
+static plist_err_t push_parse(plist_xml_parser_t parser, const char *buf, size_t len, size_t chunk, plist_t *plist)
+{
+	size_t pos = 0;
+	while (pos < len) {
+		size_t n = (len - pos < chunk) ? len - pos : chunk;
+		if (plist_xml_parser_feed(parser, buf + pos, n) != PLIST_ERR_SUCCESS) {
+			break;
+		}
+		pos += n;
+	}
+	return plist_xml_parser_finish(parser, plist);
+}
+
+int main(int argc, char** argv)
+{
+	static const size_t chunk_sizes[] = { 1, 2, 3, 7, 61, 4096, SIZE_MAX };
+	plist_xml_parser_t parser = NULL;
+	plist_t ref = NULL;
+	plist_err_t ref_err;
+	size_t len = 0;
+	char *buf;
+	unsigned int i;
+	int err = 0;
+
+	if (argc < 2) {
+		printf("Usage: %s FILE\n", argv[0]);
+		return 1;
+	}
+
+	buf = read_file(argv[1], &len);
+	if (!buf) {
+		printf("ERROR: could not read %s\n", argv[1]);
+		return 1;
+	}
+	ref_err = plist_from_xml(buf, (uint32_t)len, &ref);
+
+	/* the same parser is reused for every run */
+	parser = plist_xml_parser_new();
+	if (!parser) {
+		printf("ERROR: could not create parser\n");
+		free(buf);
+		return 1;
+	}
+	for (i = 0; i < sizeof(chunk_sizes)/sizeof(chunk_sizes[0]); i++) {
+		plist_t res = NULL;
+		plist_err_t res_err = push_parse(parser, buf, len, chunk_sizes[i], &res);
+		if (res_err != ref_err) {
+			printf("ERROR: chunk size %zu: got error %d, expected %d\n", chunk_sizes[i], res_err, ref_err);
+			err++;
+		} else if (ref_err == PLIST_ERR_SUCCESS && !same_plist(ref, res)) {
+			printf("ERROR: chunk size %zu: parsed plist differs\n", chunk_sizes[i]);
+			err++;
+		}
+		plist_free(res);
+	}
+	if (!err) {
+		printf("SUCCESS: %s (result %d)\n", argv[1], ref_err);
+	}
+
+	/* a parser freed in the middle of a document must not leak */
+	plist_xml_parser_feed(parser, buf, len / 2);
+	plist_xml_parser_free(parser);
+
+	plist_free(ref);
+	free(buf);
+
+	return (err) ? 1 : 0;
+}
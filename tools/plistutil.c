@@ -53,6 +53,7 @@ typedef struct _options
 #define OPT_COMPACT (1 << 1)
 #define OPT_SORT    (1 << 2)
 #define OPT_COERCE  (1 << 3)
+#define OPT_DEDUP   (1 << 4)
 
 static void print_usage(int argc, char *argv[])
 {
@@ -83,6 +84,8 @@ static void print_usage(int argc, char *argv[])
     printf("                       boolean becomes 1 or 0 (OpenStep),\n");
     printf("                       and NULL becomes a string 'NULL' (OpenStep)\n");
     printf("                       This options is implied when invoked as plist2json.\n");
+    printf("  -D, --dedup          Binary only: Write equal arrays and dictionaries\n");
+    printf("                       only once, like equal values always are.\n");
     printf("  -s, --sort           Sort all dictionary nodes lexicographically by key\n");
     printf("                       before converting to the output format.\n");
     printf("  -d, --debug          Enable extended debug output\n");
@@ -106,6 +109,7 @@ static options_t *parse_arguments(int argc, char *argv[])
         { "format",   required_argument, 0, 'f' },
         { "compact",  no_argument,       0, 'c' },
         { "coerce",   no_argument,       0, 'C' },
+        { "dedup",    no_argument,       0, 'D' },
         { "sort",     no_argument,       0, 's' },
         { "print",    required_argument, 0, 'p' },
         { "nodepath", required_argument, 0, 'n' },
@@ -116,7 +120,7 @@ static options_t *parse_arguments(int argc, char *argv[])
     };
 
     int c;
-    while ((c = getopt_long(argc, argv, "i:o:f:cCsp:n:dhv", long_options, NULL)) != -1)
+    while ((c = getopt_long(argc, argv, "i:o:f:cCDsp:n:dhv", long_options, NULL)) != -1)
     {
         switch (c)
         {
@@ -168,6 +172,10 @@ static options_t *parse_arguments(int argc, char *argv[])
                 options->flags |= OPT_COERCE;
                 break;
 
+            case 'D':
+                options->flags |= OPT_DEDUP;
+                break;
+
             case 's':
                 options->flags |= OPT_SORT;
                 break;
@@ -367,7 +375,7 @@ int main(int argc, char *argv[])
                 if (options->flags & OPT_SORT) {
                     plist_sort(root_node);
                 }
-                output_res = plist_to_bin(root_node, &plist_out, &size);
+                output_res = plist_to_bin_with_options(root_node, &plist_out, &size, (options->flags & OPT_DEDUP) ? PLIST_OPT_DEDUP : PLIST_OPT_NONE);
             }
         }
     }
@@ -433,7 +441,7 @@ int main(int argc, char *argv[])
                 plist_sort(root_node);
             }
             if (options->out_fmt == PLIST_FORMAT_BINARY) {
-                output_res = plist_to_bin(root_node, &plist_out, &size);
+                output_res = plist_to_bin_with_options(root_node, &plist_out, &size, (options->flags & OPT_DEDUP) ? PLIST_OPT_DEDUP : PLIST_OPT_NONE);
             } else if (options->out_fmt == PLIST_FORMAT_XML) {
                 output_res = plist_to_xml(root_node, &plist_out, &size);
             } else if (options->out_fmt == PLIST_FORMAT_JSON) {